@@ -36,6 +36,15 @@ typedef struct _cdBitmap {
   void *data;
 } cdBitmap;
 
+/* points used in batch functions */
+typedef struct _cdPoint {
+  int x, y;
+} cdPoint;
+
+typedef struct _cdfPoint {
+  double x, y;
+} cdfPoint;
+
 
 /* library */
 char*         cdVersion(void);
@@ -120,6 +129,10 @@ void cdfCanvasMark(cdCanvas* canvas, double x, double y);
 void cdCanvasBegin(cdCanvas* canvas, int mode);
 void cdCanvasPathSet(cdCanvas* canvas, int action);
 void cdCanvasEnd(cdCanvas* canvas);
+void cdCanvasPoly(cdCanvas* canvas, int mode, const cdPoint* points, int n);
+void cdfCanvasPoly(cdCanvas* canvas, int mode, const cdfPoint* points, int n);
+void cdCanvasMultiPoly(cdCanvas* canvas, int mode, const cdPoint* points, const int* counts, int count);
+void cdfCanvasMultiPoly(cdCanvas* canvas, int mode, const cdfPoint* points, const int* counts, int count);
 
 void cdCanvasLine(cdCanvas* canvas, int x1, int y1, int x2, int y2);
 void cdCanvasVertex(cdCanvas* canvas, int x, int y);
@@ -174,6 +187,8 @@ void cdCanvasMultiLineVectorText(cdCanvas* canvas, int x, int y, const char* s);
 char* cdCanvasVectorFont(cdCanvas* canvas, const char *filename);
 void  cdCanvasVectorTextDirection(cdCanvas* canvas, int x1, int y1, int x2, int y2);
 double* cdCanvasVectorTextTransform(cdCanvas* canvas, const double* matrix);
+int   cdCanvasVectorTextPath(cdCanvas* canvas, int path);
+int   cdCompileVectorFont(const char* font, const char* filename);
 void  cdCanvasVectorTextSize(cdCanvas* canvas, int size_x, int size_y, const char* s);
 int   cdCanvasVectorCharSize(cdCanvas* canvas, int size);
 void  cdCanvasVectorFontSize(cdCanvas* canvas, double size_x, double size_y);
@@ -249,12 +264,18 @@ unsigned char cdDecodeAlpha(long color);
 
 /* client image color conversion */
 void cdRGB2Map(int width, int height, const unsigned char* red, const unsigned char* green, const unsigned char* blue, unsigned char* index, int pal_size, long *color);
+void cdRGB2MapEx(int width, int height, const unsigned char* red, const unsigned char* green, const unsigned char* blue, unsigned char* index, int pal_size, long *color, int flags, int num_threads);
 
 
 /* CD Values */
 
 #define CD_QUERY -1             /* query value */
 
+enum {                        /* cdRGB2MapEx flags */
+ CD_RGB2MAP_NODITHER = 1,
+ CD_RGB2MAP_KMEANS   = 2
+};
+
 enum {                        /* bitmap type */
  CD_RGB,                      /* these definitions are compatible with the IM library */
  CD_MAP,
@@ -25,16 +25,6 @@ typedef struct _cdCtxImage cdCtxImage;
 typedef struct _cdVectorFont cdVectorFont;
 typedef struct _cdSimulation cdSimulation;
 
-typedef struct _cdPoint 
-{
-  int x, y; 
-} cdPoint; 
-
-typedef struct _cdfPoint 
-{
-  double x, y; 
-} cdfPoint; 
-
 typedef struct _cdRect 
 {
   int xmin, xmax, ymin, ymax; 
@@ -372,6 +362,36 @@ void cdImageRGBInverseTransform(int t_x, int t_y, double *i_x, double *i_y, doub
 void cdImageRGBCalcDstLimits(cdCanvas* canvas, int x, int y, int w, int h, int *xmin, int *xmax, int *ymin, int *ymax, int* rect);
 void cdRGB2Gray(int width, int height, const unsigned char* red, const unsigned char* green, const unsigned char* blue, unsigned char* index, long *color);
 
+/* nearest palette color using a lazily computed inverse colormap, weights must be <= 100 */
+typedef struct _cdInverseMap cdInverseMap;
+cdInverseMap* cdInverseMapCreate(int r_weight, int g_weight, int b_weight);
+void cdInverseMapKill(cdInverseMap* imap);
+void cdInverseMapSetPalette(cdInverseMap* imap, int count, const long* palette);
+int cdInverseMapFind(cdInverseMap* imap, long color);
+
+/* image keys for the driver image caches, hash of the region, its position and size and flags, 
+   or of img_id instead of the region contents if not NULL, hash is never 0 (0 means no key).
+   The key keeps pointers to the region, they are valid only while the image is drawn. */
+typedef struct _cdImageKey 
+{
+  unsigned long long hash;
+  const char* img_id;
+  int type, flags, iw, xmin, ymin, rw, rh;
+  const unsigned char *r, *g, *b, *a;   /* RGB and RGBA images */
+  const unsigned char *index;           /* Map images */
+  const long *colors;
+} cdImageKey;
+
+unsigned long long cdHashBytes(unsigned long long hash, const unsigned char* data, int size);
+void cdImageKeyRGBA(cdImageKey* key, const char* img_id, int flags, int iw, const unsigned char *r, const unsigned char *g, const unsigned char *b, const unsigned char *a, 
+                    int xmin, int ymin, int rw, int rh);
+void cdImageKeyMap(cdImageKey* key, const char* img_id, int flags, int iw, const unsigned char *index, const long *colors, 
+                   int xmin, int ymin, int rw, int rh);
+/* copy of the region contents stored with the cached image, so a hit can be confirmed, 
+   NULL if the key uses img_id. cdImageKeyMatch compares the key with a stored copy. */
+unsigned char* cdImageKeyData(const cdImageKey* key, int *size);
+int cdImageKeyMatch(const cdImageKey* key, const unsigned char* data);
+
 #define CD_ALPHA_BLEND(_src,_dst,_alpha) (unsigned char)(((_src) * (_alpha) + (_dst) * (255 - (_alpha))) / 255)
 
 int* cdGetZoomTable(int w, int rw, int xmin);
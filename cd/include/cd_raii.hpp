@@ -0,0 +1,295 @@
+/** \file
+ * \brief C++17 RAII wrappers
+ *
+ * Header only. Canvas, server image and bitmap handles own their C objects,
+ * can be moved but not copied, and release the objects when destroyed.
+ * Batch functions receive contiguous ranges of points or pixels.
+ *
+ * See Copyright Notice in cd.h
+ */
+
+#ifndef __CD_RAII_HPP
+#define __CD_RAII_HPP
+
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "cd.h"
+#include "wd.h"
+
+
+/** \brief Name space for C++17 RAII wrappers
+ *
+ * \par
+ * Can be used together with the classes in \ref cd_plus.h.
+ *
+ * See \ref cd_raii.hpp
+ */
+namespace cd::raii
+{
+  /** Read only view of contiguous elements.
+   * Can be created from a pointer and a size, a C array, or any container with
+   * std::data and std::size, like std::vector, std::array and std::span (C++20). */
+  template <class T>
+  class Span
+  {
+    const T* ptr = nullptr;
+    std::size_t count = 0;
+
+  public:
+    constexpr Span() noexcept = default;
+    constexpr Span(const T* data, std::size_t size) noexcept : ptr(data), count(size) {}
+
+    template <class Container, class = std::enable_if_t<
+      !std::is_same_v<std::decay_t<Container>, Span> &&
+      std::is_convertible_v<decltype(std::data(std::declval<const Container&>())), const T*>>>
+    constexpr Span(const Container& container) noexcept : ptr(std::data(container)), count(std::size(container)) {}
+
+    constexpr const T* data() const noexcept { return ptr; }
+    constexpr std::size_t size() const noexcept { return count; }
+    constexpr bool empty() const noexcept { return count == 0; }
+    constexpr const T* begin() const noexcept { return ptr; }
+    constexpr const T* end() const noexcept { return ptr + count; }
+    constexpr const T& operator[](std::size_t i) const noexcept { return ptr[i]; }
+  };
+
+
+  /** Client RGB image, with one buffer for each channel. */
+  struct ImageRGB
+  {
+    int width = 0, height = 0;
+    std::vector<unsigned char> red, green, blue;
+
+    ImageRGB() = default;
+    ImageRGB(int w, int h, unsigned char value = 255)
+      : width(w), height(h), red(Size(w, h), value), green(Size(w, h), value), blue(Size(w, h), value) {}
+
+    std::size_t Size() const noexcept { return Size(width, height); }
+
+  private:
+    static std::size_t Size(int w, int h) noexcept { return (w > 0 && h > 0)? (std::size_t)w * (std::size_t)h: 0; }
+  };
+
+
+  /** Saves the canvas state when created, restores and releases it when destroyed. */
+  class StateGuard
+  {
+    cdCanvas* canvas = nullptr;
+    cdState* state = nullptr;
+
+  public:
+    explicit StateGuard(cdCanvas* ref_canvas) : canvas(ref_canvas), state(ref_canvas? cdCanvasSaveState(ref_canvas): nullptr) {}
+    StateGuard(StateGuard&& other) noexcept
+      : canvas(std::exchange(other.canvas, nullptr)), state(std::exchange(other.state, nullptr)) {}
+    StateGuard(const StateGuard&) = delete;
+    StateGuard& operator=(const StateGuard&) = delete;
+    StateGuard& operator=(StateGuard&&) = delete;
+
+    ~StateGuard() {
+      if (state) {
+        cdCanvasRestoreState(canvas, state);
+        cdReleaseState(state);
+      }
+    }
+  };
+
+
+  /** Server image, created by Canvas::CreateImage. */
+  class Image
+  {
+    cdImage* image = nullptr;
+
+  public:
+    Image() noexcept = default;
+    explicit Image(cdImage* owned_image) noexcept : image(owned_image) {}
+    Image(Image&& other) noexcept : image(std::exchange(other.image, nullptr)) {}
+    Image& operator=(Image&& other) noexcept { Reset(std::exchange(other.image, nullptr)); return *this; }
+    Image(const Image&) = delete;
+    Image& operator=(const Image&) = delete;
+    ~Image() { Reset(); }
+
+    cdImage* GetHandle() const noexcept { return image; }
+    cdImage* Release() noexcept { return std::exchange(image, nullptr); }
+    void Reset(cdImage* owned_image = nullptr) noexcept {
+      if (image && image != owned_image)
+        cdKillImage(image);
+      image = owned_image;
+    }
+    explicit operator bool() const noexcept { return image != nullptr; }
+  };
+
+
+  /** Client image of type CD_RGB, CD_RGBA or CD_MAP. */
+  class Bitmap
+  {
+    cdBitmap* bitmap = nullptr;
+
+  public:
+    Bitmap() noexcept = default;
+    Bitmap(int w, int h, int type) : bitmap(cdCreateBitmap(w, h, type)) {}
+    explicit Bitmap(cdBitmap* owned_bitmap) noexcept : bitmap(owned_bitmap) {}
+    Bitmap(Bitmap&& other) noexcept : bitmap(std::exchange(other.bitmap, nullptr)) {}
+    Bitmap& operator=(Bitmap&& other) noexcept { Reset(std::exchange(other.bitmap, nullptr)); return *this; }
+    Bitmap(const Bitmap&) = delete;
+    Bitmap& operator=(const Bitmap&) = delete;
+    ~Bitmap() { Reset(); }
+
+    cdBitmap* GetHandle() const noexcept { return bitmap; }
+    cdBitmap* Release() noexcept { return std::exchange(bitmap, nullptr); }
+    void Reset(cdBitmap* owned_bitmap = nullptr) noexcept {
+      if (bitmap && bitmap != owned_bitmap)
+        cdKillBitmap(bitmap);
+      bitmap = owned_bitmap;
+    }
+    explicit operator bool() const noexcept { return bitmap != nullptr; }
+
+    int Width() const noexcept { return bitmap? bitmap->w: 0; }
+    int Height() const noexcept { return bitmap? bitmap->h: 0; }
+    int Type() const noexcept { return bitmap? bitmap->type: 0; }
+    unsigned char* GetData(int dataptr) const { return bitmap? cdBitmapGetData(bitmap, dataptr): nullptr; }
+  };
+
+
+  /** Canvas handle. The canvas is killed when the object is destroyed. */
+  class Canvas
+  {
+    cdCanvas* canvas = nullptr;
+
+    static bool CheckSize(std::size_t size, int iw, int ih) noexcept {
+      return iw > 0 && ih > 0 && size >= (std::size_t)iw * (std::size_t)ih;
+    }
+
+  public:
+    Canvas() noexcept = default;
+    explicit Canvas(cdCanvas* owned_canvas) noexcept : canvas(owned_canvas) {}
+    Canvas(cdContext* context, const char* data) : canvas(cdCreateCanvas(context, const_cast<char*>(data))) {}
+    Canvas(cdContext* context, void* data) : canvas(cdCreateCanvas(context, data)) {}
+    Canvas(Canvas&& other) noexcept : canvas(std::exchange(other.canvas, nullptr)) {}
+    Canvas& operator=(Canvas&& other) noexcept { Reset(std::exchange(other.canvas, nullptr)); return *this; }
+    Canvas(const Canvas&) = delete;
+    Canvas& operator=(const Canvas&) = delete;
+    ~Canvas() { Reset(); }
+
+    cdCanvas* GetHandle() const noexcept { return canvas; }
+    cdCanvas* Release() noexcept { return std::exchange(canvas, nullptr); }
+    void Reset(cdCanvas* owned_canvas = nullptr) noexcept {
+      if (canvas && canvas != owned_canvas)
+        cdKillCanvas(canvas);
+      canvas = owned_canvas;
+    }
+    explicit operator bool() const noexcept { return canvas != nullptr; }
+    bool Failed() const noexcept { return canvas == nullptr; }
+
+    /* control */
+    int Activate() { return cdCanvasActivate(canvas); }
+    void Deactivate() { cdCanvasDeactivate(canvas); }
+    void Flush() { cdCanvasFlush(canvas); }
+    void Clear() { cdCanvasClear(canvas); }
+    [[nodiscard]] StateGuard SaveState() { return StateGuard(canvas); }
+    void SetAttribute(const char* name, const char* data) { cdCanvasSetAttribute(canvas, name, const_cast<char*>(data)); }
+    char* GetAttribute(const char* name) { return cdCanvasGetAttribute(canvas, name); }
+    void GetSize(int &width, int &height) { cdCanvasGetSize(canvas, &width, &height, nullptr, nullptr); }
+
+    /* attributes */
+    long Foreground(long color) { return cdCanvasForeground(canvas, color); }
+    long Background(long color) { return cdCanvasBackground(canvas, color); }
+    int WriteMode(int mode) { return cdCanvasWriteMode(canvas, mode); }
+    int LineStyle(int style) { return cdCanvasLineStyle(canvas, style); }
+    int LineWidth(int width) { return cdCanvasLineWidth(canvas, width); }
+    int InteriorStyle(int style) { return cdCanvasInteriorStyle(canvas, style); }
+    int MarkType(int type) { return cdCanvasMarkType(canvas, type); }
+    int MarkSize(int size) { return cdCanvasMarkSize(canvas, size); }
+
+    /* primitives */
+    void Pixel(int x, int y, long color) { cdCanvasPixel(canvas, x, y, color); }
+    void Mark(int x, int y) { cdCanvasMark(canvas, x, y); }
+    void Mark(double x, double y) { cdfCanvasMark(canvas, x, y); }
+    void Line(int x1, int y1, int x2, int y2) { cdCanvasLine(canvas, x1, y1, x2, y2); }
+    void Line(double x1, double y1, double x2, double y2) { cdfCanvasLine(canvas, x1, y1, x2, y2); }
+    void Rect(int xmin, int xmax, int ymin, int ymax) { cdCanvasRect(canvas, xmin, xmax, ymin, ymax); }
+    void Rect(double xmin, double xmax, double ymin, double ymax) { cdfCanvasRect(canvas, xmin, xmax, ymin, ymax); }
+    void Box(int xmin, int xmax, int ymin, int ymax) { cdCanvasBox(canvas, xmin, xmax, ymin, ymax); }
+    void Box(double xmin, double xmax, double ymin, double ymax) { cdfCanvasBox(canvas, xmin, xmax, ymin, ymax); }
+    void Text(int x, int y, const char* s) { cdCanvasText(canvas, x, y, s); }
+    void Text(double x, double y, const char* s) { cdfCanvasText(canvas, x, y, s); }
+
+    /* batch primitives, mode is the same of cdCanvasBegin except CD_REGION and CD_PATH,
+       MultiPoly draws nothing if the counts add up to more than the points */
+    void Poly(int mode, Span<cdPoint> points) { cdCanvasPoly(canvas, mode, points.data(), (int)points.size()); }
+    void Poly(int mode, Span<cdfPoint> points) { cdfCanvasPoly(canvas, mode, points.data(), (int)points.size()); }
+    void MultiPoly(int mode, Span<cdPoint> points, Span<int> counts) {
+      std::size_t total = 0;
+      for (int c : counts)
+        total += (c > 0)? (std::size_t)c: 0;
+      if (total <= points.size())
+        cdCanvasMultiPoly(canvas, mode, points.data(), counts.data(), (int)counts.size());
+    }
+    void MultiPoly(int mode, Span<cdfPoint> points, Span<int> counts) {
+      std::size_t total = 0;
+      for (int c : counts)
+        total += (c > 0)? (std::size_t)c: 0;
+      if (total <= points.size())
+        cdfCanvasMultiPoly(canvas, mode, points.data(), counts.data(), (int)counts.size());
+    }
+    void Polyline(Span<cdPoint> points) { Poly(CD_OPEN_LINES, points); }
+    void Polyline(Span<cdfPoint> points) { Poly(CD_OPEN_LINES, points); }
+    void Polygon(Span<cdPoint> points, int mode = CD_FILL) { Poly(mode, points); }
+    void Polygon(Span<cdfPoint> points, int mode = CD_FILL) { Poly(mode, points); }
+    void Marks(Span<cdPoint> points) {
+      for (const cdPoint& p : points)
+        cdCanvasMark(canvas, p.x, p.y);
+    }
+    void Marks(Span<cdfPoint> points) {
+      for (const cdfPoint& p : points)
+        cdfCanvasMark(canvas, p.x, p.y);
+    }
+
+    /* client images, nothing is drawn if the buffers are smaller than iw*ih, 
+       or if the colors do not include all the indices */
+    void PutImageRectRGB(int iw, int ih, Span<unsigned char> r, Span<unsigned char> g, Span<unsigned char> b,
+                         int x, int y, int w = 0, int h = 0, int xmin = 0, int xmax = 0, int ymin = 0, int ymax = 0) {
+      if (CheckSize(r.size(), iw, ih) && CheckSize(g.size(), iw, ih) && CheckSize(b.size(), iw, ih))
+        cdCanvasPutImageRectRGB(canvas, iw, ih, r.data(), g.data(), b.data(), x, y, w, h, xmin, xmax, ymin, ymax);
+    }
+    void PutImageRectRGBA(int iw, int ih, Span<unsigned char> r, Span<unsigned char> g, Span<unsigned char> b, Span<unsigned char> a,
+                          int x, int y, int w = 0, int h = 0, int xmin = 0, int xmax = 0, int ymin = 0, int ymax = 0) {
+      if (CheckSize(r.size(), iw, ih) && CheckSize(g.size(), iw, ih) && CheckSize(b.size(), iw, ih) && CheckSize(a.size(), iw, ih))
+        cdCanvasPutImageRectRGBA(canvas, iw, ih, r.data(), g.data(), b.data(), a.data(), x, y, w, h, xmin, xmax, ymin, ymax);
+    }
+    void PutImageRectMap(int iw, int ih, Span<unsigned char> index, Span<long> colors,
+                         int x, int y, int w = 0, int h = 0, int xmin = 0, int xmax = 0, int ymin = 0, int ymax = 0) {
+      if (!CheckSize(index.size(), iw, ih))
+        return;
+
+      unsigned char max_index = 0;
+      for (std::size_t i = 0, size = (std::size_t)iw * (std::size_t)ih; i < size; i++) {
+        if (index[i] > max_index)
+          max_index = index[i];
+      }
+
+      if (colors.size() > max_index)
+        cdCanvasPutImageRectMap(canvas, iw, ih, index.data(), colors.data(), x, y, w, h, xmin, xmax, ymin, ymax);
+    }
+    void PutImage(const ImageRGB& image, int x, int y, int w = 0, int h = 0) {
+      PutImageRectRGB(image.width, image.height, image.red, image.green, image.blue, x, y, w, h);
+    }
+    void GetImage(ImageRGB& image, int x, int y) {
+      if (CheckSize(image.red.size(), image.width, image.height) && CheckSize(image.green.size(), image.width, image.height) &&
+          CheckSize(image.blue.size(), image.width, image.height))
+        cdCanvasGetImageRGB(canvas, image.red.data(), image.green.data(), image.blue.data(), x, y, image.width, image.height);
+    }
+    void PutBitmap(const Bitmap& bitmap, int x, int y, int w = 0, int h = 0) { cdCanvasPutBitmap(canvas, bitmap.GetHandle(), x, y, w, h); }
+    void GetBitmap(Bitmap& bitmap, int x, int y) { cdCanvasGetBitmap(canvas, bitmap.GetHandle(), x, y); }
+
+    /* server images */
+    Image CreateImage(int w, int h) { return Image(cdCanvasCreateImage(canvas, w, h)); }
+    void GetImage(Image& image, int x, int y) { cdCanvasGetImage(canvas, image.GetHandle(), x, y); }
+    void PutImageRect(const Image& image, int x, int y, int xmin = 0, int xmax = 0, int ymin = 0, int ymax = 0) {
+      cdCanvasPutImageRect(canvas, image.GetHandle(), x, y, xmin, xmax, ymin, ymax); }
+  };
+}
+
+#endif
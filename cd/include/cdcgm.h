@@ -21,6 +21,11 @@ cdContext* cdContextCGM(void);
 #define CD_CGMBEGPICTBCB 5
 #define CD_CGMBEGMTFCB 6
 
+/* Random access to the pictures of a metafile. 
+   The picture index is saved in a "<filename>.idx" file. */
+int cdCGMGetPictureCount(const char* filename);
+int cdCanvasPlayCGMPicture(cdCanvas* canvas, int picture, int xmin, int xmax, int ymin, int ymax, const char* filename);
+
 /* OLD definitions, defined for backward compatibility */
 #define CDPLAY_ABORT CD_ABORT
 #define CDPLAY_GO CD_CONTINUE
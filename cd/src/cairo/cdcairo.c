@@ -126,6 +126,10 @@ void cdcairoKillCanvas(cdCtxCanvas *ctxcanvas)
   if (ctxcanvas->utf8_buffer)
     g_free(ctxcanvas->utf8_buffer);
 
+  sFreeImageCache(ctxcanvas);
+  if (ctxcanvas->img_cache) free(ctxcanvas->img_cache);
+  if (ctxcanvas->img_id) free(ctxcanvas->img_id);
+
   if (ctxcanvas->cr)
     cairo_destroy(ctxcanvas->cr);
 
@@ -1459,149 +1463,346 @@ static void sFixImageY(cdCanvas* canvas, int *topdown, double *y, double h)
     *y -= (h - 1);  /* move Y to top-left corner, since it was at the bottom of the image */
 }
 
-static void cdfputimagerectrgb(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *r, const unsigned char *g, const unsigned char *b, 
-                               double x, double y, double w, double h, int xmin, int xmax, int ymin, int ymax)
+#define CD_CAIRO_IMAGE_CACHE_SIZE 65536  /* KB */
+
+/* Computes the key of the image region and orientation, its hash is 0 if the image cache is not used. */
+static void sImageKeyRGBA(cdCtxCanvas *ctxcanvas, cdImageKey* key, int iw, const unsigned char *r, const unsigned char *g, const unsigned char *b, const unsigned char *a,
+                          int topdown, int xmin, int ymin, int rw, int rh)
 {
-  int i, j, rw, rh, pos, offset, topdown, stride;
-  unsigned int* data;
-  cairo_surface_t* image_surface;
-  cairo_filter_t filter;
+  if (ctxcanvas->img_cache_size == 0)
+    key->hash = 0;
+  else
+    cdImageKeyRGBA(key, ctxcanvas->img_id, topdown, iw, r, g, b, a, xmin, ymin, rw, rh);
+}
 
-  if (xmin<0 || ymin<0 || xmax-xmin+1>iw || ymax-ymin+1>ih) return;
+static void sImageKeyMap(cdCtxCanvas *ctxcanvas, cdImageKey* key, int iw, const unsigned char *index, const long *colors,
+                         int topdown, int xmin, int ymin, int rw, int rh)
+{
+  if (ctxcanvas->img_cache_size == 0)
+    key->hash = 0;
+  else
+    cdImageKeyMap(key, ctxcanvas->img_id, topdown, iw, index, colors, xmin, ymin, rw, rh);
+}
 
-  rw = xmax-xmin+1;
-  rh = ymax-ymin+1;
+/* Returns a new reference to the cached surface, or NULL if not found.
+   The hash is confirmed comparing the image contents, unless IMGID is used.
+   update is set if the surface contents must be replaced (IMGUPDATE). */
+static cairo_surface_t* sFindImageSurface(cdCtxCanvas *ctxcanvas, const cdImageKey* key, int w, int h, cairo_format_t format, int *update)
+{
+  int i;
 
-  /* CAIRO_FORMAT_RGB24	each pixel is a 32-bit quantity, with the upper 8 bits unused. 
-     Red, Green, and Blue are stored in the remaining 24 bits in that order. */
-  image_surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, rw, rh);
-  if (cairo_surface_status(image_surface) != CAIRO_STATUS_SUCCESS)
+  *update = 0;
+  if (!key->hash)
+    return NULL;
+
+  for (i = 0; i < ctxcanvas->img_count; i++)
   {
-    cairo_surface_destroy(image_surface);
+    cdCairoImage* image = ctxcanvas->img_cache + i;
+    if (image->key == key->hash && image->w == w && image->h == h && image->format == format &&
+        cdImageKeyMatch(key, image->key_data))
+    {
+      if (ctxcanvas->img_update && ctxcanvas->img_id)
+      {
+        *update = 1;
+        ctxcanvas->img_misses++;
+      }
+      else
+        ctxcanvas->img_hits++;
+
+      ctxcanvas->img_update = 0;
+      image->tick = ++ctxcanvas->img_tick;
+      return cairo_surface_reference(image->surface);
+    }
+  }
+
+  ctxcanvas->img_misses++;
+  return NULL;
+}
+
+/* Removes the least recently used surfaces until size bytes are available. */
+static void sFreeImageSurfaces(cdCtxCanvas *ctxcanvas, unsigned long size)
+{
+  while (ctxcanvas->img_count > 0 && ctxcanvas->img_bytes + size > ctxcanvas->img_cache_size)
+  {
+    int i, lru = 0;
+    cdCairoImage* image;
+
+    for (i = 1; i < ctxcanvas->img_count; i++)
+    {
+      if (ctxcanvas->img_cache[i].tick < ctxcanvas->img_cache[lru].tick)
+        lru = i;
+    }
+
+    image = ctxcanvas->img_cache + lru;
+    cairo_surface_destroy(image->surface);
+    if (image->key_data) free(image->key_data);
+
+    ctxcanvas->img_bytes -= (unsigned long)image->w * image->h * 4 + image->key_size;
+    ctxcanvas->img_count--;
+    *image = ctxcanvas->img_cache[ctxcanvas->img_count];
+  }
+}
+
+static void sFreeImageCache(cdCtxCanvas *ctxcanvas)
+{
+  int i;
+  for (i = 0; i < ctxcanvas->img_count; i++)
+  {
+    cairo_surface_destroy(ctxcanvas->img_cache[i].surface);
+    if (ctxcanvas->img_cache[i].key_data) free(ctxcanvas->img_cache[i].key_data);
+  }
+
+  ctxcanvas->img_count = 0;
+  ctxcanvas->img_bytes = 0;
+}
+
+/* Keeps a reference to the surface in the cache. */
+static void sAddImageSurface(cdCtxCanvas *ctxcanvas, const cdImageKey* key, cairo_surface_t* surface, int w, int h, cairo_format_t format)
+{
+  unsigned long size = (unsigned long)w * h * 4;
+  unsigned char* key_data;
+  int key_size = 0;
+  cdCairoImage* image;
+
+  ctxcanvas->img_update = 0;
+
+  if (!key->hash || size > ctxcanvas->img_cache_size)
     return;
+
+  if (ctxcanvas->img_count == ctxcanvas->img_max)
+  {
+    int new_max = ctxcanvas->img_max + 32;
+    cdCairoImage* new_cache = (cdCairoImage*)realloc(ctxcanvas->img_cache, new_max * sizeof(cdCairoImage));
+    if (!new_cache)
+      return;
+    ctxcanvas->img_cache = new_cache;
+    ctxcanvas->img_max = new_max;
   }
 
-  cairo_surface_flush(image_surface);
-  data = (unsigned int*)cairo_image_surface_get_data(image_surface);
-  stride = cairo_image_surface_get_stride(image_surface);
-  offset = stride/4 - rw;
+  /* a copy of the contents confirms the hash in the next searches */
+  key_data = cdImageKeyData(key, &key_size);
+  if (!key_data && !key->img_id)
+    return;
 
-  sFixImageY(ctxcanvas->canvas, &topdown, &y, h);
+  size += key_size;
+  if (size > ctxcanvas->img_cache_size)
+  {
+    if (key_data) free(key_data);
+    return;
+  }
 
-  for (i=ymin; i<=ymax; i++)
+  sFreeImageSurfaces(ctxcanvas, size);
+
+  image = ctxcanvas->img_cache + ctxcanvas->img_count;
+  image->key = key->hash;
+  image->key_data = key_data;
+  image->key_size = key_size;
+  image->w = w;
+  image->h = h;
+  image->format = format;
+  image->surface = cairo_surface_reference(surface);
+  image->tick = ++ctxcanvas->img_tick;
+  ctxcanvas->img_count++;
+  ctxcanvas->img_bytes += size;
+}
+
+/* Returns the surface where the image must be converted,
+   or NULL if the image is already converted in the cache (or there is no memory).
+   image_surface returns a reference that must be destroyed after use. */
+static cairo_surface_t* sCreateImageSurface(cdCtxCanvas *ctxcanvas, const cdImageKey* key, int rw, int rh, cairo_format_t format, cairo_surface_t** image_surface)
+{
+  int update;
+
+  *image_surface = sFindImageSurface(ctxcanvas, key, rw, rh, format, &update);
+  if (*image_surface)
   {
-    for (j=xmin; j<=xmax; j++)
+    if (!update)
+      return NULL;
+  }
+  else
+  {
+    *image_surface = cairo_image_surface_create(format, rw, rh);
+    if (cairo_surface_status(*image_surface) != CAIRO_STATUS_SUCCESS)
     {
-      if (topdown)
-        pos = i*iw+j;
-      else
-        pos = (ymax+ymin - i)*iw+j;
-      *data++ = sEncodeRGBA(r[pos], g[pos], b[pos], 255);
+      cairo_surface_destroy(*image_surface);
+      *image_surface = NULL;
+      return NULL;
     }
 
-    if (offset)
-      data += offset;
+    sAddImageSurface(ctxcanvas, key, *image_surface, rw, rh, format);
   }
 
-  cairo_surface_mark_dirty(image_surface);
+  /* the surface may be used by a snapshot, flush before changing it */
+  cairo_surface_flush(*image_surface);
+  return *image_surface;
+}
+
+/* Line converters, simple enough for the compiler to vectorize them.
+   CAIRO_FORMAT_RGB24 and CAIRO_FORMAT_ARGB32 each pixel is a 32-bit quantity,
+   with alpha (or unused) in the upper 8 bits, then red, then green, then blue.
+   The 32-bit quantities are stored native-endian. Pre-multiplied alpha is used. */
+
+static void sEncodeLineRGB(unsigned int* data, const unsigned char *r, const unsigned char *g, const unsigned char *b, int n)
+{
+  int j;
+  for (j = 0; j < n; j++)
+    data[j] = 0xFF000000 | ((unsigned int)r[j] << 16) | ((unsigned int)g[j] << 8) | (unsigned int)b[j];
+}
+
+/* same as CD_ALPHAPRE without the division, v/255 = (v + 1 + ((v + 1) >> 8)) >> 8 for v <= 255*255 */
+#define CD_ALPHAPRE_LINE(_src, _alpha) ((((_src)*(_alpha)) + 1 + ((((_src)*(_alpha)) + 1) >> 8)) >> 8)
+
+static void sEncodeLineRGBA(unsigned int* data, const unsigned char *r, const unsigned char *g, const unsigned char *b, const unsigned char *a, int n)
+{
+  int j;
+  for (j = 0; j < n; j++)
+  {
+    unsigned int al = a[j];
+    data[j] = (al << 24) |
+              (CD_ALPHAPRE_LINE((unsigned int)r[j], al) << 16) |
+              (CD_ALPHAPRE_LINE((unsigned int)g[j], al) << 8) |
+               CD_ALPHAPRE_LINE((unsigned int)b[j], al);
+  }
+}
+
+static void sEncodeLineMap(unsigned int* data, const unsigned char *index, const unsigned int *cairo_colors, int n)
+{
+  int j;
+  for (j = 0; j < n; j++)
+    data[j] = cairo_colors[index[j]];
+}
+
+static void sPaintImageSurface(cdCtxCanvas *ctxcanvas, cairo_surface_t* image_surface, double x, double y, double w, double h, int rw, int rh, int flip)
+{
+  cairo_filter_t filter;
 
   cairo_save (ctxcanvas->cr);
 
   sfCairoRectangle(ctxcanvas->cr, x, y, x+w, y+h);
   cairo_clip(ctxcanvas->cr);
 
-  if (w != rw || h != rh)
+  filter = cairo_pattern_get_filter(cairo_get_source(ctxcanvas->cr));
+
+  if (flip)
   {
-    /* Scale *before* setting the source surface (1) */
-    cairo_translate(ctxcanvas->cr, x, y);
-    cairo_scale (ctxcanvas->cr, (double)w / rw, (double)h / rh);
-    cairo_translate(ctxcanvas->cr, -x, -y);
+    /* the surface is top-down, but the Y axis is up */
+    cairo_translate(ctxcanvas->cr, x, y + h);
+    cairo_scale (ctxcanvas->cr, (double)w / rw, -(double)h / rh);
+    cairo_set_source_surface(ctxcanvas->cr, image_surface, 0, 0);
+  }
+  else
+  {
+    if (w != rw || h != rh)
+    {
+      /* Scale *before* setting the source surface (1) */
+      cairo_translate(ctxcanvas->cr, x, y);
+      cairo_scale (ctxcanvas->cr, (double)w / rw, (double)h / rh);
+      cairo_translate(ctxcanvas->cr, -x, -y);
+    }
+
+    cairo_set_source_surface(ctxcanvas->cr, image_surface, x, y);
   }
 
-  filter = cairo_pattern_get_filter(cairo_get_source(ctxcanvas->cr));
-  cairo_set_source_surface(ctxcanvas->cr, image_surface, x, y);
   cairo_pattern_set_filter(cairo_get_source(ctxcanvas->cr), filter);
 
   cairo_paint(ctxcanvas->cr);
 
-  cairo_surface_destroy(image_surface);
   cairo_restore (ctxcanvas->cr);
 }
 
-static void cdputimagerectrgb(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *r, const unsigned char *g, const unsigned char *b, 
-                              int x, int y, int w, int h, int xmin, int xmax, int ymin, int ymax)
-{
-  cdfputimagerectrgb(ctxcanvas, iw, ih, r, g, b, (double)x, (double)y, (double)w, (double)h, xmin, xmax, ymin, ymax);
-}
-
-static void cdfputimagerectrgba(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *r, const unsigned char *g, const unsigned char *b, const unsigned char *a, 
-                                double x, double y, double w, double h, int xmin, int xmax, int ymin, int ymax)
+static void cdfputimagerectrgb(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *r, const unsigned char *g, const unsigned char *b,
+                               double x, double y, double w, double h, int xmin, int xmax, int ymin, int ymax)
 {
-  int i, j, rw, rh, pos, offset, topdown, stride;
-  unsigned int* data;
+  int i, rw, rh, offset, topdown, stride;
+  unsigned char* data;
+  cdImageKey key;
   cairo_surface_t* image_surface;
-  cairo_filter_t filter;
 
   if (xmin<0 || ymin<0 || xmax-xmin+1>iw || ymax-ymin+1>ih) return;
 
   rw = xmax-xmin+1;
   rh = ymax-ymin+1;
 
-  image_surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, rw, rh);
-  if (cairo_surface_status(image_surface) != CAIRO_STATUS_SUCCESS)
-  {
-    cairo_surface_destroy(image_surface);
-    return;
-  }
-
-  cairo_surface_flush(image_surface);
-  data = (unsigned int*)cairo_image_surface_get_data(image_surface);
-  stride = cairo_image_surface_get_stride(image_surface);
-  offset = stride/4 - rw;
-
   sFixImageY(ctxcanvas->canvas, &topdown, &y, h);
 
-  for (i=ymin; i<=ymax; i++)
+  sImageKeyRGBA(ctxcanvas, &key, iw, r, g, b, NULL, topdown, xmin, ymin, rw, rh);
+
+  /* CAIRO_FORMAT_RGB24	each pixel is a 32-bit quantity, with the upper 8 bits unused.
+     Red, Green, and Blue are stored in the remaining 24 bits in that order. */
+  if (sCreateImageSurface(ctxcanvas, &key, rw, rh, CAIRO_FORMAT_RGB24, &image_surface))
   {
-    for (j=xmin; j<=xmax; j++)
+    data = cairo_image_surface_get_data(image_surface);
+    stride = cairo_image_surface_get_stride(image_surface);
+
+    for (i=0; i<rh; i++)
     {
       if (topdown)
-        pos = i*iw+j;
+        offset = (ymin + i)*iw + xmin;
       else
-        pos = (ymax+ymin - i)*iw+j;
-      *data++ = sEncodeRGBA(r[pos], g[pos], b[pos], a[pos]);
+        offset = (ymax - i)*iw + xmin;
+      sEncodeLineRGB((unsigned int*)(data + i*stride), r + offset, g + offset, b + offset, rw);
     }
 
-    if (offset)
-      data += offset;
+    cairo_surface_mark_dirty(image_surface);
   }
 
-  cairo_surface_mark_dirty(image_surface);
+  if (!image_surface)
+    return;
 
-  cairo_save (ctxcanvas->cr);
+  sPaintImageSurface(ctxcanvas, image_surface, x, y, w, h, rw, rh, 0);
 
-  sfCairoRectangle(ctxcanvas->cr, x, y, x+w, y+h);
-  cairo_clip(ctxcanvas->cr);
+  cairo_surface_destroy(image_surface);
+}
+
+static void cdputimagerectrgb(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *r, const unsigned char *g, const unsigned char *b,
+                              int x, int y, int w, int h, int xmin, int xmax, int ymin, int ymax)
+{
+  cdfputimagerectrgb(ctxcanvas, iw, ih, r, g, b, (double)x, (double)y, (double)w, (double)h, xmin, xmax, ymin, ymax);
+}
+
+static void cdfputimagerectrgba(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *r, const unsigned char *g, const unsigned char *b, const unsigned char *a,
+                                double x, double y, double w, double h, int xmin, int xmax, int ymin, int ymax)
+{
+  int i, rw, rh, offset, topdown, stride;
+  unsigned char* data;
+  cdImageKey key;
+  cairo_surface_t* image_surface;
+
+  if (xmin<0 || ymin<0 || xmax-xmin+1>iw || ymax-ymin+1>ih) return;
+
+  rw = xmax-xmin+1;
+  rh = ymax-ymin+1;
+
+  sFixImageY(ctxcanvas->canvas, &topdown, &y, h);
 
-  if (w != rw || h != rh)
+  sImageKeyRGBA(ctxcanvas, &key, iw, r, g, b, a, topdown, xmin, ymin, rw, rh);
+
+  if (sCreateImageSurface(ctxcanvas, &key, rw, rh, CAIRO_FORMAT_ARGB32, &image_surface))
   {
-    /* Scale *before* setting the source surface (1) */
-    cairo_translate(ctxcanvas->cr, x, y);
-    cairo_scale (ctxcanvas->cr, (double)w / rw, (double)h / rh);
-    cairo_translate(ctxcanvas->cr, -x, -y);
+    data = cairo_image_surface_get_data(image_surface);
+    stride = cairo_image_surface_get_stride(image_surface);
+
+    for (i=0; i<rh; i++)
+    {
+      if (topdown)
+        offset = (ymin + i)*iw + xmin;
+      else
+        offset = (ymax - i)*iw + xmin;
+      sEncodeLineRGBA((unsigned int*)(data + i*stride), r + offset, g + offset, b + offset, a + offset, rw);
+    }
+
+    cairo_surface_mark_dirty(image_surface);
   }
 
-  filter = cairo_pattern_get_filter(cairo_get_source(ctxcanvas->cr));
-  cairo_set_source_surface(ctxcanvas->cr, image_surface, x, y);
-  cairo_pattern_set_filter(cairo_get_source(ctxcanvas->cr), filter);
+  if (!image_surface)
+    return;
 
-  cairo_paint(ctxcanvas->cr);
+  sPaintImageSurface(ctxcanvas, image_surface, x, y, w, h, rw, rh, 0);
 
   cairo_surface_destroy(image_surface);
-  cairo_restore (ctxcanvas->cr);
 }
 
-static void cdputimagerectrgba(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *r, const unsigned char *g, const unsigned char *b, const unsigned char *a, 
+static void cdputimagerectrgba(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *r, const unsigned char *g, const unsigned char *b, const unsigned char *a,
                                int x, int y, int w, int h, int xmin, int xmax, int ymin, int ymax)
 {
   cdfputimagerectrgba(ctxcanvas, iw, ih, r, g, b, a, (double)x, (double)y, (double)w, (double)h, xmin, xmax, ymin, ymax);
@@ -1621,87 +1822,101 @@ static int sCalcPalSize(int size, const unsigned char *index)
   return pal_size;
 }
 
-static void cdfputimagerectmap(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *index, const long *colors, 
+static void cdfputimagerectmap(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *index, const long *colors,
                                double x, double y, double w, double h, int xmin, int xmax, int ymin, int ymax)
 {
-  int i, j, rw, rh, pos, offset, pal_size, topdown, stride;
-  unsigned int* data, cairo_colors[256];
+  int i, rw, rh, offset, pal_size, topdown, stride;
+  unsigned int cairo_colors[256];
+  unsigned char* data;
+  cdImageKey key;
   long c;
   cairo_surface_t* image_surface;
-  cairo_filter_t filter;
 
   if (xmin<0 || ymin<0 || xmax-xmin+1>iw || ymax-ymin+1>ih) return;
 
   rw = xmax-xmin+1;
   rh = ymax-ymin+1;
 
-  /* CAIRO_FORMAT_RGB24	each pixel is a 32-bit quantity, with the upper 8 bits unused. 
-     Red, Green, and Blue are stored in the remaining 24 bits in that order. */
-  image_surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, rw, rh);
-  if (cairo_surface_status(image_surface) != CAIRO_STATUS_SUCCESS)
-  {
-    cairo_surface_destroy(image_surface);
-    return;
-  }
-
-  cairo_surface_flush(image_surface);
-  data = (unsigned int*)cairo_image_surface_get_data(image_surface);
-  stride = cairo_image_surface_get_stride(image_surface);
-  offset = stride/4 - rw;
+  sFixImageY(ctxcanvas->canvas, &topdown, &y, h);
 
   pal_size = sCalcPalSize(iw*ih, index);
-  for (i=0; i<pal_size; i++)
-  {
-    c = colors[i];
-    cairo_colors[i] = sEncodeRGBA(cdRed(c), cdGreen(c), cdBlue(c), 255);
-  }
 
-  sFixImageY(ctxcanvas->canvas, &topdown, &y, h);
+  sImageKeyMap(ctxcanvas, &key, iw, index, colors, topdown, xmin, ymin, rw, rh);
 
-  for (i=ymin; i<=ymax; i++)
+  /* CAIRO_FORMAT_RGB24	each pixel is a 32-bit quantity, with the upper 8 bits unused.
+     Red, Green, and Blue are stored in the remaining 24 bits in that order. */
+  if (sCreateImageSurface(ctxcanvas, &key, rw, rh, CAIRO_FORMAT_RGB24, &image_surface))
   {
-    for (j=xmin; j<=xmax; j++)
+    data = cairo_image_surface_get_data(image_surface);
+    stride = cairo_image_surface_get_stride(image_surface);
+
+    for (i=0; i<pal_size; i++)
+    {
+      c = colors[i];
+      cairo_colors[i] = sEncodeRGBA(cdRed(c), cdGreen(c), cdBlue(c), 255);
+    }
+
+    for (i=0; i<rh; i++)
     {
       if (topdown)
-        pos = i*iw+j;
+        offset = (ymin + i)*iw + xmin;
       else
-        pos = (ymax+ymin - i)*iw+j;
-      *data++ = cairo_colors[index[pos]];
+        offset = (ymax - i)*iw + xmin;
+      sEncodeLineMap((unsigned int*)(data + i*stride), index + offset, cairo_colors, rw);
     }
 
-    if (offset)
-      data += offset;
+    cairo_surface_mark_dirty(image_surface);
   }
 
-  cairo_surface_mark_dirty(image_surface);
+  if (!image_surface)
+    return;
 
-  cairo_save (ctxcanvas->cr);
+  sPaintImageSurface(ctxcanvas, image_surface, x, y, w, h, rw, rh, 0);
 
-  sfCairoRectangle(ctxcanvas->cr, x, y, x+w, y+h);
-  cairo_clip(ctxcanvas->cr);
+  cairo_surface_destroy(image_surface);
+}
+
+static void cdputimagerectmap(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *index, const long *colors,
+                              int x, int y, int w, int h, int xmin, int xmax, int ymin, int ymax)
+{
+  cdfputimagerectmap(ctxcanvas, iw, ih, index, colors, (double)x, (double)y, (double)w, (double)h, xmin, xmax, ymin, ymax);
+}
+
+/* Draws a premultiplied ARGB32 top-down image without any conversion.
+   The buffer is used directly, and only during this call. */
+void cdcairoPutImageARGB(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *argb, double x, double y, double w, double h)
+{
+  cdCanvas* canvas = ctxcanvas->canvas;
+  cairo_surface_t* image_surface;
+  int topdown;
+
+  if (w == 0) w = iw;
+  if (h == 0) h = ih;
 
-  if (w != rw || h != rh)
+  if (canvas->use_origin)
   {
-    /* Scale *before* setting the source surface (1) */
-    cairo_translate(ctxcanvas->cr, x, y);
-    cairo_scale (ctxcanvas->cr, (double)w / rw, (double)h / rh);
-    cairo_translate(ctxcanvas->cr, -x, -y);
+    x += canvas->forigin.x;
+    y += canvas->forigin.y;
   }
 
-  filter = cairo_pattern_get_filter(cairo_get_source(ctxcanvas->cr));
-  cairo_set_source_surface(ctxcanvas->cr, image_surface, x, y);
-  cairo_pattern_set_filter(cairo_get_source(ctxcanvas->cr), filter);
+  if (canvas->invert_yaxis)
+    y = _cdInvertYAxis(canvas, y);
 
-  cairo_paint(ctxcanvas->cr);
+  image_surface = cairo_image_surface_create_for_data((unsigned char*)argb, CAIRO_FORMAT_ARGB32, iw, ih, iw*4);
+  if (cairo_surface_status(image_surface) != CAIRO_STATUS_SUCCESS)
+  {
+    cairo_surface_destroy(image_surface);
+    return;
+  }
 
-  cairo_surface_destroy(image_surface);
-  cairo_restore (ctxcanvas->cr);
-}
+  sFixImageY(canvas, &topdown, &y, h);
 
-static void cdputimagerectmap(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *index, const long *colors, 
-                              int x, int y, int w, int h, int xmin, int xmax, int ymin, int ymax)
-{
-  cdfputimagerectmap(ctxcanvas, iw, ih, index, colors, (double)x, (double)y, (double)w, (double)h, xmin, xmax, ymin, ymax);
+  /* when topdown the Y axis is up, so the top-down buffer must be flipped */
+  sPaintImageSurface(ctxcanvas, image_surface, x, y, w, h, iw, ih, topdown);
+
+  /* make sure the buffer is not referenced after return */
+  cairo_surface_finish(image_surface);
+  cairo_surface_destroy(image_surface);
 }
 
 static void cdfpixel(cdCtxCanvas *ctxcanvas, double x, double y, long color)
@@ -2283,6 +2498,84 @@ static cdAttribute interp_attrib =
   get_interp_attrib
 };
 
+static void set_imgcachesize_attrib(cdCtxCanvas* ctxcanvas, char* data)
+{
+  unsigned long size = CD_CAIRO_IMAGE_CACHE_SIZE;
+
+  if (data)
+    sscanf(data, "%lu", &size);
+
+  ctxcanvas->img_cache_size = size * 1024;
+  sFreeImageSurfaces(ctxcanvas, 0);
+}
+
+static char* get_imgcachesize_attrib(cdCtxCanvas* ctxcanvas)
+{
+  static char data[100];
+  sprintf(data, "%lu", ctxcanvas->img_cache_size / 1024);
+  return data;
+}
+
+static cdAttribute imgcachesize_attrib =
+{
+  "IMGCACHESIZE",
+  set_imgcachesize_attrib,
+  get_imgcachesize_attrib
+};
+
+static char* get_imgcacheinfo_attrib(cdCtxCanvas* ctxcanvas)
+{
+  static char data[200];
+  sprintf(data, "%lu %lu %d %lu", ctxcanvas->img_hits, ctxcanvas->img_misses, ctxcanvas->img_count, ctxcanvas->img_bytes / 1024);
+  return data;
+}
+
+static cdAttribute imgcacheinfo_attrib =
+{
+  "IMGCACHEINFO",
+  NULL,
+  get_imgcacheinfo_attrib
+};
+
+static void set_imgid_attrib(cdCtxCanvas* ctxcanvas, char* data)
+{
+  if (ctxcanvas->img_id)
+  {
+    free(ctxcanvas->img_id);
+    ctxcanvas->img_id = NULL;
+  }
+
+  if (data)
+    ctxcanvas->img_id = cdStrDup(data);
+}
+
+static char* get_imgid_attrib(cdCtxCanvas* ctxcanvas)
+{
+  return ctxcanvas->img_id;
+}
+
+static cdAttribute imgid_attrib =
+{
+  "IMGID",
+  set_imgid_attrib,
+  get_imgid_attrib
+};
+
+static void set_imgupdate_attrib(cdCtxCanvas* ctxcanvas, char* data)
+{
+  if (!data || data[0] == '0')
+    ctxcanvas->img_update = 0;
+  else
+    ctxcanvas->img_update = 1;
+}
+
+static cdAttribute imgupdate_attrib =
+{
+  "IMGUPDATE",
+  set_imgupdate_attrib,
+  NULL
+};
+
 static char* get_status_attrib(cdCtxCanvas *ctxcanvas)
 {
   return (char*)cairo_status_to_string(cairo_status(ctxcanvas->cr));
@@ -2334,6 +2627,7 @@ cdCtxCanvas *cdcairoCreateCanvas(cdCanvas* canvas, cairo_t* cr)
   ctxcanvas->canvas = canvas;
   ctxcanvas->last_source = -1;
   ctxcanvas->hatchboxsize = 8;
+  ctxcanvas->img_cache_size = CD_CAIRO_IMAGE_CACHE_SIZE * 1024;
 
   canvas->ctxcanvas = ctxcanvas;
   canvas->invert_yaxis = 1;
@@ -2362,6 +2656,10 @@ cdCtxCanvas *cdcairoCreateCanvas(cdCanvas* canvas, cairo_t* cr)
   cdRegisterAttribute(canvas, &pattern_image_attrib);
   cdRegisterAttribute(canvas, &utf8mode_attrib);
   cdRegisterAttribute(canvas, &status_attrib);
+  cdRegisterAttribute(canvas, &imgcachesize_attrib);
+  cdRegisterAttribute(canvas, &imgcacheinfo_attrib);
+  cdRegisterAttribute(canvas, &imgid_attrib);
+  cdRegisterAttribute(canvas, &imgupdate_attrib);
 
   cairo_save(ctxcanvas->cr);
   cairo_set_operator(ctxcanvas->cr, CAIRO_OPERATOR_OVER);
@@ -27,6 +27,16 @@ struct _cdCtxImage {
   cairo_t* cr;
 };
 
+typedef struct _cdCairoImage {
+  unsigned long long key;  /* image content hash or IMGID */
+  unsigned char* key_data; /* image contents to confirm the key, NULL for IMGID */
+  int key_size;
+  int w, h;
+  cairo_format_t format;
+  cairo_surface_t* surface;
+  unsigned long tick;      /* last use, for LRU eviction */
+} cdCairoImage;
+
 struct _cdCtxCanvas
 {
   cdCanvas* canvas;
@@ -54,6 +64,13 @@ struct _cdCtxCanvas
   int poly_holes[500];
   int holes;
 
+  /* image surfaces already converted, used by the PutImageRect functions */
+  cdCairoImage* img_cache;
+  int img_count, img_max;
+  unsigned long img_bytes, img_cache_size, img_tick, img_hits, img_misses;
+  char* img_id;
+  int img_update;
+
 #if CAIRO_VERSION >= CAIRO_VERSION_110
   cairo_region_t* new_rgn;
 #endif
@@ -93,5 +110,6 @@ struct _cdCtxCanvas
 cdCtxCanvas *cdcairoCreateCanvas(cdCanvas* canvas, cairo_t* cr);
 void cdcairoInitTable(cdCanvas* canvas);
 void cdcairoKillCanvas(cdCtxCanvas *ctxcanvas);
+void cdcairoPutImageARGB(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *argb, double x, double y, double w, double h);
 
 #endif
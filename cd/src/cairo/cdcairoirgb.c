@@ -52,6 +52,23 @@ static cdAttribute data_attrib =
   get_data_attrib
 }; 
 
+static void set_putimageargb_attrib(cdCtxCanvas *ctxcanvas, char* data)
+{
+  void* argb = NULL;
+  int iw, ih, x, y, w = 0, h = 0;
+
+  /* must be a premultiplied ARGB32 top-down buffer, used without conversion */
+  if (data && sscanf(data, "%p %d %d %d %d %d %d", &argb, &iw, &ih, &x, &y, &w, &h) >= 5 && argb && iw > 0 && ih > 0)
+    cdcairoPutImageARGB(ctxcanvas, iw, ih, (const unsigned char*)argb, (double)x, (double)y, (double)w, (double)h);
+}
+
+static cdAttribute putimageargb_attrib =
+{
+  "PUTIMAGEARGB",
+  set_putimageargb_attrib,
+  NULL
+}; 
+
 static void cdkillcanvas (cdCtxCanvas *ctxcanvas)
 {
   if (!ctxcanvas->user_image)
@@ -135,6 +152,7 @@ static void cdcreatecanvas(cdCanvas* canvas, void* data)
   cdRegisterAttribute(canvas, &stride_attrib);
   cdRegisterAttribute(canvas, &write2png_attrib);
   cdRegisterAttribute(canvas, &data_attrib);
+  cdRegisterAttribute(canvas, &putimageargb_attrib);
 }
 
 static void cdinittable(cdCanvas* canvas)
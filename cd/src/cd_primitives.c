@@ -401,6 +401,227 @@ void cdCanvasEnd(cdCanvas* canvas)
   canvas->use_fpoly = -1;
 }
 
+static int sBeginPoly(cdCanvas* canvas, int mode, int n)
+{
+  /* regions and paths need more than a list of points */
+  if (mode == CD_REGION || mode == CD_PATH || n < 1)
+    return -1;
+
+  if (canvas->interior_style == CD_HOLLOW && mode == CD_FILL)
+    mode = CD_CLOSED_LINES;
+
+  return mode;
+}
+
+static void sPolyAlloc(cdCanvas* canvas, int n)
+{
+  if (!canvas->poly || canvas->poly_size < n)
+  {
+    int size = ((n + _CD_POLY_BLOCK - 1) / _CD_POLY_BLOCK) * _CD_POLY_BLOCK;
+    if (canvas->poly) free(canvas->poly);
+    canvas->poly = (cdPoint*)malloc(sizeof(cdPoint)*(size+1));  /* same extra point of cdCanvasVertex */
+    canvas->poly_size = size;
+  }
+}
+
+static void sfPolyAlloc(cdCanvas* canvas, int n)
+{
+  if (!canvas->fpoly || canvas->fpoly_size < n)
+  {
+    int size = ((n + _CD_POLY_BLOCK - 1) / _CD_POLY_BLOCK) * _CD_POLY_BLOCK;
+    if (canvas->fpoly) free(canvas->fpoly);
+    canvas->fpoly = (cdfPoint*)malloc(sizeof(cdfPoint)*(size+1));
+    canvas->fpoly_size = size;
+  }
+}
+
+static void sPolyEnd(cdCanvas* canvas, int mode, int n, int use_fpoly)
+{
+  canvas->poly_mode = mode;
+  canvas->poly_n = n;
+  canvas->path_n = 0;
+  canvas->use_fpoly = use_fpoly;
+
+  /* validates the number of points, draws and stores the clipping polygon */
+  cdCanvasEnd(canvas);
+}
+
+static void sPoly(cdCanvas* canvas, int mode, const cdPoint* points, int n)
+{
+  int i, x, y, poly_n = 0,
+      dx = 0, dy = 0,
+      invert_yaxis = canvas->invert_yaxis,
+      h = canvas->h;
+  cdPoint* poly;
+
+  mode = sBeginPoly(canvas, mode, n);
+  if (mode < 0)
+    return;
+
+  sPolyAlloc(canvas, n);
+  poly = canvas->poly;
+
+  if (canvas->use_origin)
+  {
+    dx = canvas->origin.x;
+    dy = canvas->origin.y;
+  }
+
+  for (i = 0; i < n; i++)
+  {
+    x = points[i].x + dx;
+    y = points[i].y + dy;
+    if (invert_yaxis)
+      y = h - y - 1;
+
+    if (mode != CD_BEZIER && poly_n > 0 && 
+        poly[poly_n-1].x == x && poly[poly_n-1].y == y)
+      continue;  /* avoid duplicate points, if not a bezier */
+
+    poly[poly_n].x = x;
+    poly[poly_n].y = y;
+    poly_n++;
+  }
+
+  sPolyEnd(canvas, mode, poly_n, 0);
+}
+
+static void sfPoly(cdCanvas* canvas, int mode, const cdfPoint* points, int n)
+{
+  int i, invert_yaxis = canvas->invert_yaxis;
+  double dx = 0, dy = 0, h = canvas->h;
+
+  if (!canvas->cxFPoly)
+  {
+    /* same as cdfCanvasVertex, round to integer and use the integer polygon */
+    int x, y, poly_n = 0, idx = 0, idy = 0;
+    cdPoint* poly;
+
+    mode = sBeginPoly(canvas, mode, n);
+    if (mode < 0)
+      return;
+
+    sPolyAlloc(canvas, n);
+    poly = canvas->poly;
+
+    if (canvas->use_origin)
+    {
+      idx = canvas->origin.x;
+      idy = canvas->origin.y;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+      x = _cdRound(points[i].x) + idx;
+      y = _cdRound(points[i].y) + idy;
+      if (invert_yaxis)
+        y = canvas->h - y - 1;
+
+      if (mode != CD_BEZIER && poly_n > 0 && 
+          poly[poly_n-1].x == x && poly[poly_n-1].y == y)
+        continue;
+
+      poly[poly_n].x = x;
+      poly[poly_n].y = y;
+      poly_n++;
+    }
+
+    sPolyEnd(canvas, mode, poly_n, 0);
+  }
+  else
+  {
+    cdfPoint* fpoly;
+
+    mode = sBeginPoly(canvas, mode, n);
+    if (mode < 0)
+      return;
+
+    sfPolyAlloc(canvas, n);
+    fpoly = canvas->fpoly;
+
+    if (canvas->use_origin)
+    {
+      dx = canvas->forigin.x;
+      dy = canvas->forigin.y;
+    }
+
+    if (invert_yaxis)
+    {
+      for (i = 0; i < n; i++)
+      {
+        fpoly[i].x = points[i].x + dx;
+        fpoly[i].y = h - (points[i].y + dy) - 1;
+      }
+    }
+    else
+    {
+      for (i = 0; i < n; i++)
+      {
+        fpoly[i].x = points[i].x + dx;
+        fpoly[i].y = points[i].y + dy;
+      }
+    }
+
+    sPolyEnd(canvas, mode, n, 1);
+  }
+}
+
+void cdCanvasPoly(cdCanvas* canvas, int mode, const cdPoint* points, int n)
+{
+  assert(canvas);
+  assert(mode>=CD_FILL);
+  if (!_cdCheckCanvas(canvas)) return;
+  if (!points) return;
+
+  sPoly(canvas, mode, points, n);
+}
+
+void cdfCanvasPoly(cdCanvas* canvas, int mode, const cdfPoint* points, int n)
+{
+  assert(canvas);
+  assert(mode>=CD_FILL);
+  if (!_cdCheckCanvas(canvas)) return;
+  if (!points) return;
+
+  sfPoly(canvas, mode, points, n);
+}
+
+void cdCanvasMultiPoly(cdCanvas* canvas, int mode, const cdPoint* points, const int* counts, int count)
+{
+  int i;
+  assert(canvas);
+  assert(mode>=CD_FILL);
+  if (!_cdCheckCanvas(canvas)) return;
+  if (!points || !counts) return;
+
+  for (i = 0; i < count; i++)
+  {
+    if (counts[i] <= 0)
+      continue;
+
+    sPoly(canvas, mode, points, counts[i]);
+    points += counts[i];
+  }
+}
+
+void cdfCanvasMultiPoly(cdCanvas* canvas, int mode, const cdfPoint* points, const int* counts, int count)
+{
+  int i;
+  assert(canvas);
+  assert(mode>=CD_FILL);
+  if (!_cdCheckCanvas(canvas)) return;
+  if (!points || !counts) return;
+
+  for (i = 0; i < count; i++)
+  {
+    if (counts[i] <= 0)
+      continue;
+
+    sfPoly(canvas, mode, points, counts[i]);
+    points += counts[i];
+  }
+}
+
 void cdCanvasRect(cdCanvas* canvas, int xmin, int xmax, int ymin, int ymax)
 {
   assert(canvas);
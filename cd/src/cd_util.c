@@ -478,6 +478,442 @@ void cdSetPaperSize(int size, double *w_pt, double *h_pt)
 }
 
 
+/**************************************************************************************/
+
+/* Inverse palette lookup.
+   The RGB cube is divided in 32x32x32 cells. Each cell stores the palette index that is
+   the closest to all the colors inside the cell, or the list of palette colors that can be
+   the closest to some color inside the cell (as in the IJG inverse colormap).
+   The cells are computed only when used, and discarded when the palette changes.
+   The result is always the same of a search in the full palette. */
+
+#define CD_IMAP_CELL_BITS 3  /* 8 values per cell, 32 cells per channel */
+#define CD_IMAP_CELLS 32
+#define CD_IMAP_NOTDONE  -1  /* cell < -1 is the candidate list at position -(cell+2) */
+
+struct _cdInverseMap
+{
+  int count;
+  long weight[3];
+  unsigned char red[256], green[256], blue[256];
+  int cube[CD_IMAP_CELLS*CD_IMAP_CELLS*CD_IMAP_CELLS];
+  unsigned char* list;    /* candidate lists, the number of candidates followed by their indices */
+  int list_size, list_max;
+};
+
+cdInverseMap* cdInverseMapCreate(int r_weight, int g_weight, int b_weight)
+{
+  cdInverseMap* imap = (cdInverseMap*)malloc(sizeof(cdInverseMap));
+  if (!imap)
+    return NULL;
+
+  imap->weight[0] = r_weight;
+  imap->weight[1] = g_weight;
+  imap->weight[2] = b_weight;
+  imap->count = 0;
+  imap->list = NULL;
+  imap->list_size = 0;
+  imap->list_max = 0;
+  memset(imap->cube, 0xFF, sizeof(imap->cube));  /* all CD_IMAP_NOTDONE */
+  return imap;
+}
+
+void cdInverseMapKill(cdInverseMap* imap)
+{
+  if (!imap)
+    return;
+
+  if (imap->list) free(imap->list);
+  free(imap);
+}
+
+void cdInverseMapSetPalette(cdInverseMap* imap, int count, const long* palette)
+{
+  int i;
+
+  if (count > 256) count = 256;
+  if (count < 0) count = 0;
+
+  for (i = 0; i < count; i++)
+    cdDecodeColor(palette[i], imap->red + i, imap->green + i, imap->blue + i);
+
+  imap->count = count;
+  imap->list_size = 0;
+  memset(imap->cube, 0xFF, sizeof(imap->cube));  /* all CD_IMAP_NOTDONE */
+}
+
+static long iInverseMapDist(long weight, int v, int lo, int hi, int far)
+{
+  long d;
+
+  if (far)
+    d = (v - lo > hi - v)? v - lo: hi - v;
+  else if (v < lo)
+    d = lo - v;
+  else if (v > hi)
+    d = v - hi;
+  else
+    d = 0;
+
+  d *= weight;
+  return d*d;
+}
+
+static int iInverseMapFillCell(cdInverseMap* imap, int r0, int g0, int b0)
+{
+  int i, best = 0, count = 0, pos,
+      r1 = r0 + (1 << CD_IMAP_CELL_BITS) - 1,
+      g1 = g0 + (1 << CD_IMAP_CELL_BITS) - 1,
+      b1 = b0 + (1 << CD_IMAP_CELL_BITS) - 1;
+  long dist, min_maxdist = -1;
+  long mindist[256];
+
+  /* the color whose farthest point in the cell is the closest */
+  for (i = 0; i < imap->count; i++)
+  {
+    dist = iInverseMapDist(imap->weight[0], imap->red[i], r0, r1, 1) +
+           iInverseMapDist(imap->weight[1], imap->green[i], g0, g1, 1) +
+           iInverseMapDist(imap->weight[2], imap->blue[i], b0, b1, 1);
+
+    if (min_maxdist < 0 || dist < min_maxdist)
+    {
+      min_maxdist = dist;
+      best = i;
+    }
+  }
+
+  /* any other color that is always farther than that is never the closest */
+  for (i = 0; i < imap->count; i++)
+  {
+    mindist[i] = iInverseMapDist(imap->weight[0], imap->red[i], r0, r1, 0) +
+                 iInverseMapDist(imap->weight[1], imap->green[i], g0, g1, 0) +
+                 iInverseMapDist(imap->weight[2], imap->blue[i], b0, b1, 0);
+
+    if (mindist[i] <= min_maxdist)
+      count++;
+  }
+
+  if (count <= 1)
+    return best;
+
+  if (imap->list_size + count + 1 > imap->list_max)
+  {
+    int new_max = imap->list_max? 2 * imap->list_max: 4096;
+    unsigned char* new_list;
+    while (new_max < imap->list_size + count + 1)
+      new_max *= 2;
+
+    new_list = (unsigned char*)realloc(imap->list, new_max);
+    if (!new_list)
+      return CD_IMAP_NOTDONE;
+
+    imap->list = new_list;
+    imap->list_max = new_max;
+  }
+
+  pos = imap->list_size;
+  imap->list[pos] = (unsigned char)(count - 1);  /* count is at least 2 */
+  imap->list_size++;
+
+  /* candidates are kept in the palette order, so ties are solved as in the full search */
+  for (i = 0; i < imap->count; i++)
+  {
+    if (mindist[i] <= min_maxdist)
+    {
+      imap->list[imap->list_size] = (unsigned char)i;
+      imap->list_size++;
+    }
+  }
+
+  return -(pos + 2);
+}
+
+static int iInverseMapSearch(cdInverseMap* imap, const unsigned char* list, int count, int r, int g, int b)
+{
+  int i, c, best = 0;
+  long dist, dr, dg, db, min_dist = -1;
+
+  for (c = 0; c < count; c++)
+  {
+    i = list? list[c]: c;
+
+    dr = (r - imap->red[i]) * imap->weight[0];
+    dg = (g - imap->green[i]) * imap->weight[1];
+    db = (b - imap->blue[i]) * imap->weight[2];
+
+    dist = dr*dr + dg*dg + db*db;
+    if (min_dist < 0 || dist < min_dist)
+    {
+      min_dist = dist;
+      best = i;
+
+      if (dist == 0)
+        break;
+    }
+  }
+
+  return best;
+}
+
+int cdInverseMapFind(cdInverseMap* imap, long color)
+{
+  int r = cdRed(color),
+      g = cdGreen(color),
+      b = cdBlue(color);
+  int cell = ((r >> CD_IMAP_CELL_BITS) << 10) | ((g >> CD_IMAP_CELL_BITS) << 5) | (b >> CD_IMAP_CELL_BITS);
+  int index = imap->cube[cell];
+
+  if (index == CD_IMAP_NOTDONE)
+  {
+    int mask = ~((1 << CD_IMAP_CELL_BITS) - 1);
+    index = iInverseMapFillCell(imap, r & mask, g & mask, b & mask);
+    if (index == CD_IMAP_NOTDONE)  /* no memory for the candidates */
+      return iInverseMapSearch(imap, NULL, imap->count, r, g, b);
+
+    imap->cube[cell] = index;
+  }
+
+  if (index >= 0)
+    return index;
+  else
+  {
+    const unsigned char* list = imap->list - (index + 2);
+    return iInverseMapSearch(imap, list + 1, list[0] + 1, r, g, b);
+  }
+}
+
+
+/**************************************************************************************/
+
+/* Image keys, used by the drivers that cache the converted images 
+   (IMGCACHESIZE, IMGID and IMGUPDATE attributes). */
+
+unsigned long long cdHashBytes(unsigned long long hash, const unsigned char* data, int size)
+{
+  /* FNV-1a variant, 8 bytes at a time */
+  while (size >= 8)
+  {
+    unsigned long long word;
+    memcpy(&word, data, 8);
+    hash = (hash ^ word) * 1099511628211ULL;
+    hash ^= hash >> 32;
+    data += 8;
+    size -= 8;
+  }
+
+  while (size > 0)
+  {
+    hash = (hash ^ *data) * 1099511628211ULL;
+    data++;
+    size--;
+  }
+
+  return hash;
+}
+
+static void iImageKeyBegin(cdImageKey* key, const char* img_id, int type, int flags, int iw, int xmin, int ymin, int rw, int rh)
+{
+  int header[6];
+
+  memset(key, 0, sizeof(cdImageKey));
+  key->img_id = img_id;
+  key->type = type;
+  key->flags = flags;
+  key->iw = iw;
+  key->xmin = xmin;
+  key->ymin = ymin;
+  key->rw = rw;
+  key->rh = rh;
+
+  header[0] = type;
+  header[1] = flags;
+  header[2] = xmin;
+  header[3] = ymin;
+  header[4] = rw;
+  header[5] = rh;
+  key->hash = cdHashBytes(14695981039346656037ULL, (const unsigned char*)header, sizeof(header));
+
+  if (img_id)
+    key->hash = cdHashBytes(key->hash, (const unsigned char*)img_id, (int)strlen(img_id));
+}
+
+static void iImageKeyEnd(cdImageKey* key)
+{
+  /* 0 means no key */
+  if (!key->hash)
+    key->hash = 1;
+}
+
+void cdImageKeyRGBA(cdImageKey* key, const char* img_id, int flags, int iw, const unsigned char *r, const unsigned char *g, const unsigned char *b, const unsigned char *a, 
+                    int xmin, int ymin, int rw, int rh)
+{
+  int y;
+
+  iImageKeyBegin(key, img_id, a ? 4 : 3, flags, iw, xmin, ymin, rw, rh);
+  key->r = r;
+  key->g = g;
+  key->b = b;
+  key->a = a;
+
+  if (!img_id)
+  {
+    for (y = ymin; y < ymin + rh; y++)
+    {
+      int offset = y * iw + xmin;
+      key->hash = cdHashBytes(key->hash, r + offset, rw);
+      key->hash = cdHashBytes(key->hash, g + offset, rw);
+      key->hash = cdHashBytes(key->hash, b + offset, rw);
+      if (a) key->hash = cdHashBytes(key->hash, a + offset, rw);
+    }
+  }
+
+  iImageKeyEnd(key);
+}
+
+static int iImageKeyMaxIndex(const cdImageKey* key)
+{
+  int x, y, max_index = 0;
+
+  for (y = key->ymin; y < key->ymin + key->rh; y++)
+  {
+    const unsigned char* line = key->index + y * key->iw + key->xmin;
+    for (x = 0; x < key->rw; x++)
+    {
+      if (line[x] > max_index)
+        max_index = line[x];
+    }
+  }
+
+  return max_index;
+}
+
+void cdImageKeyMap(cdImageKey* key, const char* img_id, int flags, int iw, const unsigned char *index, const long *colors, 
+                   int xmin, int ymin, int rw, int rh)
+{
+  int y;
+
+  iImageKeyBegin(key, img_id, 1, flags, iw, xmin, ymin, rw, rh);
+  key->index = index;
+  key->colors = colors;
+
+  if (!img_id)
+  {
+    for (y = ymin; y < ymin + rh; y++)
+      key->hash = cdHashBytes(key->hash, index + y * iw + xmin, rw);
+
+    /* only the used colors */
+    key->hash = cdHashBytes(key->hash, (const unsigned char*)colors, (iImageKeyMaxIndex(key) + 1) * (int)sizeof(long));
+  }
+
+  iImageKeyEnd(key);
+}
+
+/* The copy has a header with the type, flags, size and number of colors,
+   then the region lines, and the used colors of Map images. */
+#define IMAGEKEY_HEADER 5
+
+unsigned char* cdImageKeyData(const cdImageKey* key, int *size)
+{
+  int y, header[IMAGEKEY_HEADER], planes = 0, colors_size = 0;
+  unsigned char *data, *line;
+
+  if (key->img_id)
+    return NULL;
+
+  header[0] = key->type;
+  header[1] = key->flags;
+  header[2] = key->rw;
+  header[3] = key->rh;
+  header[4] = 0;
+
+  if (key->index)
+  {
+    planes = 1;
+    header[4] = iImageKeyMaxIndex(key) + 1;
+    colors_size = header[4] * (int)sizeof(long);
+  }
+  else
+    planes = key->a ? 4 : 3;
+
+  *size = (int)sizeof(header) + planes * key->rw * key->rh + colors_size;
+  data = (unsigned char*)malloc(*size);
+  if (!data)
+    return NULL;
+
+  memcpy(data, header, sizeof(header));
+  line = data + sizeof(header);
+
+  for (y = key->ymin; y < key->ymin + key->rh; y++)
+  {
+    int offset = y * key->iw + key->xmin;
+
+    if (key->index)
+    {
+      memcpy(line, key->index + offset, key->rw); line += key->rw;
+    }
+    else
+    {
+      memcpy(line, key->r + offset, key->rw); line += key->rw;
+      memcpy(line, key->g + offset, key->rw); line += key->rw;
+      memcpy(line, key->b + offset, key->rw); line += key->rw;
+      if (key->a) { memcpy(line, key->a + offset, key->rw); line += key->rw; }
+    }
+  }
+
+  if (colors_size)
+    memcpy(line, key->colors, colors_size);
+
+  return data;
+}
+
+int cdImageKeyMatch(const cdImageKey* key, const unsigned char* data)
+{
+  int y, header[IMAGEKEY_HEADER];
+  const unsigned char *line;
+
+  /* IMGID identifies the image, the contents are not compared */
+  if (key->img_id || !data)
+    return key->img_id && !data;
+
+  memcpy(header, data, sizeof(header));
+  if (header[0] != key->type || header[1] != key->flags || header[2] != key->rw || header[3] != key->rh)
+    return 0;
+
+  line = data + sizeof(header);
+
+  for (y = key->ymin; y < key->ymin + key->rh; y++)
+  {
+    int offset = y * key->iw + key->xmin;
+
+    if (key->index)
+    {
+      if (memcmp(line, key->index + offset, key->rw) != 0) return 0;
+      line += key->rw;
+    }
+    else
+    {
+      if (memcmp(line, key->r + offset, key->rw) != 0) return 0;
+      line += key->rw;
+      if (memcmp(line, key->g + offset, key->rw) != 0) return 0;
+      line += key->rw;
+      if (memcmp(line, key->b + offset, key->rw) != 0) return 0;
+      line += key->rw;
+      if (key->a)
+      {
+        if (memcmp(line, key->a + offset, key->rw) != 0) return 0;
+        line += key->rw;
+      }
+    }
+  }
+
+  /* the indices are equal, so the number of used colors is also equal */
+  if (key->index && memcmp(line, key->colors, header[4] * sizeof(long)) != 0)
+    return 0;
+
+  return 1;
+}
+
+
 /**************************************************************************************/
 
 
@@ -1142,15 +1578,18 @@ char* cdStrConvertToUTF8(const char* str, int len, char* utf8_buffer, int *utf8_
   {
     size_t ulen = (size_t)len;
     size_t mlen = ulen * 2;
+    char* out;
     iconv_t cd_iconv = iconv_open("UTF-8", "ISO-8859-1");
 
     if (cd_iconv == (iconv_t)-1)
       return cdStrCopyToUtf8Buffer(str, len, utf8_buffer, utf8_buffer_max);
 
-    utf8_buffer = cdCheckUtf8Buffer(utf8_buffer, utf8_buffer_max, mlen);
+    utf8_buffer = cdCheckUtf8Buffer(utf8_buffer, utf8_buffer_max, (int)mlen);
 
-    iconv(cd_iconv, (char**)&str, &ulen, &utf8_buffer, &mlen);
-    utf8_buffer[mlen] = 0;
+    /* iconv advances the output pointer */
+    out = utf8_buffer;
+    iconv(cd_iconv, (char**)&str, &ulen, &out, &mlen);
+    *out = 0;
 
     iconv_close(cd_iconv);
   }
@@ -9,6 +9,14 @@
 #include <string.h>
 #include <math.h>
 #include <assert.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
 
 #include "cd.h"
 #include "wd.h"
@@ -29,12 +37,31 @@ typedef struct cdCaracter
   cdOperation *op;
 } cdCaracter;
 
+/* loaded font, shared by all the canvases that use it */
+typedef struct _vfFontData
+{
+  char name[256];         /* font name */
+  int top, cap, half, bottom;
+  cdCaracter chars[256];  /* never changed after loaded */
+
+  char* key;              /* file name or font string */
+  unsigned long key_hash;
+  int is_file;
+  time_t file_time;       /* file modification time and size when loaded */
+  long file_size;
+  int ref_count;          /* canvases using the font */
+  unsigned long unused_tick;  /* when ref_count reached 0, for LRU eviction */
+  int cached;             /* still in the cache list */
+  struct _vfFontData* next;
+} vfFontData;
+
 struct _cdVectorFont
 {
   /* font data */
   char name[256];         /* font name */
   char file_name[10240];  /* font file name */
   cdCaracter *chars;      /* array of characters */
+  vfFontData *font_data;  /* shared font data, NULL for the default font */
   int top,                /* from baseline to top */
       cap,                /* from baseline to cap (UNUSED) */
       half,               /* half between top and bottom (UNUSED) */
@@ -48,6 +75,21 @@ struct _cdVectorFont
   int text_transf;
   double text_matrix[6];
 
+  /* character operations already scaled by size and rotated by direction,
+     each character is scaled only when drawn */
+  cdfPoint *scaled_op;                    /* all the operations, in the same order of the characters */
+  int scaled_first[256];                  /* index of the first operation of each character */
+  int scaled_count;                       /* allocated operations */
+  int scaled_valid;                       /* scaled_first is valid for the current font */
+  unsigned int scaled_stamp;              /* changes when the size or the direction changes */
+  unsigned int scaled_char_stamp[256];    /* stamp used to scale each character */
+  double scaled_size_x, scaled_size_y, 
+         scaled_cos, scaled_sin;          /* size and direction used to scale */
+
+  /* draw the strokes of a text as a single path */
+  int text_path;
+  int in_path;
+
   cdCanvas* canvas;
 };
 
@@ -4183,64 +4225,174 @@ static cdCaracter vf_default_chars[256] = {
 /* inicializacao & controle                           */
 /******************************************************/
 
-static void vf_releasefontchars(cdVectorFont *vector_font)
+#ifdef WIN32
+static SRWLOCK vf_cache_lock = SRWLOCK_INIT;
+#define vfCacheLock()    AcquireSRWLockExclusive(&vf_cache_lock)
+#define vfCacheUnlock()  ReleaseSRWLockExclusive(&vf_cache_lock)
+#else
+static pthread_mutex_t vf_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+#define vfCacheLock()    pthread_mutex_lock(&vf_cache_lock)
+#define vfCacheUnlock()  pthread_mutex_unlock(&vf_cache_lock)
+#endif
+
+/* process-wide list of loaded fonts, 
+   only the last VF_CACHE_UNUSED fonts not used by any canvas are kept */
+#define VF_CACHE_UNUSED 16
+static vfFontData* vf_cache = NULL;
+static unsigned long vf_cache_tick = 0;
+static int vf_cache_atexit = 0;
+
+static void vf_freefontdata(vfFontData *font_data)
 {
   int c;
 
   for (c=0; c<256; c++)
   {
-    if (vector_font->chars[c].op)
-      free(vector_font->chars[c].op);
+    if (font_data->chars[c].op)
+      free(font_data->chars[c].op);
+  }
+
+  if (font_data->key)
+    free(font_data->key);
+
+  free(font_data);
+}
+
+static unsigned long vf_hashkey(const char* key)
+{
+  /* FNV-1a */
+  unsigned long hash = 2166136261UL;
+  while (*key)
+  {
+    hash ^= (unsigned char)*key++;
+    hash *= 16777619UL;
+  }
+  return hash;
+}
+
+/* Removes the least recently used fonts that are not used by any canvas. */
+static void vf_trimcache(int max_unused)
+{
+  for (;;)
+  {
+    vfFontData *font_data, **prev, **lru_prev = NULL;
+    int unused = 0;
+
+    for (prev = &vf_cache; *prev; prev = &(*prev)->next)
+    {
+      font_data = *prev;
+      if (font_data->ref_count == 0)
+      {
+        unused++;
+        if (!lru_prev || font_data->unused_tick < (*lru_prev)->unused_tick)
+          lru_prev = prev;
+      }
+    }
+
+    if (unused <= max_unused)
+      break;
+
+    font_data = *lru_prev;
+    *lru_prev = font_data->next;
+    vf_freefontdata(font_data);
   }
+}
+
+static void vf_freecache(void)
+{
+  vfFontData *font_data;
 
-  free(vector_font->chars);
+  vfCacheLock();
+  vf_trimcache(0);
+
+  /* fonts still used are released by the last canvas that uses them */
+  for (font_data = vf_cache; font_data; font_data = font_data->next)
+    font_data->cached = 0;
+  vf_cache = NULL;
+  vfCacheUnlock();
+}
+
+static void vf_releasefontdata(vfFontData *font_data)
+{
+  vfCacheLock();
+  font_data->ref_count--;
+  if (font_data->ref_count == 0)
+  {
+    /* fonts in the cache are kept to be used by the next canvases */
+    if (font_data->cached)
+    {
+      font_data->unused_tick = ++vf_cache_tick;
+      vf_trimcache(VF_CACHE_UNUSED);
+    }
+    else
+      vf_freefontdata(font_data);
+  }
+  vfCacheUnlock();
+}
+
+static void vf_releasefont(cdVectorFont *vector_font)
+{
+  if (!vector_font->font_data)
+    return;
+
+  vf_releasefontdata(vector_font->font_data);
+
+  vector_font->font_data = NULL;
+  vector_font->chars = NULL;
+}
+
+static void vf_setfont(cdVectorFont *vector_font, vfFontData *font_data)
+{
+  vf_releasefont(vector_font);
+
+  strcpy(vector_font->name, font_data->name);
+  vector_font->font_data    = font_data;
+  vector_font->chars        = font_data->chars;
+  vector_font->scaled_valid = 0;
+  vector_font->top          = font_data->top;
+  vector_font->cap          = font_data->cap;
+  vector_font->half         = font_data->half;
+  vector_font->bottom       = font_data->bottom;
 }
 
 static void vf_setdefaultfont(cdVectorFont *vector_font)
 {
-  if (vector_font->chars && vector_font->chars != vf_default_chars) 
-    vf_releasefontchars(vector_font);
+  vf_releasefont(vector_font);
 
   strcpy(vector_font->name, "Simplex II");
   vector_font->file_name[0] = 0;
   vector_font->chars        = vf_default_chars;
+  vector_font->scaled_valid = 0;
   vector_font->top          = vf_default_top;
   vector_font->cap          = vf_default_cap;
   vector_font->half         = vf_default_half;
   vector_font->bottom       = vf_default_bottom;
 }
 
-static int vf_readfontfile(FILE *file, cdVectorFont *vector_font)
+static int vf_readfontfile(FILE *file, vfFontData *font_data)
 {
   int c, right, center, operations;
 
-  if (vector_font->chars && vector_font->chars != vf_default_chars) 
-    vf_releasefontchars(vector_font);
-
-  vector_font->chars = (cdCaracter *)calloc(256, sizeof(cdCaracter));
-  if (!vector_font->chars) 
-    return 0;
-
-  if (fscanf(file,"%d%d%d%d",&vector_font->top,&vector_font->cap,&vector_font->half,&vector_font->bottom) != 4)
+  if (fscanf(file,"%d%d%d%d",&font_data->top,&font_data->cap,&font_data->half,&font_data->bottom) != 4)
   {
-    if (fscanf(file, "%[^\n]", vector_font->name) != 1)
+    if (fscanf(file, "%[^\n]", font_data->name) != 1)
       return 0;
-    if (fscanf(file,"%d%d%d%d",&vector_font->top,&vector_font->cap,&vector_font->half,&vector_font->bottom)!=4)
+    if (fscanf(file,"%d%d%d%d",&font_data->top,&font_data->cap,&font_data->half,&font_data->bottom)!=4)
       return 0;
   }
   else 
-    sprintf(vector_font->name, "Unknown");
+    sprintf(font_data->name, "Unknown");
 
   while (fscanf(file, "%d%d%d%d", &c, &right, &center, &operations) == 4)
   {
-    vector_font->chars[c].right = right;
-    vector_font->chars[c].center = center;
-    vector_font->chars[c].operations = operations;
+    font_data->chars[c].right = right;
+    font_data->chars[c].center = center;
+    font_data->chars[c].operations = operations;
     if (operations)
     {
       int i;
-      vector_font->chars[c].op = (cdOperation *)calloc(operations, sizeof(cdOperation));
-      if (!vector_font->chars[c].op) return 0;
+      font_data->chars[c].op = (cdOperation *)calloc(operations, sizeof(cdOperation));
+      if (!font_data->chars[c].op) return 0;
       for (i=0; i<operations; i++)
       {
         char operation;
@@ -4249,9 +4401,9 @@ static int vf_readfontfile(FILE *file, cdVectorFont *vector_font)
         if (fscanf(file, "\n%c%d%d", &operation, &x, &y) != 3)
           return 0;
 
-        vector_font->chars[c].op[i].operation = operation;
-        vector_font->chars[c].op[i].x = (signed char)x;
-        vector_font->chars[c].op[i].y = (signed char)y;
+        font_data->chars[c].op[i].operation = operation;
+        font_data->chars[c].op[i].x = (signed char)x;
+        font_data->chars[c].op[i].y = (signed char)y;
       }
     }
   }
@@ -4259,26 +4411,19 @@ static int vf_readfontfile(FILE *file, cdVectorFont *vector_font)
   return 1;
 }
 
-static int vf_readfontstring(const char* strdata, cdVectorFont *vector_font)
+static int vf_readfontstring(const char* strdata, vfFontData *font_data)
 {
   int c, right, center, operations;
 
-  if (vector_font->chars && vector_font->chars != vf_default_chars) 
-    vf_releasefontchars(vector_font);
-
-  vector_font->chars = (cdCaracter *)calloc(256, sizeof(cdCaracter));
-  if (!vector_font->chars) 
-    return 0;
-
   /* try to read without a name */
-  if (sscanf(strdata,"%d%d%d%d",&vector_font->top,&vector_font->cap,&vector_font->half,&vector_font->bottom) != 4)
+  if (sscanf(strdata,"%d%d%d%d",&font_data->top,&font_data->cap,&font_data->half,&font_data->bottom) != 4)
   {
-    if (sscanf(strdata, "%[^\n]", vector_font->name) != 1)
+    if (sscanf(strdata, "%[^\n]", font_data->name) != 1)
       return 0;
     strdata = strstr(strdata, "\n")+1; /* goto next line */
     if (strdata == (void*)1) return 0;
 
-    if (sscanf(strdata,"%d%d%d%d",&vector_font->top,&vector_font->cap,&vector_font->half,&vector_font->bottom)!=4)
+    if (sscanf(strdata,"%d%d%d%d",&font_data->top,&font_data->cap,&font_data->half,&font_data->bottom)!=4)
       return 0;
     strdata = strstr(strdata, "\n");   /* goto next line */
     if (strdata == (void*)1) return 0;
@@ -4286,7 +4431,7 @@ static int vf_readfontstring(const char* strdata, cdVectorFont *vector_font)
   else 
   {
     strdata = strstr(strdata, "\n")+1; /* goto next line */
-    sprintf(vector_font->name, "Unknown");
+    sprintf(font_data->name, "Unknown");
   }
 
   /* skip 2 blank lines */
@@ -4299,14 +4444,14 @@ static int vf_readfontstring(const char* strdata, cdVectorFont *vector_font)
     strdata = strstr(strdata, "\n")+1; /* goto next line */
     if (strdata == (void*)1) return 0;
 
-    vector_font->chars[c].right = right;
-    vector_font->chars[c].center = center;
-    vector_font->chars[c].operations = operations;
+    font_data->chars[c].right = right;
+    font_data->chars[c].center = center;
+    font_data->chars[c].operations = operations;
     if (operations)
     {
       int i;
-      vector_font->chars[c].op = (cdOperation *)calloc(operations, sizeof(cdOperation));
-      if (!vector_font->chars[c].op) return 0;
+      font_data->chars[c].op = (cdOperation *)calloc(operations, sizeof(cdOperation));
+      if (!font_data->chars[c].op) return 0;
       for (i=0; i<operations; i++)
       {
         char operation;
@@ -4317,9 +4462,9 @@ static int vf_readfontstring(const char* strdata, cdVectorFont *vector_font)
         strdata = strstr(strdata, "\n")+1; /* goto next line */
         if (strdata == (void*)1) return 0;
 
-        vector_font->chars[c].op[i].operation = operation;
-        vector_font->chars[c].op[i].x = (signed char)x;
-        vector_font->chars[c].op[i].y = (signed char)y;
+        font_data->chars[c].op[i].operation = operation;
+        font_data->chars[c].op[i].x = (signed char)x;
+        font_data->chars[c].op[i].y = (signed char)y;
       }
     }
 
@@ -4331,6 +4476,314 @@ static int vf_readfontstring(const char* strdata, cdVectorFont *vector_font)
   return 1;
 }
 
+/* Compiled font format, all numbers are little endian:
+   "CDVF" 1                         magic and version (5 bytes)
+   name_len name                    2 bytes + name_len bytes
+   top cap half bottom              2 bytes each
+   num_chars                        2 bytes
+   for each character:
+     c right center operations      1 + 2 + 2 + 2 bytes
+     operation x y                  1 + 1 + 1 bytes, for each operation  */
+
+#define VF_MAGIC "CDVF"
+#define VF_VERSION 1
+
+static void vf_writeshort(FILE* file, int v)
+{
+  fputc(v & 0xFF, file);
+  fputc((v >> 8) & 0xFF, file);
+}
+
+static int vf_readshort(const unsigned char** data, const unsigned char* end, int *v)
+{
+  const unsigned char* d = *data;
+  if (end - d < 2)
+    return 0;
+  *v = (short)(d[0] | (d[1] << 8));
+  *data = d + 2;
+  return 1;
+}
+
+static int vf_writefontbinary(FILE *file, const char* name, int top, int cap, int half, int bottom, const cdCaracter* chars)
+{
+  int c, i, num_chars = 0, name_len = (int)strlen(name);
+
+  for (c=0; c<256; c++)
+  {
+    if (chars[c].right || chars[c].operations)
+      num_chars++;
+  }
+
+  fwrite(VF_MAGIC, 1, 4, file);
+  fputc(VF_VERSION, file);
+  vf_writeshort(file, name_len);
+  fwrite(name, 1, name_len, file);
+  vf_writeshort(file, top);
+  vf_writeshort(file, cap);
+  vf_writeshort(file, half);
+  vf_writeshort(file, bottom);
+  vf_writeshort(file, num_chars);
+
+  for (c=0; c<256; c++)
+  {
+    if (chars[c].right || chars[c].operations)
+    {
+      fputc(c, file);
+      vf_writeshort(file, chars[c].right);
+      vf_writeshort(file, chars[c].center);
+      vf_writeshort(file, chars[c].operations);
+      for (i=0; i<chars[c].operations; i++)
+      {
+        fputc(chars[c].op[i].operation, file);
+        fputc((unsigned char)chars[c].op[i].x, file);
+        fputc((unsigned char)chars[c].op[i].y, file);
+      }
+    }
+  }
+
+  return ferror(file)? 0: 1;
+}
+
+static int vf_readfontbinary(const unsigned char* data, long size, vfFontData *font_data)
+{
+  const unsigned char* end = data + size;
+  int n, num_chars;
+
+  if (size < 5 || memcmp(data, VF_MAGIC, 4) != 0 || data[4] != VF_VERSION)
+    return 0;
+  data += 5;
+
+  if (!vf_readshort(&data, end, &n) || n < 0 || n > 255 || end - data < n)
+    return 0;
+  memcpy(font_data->name, data, n);
+  font_data->name[n] = 0;
+  data += n;
+
+  if (!vf_readshort(&data, end, &font_data->top) ||
+      !vf_readshort(&data, end, &font_data->cap) ||
+      !vf_readshort(&data, end, &font_data->half) ||
+      !vf_readshort(&data, end, &font_data->bottom) ||
+      !vf_readshort(&data, end, &num_chars))
+    return 0;
+
+  while (num_chars > 0)
+  {
+    cdCaracter* ch;
+    int i;
+
+    if (data == end)
+      return 0;
+
+    ch = font_data->chars + *data;
+    data++;
+
+    if (!vf_readshort(&data, end, &ch->right) ||
+        !vf_readshort(&data, end, &ch->center) ||
+        !vf_readshort(&data, end, &ch->operations) ||
+        ch->operations < 0 || end - data < ch->operations * 3 || ch->op)
+      return 0;
+
+    if (ch->operations)
+    {
+      ch->op = (cdOperation *)malloc(ch->operations * sizeof(cdOperation));
+      if (!ch->op) return 0;
+      for (i=0; i<ch->operations; i++)
+      {
+        ch->op[i].operation = (char)data[0];
+        ch->op[i].x = (signed char)data[1];
+        ch->op[i].y = (signed char)data[2];
+        data += 3;
+      }
+    }
+
+    num_chars--;
+  }
+
+  return 1;
+}
+
+static int vf_readfont(FILE *file, long size, vfFontData *font_data)
+{
+  unsigned char magic[5];
+  int n;
+
+  /* the compiled format is read in a single block */
+  if (fread(magic, 1, 5, file) == 5 && memcmp(magic, VF_MAGIC, 4) == 0)
+  {
+    int read_ok;
+    unsigned char* data = (unsigned char*)malloc(size);
+    if (!data)
+      return 0;
+
+    rewind(file);
+    read_ok = (fread(data, 1, size, file) == (size_t)size) && vf_readfontbinary(data, size, font_data);
+
+    free(data);
+    return read_ok;
+  }
+
+  rewind(file);
+  if (!vf_readfontfile(file, font_data))
+    return 0;
+
+  /* file opened in binary mode */
+  n = (int)strlen(font_data->name);
+  if (n > 0 && font_data->name[n-1] == '\r')
+    font_data->name[n-1] = 0;
+
+  return 1;
+}
+
+static int vf_findfile(const char* file, char* filename, struct stat* st)
+{
+  char *env;
+
+  if (strlen(file) >= 10240)
+    return 0;
+
+  /* current directory */
+  if (stat(file, st) == 0 && !(st->st_mode & S_IFDIR))
+  {
+    strcpy(filename, file);
+    return 1;
+  }
+
+  /* CD directory */
+  env = getenv("CDDIR");
+  if (env && strlen(env) + strlen(file) < 10239)
+  {
+    sprintf(filename, "%s/%s", env, file);
+    if (stat(filename, st) == 0 && !(st->st_mode & S_IFDIR))
+      return 1;
+  }
+
+  return 0;
+}
+
+static vfFontData* vf_findcache(const char* key, int is_file, const struct stat* st)
+{
+  vfFontData *font_data;
+  unsigned long key_hash = vf_hashkey(key);
+
+  for (font_data = vf_cache; font_data; font_data = font_data->next)
+  {
+    if (font_data->key_hash == key_hash && font_data->is_file == is_file && strcmp(font_data->key, key) == 0)
+    {
+      if (!is_file || (font_data->file_time == st->st_mtime && font_data->file_size == (long)st->st_size))
+        return font_data;
+    }
+  }
+
+  return NULL;
+}
+
+static void vf_addcache(vfFontData *new_font_data)
+{
+  vfFontData *font_data, **prev = &vf_cache;
+
+  /* an older version of the same file is removed from the cache,
+     it is released by the last canvas that uses it */
+  font_data = vf_cache;
+  while (font_data)
+  {
+    vfFontData *next = font_data->next;
+
+    if (font_data->key_hash == new_font_data->key_hash && font_data->is_file == new_font_data->is_file && strcmp(font_data->key, new_font_data->key) == 0)
+    {
+      *prev = next;
+      font_data->cached = 0;
+      if (font_data->ref_count == 0)
+        vf_freefontdata(font_data);
+    }
+    else
+      prev = &font_data->next;
+
+    font_data = next;
+  }
+
+  new_font_data->cached = 1;
+  new_font_data->next = vf_cache;
+  vf_cache = new_font_data;
+
+  /* the cache is released when the program ends */
+  if (!vf_cache_atexit)
+  {
+    atexit(vf_freecache);
+    vf_cache_atexit = 1;
+  }
+}
+
+/* Returns the font from the cache, or loads it from a file or from a string.
+   The returned font must be released with vf_releasefont. */
+static vfFontData* vf_loadfont(const char* file, int *is_file)
+{
+  char filename[10240];
+  struct stat st;
+  vfFontData *font_data, *cache_data;
+  const char* key;
+  int read_ok;
+
+  *is_file = vf_findfile(file, filename, &st);
+  key = *is_file? filename: file;
+
+  vfCacheLock();
+  font_data = vf_findcache(key, *is_file, &st);
+  if (font_data)
+    font_data->ref_count++;
+  vfCacheUnlock();
+
+  if (font_data)
+    return font_data;
+
+  /* load outside the lock, so several fonts can be loaded in parallel */
+  font_data = (vfFontData*)calloc(1, sizeof(vfFontData));
+  if (!font_data)
+    return NULL;
+
+  if (*is_file)
+  {
+    FILE *font = fopen(filename, "rb");
+    if (!font)
+    {
+      free(font_data);
+      return NULL;
+    }
+
+    read_ok = vf_readfont(font, (long)st.st_size, font_data);
+    fclose(font);
+
+    font_data->file_time = st.st_mtime;
+    font_data->file_size = (long)st.st_size;
+  }
+  else
+    read_ok = vf_readfontstring(file, font_data);
+
+  font_data->key = cdStrDup(key);
+  font_data->key_hash = vf_hashkey(key);
+  font_data->is_file = *is_file;
+
+  if (!read_ok || !font_data->key)
+  {
+    vf_freefontdata(font_data);
+    return NULL;
+  }
+
+  vfCacheLock();
+  /* another canvas may have loaded the same font meanwhile */
+  cache_data = vf_findcache(key, *is_file, &st);
+  if (cache_data)
+  {
+    vf_freefontdata(font_data);
+    font_data = cache_data;
+  }
+  else
+    vf_addcache(font_data);
+  font_data->ref_count++;
+  vfCacheUnlock();
+
+  return font_data;
+}
+
 static int vf_textwidth(cdVectorFont *vector_font, const char* str)
 {
   int width = 0;
@@ -4358,24 +4811,133 @@ static void vf_fmove_dir(cdVectorFont *vector_font, double *x, double *y, double
   *y += vector_font->current_sin*dx + vector_font->current_cos*dy;
 }
 
+static void vf_new_scaled_stamp(cdVectorFont *vector_font)
+{
+  vector_font->scaled_stamp++;
+  if (vector_font->scaled_stamp == 0)  /* wrapped, 0 means never scaled */
+  {
+    memset(vector_font->scaled_char_stamp, 0, sizeof(vector_font->scaled_char_stamp));
+    vector_font->scaled_stamp = 1;
+  }
+}
+
+static int vf_update_scaled(cdVectorFont *vector_font)
+{
+  /* only invalidates the scaled characters, they are scaled when drawn */
+  if (!vector_font->scaled_valid)
+  {
+    int c, count = 0;
+
+    for (c = 0; c < 256; c++)
+    {
+      vector_font->scaled_first[c] = count;
+      count += vector_font->chars[c].operations;
+    }
+
+    if (count > vector_font->scaled_count)
+    {
+      cdfPoint* new_scaled = (cdfPoint*)realloc(vector_font->scaled_op, count * sizeof(cdfPoint));
+      if (!new_scaled)
+        return 0;
+
+      vector_font->scaled_op = new_scaled;
+      vector_font->scaled_count = count;
+    }
+
+    vector_font->scaled_valid = 1;
+    vf_new_scaled_stamp(vector_font);
+  }
+  else if (vector_font->scaled_size_x != vector_font->size_x ||
+           vector_font->scaled_size_y != vector_font->size_y ||
+           vector_font->scaled_cos != vector_font->current_cos ||
+           vector_font->scaled_sin != vector_font->current_sin)
+    vf_new_scaled_stamp(vector_font);
+
+  vector_font->scaled_size_x = vector_font->size_x;
+  vector_font->scaled_size_y = vector_font->size_y;
+  vector_font->scaled_cos = vector_font->current_cos;
+  vector_font->scaled_sin = vector_font->current_sin;
+  return 1;
+}
+
+static cdfPoint* vf_scaled_char(cdVectorFont *vector_font, unsigned char ac)
+{
+  cdfPoint *scaled = vector_font->scaled_op + vector_font->scaled_first[ac];
+
+  if (vector_font->scaled_char_stamp[ac] != vector_font->scaled_stamp)
+  {
+    cdOperation *current = vector_font->chars[ac].op;
+    int m, op = vector_font->chars[ac].operations;
+
+    for (m = 0; m < op; m++)
+    {
+      /* same as vf_move_dir */
+      double dx = current[m].x*vector_font->size_x;
+      double dy = current[m].y*vector_font->size_y;
+      scaled[m].x = vector_font->current_cos*dx - vector_font->current_sin*dy;
+      scaled[m].y = vector_font->current_sin*dx + vector_font->current_cos*dy;
+    }
+
+    vector_font->scaled_char_stamp[ac] = vector_font->scaled_stamp;
+  }
+
+  return scaled;
+}
+
+static int vf_begin_path(cdVectorFont *vector_font)
+{
+  if (!vf_update_scaled(vector_font))
+    return 0;
+
+  /* the simulated path does not break the polyline at MOVETO */
+  if (vector_font->text_path && (vector_font->canvas->context->caps & CD_CAP_PATH))
+  {
+    cdCanvasBegin(vector_font->canvas, CD_PATH);
+    vector_font->in_path = 1;
+  }
+
+  return 1;
+}
+
+static void vf_end_path(cdVectorFont *vector_font)
+{
+  if (vector_font->in_path)
+  {
+    cdCanvasPathSet(vector_font->canvas, CD_PATH_STROKE);
+    cdCanvasEnd(vector_font->canvas);
+    vector_font->in_path = 0;
+  }
+}
+
+static void vf_begin_stroke(cdVectorFont *vector_font, int m, char operation)
+{
+  if (vector_font->in_path)
+  {
+    if (operation == 'm')
+      cdCanvasPathSet(vector_font->canvas, CD_PATH_MOVETO);
+    else
+      cdCanvasPathSet(vector_font->canvas, CD_PATH_LINETO);
+  }
+  else if (operation == 'm')
+  {
+    if (m) cdCanvasEnd(vector_font->canvas);
+    cdCanvasBegin(vector_font->canvas, CD_OPEN_LINES);
+  }
+}
+
 static void vf_draw_char(cdVectorFont *vector_font, char c, int *x, int *y)
 {
   unsigned char ac = vf_ansi2ascii[(unsigned char)c];
   cdOperation *current = vector_font->chars[ac].op;
   int m, op = vector_font->chars[ac].operations;
+  cdfPoint *scaled = vf_scaled_char(vector_font, ac);
 
   for(m = 0; m < op; m++)
   {
-    int px = *x;
-    int py = *y;
+    int px = *x + cdRound(scaled->x);
+    int py = *y + cdRound(scaled->y);
 
-    if (current->operation == 'm')
-    {
-      if (m) cdCanvasEnd(vector_font->canvas);
-      cdCanvasBegin(vector_font->canvas, CD_OPEN_LINES);
-    }
-
-    vf_move_dir(vector_font, &px, &py, current->x*vector_font->size_x, current->y*vector_font->size_y);
+    vf_begin_stroke(vector_font, m, current->operation);
 
     if (vector_font->text_transf)
     {
@@ -4386,9 +4948,10 @@ static void vf_draw_char(cdVectorFont *vector_font, char c, int *x, int *y)
 
     cdCanvasVertex(vector_font->canvas, px, py);
     current++; 
+    scaled++;
   }
 
-  if (m) cdCanvasEnd(vector_font->canvas);
+  if (m && !vector_font->in_path) cdCanvasEnd(vector_font->canvas);
 }
 
 static void vf_wdraw_char(cdVectorFont *vector_font, char c, double *x, double *y)
@@ -4396,19 +4959,14 @@ static void vf_wdraw_char(cdVectorFont *vector_font, char c, double *x, double *
   unsigned char ac = vf_ansi2ascii[(unsigned char)c];
   cdOperation *current = vector_font->chars[ac].op;
   int m, op = vector_font->chars[ac].operations;
+  cdfPoint *scaled = vf_scaled_char(vector_font, ac);
 
   for(m = 0; m < op; m++)
   {
-    double px = *x;
-    double py = *y;
+    double px = *x + scaled->x;
+    double py = *y + scaled->y;
 
-    if (current->operation == 'm')
-    {
-      if (m) cdCanvasEnd(vector_font->canvas);
-      cdCanvasBegin(vector_font->canvas, CD_OPEN_LINES);
-    }
-
-    vf_wmove_dir(vector_font, &px, &py, current->x*vector_font->size_x, current->y*vector_font->size_y);
+    vf_begin_stroke(vector_font, m, current->operation);
 
     if (vector_font->text_transf)
     {
@@ -4419,9 +4977,10 @@ static void vf_wdraw_char(cdVectorFont *vector_font, char c, double *x, double *
 
     wdCanvasVertex(vector_font->canvas, px, py);
     current++;
+    scaled++;
   }
 
-  if (m) cdCanvasEnd(vector_font->canvas);
+  if (m && !vector_font->in_path) cdCanvasEnd(vector_font->canvas);
 }
 
 static void vf_fdraw_char(cdVectorFont *vector_font, char c, double *x, double *y)
@@ -4429,19 +4988,14 @@ static void vf_fdraw_char(cdVectorFont *vector_font, char c, double *x, double *
   unsigned char ac = vf_ansi2ascii[(unsigned char)c];
   cdOperation *current = vector_font->chars[ac].op;
   int m, op = vector_font->chars[ac].operations;
+  cdfPoint *scaled = vf_scaled_char(vector_font, ac);
 
   for(m = 0; m < op; m++)
   {
-    double px = *x;
-    double py = *y;
-
-    if (current->operation == 'm')
-    {
-      if (m) cdCanvasEnd(vector_font->canvas);
-      cdCanvasBegin(vector_font->canvas, CD_OPEN_LINES);
-    }
+    double px = *x + scaled->x;
+    double py = *y + scaled->y;
 
-    vf_fmove_dir(vector_font, &px, &py, current->x*vector_font->size_x, current->y*vector_font->size_y);
+    vf_begin_stroke(vector_font, m, current->operation);
 
     if (vector_font->text_transf)
     {
@@ -4452,9 +5006,10 @@ static void vf_fdraw_char(cdVectorFont *vector_font, char c, double *x, double *
 
     wdCanvasVertex(vector_font->canvas, px, py);
     current++;
+    scaled++;
   }
 
-  if (m) cdCanvasEnd(vector_font->canvas);
+  if (m && !vector_font->in_path) cdCanvasEnd(vector_font->canvas);
 }
 
 static void vf_move_to_base(cdVectorFont *vector_font, int *x, int *y, const  char* str, int width)
@@ -4763,8 +5318,10 @@ void cdKillVectorFont(cdVectorFont* vector_font)
   assert(vector_font);
   if (!vector_font) return;
 
-  if (vector_font->chars && vector_font->chars != vf_default_chars) 
-    vf_releasefontchars(vector_font);     /* not the default font */
+  vf_releasefont(vector_font);
+
+  if (vector_font->scaled_op)
+    free(vector_font->scaled_op);
 
   free(vector_font);
 }
@@ -4785,45 +5342,27 @@ char *cdCanvasVectorFont(cdCanvas* canvas, const char *file)
   }
   else
   {
-    FILE *font = NULL;
-    int read_ok;
-    char *env;
+    vfFontData *font_data;
+    int is_file;
 
     /* se arquivo foi o mesmo que o arq. corrente, entao retorna */
     if (strcmp (file, vector_font->file_name) == 0)
         return vector_font->name;
 
-    /* abre arq. no dir. corrente */
-    font = fopen(file, "r");
-
-    /* se nao conseguiu, abre arq. no dir. do cd, */
-    env = getenv("CDDIR");
-    if (!font && env && strlen(file)<10240)
+    /* fonts are shared by all the canvases */
+    font_data = vf_loadfont(file, &is_file);
+    if (!font_data)
     {
-      char filename[10240];
-      sprintf(filename, "%str/%str", env, file);
-      font = fopen(filename, "r");
-    }
-
-    if (font)
-      read_ok = vf_readfontfile(font, vector_font);
-    else
-      read_ok = vf_readfontstring(file, vector_font);
-
-    if (!read_ok)
-    {
-      if (font) fclose(font);
       vf_setdefaultfont(vector_font);
       vector_font->file_name[0] = 0;
       return NULL;
     }
 
+    vf_setfont(vector_font, font_data);
+
     /* guarda nome do arquivo que esta' carregado */
-    if (font)
-    {
+    if (is_file)
       strcpy(vector_font->file_name, file);
-      fclose(font);
-    }
     else
       strcpy(vector_font->file_name, vector_font->name);
   }
@@ -4831,6 +5370,45 @@ char *cdCanvasVectorFont(cdCanvas* canvas, const char *file)
   return vector_font->name;
 }
 
+int cdCompileVectorFont(const char* font, const char* filename)
+{
+  FILE *file;
+  int write_ok, is_file;
+
+  assert(filename);
+  if (!filename)
+    return CD_ERROR;
+
+  file = fopen(filename, "wb");
+  if (!file)
+    return CD_ERROR;
+
+  if (!font || font[0] == 0)
+    write_ok = vf_writefontbinary(file, "Simplex II", vf_default_top, vf_default_cap, vf_default_half, vf_default_bottom, vf_default_chars);
+  else
+  {
+    vfFontData *font_data = vf_loadfont(font, &is_file);
+    if (font_data)
+    {
+      write_ok = vf_writefontbinary(file, font_data->name, font_data->top, font_data->cap, font_data->half, font_data->bottom, font_data->chars);
+      vf_releasefontdata(font_data);
+    }
+    else
+      write_ok = 0;
+  }
+
+  if (fclose(file) != 0)
+    write_ok = 0;
+
+  if (!write_ok)
+  {
+    remove(filename);
+    return CD_ERROR;
+  }
+
+  return CD_OK;
+}
+
 double* cdCanvasVectorTextTransform(cdCanvas* canvas, const double* matrix)
 {
   cdVectorFont* vector_font;
@@ -4866,6 +5444,23 @@ double* cdCanvasVectorTextTransform(cdCanvas* canvas, const double* matrix)
   return old_matrix;
 }
 
+int cdCanvasVectorTextPath(cdCanvas* canvas, int path)
+{
+  cdVectorFont* vector_font;
+  int old_path;
+
+  assert(canvas);
+  if (!_cdCheckCanvas(canvas)) return CD_ERROR;
+
+  vector_font = canvas->vector_font;
+  old_path = vector_font->text_path;
+
+  if (path != CD_QUERY)
+    vector_font->text_path = path;
+
+  return old_path;
+}
+
 /******************************************************/
 /* vector text em Raster                              */
 /******************************************************/
@@ -5064,6 +5659,9 @@ void cdCanvasVectorText(cdCanvas* canvas, int x, int y, const char* str)
 
   vector_font = canvas->vector_font;
 
+  if (!vf_begin_path(vector_font))
+    return;
+
   num_lin = cdStrLineCount(str);
   if (num_lin == 1)
     vf_draw_text(vector_font, x, y, str);
@@ -5091,6 +5689,8 @@ void cdCanvasVectorText(cdCanvas* canvas, int x, int y, const char* str)
       vf_move_dir(vector_font, &x, &y, 0, -line_height);
     }
   }
+
+  vf_end_path(vector_font);
 }
 
 void cdCanvasMultiLineVectorText(cdCanvas* canvas, int x, int y, const char* str)
@@ -5268,6 +5868,9 @@ void wdCanvasVectorText(cdCanvas* canvas, double x, double y, const char* str)
 
   vector_font = canvas->vector_font;
 
+  if (!vf_begin_path(vector_font))
+    return;
+
   num_lin = cdStrLineCount(str);
   if (num_lin == 1)
     vf_wdraw_text(vector_font, x, y, str);
@@ -5295,6 +5898,8 @@ void wdCanvasVectorText(cdCanvas* canvas, double x, double y, const char* str)
       vf_wmove_dir(vector_font, &x, &y, 0, -line_height);
     }
   }
+
+  vf_end_path(vector_font);
 }
 
 void wdCanvasMultiLineVectorText(cdCanvas* canvas, double x, double y, const char* str)
@@ -5472,6 +6077,9 @@ void cdfCanvasVectorText(cdCanvas* canvas, double x, double y, const char* str)
 
   vector_font = canvas->vector_font;
 
+  if (!vf_begin_path(vector_font))
+    return;
+
   num_lin = cdStrLineCount(str);
   if (num_lin == 1)
     vf_fdraw_text(vector_font, x, y, str);
@@ -5499,6 +6107,8 @@ void cdfCanvasVectorText(cdCanvas* canvas, double x, double y, const char* str)
       vf_fmove_dir(vector_font, &x, &y, 0, -line_height);
     }
   }
+
+  vf_end_path(vector_font);
 }
 
 void cdfCanvasMultiLineVectorText(cdCanvas* canvas, double x, double y, const char* str)
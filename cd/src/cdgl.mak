@@ -6,18 +6,11 @@ SRC = drv/cdgl.c
 
 INCLUDES = . sim
 
-USE_FTGL = Yes
 USE_FREETYPE = Yes
 USE_OPENGL = Yes
 USE_CD = YES
 CD = ..
 
-ifneq ($(findstring Win, $(TEC_SYSNAME)), )
-  ifeq ($(findstring dll, $(TEC_UNAME)), )
-    DEFINES += FTGL_LIBRARY_STATIC
-  endif
-endif
-
 ifneq ($(findstring MacOS, $(TEC_UNAME)), )
   STDINCS = $(X11_INC)
   ifneq ($(TEC_SYSMINOR), 4)
@@ -28,7 +28,7 @@ else
 endif
 endif
 
-SRCSVG = base64.c lodepng.c cdsvg.c
+SRCSVG = base64.c lodepng.c pngqueue.c cdsvg.c
 SRCSVG := $(addprefix svg/, $(SRCSVG))
 
 SRCMINIZIP = ioapi.c minizip.c zip.c miniunzip.c unzip.c 
@@ -121,7 +121,7 @@ ifdef USE_GDK
   endif
 else
   ifdef USE_X11
-    DEFINES += USE_ICONV
+    DEFINES += USE_ICONV USE_XSHM
     LIBS += iconv
     SRC += $(SRCX11) $(SRCNULL)
     ifneq ($(findstring Linux26g4, $(TEC_UNAME)), )
@@ -151,6 +151,11 @@ else
   endif
 endif
 
+ifeq ($(findstring Win, $(TEC_SYSNAME)), )
+  # PNG encoding threads
+  LIBS += pthread
+endif
+
 ifneq ($(findstring dll, $(TEC_UNAME)), )
   SRC += cd.rc
 endif
@@ -122,7 +122,7 @@ static void cdkillcanvas(cdCtxCanvas *ctxcanvas)
 
 static void cddeactivate(cdCtxCanvas *ctxcanvas)
 {
-  fflush(ctxcanvas->cgm->file);
+  cgm_flush(ctxcanvas->cgm);
 }
 
 /*
@@ -131,7 +131,7 @@ static void cddeactivate(cdCtxCanvas *ctxcanvas)
 static void cdflush(cdCtxCanvas *ctxcanvas)
 {
   char str[20];
-  fflush(ctxcanvas->cgm->file);
+  cgm_flush(ctxcanvas->cgm);
   
   cgm_end_picture        ( ctxcanvas->cgm );
 
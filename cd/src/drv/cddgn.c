@@ -26,6 +26,9 @@
 #define END_OF_DGN_FILE 0xffff
 #define DGN_FILE_BLOCK  512
 
+#define DGN_BUFFER_SIZE 65536
+#define DGN_COLOR_CACHE 4096      /* must be a power of 2 */
+
 #define NOFILL 0    /* tipos de fill que o driver faz */
 #define CONVEX 1
 #define NORMAL 2 
@@ -145,11 +148,24 @@ struct _cdCtxCanvas
   long colortable[256];              /* palette */
   short num_colors;
 
+  struct                             /* cache de getclosestColor */
+  {
+    long color;
+    short index;                     /* -1 se vazio */
+  } color_cache[DGN_COLOR_CACHE];
+
+  cdInverseMap* imap;                /* busca da cor mais proxima quando a palette esta cheia */
+  short imap_valid;
+
   short is_complex;
+  int complex_pos;                   /* posicao no buffer do tamanho do elemento complexo, ou -1 */
+
+  unsigned char* buffer;             /* elementos sao escritos em memoria antes do arquivo */
+  int buffer_n, buffer_size;
 };
 
 /* prototipos de funcao */
-static void startComplexShape(cdCtxCanvas*, unsigned short,short,unsigned short,
+static void startComplexShape(cdCtxCanvas*, unsigned short,short,
                             unsigned long,unsigned long,
                             unsigned long,unsigned long);
 static void endComplexElement(cdCtxCanvas*);
@@ -270,13 +286,52 @@ static long gettextwidth(cdCtxCanvas* ctxcanvas, const char *s, int len, int siz
   return width;
 }
 
+/***********************************
+ * Escreve o buffer no arquivo     *
+ ***********************************/
+
+static void write_flush(cdCtxCanvas* ctxcanvas)
+{
+  if (ctxcanvas->buffer_n)
+  {
+    fwrite(ctxcanvas->buffer, 1, ctxcanvas->buffer_n, ctxcanvas->file);
+    ctxcanvas->buffer_n = 0;
+  }
+}
+
+/**********************************************
+ * Garante espaco para n bytes no buffer.     *
+ * Elementos complexos ficam inteiros no      *
+ * buffer ate o seu final, para que o seu     *
+ * tamanho seja calculado.                    *
+ **********************************************/
+
+static unsigned char* write_reserve(cdCtxCanvas* ctxcanvas, int n)
+{
+  if (ctxcanvas->buffer_n + n > ctxcanvas->buffer_size)
+  {
+    if (ctxcanvas->complex_pos == -1)
+      write_flush(ctxcanvas);
+
+    if (ctxcanvas->buffer_n + n > ctxcanvas->buffer_size)
+    {
+      while (ctxcanvas->buffer_n + n > ctxcanvas->buffer_size)
+        ctxcanvas->buffer_size *= 2;
+      ctxcanvas->buffer = (unsigned char*)realloc(ctxcanvas->buffer, ctxcanvas->buffer_size);
+    }
+  }
+
+  return ctxcanvas->buffer + ctxcanvas->buffer_n;
+}
+
 /****************************
  * Salva um byte no arquivo *
  ****************************/
 
 static void put_byte(cdCtxCanvas* ctxcanvas, unsigned char byte)
 {
-  fputc(byte, ctxcanvas->file);
+  *write_reserve(ctxcanvas, 1) = byte;
+  ctxcanvas->buffer_n++;
 }
 
 /************************************
@@ -285,11 +340,9 @@ static void put_byte(cdCtxCanvas* ctxcanvas, unsigned char byte)
 
 static void writec (cdCtxCanvas* ctxcanvas, const char *t, short tam )
 {
- short i;
-
- ctxcanvas->bytes += tam;
- for ( i = 0; i < tam; i++ )
-     fputc ( t[i], ctxcanvas->file );
+  memcpy(write_reserve(ctxcanvas, tam), t, tam);
+  ctxcanvas->buffer_n += tam;
+  ctxcanvas->bytes += tam;
 }
 
 /******************
@@ -298,13 +351,11 @@ static void writec (cdCtxCanvas* ctxcanvas, const char *t, short tam )
 
 static void put_word(cdCtxCanvas* ctxcanvas, unsigned short w)
 {
-  char c;
-
-  c = (char) (w & 0xff);
-  fputc (c, ctxcanvas->file);
+  unsigned char* b = write_reserve(ctxcanvas, 2);
 
-  c = (char) ((w >> 8) & 0xff);
-  fputc (c, ctxcanvas->file);
+  b[0] = (unsigned char) (w & 0xff);
+  b[1] = (unsigned char) ((w >> 8) & 0xff);
+  ctxcanvas->buffer_n += 2;
 
   ctxcanvas->bytes += 2;
 }
@@ -525,7 +576,16 @@ static void ellipse(cdCtxCanvas* ctxcanvas, long xc, long yc, long w, long h, sh
   }
 }
 
-static short getclosestColor(cdCtxCanvas* ctxcanvas, long color)
+static void resetColorCache(cdCtxCanvas* ctxcanvas)
+{
+  int i;
+  for (i = 0; i < DGN_COLOR_CACHE; i++)
+    ctxcanvas->color_cache[i].index = -1;
+
+  ctxcanvas->imap_valid = 0;
+}
+
+static short searchClosestColor(cdCtxCanvas* ctxcanvas, long color, int *exact)
 {
   short count=0, closest=0;
   long diff=0;
@@ -551,7 +611,10 @@ static short getclosestColor(cdCtxCanvas* ctxcanvas, long color)
     {
       /* verifica se encontrou a cor */
       if(newdiff == 0)
+      {
+        *exact = 1;
         return count-1;
+      }
 
       diff = newdiff;
       closest=count-1;
@@ -562,12 +625,50 @@ static short getclosestColor(cdCtxCanvas* ctxcanvas, long color)
   if(ctxcanvas->num_colors < 254)
   {
     ctxcanvas->colortable[ctxcanvas->num_colors+1] = color;
-      return ctxcanvas->num_colors++;
+    ctxcanvas->imap_valid = 0;
+    *exact = 1;
+    return ctxcanvas->num_colors++;
   }
   else
     return closest;
 }
 
+static short getclosestColor(cdCtxCanvas* ctxcanvas, long color)
+{
+  unsigned long h = (unsigned long)color & 0xFFFFFF;
+  int exact = 0;
+  short index;
+
+  h = ((h * 2654435761UL) >> 12) & (DGN_COLOR_CACHE - 1);
+
+  if (ctxcanvas->color_cache[h].index != -1 && ctxcanvas->color_cache[h].color == color)
+    return ctxcanvas->color_cache[h].index;
+
+  if (ctxcanvas->num_colors >= 254)
+  {
+    /* palette cheia, nenhuma cor sera adicionada */
+    if (!ctxcanvas->imap_valid)
+    {
+      cdInverseMapSetPalette(ctxcanvas->imap, ctxcanvas->num_colors, ctxcanvas->colortable);
+      ctxcanvas->imap_valid = 1;
+    }
+
+    index = (short)(cdInverseMapFind(ctxcanvas->imap, color) - 1);
+  }
+  else
+    index = searchClosestColor(ctxcanvas, color, &exact);
+
+  /* cores encontradas (ou adicionadas) nao mudam de indice, 
+     e a mais proxima nao muda mais quando a palette esta cheia */
+  if (exact || ctxcanvas->num_colors >= 254)
+  {
+    ctxcanvas->color_cache[h].color = color;
+    ctxcanvas->color_cache[h].index = index;
+  }
+
+  return index;
+}
+
 static void saveColorTable(cdCtxCanvas* ctxcanvas)
 {
   unsigned char r,g,b;
@@ -682,19 +783,25 @@ static void cdkillcanvas(cdCtxCanvas* ctxcanvas)
 {
   saveColorTable(ctxcanvas);
   complete_file(ctxcanvas);
+  write_flush(ctxcanvas);
   fclose (ctxcanvas->file);
 
+  free(ctxcanvas->buffer);
+  cdInverseMapKill(ctxcanvas->imap);
+
   memset(ctxcanvas, 0, sizeof(cdCtxCanvas));
   free(ctxcanvas);
 }
 
 static void cddeactivate (cdCtxCanvas* ctxcanvas)
 {
+  write_flush(ctxcanvas);
   fflush(ctxcanvas->file);
 }
 
 static void cdflush (cdCtxCanvas* ctxcanvas)
 {
+  write_flush(ctxcanvas);
   fflush(ctxcanvas->file);
 }
 
@@ -807,7 +914,7 @@ static void cdsector (cdCtxCanvas* ctxcanvas, int xc, int yc, int w, int h, doub
     return;
   }
 
-  startComplexShape(ctxcanvas, 3, 1, SIZE_ARC+SIZE_LINE*2,
+  startComplexShape(ctxcanvas, 3, 1,
     (unsigned long) xc-w/2, (unsigned long) yc-h/2,
     (unsigned long) xc+h/2, (unsigned long) yc+h/2);
 
@@ -905,7 +1012,6 @@ static void cdtext (cdCtxCanvas* ctxcanvas, int x, int y, const char *s, int len
 static void startComplexShape(cdCtxCanvas* ctxcanvas, 
                               unsigned short num_elements,
                               short is_fill,
-                              unsigned short size,
                               unsigned long xmin,
                               unsigned long ymin,
                               unsigned long xmax,
@@ -931,7 +1037,9 @@ static void startComplexShape(cdCtxCanvas* ctxcanvas,
 
   putDisplayHeader(ctxcanvas, &dhdr);
 
-  put_word(ctxcanvas, size + 5 + ((is_fill) ? 8 : 0));
+  /* o tamanho e' calculado em endComplexElement */
+  ctxcanvas->complex_pos = ctxcanvas->buffer_n;
+  put_word(ctxcanvas, 0);
   put_word(ctxcanvas, num_elements);
 
   put_long(ctxcanvas, 0);  /* atributo nulo */
@@ -958,7 +1066,6 @@ static void startComplexShape(cdCtxCanvas* ctxcanvas,
 
 static void startComplexChain(cdCtxCanvas* ctxcanvas, 
                               unsigned short num_elements,
-                              unsigned short size,
                               unsigned long xmin,
                               unsigned long ymin,
                               unsigned long xmax,
@@ -987,7 +1094,9 @@ static void startComplexChain(cdCtxCanvas* ctxcanvas,
 
   putDisplayHeader(ctxcanvas, &dhdr);
 
-  put_word(ctxcanvas, size+5);
+  /* o tamanho e' calculado em endComplexElement */
+  ctxcanvas->complex_pos = ctxcanvas->buffer_n;
+  put_word(ctxcanvas, 0);
   put_word(ctxcanvas, num_elements);
 
   put_long(ctxcanvas, 0);  /* atributo nulo */
@@ -1001,6 +1110,15 @@ static void startComplexChain(cdCtxCanvas* ctxcanvas,
 
 static void endComplexElement(cdCtxCanvas* ctxcanvas)
 {
+  if (ctxcanvas->complex_pos != -1)
+  {
+    /* numero de words depois do tamanho, o elemento inteiro ainda esta no buffer */
+    int words = (ctxcanvas->buffer_n - ctxcanvas->complex_pos - 2) / 2;
+    ctxcanvas->buffer[ctxcanvas->complex_pos] = (unsigned char)(words & 0xff);
+    ctxcanvas->buffer[ctxcanvas->complex_pos + 1] = (unsigned char)((words >> 8) & 0xff);
+    ctxcanvas->complex_pos = -1;
+  }
+
   ctxcanvas->is_complex = 0;
 }
 
@@ -1162,18 +1280,15 @@ static void cdpoly(cdCtxCanvas* ctxcanvas, int mode, cdPoint* poly, int n)
     short rest = n % MAX_NUM_VERTEX;
     short is_there_rest = (rest > 0) ? 1 : 0;
     unsigned long xmax, xmin, ymax, ymin;
-    unsigned short size =
-         SIZE_LINE_STRING(MAX_NUM_VERTEX)*num_whole_elements+ 
-         SIZE_LINE_STRING(rest)*is_there_rest;
 
     line_string_bound(poly, (short)n, &xmin, &ymin, &xmax, &ymax);
 
     if(mode == CD_OPEN_LINES)
-      startComplexChain(ctxcanvas, (unsigned short) (num_whole_elements+((rest > 0) ? 1 : 0)),
-                         size, xmin, ymin, xmax, ymax);
+      startComplexChain(ctxcanvas, (unsigned short) (num_whole_elements+is_there_rest),
+                         xmin, ymin, xmax, ymax);
     else
-      startComplexShape(ctxcanvas, (unsigned short) (num_whole_elements+((rest > 0) ? 1 : 0)),
-                        is_fill, size, xmin, ymin, xmax, ymax);
+      startComplexShape(ctxcanvas, (unsigned short) (num_whole_elements+is_there_rest),
+                        is_fill, xmin, ymin, xmax, ymax);
 
     for(count=0;count < num_whole_vertex; count+=MAX_NUM_VERTEX, n-=MAX_NUM_VERTEX)
       putLineString(ctxcanvas, &poly[count], MAX_NUM_VERTEX);
@@ -1358,6 +1473,7 @@ static void cdpalette (cdCtxCanvas* ctxcanvas, int n, const long int *palette, i
     ctxcanvas->colortable[c] = *palette++;
 
   ctxcanvas->num_colors = (short)n;
+  resetColorCache(ctxcanvas);
 }
 
 static long int cdforeground (cdCtxCanvas* ctxcanvas, long int color)
@@ -1540,6 +1656,11 @@ static void cdcreatecanvas(cdCanvas* canvas, void *data)
     return;
   }
 
+  ctxcanvas->buffer_size = DGN_BUFFER_SIZE;
+  ctxcanvas->buffer = (unsigned char*)malloc(ctxcanvas->buffer_size);
+  ctxcanvas->complex_pos = -1;
+  ctxcanvas->imap = cdInverseMapCreate(1, 1, 1);
+
   /* store the base canvas */
   ctxcanvas->canvas = canvas;
   canvas->ctxcanvas = ctxcanvas;
@@ -1583,6 +1704,7 @@ static void cdcreatecanvas(cdCanvas* canvas, void *data)
   memset(ctxcanvas->colortable, 0, 256*sizeof(long));
   ctxcanvas->colortable[0] = CD_BLACK;
   ctxcanvas->num_colors = 1;
+  resetColorCache(ctxcanvas);
 
   /* atributos */
   ctxcanvas->color = 1;
@@ -9,6 +9,7 @@
 #include <string.h>
 #include <math.h>
 #include <limits.h>
+#include <locale.h>
 
 #include "cd.h"
 #include "cd_private.h"
@@ -27,6 +28,16 @@
 #define min(x, y) ((x < y)? x : y)
 #endif
 
+#define DXF_BUFFER_SIZE 65536
+#define DXF_MAX_BLOCKNAME 256
+#define DXF_PRECISION 6            /* same as "%f" */
+
+typedef struct _dxfBlock
+{
+  char name[DXF_MAX_BLOCKNAME];
+  int handle;        /* handle of the BLOCK_RECORD entry, AutoCAD 2000 only */
+} dxfBlock;
+
 struct _cdCtxCanvas
 {
   cdCanvas* canvas;
@@ -48,37 +59,267 @@ struct _cdCtxCanvas
   /* AutoCAD 2000 only */
   int acad2000;      /* Use new DXF version  */
   int handle;        /* next handle, starts at 0x30 */
+
+  int precision;     /* number of decimals of real values, -1 for the shortest exact representation */
+
+  int entities;      /* ENTITIES section was started, no more blocks can be defined */
+
+  /* block definitions, written to the BLOCKS section when the first entity is drawn */
+  dxfBlock* blocks;
+  int block_count;
+  int block_recording;   /* index+1 of the block being recorded, or 0 */
+  char* block_data;
+  int block_data_size, block_data_max;
+
+  int buffer_n;      /* output buffer, written only when full */
+  char buffer[DXF_BUFFER_SIZE];
 };
 
 
+static void write_data(cdCtxCanvas *ctxcanvas, const char* data, int len)
+{
+  if (ctxcanvas->block_recording)
+  {
+    /* block definitions are kept in memory until the BLOCKS section is written */
+    if (ctxcanvas->block_data_size + len > ctxcanvas->block_data_max)
+    {
+      char* block_data;
+      int max = ctxcanvas->block_data_max ? 2 * ctxcanvas->block_data_max : DXF_BUFFER_SIZE;
+      while (ctxcanvas->block_data_size + len > max)
+        max *= 2;
+
+      block_data = (char*)realloc(ctxcanvas->block_data, max);
+      if (!block_data)
+        return;  /* no memory, the block definition will be incomplete */
+
+      ctxcanvas->block_data = block_data;
+      ctxcanvas->block_data_max = max;
+    }
+
+    memcpy(ctxcanvas->block_data + ctxcanvas->block_data_size, data, len);
+    ctxcanvas->block_data_size += len;
+  }
+  else
+    fwrite(data, 1, len, ctxcanvas->file);
+}
+
+static void write_flush(cdCtxCanvas *ctxcanvas)
+{
+  if (ctxcanvas->buffer_n)
+  {
+    write_data(ctxcanvas, ctxcanvas->buffer, ctxcanvas->buffer_n);
+    ctxcanvas->buffer_n = 0;
+  }
+}
+
+/* make room for at least n characters in the buffer */
+static char* write_reserve(cdCtxCanvas *ctxcanvas, int n)
+{
+  if (ctxcanvas->buffer_n + n > DXF_BUFFER_SIZE)
+    write_flush(ctxcanvas);
+  return ctxcanvas->buffer + ctxcanvas->buffer_n;
+}
+
+static void write_string(cdCtxCanvas *ctxcanvas, const char* str, int len)
+{
+  if (len >= DXF_BUFFER_SIZE)
+  {
+    write_flush(ctxcanvas);
+    write_data(ctxcanvas, str, len);
+    return;
+  }
+
+  memcpy(write_reserve(ctxcanvas, len), str, len);
+  ctxcanvas->buffer_n += len;
+}
+
+/* the formatting functions below return the number of characters written, 
+   and do not depend on the C locale */
+
+static int format_uint(char* str, unsigned long long value, int base)
+{
+  char digits[24];
+  int n = 0, i;
+
+  do
+  {
+    digits[n++] = "0123456789ABCDEF"[value % base];
+    value /= base;
+  } while (value);
+
+  for (i = 0; i < n; i++)
+    str[i] = digits[n - 1 - i];
+
+  return n;
+}
+
+static int format_int(char* str, int value)
+{
+  if (value < 0)
+  {
+    str[0] = '-';
+    return 1 + format_uint(str + 1, (unsigned long long)(-(long long)value), 10);
+  }
+
+  return format_uint(str, (unsigned long long)value, 10);
+}
+
+static int format_real_printf(char* str, double value, int precision)
+{
+  char* dp = localeconv()->decimal_point;
+  int n, i;
+
+  if (precision >= 0)
+    n = sprintf(str, "%.*f", precision, value);
+  else
+  {
+    /* the shortest representation that reads back as the same value */
+    int digits = 15;
+    do
+    {
+      n = sprintf(str, "%.*g", digits, value);
+      digits++;
+    } while (digits <= 17 && strtod(str, NULL) != value);
+  }
+
+  /* the decimal point must always be a period */
+  if (dp[0] != '.' && dp[0] != 0)
+  {
+    int dp_len = (int)strlen(dp);
+    char* p = strstr(str, dp);
+    if (p)
+    {
+      *p = '.';
+      if (dp_len > 1)
+      {
+        memmove(p + 1, p + dp_len, n - (int)(p - str) - dp_len + 1);
+        n -= dp_len - 1;
+      }
+    }
+  }
+
+  if (precision > 0)
+  {
+    /* remove trailing zeros */
+    for (i = n - 1; str[i] == '0'; i--)
+      n--;
+    if (str[n - 1] == '.')
+      n--;
+    str[n] = 0;
+  }
+
+  return n;
+}
+
+static int format_real(char* str, double value, int precision)
+{
+  static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 
+                                 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15};
+  double value_abs, scaled, rest, error, split, a_hi, a_lo, b_hi, b_lo;
+  unsigned long long digits, int_part, dec_part;
+  int n = 0, i;
+
+  if (precision < 0 || precision > 15)
+    return format_real_printf(str, value, precision);
+
+  value_abs = fabs(value);
+  scaled = value_abs * pow10[precision];
+  if (!(scaled < 2251799813685248.0))   /* 2^51, also excludes NaN */
+    return format_real_printf(str, value, precision);
+
+  /* exact rounding error of the product (Dekker), 
+     so the result is rounded like printf even when the product is not exact */
+  split = 134217729.0 * value_abs;   /* 2^27 + 1 */
+  a_hi = split - (split - value_abs);
+  a_lo = value_abs - a_hi;
+  split = 134217729.0 * pow10[precision];
+  b_hi = split - (split - pow10[precision]);
+  b_lo = pow10[precision] - b_hi;
+  error = ((a_hi * b_hi - scaled) + a_hi * b_lo + a_lo * b_hi) + a_lo * b_lo;
+
+  /* round half to even, like printf */
+  digits = (unsigned long long)scaled;
+  rest = scaled - (double)digits;
+  if (rest > 0.5 || (rest == 0.5 && (error > 0 || (error == 0 && (digits & 1)))))
+    digits++;
+
+  if (value < 0 && digits != 0)
+    str[n++] = '-';
+
+  int_part = digits / (unsigned long long)pow10[precision];
+  dec_part = digits % (unsigned long long)pow10[precision];
+
+  n += format_uint(str + n, int_part, 10);
+
+  if (dec_part)
+  {
+    str[n++] = '.';
+
+    /* leading zeros of the decimals */
+    for (i = precision - 1; i > 0 && dec_part < (unsigned long long)pow10[i]; i--)
+      str[n++] = '0';
+
+    /* remove trailing zeros */
+    while (dec_part % 10 == 0)
+      dec_part /= 10;
+
+    n += format_uint(str + n, dec_part, 10);
+  }
+
+  return n;
+}
+
+static void write_code_value(cdCtxCanvas *ctxcanvas, int code)
+{
+  char* str = write_reserve(ctxcanvas, 12);
+  int n = format_int(str, code);
+  str[n++] = '\n';
+  ctxcanvas->buffer_n += n;
+}
+
 static void write_code(cdCtxCanvas *ctxcanvas, int code, const char* value)
 {
-  fprintf (ctxcanvas->file, "%d\n", code);
-  fprintf (ctxcanvas->file, "%s\n", value);
+  write_code_value(ctxcanvas, code);
+  write_string(ctxcanvas, value, (int)strlen(value));
+  write_string(ctxcanvas, "\n", 1);
 }
 
 static void write_code_int(cdCtxCanvas *ctxcanvas, int code, int value)
 {
-  fprintf (ctxcanvas->file, "%d\n", code);
-  fprintf (ctxcanvas->file, "%d\n", value);
+  char* str = write_reserve(ctxcanvas, 24);
+  int n = format_int(str, code);
+  str[n++] = '\n';
+  n += format_int(str + n, value);
+  str[n++] = '\n';
+  ctxcanvas->buffer_n += n;
 }
 
 static void write_code_hex(cdCtxCanvas *ctxcanvas, int code, int value)
 {
-  fprintf (ctxcanvas->file, "%d\n", code);
-  fprintf (ctxcanvas->file, "%0X\n", value);
+  char* str = write_reserve(ctxcanvas, 24);
+  int n = format_int(str, code);
+  str[n++] = '\n';
+  n += format_uint(str + n, (unsigned int)value, 16);
+  str[n++] = '\n';
+  ctxcanvas->buffer_n += n;
 }
 
 static void write_code_real(cdCtxCanvas *ctxcanvas, int code, double value)
 {
-  fprintf (ctxcanvas->file, "%d\n", code);
-  fprintf (ctxcanvas->file, "%f\n", value);
+  /* "%.15f" of DBL_MAX has 325 characters */
+  char* str = write_reserve(ctxcanvas, 12 + 340);
+  int n = format_int(str, code);
+  str[n++] = '\n';
+  n += format_real(str + n, value, ctxcanvas->precision);
+  str[n++] = '\n';
+  ctxcanvas->buffer_n += n;
 }
 
 static void write_header_variable(cdCtxCanvas *ctxcanvas, const char* variable)
 {
-  fprintf (ctxcanvas->file, "9\n");
-  fprintf (ctxcanvas->file, "$%s\n", variable);
+  write_string(ctxcanvas, "9\n$", 3);
+  write_string(ctxcanvas, variable, (int)strlen(variable));
+  write_string(ctxcanvas, "\n", 1);
 }
 
 static void begin_section(cdCtxCanvas *ctxcanvas, const char* section_name)
@@ -545,9 +786,11 @@ static void write_dimstyle(cdCtxCanvas *ctxcanvas)
 
 static void write_blockrecord(cdCtxCanvas *ctxcanvas)
 {
+  int i;
+
   /* Used here, only for AutoCAD 2000 */
 
-  begin_table(ctxcanvas, "BLOCK_RECORD", 3, "1");    /* BLOCK_RECORD table handle=1 */
+  begin_table(ctxcanvas, "BLOCK_RECORD", 3 + ctxcanvas->block_count, "1");    /* BLOCK_RECORD table handle=1 */
 
   write_code(ctxcanvas, 0, "BLOCK_RECORD");
   write_code(ctxcanvas, 5, "1F");   /* blockrecord entry handle=1F */
@@ -570,6 +813,15 @@ static void write_blockrecord(cdCtxCanvas *ctxcanvas)
   write_code(ctxcanvas,  2, "*Paper_Space0");
   write_code(ctxcanvas,340, "26");
 
+  for (i = 0; i < ctxcanvas->block_count; i++)
+  {
+    write_code(ctxcanvas, 0, "BLOCK_RECORD");
+    write_code_hex(ctxcanvas, 5, ctxcanvas->blocks[i].handle);
+    write_code(ctxcanvas, 100, "AcDbSymbolTableRecord");
+    write_code(ctxcanvas, 100, "AcDbBlockTableRecord");
+    write_code(ctxcanvas, 2, ctxcanvas->blocks[i].name);
+  }
+
   end_table(ctxcanvas);
 }
 
@@ -601,6 +853,52 @@ static void write_block(cdCtxCanvas *ctxcanvas, const char* name, const char* ha
   write_code(ctxcanvas, 100, "AcDbBlockEnd");
 }
 
+static void begin_user_block(cdCtxCanvas *ctxcanvas, const char* name)
+{
+  /* base point is always 0,0 */
+  write_code(ctxcanvas, 0, "BLOCK");
+  if (ctxcanvas->acad2000)
+  {
+    write_unique_handle(ctxcanvas);
+    write_code(ctxcanvas, 100, "AcDbEntity");
+  }
+  write_code(ctxcanvas, 8, "0");
+  if (ctxcanvas->acad2000)
+    write_code(ctxcanvas, 100, "AcDbBlockBegin");
+  write_code(ctxcanvas, 2, name);
+  write_code(ctxcanvas, 70, "0");
+  write_code(ctxcanvas, 10, "0");
+  write_code(ctxcanvas, 20, "0");
+  write_code(ctxcanvas, 30, "0");
+  write_code(ctxcanvas, 3, name);
+  if (ctxcanvas->acad2000)
+    write_code(ctxcanvas, 1, "");
+}
+
+static void end_user_block(cdCtxCanvas *ctxcanvas)
+{
+  write_code(ctxcanvas, 0, "ENDBLK");
+  if (ctxcanvas->acad2000)
+  {
+    write_unique_handle(ctxcanvas);
+    write_code(ctxcanvas, 100, "AcDbEntity");
+  }
+  write_code(ctxcanvas, 8, "0");
+  if (ctxcanvas->acad2000)
+    write_code(ctxcanvas, 100, "AcDbBlockEnd");
+}
+
+static int find_block(cdCtxCanvas *ctxcanvas, const char* name)
+{
+  int i;
+  for (i = 0; i < ctxcanvas->block_count; i++)
+  {
+    if (strcmp(ctxcanvas->blocks[i].name, name) == 0)
+      return i;
+  }
+  return -1;
+}
+
 static void write_objects(cdCtxCanvas *ctxcanvas)
 {
   write_code(ctxcanvas, 0, "DICTIONARY");
@@ -883,8 +1181,49 @@ static void write_objects(cdCtxCanvas *ctxcanvas)
   write_code_int(ctxcanvas, 1, 1);
 }
 
+static void begin_entities(cdCtxCanvas *ctxcanvas)
+{
+  /* TABLES and BLOCKS are written only before the first entity,
+     because of the block definitions */
+  ctxcanvas->entities = 1;
+
+  begin_section(ctxcanvas, "TABLES");
+    write_line_types (ctxcanvas);   /* must be before layers */
+    write_fonts (ctxcanvas);
+    if (ctxcanvas->acad2000)
+    {
+      write_vport(ctxcanvas);
+      write_layers(ctxcanvas);
+      write_view(ctxcanvas);
+      write_ucs(ctxcanvas);
+      write_appid(ctxcanvas);
+      write_dimstyle(ctxcanvas);
+      write_blockrecord(ctxcanvas);
+    }
+  end_section(ctxcanvas);  /* End TABLES section */
+
+  begin_section(ctxcanvas, "BLOCKS");
+    if (ctxcanvas->acad2000)
+    {
+      write_block(ctxcanvas, "*Model_Space",  "20", "21", 0);  /* handle=20  handle=21 */
+      write_block(ctxcanvas, "*Paper_Space",  "1C", "1D", 1);  /* handle=1C  handle=1D */
+      write_block(ctxcanvas, "*Paper_Space0", "24", "25", 0);  /* handle=24  handle=25 */
+    }
+
+    /* user blocks */
+    write_flush(ctxcanvas);
+    if (ctxcanvas->block_data_size)
+      write_data(ctxcanvas, ctxcanvas->block_data, ctxcanvas->block_data_size);
+  end_section(ctxcanvas);  /* End BLOCKS section */
+
+  begin_section(ctxcanvas, "ENTITIES");
+}
+
 static void begin_entity(cdCtxCanvas *ctxcanvas, const char* name, const char* db_name)
 {
+  if (!ctxcanvas->entities && !ctxcanvas->block_recording)
+    begin_entities(ctxcanvas);
+
   write_code(ctxcanvas, 0, name);
 
   if (ctxcanvas->acad2000)
@@ -1101,11 +1440,25 @@ static void write_hatch_int(cdCtxCanvas *ctxcanvas, cdPoint *poly, int nv)
 
 static void cddeactivate (cdCtxCanvas *ctxcanvas)
 {
+  write_flush(ctxcanvas);
   fflush (ctxcanvas->file);
 }
 
+static void end_block_recording(cdCtxCanvas *ctxcanvas)
+{
+  end_user_block(ctxcanvas);
+  write_flush(ctxcanvas);
+  ctxcanvas->block_recording = 0;
+}
+
 static void cdkillcanvas(cdCtxCanvas *ctxcanvas)
 {
+  if (ctxcanvas->block_recording)
+    end_block_recording(ctxcanvas);
+
+  if (!ctxcanvas->entities)
+    begin_entities(ctxcanvas);
+
   end_section(ctxcanvas);  /* End ENTITIES section */
 
   if (ctxcanvas->acad2000)
@@ -1117,15 +1470,20 @@ static void cdkillcanvas(cdCtxCanvas *ctxcanvas)
 
   write_code(ctxcanvas, 0, "EOF");  /* End the ASCII format */
 
+  write_flush(ctxcanvas);
   fflush (ctxcanvas->file);
   fclose (ctxcanvas->file);
 
+  if (ctxcanvas->blocks) free(ctxcanvas->blocks);
+  if (ctxcanvas->block_data) free(ctxcanvas->block_data);
+
   memset(ctxcanvas, 0, sizeof(cdCtxCanvas));
   free (ctxcanvas);
 }
 
 static void cdflush (cdCtxCanvas *ctxcanvas)
 {
+  write_flush(ctxcanvas);
   fflush (ctxcanvas->file);               /* flush file */
   ctxcanvas->layer++;
 }
@@ -1755,6 +2113,125 @@ static void cdfpixel(cdCtxCanvas *ctxcanvas, double x, double y, long int color)
 
 /******************************************************/
 
+static void set_precision_attrib(cdCtxCanvas* ctxcanvas, char* data)
+{
+  int precision = DXF_PRECISION;
+
+  if (data)
+  {
+    sscanf(data, "%d", &precision);
+    if (precision < -1) precision = -1;
+    if (precision > 15) precision = 15;
+  }
+
+  ctxcanvas->precision = precision;
+}
+
+static char* get_precision_attrib(cdCtxCanvas* ctxcanvas)
+{
+  static char data[20];
+  sprintf(data, "%d", ctxcanvas->precision);
+  return data;
+}
+
+static cdAttribute precision_attrib =
+{
+  "PRECISION",
+  set_precision_attrib,
+  get_precision_attrib
+}; 
+
+static void set_beginblock_attrib(cdCtxCanvas* ctxcanvas, char* data)
+{
+  dxfBlock* blocks;
+
+  /* blocks must be defined before the ENTITIES section,
+     names with spaces could not be used in INSERTBLOCK */
+  if (!data || data[0] == 0 || ctxcanvas->entities || ctxcanvas->block_recording ||
+      strlen(data) >= DXF_MAX_BLOCKNAME || strpbrk(data, " \t\r\n\v\f") ||
+      find_block(ctxcanvas, data) != -1)
+    return;
+
+  blocks = (dxfBlock*)realloc(ctxcanvas->blocks, (ctxcanvas->block_count + 1) * sizeof(dxfBlock));
+  if (!blocks)
+    return;
+
+  ctxcanvas->blocks = blocks;
+  strcpy(ctxcanvas->blocks[ctxcanvas->block_count].name, data);
+  ctxcanvas->blocks[ctxcanvas->block_count].handle = ctxcanvas->handle;
+  ctxcanvas->handle++;
+  ctxcanvas->block_count++;
+
+  /* what was written so far goes to the file, the rest goes to the block data */
+  write_flush(ctxcanvas);
+  ctxcanvas->block_recording = ctxcanvas->block_count;
+
+  begin_user_block(ctxcanvas, data);
+}
+
+static char* get_beginblock_attrib(cdCtxCanvas* ctxcanvas)
+{
+  if (ctxcanvas->block_recording)
+    return ctxcanvas->blocks[ctxcanvas->block_recording - 1].name;
+  else
+    return NULL;
+}
+
+static cdAttribute beginblock_attrib =
+{
+  "BEGINBLOCK",
+  set_beginblock_attrib,
+  get_beginblock_attrib
+}; 
+
+static void set_endblock_attrib(cdCtxCanvas* ctxcanvas, char* data)
+{
+  if (ctxcanvas->block_recording)
+    end_block_recording(ctxcanvas);
+  (void)data;
+}
+
+static cdAttribute endblock_attrib =
+{
+  "ENDBLOCK",
+  set_endblock_attrib,
+  NULL
+}; 
+
+static void set_insertblock_attrib(cdCtxCanvas* ctxcanvas, char* data)
+{
+  char name[DXF_MAX_BLOCKNAME];
+  double x = 0, y = 0, scale_x = 1, scale_y = 1, angle = 0;
+  int n;
+
+  if (!data || ctxcanvas->block_recording)
+    return;
+
+  n = sscanf(data, "%255s %lg %lg %lg %lg %lg", name, &x, &y, &scale_x, &scale_y, &angle);
+  if (n < 3 || find_block(ctxcanvas, name) == -1)
+    return;
+  if (n == 4)
+    scale_y = scale_x;
+
+  begin_entity(ctxcanvas, "INSERT", "AcDbBlockReference");
+
+  write_code(ctxcanvas, 2, name);
+  write_code_real(ctxcanvas, 10, x);
+  write_code_real(ctxcanvas, 20, y);
+  write_code(ctxcanvas, 30, "0");  /* z */
+  write_code_real(ctxcanvas, 41, scale_x);
+  write_code_real(ctxcanvas, 42, scale_y);
+  write_code(ctxcanvas, 43, "1");
+  write_code_real(ctxcanvas, 50, angle);   /* degrees */
+}
+
+static cdAttribute insertblock_attrib =
+{
+  "INSERTBLOCK",
+  set_insertblock_attrib,
+  NULL
+}; 
+
 static void cdcreatecanvas(cdCanvas* canvas, void *data)
 {
   char filename[10240] = "";
@@ -1812,6 +2289,12 @@ static void cdcreatecanvas(cdCanvas* canvas, void *data)
   ctxcanvas->text_height  = 9;
   ctxcanvas->fgcolor_index = 7;    /* default AutoCAD index        */
   ctxcanvas->handle = 0x30;        /* unique handle start value */
+  ctxcanvas->precision = DXF_PRECISION;
+
+  cdRegisterAttribute(canvas, &precision_attrib);
+  cdRegisterAttribute(canvas, &beginblock_attrib);
+  cdRegisterAttribute(canvas, &endblock_attrib);
+  cdRegisterAttribute(canvas, &insertblock_attrib);
 
   /* comment */
   write_code(ctxcanvas, 999, CD_NAME", version "CD_VERSION);
@@ -1819,32 +2302,6 @@ static void cdcreatecanvas(cdCanvas* canvas, void *data)
   begin_section(ctxcanvas, "HEADER");
     write_header(ctxcanvas, xmin, xmax, ymin, ymax);
   end_section(ctxcanvas);  /* End HEADER section */
-
-  begin_section(ctxcanvas, "TABLES");
-    write_line_types (ctxcanvas);   /* must be before layers */
-    write_fonts (ctxcanvas);
-    if (ctxcanvas->acad2000)
-    {
-      write_vport(ctxcanvas);
-      write_layers(ctxcanvas);
-      write_view(ctxcanvas);
-      write_ucs(ctxcanvas);
-      write_appid(ctxcanvas);
-      write_dimstyle(ctxcanvas);
-      write_blockrecord(ctxcanvas);
-    }
-  end_section(ctxcanvas);  /* End TABLES section */
-
-  begin_section(ctxcanvas, "BLOCKS");
-    if (ctxcanvas->acad2000)
-    {
-      write_block(ctxcanvas, "*Model_Space",  "20", "21", 0);  /* handle=20  handle=21 */
-      write_block(ctxcanvas, "*Paper_Space",  "1C", "1D", 1);  /* handle=1C  handle=1D */
-      write_block(ctxcanvas, "*Paper_Space0", "24", "25", 0);  /* handle=24  handle=25 */
-    }
-  end_section(ctxcanvas);  /* End BLOCKS section */
-
-  begin_section(ctxcanvas, "ENTITIES");
 }
 
 static void cdinittable(cdCanvas* canvas)
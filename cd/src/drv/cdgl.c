@@ -7,6 +7,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <math.h>
 
 #ifdef WIN32
@@ -19,7 +20,8 @@
 #include <GL/gl.h>
 #endif
 
-#include <FTGL/ftgl.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
 
 #include "cd.h"
 #include "cd_private.h"
@@ -29,109 +31,1317 @@
 #define M_PI 3.14159265358979323846
 #endif
 
+#define CDGL_BATCH_MAX 65536  /* maximum number of vertices in a batch */
+#define CDGL_BATCH_SMALL 32   /* smaller batches are drawn without vertex arrays */
+#define CDGL_TESS_CACHE_SIZE 32
+#define CDGL_IMAGE_CACHE_SIZE 65536  /* Kbytes */
+#define CDGL_FONT_HASH_SIZE 64
+#define CDGL_GLYPH_HASH_SIZE 256
+#define CDGL_ATLAS_MIN 256   /* initial glyph atlas width and height */
+#define CDGL_ATLAS_MAX 4096
+
 #define NUM_HATCHES  6
 #define HATCH_WIDTH  8
 #define HATCH_HEIGHT 8
 
-/* 
-** 6 predefined patterns to be accessed through cdHatch(
-CD_HORIZONTAL | CD_VERTICAL | CD_FDIAGONAL | CD_BDIAGONAL |
-CD_CROSS      | CD_DIAGCROSS)
+/* 
+** 6 predefined patterns to be accessed through cdHatch(
+CD_HORIZONTAL | CD_VERTICAL | CD_FDIAGONAL | CD_BDIAGONAL |
+CD_CROSS      | CD_DIAGCROSS)
+
+*/
+static char hatches[NUM_HATCHES][8] = {
+  {0x00,0x00,0xFF,0x00,0x00,0x00,0xFF,0x00},  /* HORIZONTAL */
+  {0x22,0x22,0x22,0x22,0x22,0x22,0x22,0x22},  /* VERTICAL */
+  {0x08,0x10,0x20,0x40,0x80,0x01,0x02,0x04},  /* FDIAGONAL */
+  {0x10,0x08,0x04,0x02,0x01,0x80,0x40,0x20},  /* BDIAGONAL */
+  {0x22,0x22,0xFF,0x22,0x22,0x22,0xFF,0x22},  /* CROSS */
+  {0x18,0x18,0x24,0x42,0x81,0x81,0x42,0x24}   /* DIAGCROSS */
+};
+
+
+typedef struct _cdglGlyph
+{
+  unsigned long code;         /* Unicode */
+  unsigned int index;         /* FreeType glyph index */
+  int x, y, w, h;             /* bitmap position and size in the atlas, w=0 if empty */
+  int left, top;              /* bitmap position relative to the pen */
+  float advance;
+  struct _cdglGlyph* next;
+} cdglGlyph;
+
+/* all the glyphs of a font are rendered in the same texture */
+typedef struct _cdglFont
+{
+  char* filename;
+  unsigned int hash;
+  int size, res;
+  FT_Face face;
+  float ascent, descent, line_height, max_width;
+
+  cdglGlyph* glyphs[CDGL_GLYPH_HASH_SIZE];
+
+  unsigned char* atlas;       /* alpha only */
+  int atlas_w, atlas_h;
+  int pen_x, pen_y, row_h;    /* where the next glyph is placed, rows of glyphs are filled left to right */
+  int dirty_min, dirty_max;   /* atlas lines not uploaded yet */
+  GLuint texture;
+  int tex_w, tex_h;
+
+  struct _cdglFont* next;
+} cdglFont;
+
+
+typedef struct _cdglTriangles
+{
+  GLfloat* v;   /* 2 coordinates for each triangle vertex */
+  int count, max;
+} cdglTriangles;
+
+typedef struct _cdglTessCache
+{
+  unsigned long long hash;
+  int n, fill_mode;
+  cdfPoint* poly;     /* copy of the polygon, to confirm the hash */
+  cdglTriangles tri;
+} cdglTessCache;
+
+
+typedef struct _cdglTexture
+{
+  unsigned long long key;  /* image content hash or IMGID */
+  unsigned char* key_data; /* image contents to confirm the key, NULL for IMGID */
+  int key_size;
+  int w, h;
+  GLenum format;
+  GLuint texture;
+  unsigned long tick;      /* last use, for the LRU */
+} cdglTexture;
+
+
+struct _cdCtxImage
+{
+  unsigned int w, h;
+  GLubyte* img;     /* always RGBA 32bpp */
+  GLuint texture;
+};
+
+struct _cdCtxCanvas
+{
+  cdCanvas* canvas;
+
+  cdglFont *font;
+
+  double rotate_angle;
+  int rotate_center_x;
+  int rotate_center_y;
+
+  char* utf8_buffer;
+  int utf8mode, utf8_buffer_len;
+
+  FT_Library ft_library;
+  cdglFont* font_hash[CDGL_FONT_HASH_SIZE];
+
+  /* consecutive texts are drawn with a single glDrawArrays */
+  GLfloat* text_vertex;    /* x,y,s,t for each vertex */
+  GLubyte* text_color;
+  cdglFont* text_font;
+  int text_nearest;
+  long text_first_color;
+  int text_multicolor;
+  int text_count, text_max;
+
+  int texture_filter;
+
+  /* consecutive primitives are accumulated and drawn with a single glDrawArrays */
+  int batch;
+  GLenum batch_mode;       /* GL_POINTS, GL_LINES or GL_TRIANGLES */
+  GLfloat* batch_vertex;   /* x,y pairs */
+  GLubyte* batch_color;    /* RGBA for each vertex */
+  long batch_first_color;
+  int batch_multicolor;    /* if 0 all vertices have batch_first_color, and the color array is not used */
+  int batch_count, batch_max;
+
+  /* triangles of the last non convex filled polygons */
+  cdglTessCache tess_cache[CDGL_TESS_CACHE_SIZE];
+  int tess_cache_next;
+  cdfPoint* tess_poly;
+  int tess_poly_max;
+
+  /* textures of the last images, least recently used are deleted first */
+  cdglTexture* tex_cache;
+  int tex_count, tex_max;
+  unsigned long tex_bytes, tex_cache_size;  /* in bytes */
+  unsigned long tex_tick, tex_hits, tex_misses;
+  char* img_id;
+  int img_update;
+  int img_update_rect, img_update_xmin, img_update_xmax, img_update_ymin, img_update_ymax;  /* dirty rectangle of IMGUPDATE */
+};
+
+/******************************************************/
+
+static unsigned int cdglFontHash(const char* filename, int size, int res)
+{
+  unsigned int hash = 2166136261u;
+
+  /* file names are compared ignoring case */
+  while (*filename)
+  {
+    hash = (hash ^ (unsigned char)tolower((unsigned char)*filename)) * 16777619u;
+    filename++;
+  }
+
+  hash = (hash ^ (unsigned int)size) * 16777619u;
+  hash = (hash ^ (unsigned int)res) * 16777619u;
+  return hash;
+}
+
+static void cdglFreeFont(cdglFont* font)
+{
+  int i;
+
+  for (i = 0; i < CDGL_GLYPH_HASH_SIZE; i++)
+  {
+    cdglGlyph* glyph = font->glyphs[i];
+    while (glyph)
+    {
+      cdglGlyph* next = glyph->next;
+      free(glyph);
+      glyph = next;
+    }
+  }
+
+  if (font->texture) glDeleteTextures(1, &font->texture);
+  if (font->atlas) free(font->atlas);
+  FT_Done_Face(font->face);
+  free(font->filename);
+  free(font);
+}
+
+static cdglFont* cdglGetFont(cdCtxCanvas *ctxcanvas, const char* filename, int size, int res)
+{
+  unsigned int hash = cdglFontHash(filename, size, res);
+  cdglFont* font;
+  FT_Face face;
+
+  /* search for an existent font */
+  for (font = ctxcanvas->font_hash[hash % CDGL_FONT_HASH_SIZE]; font; font = font->next)
+  {
+    if (font->hash == hash && font->size == size && font->res == res &&
+        cdStrEqualNoCase(font->filename, filename))
+      return font;
+  }
+
+  /* not found, create a new font and add it to the cache */
+
+  if (!ctxcanvas->ft_library && FT_Init_FreeType(&ctxcanvas->ft_library))
+    return NULL;
+
+  if (FT_New_Face(ctxcanvas->ft_library, filename, 0, &face))
+    return NULL;
+
+  /* char_height is 1/64th of points */
+  if (FT_Set_Char_Size(face, 0, size * 64, res, res))
+  {
+    FT_Done_Face(face);
+    return NULL;
+  }
+
+  if (!face->charmap && face->num_charmaps > 0)
+    FT_Set_Charmap(face, face->charmaps[0]);
+
+  font = (cdglFont*)calloc(1, sizeof(cdglFont));
+  font->filename = cdStrDup(filename);
+  font->hash = hash;
+  font->size = size;
+  font->res = res;
+  font->face = face;
+
+  font->ascent = face->size->metrics.ascender / 64.0f;
+  font->descent = face->size->metrics.descender / 64.0f;
+  font->line_height = face->size->metrics.height / 64.0f;
+  if (FT_IS_SCALABLE(face))
+    font->max_width = (float)(face->bbox.xMax - face->bbox.xMin) * face->size->metrics.x_ppem / face->units_per_EM;
+  else
+    font->max_width = face->size->metrics.max_advance / 64.0f;
+
+  font->atlas_w = CDGL_ATLAS_MIN;
+  font->atlas_h = CDGL_ATLAS_MIN;
+  font->atlas = (unsigned char*)calloc(font->atlas_w * font->atlas_h, 1);
+  font->pen_x = 1;
+  font->pen_y = 1;
+  font->dirty_min = font->atlas_h;
+
+  font->next = ctxcanvas->font_hash[hash % CDGL_FONT_HASH_SIZE];
+  ctxcanvas->font_hash[hash % CDGL_FONT_HASH_SIZE] = font;
+  return font;
+}
+
+static int cdglGrowAtlas(cdglFont* font, int w, int h)
+{
+  int new_w = font->atlas_w, 
+      new_h = font->atlas_h, y;
+  unsigned char* new_atlas;
+
+  /* the glyph does not fit in the remaining rows */
+  if (w + 2 > new_w)
+  {
+    while (w + 2 > new_w) new_w *= 2;
+  }
+  else
+    new_h *= 2;
+
+  while (font->pen_y + h + 1 > new_h) new_h *= 2;
+
+  if (new_w > CDGL_ATLAS_MAX || new_h > CDGL_ATLAS_MAX)
+    return 0;
+
+  new_atlas = (unsigned char*)calloc(new_w * new_h, 1);
+  if (!new_atlas)
+    return 0;
+
+  for (y = 0; y < font->atlas_h; y++)
+    memcpy(new_atlas + y * new_w, font->atlas + y * font->atlas_w, font->atlas_w);
+
+  free(font->atlas);
+  font->atlas = new_atlas;
+  font->atlas_w = new_w;
+  font->atlas_h = new_h;
+
+  /* upload everything again */
+  font->dirty_min = 0;
+  font->dirty_max = new_h;
+  font->tex_w = 0;
+  return 1;
+}
+
+/* Reserves space for a glyph bitmap in the atlas, plus one empty pixel around it. */
+static int cdglAtlasAlloc(cdglFont* font, int w, int h, int *x, int *y)
+{
+  if (font->pen_x + w + 1 > font->atlas_w)
+  {
+    /* next shelf */
+    font->pen_x = 1;
+    font->pen_y += font->row_h + 1;
+    font->row_h = 0;
+  }
+
+  while (font->pen_x + w + 1 > font->atlas_w || font->pen_y + h + 1 > font->atlas_h)
+  {
+    if (!cdglGrowAtlas(font, w, h))
+      return 0;
+
+    if (font->pen_x + w + 1 > font->atlas_w)
+    {
+      font->pen_x = 1;
+      font->pen_y += font->row_h + 1;
+      font->row_h = 0;
+    }
+  }
+
+  *x = font->pen_x;
+  *y = font->pen_y;
+
+  font->pen_x += w + 1;
+  if (h > font->row_h) font->row_h = h;
+  return 1;
+}
+
+static cdglGlyph* cdglGetGlyph(cdglFont* font, unsigned long code)
+{
+  cdglGlyph* glyph;
+  FT_GlyphSlot slot;
+  int hash = (int)(code % CDGL_GLYPH_HASH_SIZE);
+
+  for (glyph = font->glyphs[hash]; glyph; glyph = glyph->next)
+  {
+    if (glyph->code == code)
+      return glyph;
+  }
+
+  glyph = (cdglGlyph*)calloc(1, sizeof(cdglGlyph));
+  glyph->code = code;
+  glyph->index = FT_Get_Char_Index(font->face, code);
+
+  glyph->next = font->glyphs[hash];
+  font->glyphs[hash] = glyph;
+
+  if (FT_Load_Glyph(font->face, glyph->index, FT_LOAD_NO_HINTING | FT_LOAD_NO_BITMAP) ||
+      FT_Render_Glyph(font->face->glyph, FT_RENDER_MODE_NORMAL))
+    return glyph;  /* empty glyph */
+
+  slot = font->face->glyph;
+  glyph->advance = slot->advance.x / 64.0f;
+  glyph->left = slot->bitmap_left;
+  glyph->top = slot->bitmap_top;
+
+  if (slot->bitmap.width > 0 && slot->bitmap.rows > 0 && slot->bitmap.pixel_mode == FT_PIXEL_MODE_GRAY)
+  {
+    int x, y, row, w = slot->bitmap.width, h = slot->bitmap.rows;
+
+    if (!cdglAtlasAlloc(font, w, h, &x, &y))
+      return glyph;  /* atlas is full, only the advance is used */
+
+    for (row = 0; row < h; row++)
+      memcpy(font->atlas + (y + row) * font->atlas_w + x, slot->bitmap.buffer + row * slot->bitmap.pitch, w);
+
+    if (y < font->dirty_min) font->dirty_min = y;
+    if (y + h > font->dirty_max) font->dirty_max = y + h;
+
+    glyph->x = x;
+    glyph->y = y;
+    glyph->w = w;
+    glyph->h = h;
+  }
+
+  return glyph;
+}
+
+/* Decodes the next UTF-8 character, invalid sequences return the byte value. */
+static unsigned long cdglNextChar(const unsigned char** str)
+{
+  const unsigned char* s = *str;
+  unsigned long code = *s;
+  int count = 0, i;
+
+  if (code >= 0xF0) { code &= 0x07; count = 3; }
+  else if (code >= 0xE0) { code &= 0x0F; count = 2; }
+  else if (code >= 0xC0) { code &= 0x1F; count = 1; }
+
+  for (i = 1; i <= count; i++)
+  {
+    if ((s[i] & 0xC0) != 0x80)
+    {
+      *str = s + 1;
+      return *s;
+    }
+    code = (code << 6) | (s[i] & 0x3F);
+  }
+
+  *str = s + count + 1;
+  return code;
+}
+
+/* Returns the width of an UTF-8 string, including kerning, as FTGL did. */
+static float cdglTextAdvance(cdglFont* font, const char* str)
+{
+  const unsigned char* s = (const unsigned char*)str;
+  unsigned int prev_index = 0;
+  int kerning = FT_HAS_KERNING(font->face);
+  float advance = 0;
+
+  while (*s)
+  {
+    cdglGlyph* glyph = cdglGetGlyph(font, cdglNextChar(&s));
+
+    if (kerning && prev_index && glyph->index)
+    {
+      FT_Vector delta;
+      if (!FT_Get_Kerning(font->face, prev_index, glyph->index, FT_KERNING_DEFAULT, &delta))
+        advance += delta.x / 64.0f;
+    }
+
+    advance += glyph->advance;
+    prev_index = glyph->index;
+  }
+
+  return advance;
+}
+
+static void cdglUpdateAtlas(cdglFont* font)
+{
+  if (font->texture && font->tex_w == font->atlas_w && font->tex_h == font->atlas_h)
+  {
+    if (font->dirty_min >= font->dirty_max)
+      return;
+
+    glBindTexture(GL_TEXTURE_2D, font->texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, font->dirty_min, font->atlas_w, font->dirty_max - font->dirty_min, 
+                    GL_ALPHA, GL_UNSIGNED_BYTE, font->atlas + font->dirty_min * font->atlas_w);
+  }
+  else
+  {
+    if (!font->texture)
+      glGenTextures(1, &font->texture);
+
+    glBindTexture(GL_TEXTURE_2D, font->texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, font->atlas_w, font->atlas_h, 0, GL_ALPHA, GL_UNSIGNED_BYTE, font->atlas);
+
+    font->tex_w = font->atlas_w;
+    font->tex_h = font->atlas_h;
+  }
+
+  font->dirty_min = font->atlas_h;
+  font->dirty_max = 0;
+}
+
+static void cdglFlushText(cdCtxCanvas *ctxcanvas)
+{
+  cdglFont* font = ctxcanvas->text_font;
+  GLint filter = ctxcanvas->text_nearest ? GL_NEAREST : GL_LINEAR;
+
+  if (ctxcanvas->text_count == 0)
+    return;
+
+  cdglUpdateAtlas(font);
+
+  glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_TEXTURE_BIT);
+
+  glDisable(GL_POLYGON_STIPPLE);
+  glDisable(GL_POLYGON_SMOOTH);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+  glEnable(GL_TEXTURE_2D);
+  glBindTexture(GL_TEXTURE_2D, font->texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+  glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+
+  glMatrixMode(GL_TEXTURE);
+  glPushMatrix();
+  glLoadIdentity();
+  glScaled(1.0 / font->atlas_w, 1.0 / font->atlas_h, 1.0);
+  glMatrixMode(GL_MODELVIEW);
+
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+  glVertexPointer(2, GL_FLOAT, 4 * sizeof(GLfloat), ctxcanvas->text_vertex);
+  glTexCoordPointer(2, GL_FLOAT, 4 * sizeof(GLfloat), ctxcanvas->text_vertex + 2);
+
+  if (ctxcanvas->text_multicolor)
+  {
+    glEnableClientState(GL_COLOR_ARRAY);
+    glColorPointer(4, GL_UNSIGNED_BYTE, 0, ctxcanvas->text_color);
+  }
+  else
+    glColor4ub(cdRed(ctxcanvas->text_first_color),
+               cdGreen(ctxcanvas->text_first_color),
+               cdBlue(ctxcanvas->text_first_color),
+               cdAlpha(ctxcanvas->text_first_color));
+
+  glDrawArrays(GL_TRIANGLES, 0, ctxcanvas->text_count);
+
+  if (ctxcanvas->text_multicolor)
+    glDisableClientState(GL_COLOR_ARRAY);
+  glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+  glDisableClientState(GL_VERTEX_ARRAY);
+
+  glMatrixMode(GL_TEXTURE);
+  glPopMatrix();
+  glMatrixMode(GL_MODELVIEW);
+
+  glPopAttrib();
+
+  glColor4ub(cdRed(ctxcanvas->canvas->foreground),
+             cdGreen(ctxcanvas->canvas->foreground),
+             cdBlue(ctxcanvas->canvas->foreground),
+             cdAlpha(ctxcanvas->canvas->foreground));
+
+  ctxcanvas->text_count = 0;
+}
+
+/* Returns space for n glyphs (6 vertices each) in the text batch. */
+static GLfloat* cdglTextAdd(cdCtxCanvas *ctxcanvas, cdglFont* font, int nearest, int n, long color)
+{
+  GLubyte* rgba;
+  int i, count = 6 * n;
+
+  if (ctxcanvas->text_count && (ctxcanvas->text_font != font || ctxcanvas->text_nearest != nearest ||
+                                ctxcanvas->text_count + count > CDGL_BATCH_MAX))
+    cdglFlushText(ctxcanvas);
+
+  if (ctxcanvas->text_count + count > ctxcanvas->text_max)
+  {
+    int new_max = ctxcanvas->text_max ? 2 * ctxcanvas->text_max : 1024;
+    GLfloat* new_vertex;
+    GLubyte* new_color;
+
+    while (new_max < ctxcanvas->text_count + count)
+      new_max *= 2;
+
+    new_vertex = (GLfloat*)realloc(ctxcanvas->text_vertex, new_max * 4 * sizeof(GLfloat));
+    if (new_vertex) ctxcanvas->text_vertex = new_vertex;
+    new_color = (GLubyte*)realloc(ctxcanvas->text_color, new_max * 4);
+    if (new_color) ctxcanvas->text_color = new_color;
+
+    if (!new_vertex || !new_color)
+      return NULL;
+
+    ctxcanvas->text_max = new_max;
+  }
+
+  if (ctxcanvas->text_count == 0)
+  {
+    ctxcanvas->text_first_color = color;
+    ctxcanvas->text_multicolor = 0;
+  }
+  else if (color != ctxcanvas->text_first_color)
+    ctxcanvas->text_multicolor = 1;
+
+  ctxcanvas->text_font = font;
+  ctxcanvas->text_nearest = nearest;
+
+  rgba = ctxcanvas->text_color + 4 * ctxcanvas->text_count;
+  for (i = 0; i < count; i++)
+  {
+    *rgba++ = cdRed(color);
+    *rgba++ = cdGreen(color);
+    *rgba++ = cdBlue(color);
+    *rgba++ = cdAlpha(color);
+  }
+
+  return ctxcanvas->text_vertex + 4 * ctxcanvas->text_count;
+}
+
+#define CDGL_TEXT_VERTEX(_lx, _ly, _s, _t)            \
+{                                                    \
+  *v++ = (GLfloat)(x + (_lx) * cos_a - (_ly) * sin_a);  \
+  *v++ = (GLfloat)(y + (_lx) * sin_a + (_ly) * cos_a);  \
+  *v++ = (GLfloat)(_s);                              \
+  *v++ = (GLfloat)(_t);                              \
+}
+
+/* Adds the quads of an UTF-8 string to the text batch, (x,y) is the baseline origin. */
+static void cdglTextQuads(cdCtxCanvas *ctxcanvas, cdglFont* font, const char* str, double x, double y, double angle)
+{
+  const unsigned char* s = (const unsigned char*)str;
+  unsigned int prev_index = 0;
+  int kerning = FT_HAS_KERNING(font->face);
+  double cos_a = 1, sin_a = 0, pen = 0;
+  int n = 0, nearest = (angle == 0);
+  GLfloat *v, *v0;
+
+  while (*s)
+  {
+    cdglNextChar(&s);
+    n++;
+  }
+
+  if (n == 0)
+    return;
+
+  v = v0 = cdglTextAdd(ctxcanvas, font, nearest, n, ctxcanvas->canvas->foreground);
+  if (!v)
+    return;
+
+  if (angle != 0)
+  {
+    cos_a = cos(CD_DEG2RAD * angle);
+    sin_a = sin(CD_DEG2RAD * angle);
+  }
+
+  s = (const unsigned char*)str;
+  while (*s)
+  {
+    cdglGlyph* glyph = cdglGetGlyph(font, cdglNextChar(&s));
+
+    if (kerning && prev_index && glyph->index)
+    {
+      FT_Vector delta;
+      if (!FT_Get_Kerning(font->face, prev_index, glyph->index, FT_KERNING_DEFAULT, &delta))
+        pen += delta.x / 64.0;
+    }
+
+    if (glyph->w)
+    {
+      double x0 = pen + glyph->left, 
+             y1 = glyph->top,
+             x1 = x0 + glyph->w,
+             y0 = y1 - glyph->h;
+
+      /* texture coordinates are in atlas pixels, because the atlas may grow 
+         before the batch is drawn, they are normalized by the texture matrix */
+      CDGL_TEXT_VERTEX(x0, y0, glyph->x, glyph->y + glyph->h);
+      CDGL_TEXT_VERTEX(x1, y0, glyph->x + glyph->w, glyph->y + glyph->h);
+      CDGL_TEXT_VERTEX(x1, y1, glyph->x + glyph->w, glyph->y);
+      CDGL_TEXT_VERTEX(x0, y0, glyph->x, glyph->y + glyph->h);
+      CDGL_TEXT_VERTEX(x1, y1, glyph->x + glyph->w, glyph->y);
+      CDGL_TEXT_VERTEX(x0, y1, glyph->x, glyph->y);
+    }
+
+    pen += glyph->advance;
+    prev_index = glyph->index;
+  }
+
+  ctxcanvas->text_count += (int)(v - v0) / 4;
+}
+
+static void cdglStrConvertToUTF8(cdCtxCanvas *ctxcanvas, const char* str, int len)
+{
+  /* glyphs are always searched by the Unicode value */
+  ctxcanvas->utf8_buffer = cdStrConvertToUTF8(str, len, ctxcanvas->utf8_buffer, &(ctxcanvas->utf8_buffer_len), ctxcanvas->utf8mode);
+}
+
+/******************************************************/
+
+static void cdglFlushVertices(cdCtxCanvas *ctxcanvas)
+{
+  int smooth = 0;
+
+  if (ctxcanvas->batch_count == 0)
+    return;
+
+  if (ctxcanvas->batch_mode == GL_TRIANGLES)
+  {
+    /* must disable polygon smooth or fill may get diagonal lines */
+    smooth = glIsEnabled(GL_POLYGON_SMOOTH);
+    if (smooth) glDisable(GL_POLYGON_SMOOTH);
+  }
+  else if (ctxcanvas->batch_mode == GL_POINTS)
+    glPointSize(1);
+
+  if (!ctxcanvas->batch_multicolor)
+    glColor4ub(cdRed(ctxcanvas->batch_first_color),
+               cdGreen(ctxcanvas->batch_first_color),
+               cdBlue(ctxcanvas->batch_first_color),
+               cdAlpha(ctxcanvas->batch_first_color));
+
+  if (ctxcanvas->batch_count <= CDGL_BATCH_SMALL)
+  {
+    /* interleaved primitives of different types produce small batches, 
+       the vertex arrays setup costs more than the vertices */
+    int i;
+
+    glBegin(ctxcanvas->batch_mode);
+    for (i = 0; i < ctxcanvas->batch_count; i++)
+    {
+      if (ctxcanvas->batch_multicolor)
+        glColor4ubv(ctxcanvas->batch_color + 4 * i);
+      glVertex2fv(ctxcanvas->batch_vertex + 2 * i);
+    }
+    glEnd();
+  }
+  else
+  {
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(2, GL_FLOAT, 0, ctxcanvas->batch_vertex);
+
+    if (ctxcanvas->batch_multicolor)
+    {
+      glEnableClientState(GL_COLOR_ARRAY);
+      glColorPointer(4, GL_UNSIGNED_BYTE, 0, ctxcanvas->batch_color);
+    }
+
+    glDrawArrays(ctxcanvas->batch_mode, 0, ctxcanvas->batch_count);
+
+    if (ctxcanvas->batch_multicolor)
+      glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+  }
+
+  if (smooth) glEnable(GL_POLYGON_SMOOTH);
+
+  /* restore the foreground color, 
+     it is also undefined after drawing with a color array */
+  glColor4ub(cdRed(ctxcanvas->canvas->foreground),
+             cdGreen(ctxcanvas->canvas->foreground),
+             cdBlue(ctxcanvas->canvas->foreground),
+             cdAlpha(ctxcanvas->canvas->foreground));
+
+  ctxcanvas->batch_count = 0;
+}
+
+static void cdglFlushBatch(cdCtxCanvas *ctxcanvas)
+{
+  /* only one of them is not empty */
+  cdglFlushText(ctxcanvas);
+  cdglFlushVertices(ctxcanvas);
+}
+
+/* Returns space for n vertices with the given color, in the current batch.
+   Returns NULL if the primitive must be drawn immediately, in this case the batch is already flushed. */
+static GLfloat* cdglBatchAdd(cdCtxCanvas *ctxcanvas, GLenum mode, int n, long color)
+{
+  GLfloat* vertex;
+  GLubyte* rgba;
+  int i;
+
+  cdglFlushText(ctxcanvas);
+
+  if (!ctxcanvas->batch || n > CDGL_BATCH_MAX)
+  {
+    cdglFlushBatch(ctxcanvas);
+    return NULL;
+  }
+
+  if (ctxcanvas->batch_count && (ctxcanvas->batch_mode != mode || ctxcanvas->batch_count + n > CDGL_BATCH_MAX))
+    cdglFlushBatch(ctxcanvas);
+
+  if (ctxcanvas->batch_count + n > ctxcanvas->batch_max)
+  {
+    int new_max = ctxcanvas->batch_max ? 2 * ctxcanvas->batch_max : 1024;
+    GLfloat* new_vertex;
+    GLubyte* new_color;
+
+    while (new_max < ctxcanvas->batch_count + n)
+      new_max *= 2;
+    if (new_max > CDGL_BATCH_MAX)
+      new_max = CDGL_BATCH_MAX;
+
+    new_vertex = (GLfloat*)realloc(ctxcanvas->batch_vertex, new_max * 2 * sizeof(GLfloat));
+    if (new_vertex) ctxcanvas->batch_vertex = new_vertex;
+    new_color = (GLubyte*)realloc(ctxcanvas->batch_color, new_max * 4);
+    if (new_color) ctxcanvas->batch_color = new_color;
+
+    if (!new_vertex || !new_color)
+    {
+      cdglFlushBatch(ctxcanvas);
+      return NULL;
+    }
+
+    ctxcanvas->batch_max = new_max;
+  }
+
+  if (ctxcanvas->batch_count == 0)
+  {
+    ctxcanvas->batch_first_color = color;
+    ctxcanvas->batch_multicolor = 0;
+  }
+  else if (color != ctxcanvas->batch_first_color)
+    ctxcanvas->batch_multicolor = 1;
+
+  ctxcanvas->batch_mode = mode;
+  vertex = ctxcanvas->batch_vertex + 2 * ctxcanvas->batch_count;
+  rgba = ctxcanvas->batch_color + 4 * ctxcanvas->batch_count;
+
+  for (i = 0; i < n; i++)
+  {
+    *rgba++ = cdRed(color);
+    *rgba++ = cdGreen(color);
+    *rgba++ = cdBlue(color);
+    *rgba++ = cdAlpha(color);
+  }
+
+  ctxcanvas->batch_count += n;
+  return vertex;
+}
+
+#define CDGL_POLY_X(_i) (poly ? (double)poly[_i].x : fpoly[_i].x)
+#define CDGL_POLY_Y(_i) (poly ? (double)poly[_i].y : fpoly[_i].y)
+
+/******************************************************/
+/* Filled polygon tessellation                        */
+/******************************************************/
+
+/* GL_POLYGON is defined only for convex polygons. Other polygons are decomposed 
+   in trapezoids, using a sweep line from bottom to top. 
+   Self-intersections and holes are supported, using the even-odd or the winding rule. */
+
+typedef struct _cdglEdge
+{
+  double x0, y0, y1;  /* y0 < y1 */
+  double dxdy;
+  int dir;            /* +1 or -1, original orientation, for the winding rule */
+  int trap;           /* trapezoid where it is the left edge, or -1 */
+} cdglEdge;
+
+typedef struct _cdglTrapezoid
+{
+  cdglEdge *left, *right;
+  double ybot;
+  int ended;
+} cdglTrapezoid;
+
+#define cdglEdgeX(_e, _y) ((_e)->x0 + ((_y) - (_e)->y0) * (_e)->dxdy)
+
+static int cdglIsConvex(const cdPoint* poly, const cdfPoint* fpoly, int n)
+{
+  /* all turns to the same side, and the x direction changes at most twice, 
+     so it is also not self-intersecting */
+  int i, turn = 0, xdir = 0, xchanges = 0;
+
+  for (i = 0; i < n; i++)
+  {
+    int i1 = (i + 1) % n, i2 = (i + 2) % n;
+    double dx1 = CDGL_POLY_X(i1) - CDGL_POLY_X(i);
+    double dy1 = CDGL_POLY_Y(i1) - CDGL_POLY_Y(i);
+    double dx2 = CDGL_POLY_X(i2) - CDGL_POLY_X(i1);
+    double dy2 = CDGL_POLY_Y(i2) - CDGL_POLY_Y(i1);
+    double cross = dx1 * dy2 - dy1 * dx2;
+
+    if (cross != 0)
+    {
+      int t = cross > 0 ? 1 : -1;
+      if (turn && t != turn)
+        return 0;
+      turn = t;
+    }
+
+    if (dx1 != 0)
+    {
+      int d = dx1 > 0 ? 1 : -1;
+      if (xdir && d != xdir)
+      {
+        xchanges++;
+        if (xchanges > 2)
+          return 0;
+      }
+      xdir = d;
+    }
+  }
+
+  return 1;
+}
+
+static int cdglCompareEdge(const void* a, const void* b)
+{
+  const cdglEdge* e1 = (const cdglEdge*)a;
+  const cdglEdge* e2 = (const cdglEdge*)b;
+  if (e1->y0 < e2->y0) return -1;
+  if (e1->y0 > e2->y0) return 1;
+  return 0;
+}
+
+static int cdglCompareDouble(const void* a, const void* b)
+{
+  double d1 = *(const double*)a;
+  double d2 = *(const double*)b;
+  if (d1 < d2) return -1;
+  if (d1 > d2) return 1;
+  return 0;
+}
+
+static int cdglAddTriangle(cdglTriangles* tri, double x1, double y1, double x2, double y2, double x3, double y3)
+{
+  GLfloat* v;
+
+  if (tri->count + 3 > tri->max)
+  {
+    int new_max = tri->max ? 2 * tri->max : 256;
+    GLfloat* new_v = (GLfloat*)realloc(tri->v, new_max * 2 * sizeof(GLfloat));
+    if (!new_v)
+      return 0;
+    tri->v = new_v;
+    tri->max = new_max;
+  }
+
+  v = tri->v + 2 * tri->count;
+  *v++ = (GLfloat)x1; *v++ = (GLfloat)y1;
+  *v++ = (GLfloat)x2; *v++ = (GLfloat)y2;
+  *v++ = (GLfloat)x3; *v++ = (GLfloat)y3;
+  tri->count += 3;
+  return 1;
+}
+
+/* Sorts the active edges by x at y, ties are sorted by slope (the order just above y).
+   The list is almost always sorted, so use insertion sort. */
+static void cdglSortActive(cdglEdge** active, int count, double y, double eps)
+{
+  int i, j;
+  for (i = 1; i < count; i++)
+  {
+    cdglEdge* e = active[i];
+    double x = cdglEdgeX(e, y);
+
+    for (j = i - 1; j >= 0; j--)
+    {
+      double xj = cdglEdgeX(active[j], y);
+      if (xj < x - eps || (xj <= x + eps && active[j]->dxdy <= e->dxdy))
+        break;
+      active[j + 1] = active[j];
+    }
+    active[j + 1] = e;
+  }
+}
+
+static int cdglAddTrapezoid(cdglTriangles* tri, cdglTrapezoid* trap, double ytop)
+{
+  double ybot = trap->ybot;
+  double x1b = cdglEdgeX(trap->left, ybot), x1t = cdglEdgeX(trap->left, ytop);
+  double x2b = cdglEdgeX(trap->right, ybot), x2t = cdglEdgeX(trap->right, ytop);
+
+  if (x2b > x1b && !cdglAddTriangle(tri, x1b, ybot, x2b, ybot, x2t, ytop))
+    return 0;
+  if (x2t > x1t && !cdglAddTriangle(tri, x1b, ybot, x2t, ytop, x1t, ytop))
+    return 0;
+  return 1;
+}
+
+/* Finds the inside intervals between the sorted active edges, starting at ybot.
+   Intervals between the same pair of edges continue the trapezoids of the previous slab, 
+   the others start new trapezoids. Trapezoids that do not continue are output. */
+static int cdglTessSlab(cdglTriangles* tri, cdglEdge** active, int count, double ybot, int fill_mode,
+                        cdglTrapezoid* traps, int *trap_count, cdglTrapezoid* new_traps)
+{
+  int i, t, new_count = 0, winding = 0;
+
+  for (i = 0; i < count - 1; i++)
+  {
+    cdglEdge* e1 = active[i];
+    cdglEdge* e2 = active[i + 1];
+    int inside;
+
+    winding += e1->dir;
+
+    if (fill_mode == CD_EVENODD)
+      inside = winding & 1;
+    else
+      inside = winding != 0;
+
+    if (inside)
+    {
+      t = e1->trap;
+      if (t >= 0 && traps[t].right == e2)
+      {
+        traps[t].ended = 0;
+        new_traps[new_count] = traps[t];
+      }
+      else
+      {
+        new_traps[new_count].left = e1;
+        new_traps[new_count].right = e2;
+        new_traps[new_count].ybot = ybot;
+      }
+      new_count++;
+    }
+  }
+
+  for (t = 0; t < *trap_count; t++)
+  {
+    if (traps[t].ended && !cdglAddTrapezoid(tri, traps + t, ybot))
+      return 0;
+    traps[t].left->trap = -1;
+  }
+
+  for (t = 0; t < new_count; t++)
+  {
+    traps[t] = new_traps[t];
+    traps[t].ended = 1;
+    traps[t].left->trap = t;
+  }
+  *trap_count = new_count;
+
+  return 1;
+}
+
+static int cdglTessPolygon(cdglTriangles* tri, const cdfPoint* poly, int n, int fill_mode)
+{
+  cdglEdge *edges, **active;
+  cdglTrapezoid *traps, *new_traps;
+  double *ys, eps, ybot = 0, scale = 0;
+  int i, e, k, edge_count = 0, ys_count = 0, active_count = 0, trap_count = 0, ret = 1;
+
+  edges = (cdglEdge*)malloc(n * sizeof(cdglEdge));
+  active = (cdglEdge**)malloc(n * sizeof(cdglEdge*));
+  traps = (cdglTrapezoid*)malloc(n * sizeof(cdglTrapezoid));
+  new_traps = (cdglTrapezoid*)malloc(n * sizeof(cdglTrapezoid));
+  ys = (double*)malloc(2 * n * sizeof(double));
+  if (!edges || !active || !traps || !new_traps || !ys)
+  {
+    ret = 0;
+    goto tess_end;
+  }
+
+  for (i = 0; i < n; i++)
+  {
+    const cdfPoint* p1 = poly + i;
+    const cdfPoint* p2 = poly + (i + 1) % n;
+    cdglEdge* edge;
 
-*/
-static char hatches[NUM_HATCHES][8] = {
-  {0x00,0x00,0xFF,0x00,0x00,0x00,0xFF,0x00},  /* HORIZONTAL */
-  {0x22,0x22,0x22,0x22,0x22,0x22,0x22,0x22},  /* VERTICAL */
-  {0x08,0x10,0x20,0x40,0x80,0x01,0x02,0x04},  /* FDIAGONAL */
-  {0x10,0x08,0x04,0x02,0x01,0x80,0x40,0x20},  /* BDIAGONAL */
-  {0x22,0x22,0xFF,0x22,0x22,0x22,0xFF,0x22},  /* CROSS */
-  {0x18,0x18,0x24,0x42,0x81,0x81,0x42,0x24}   /* DIAGCROSS */
-};
+    if (fabs(p1->x) > scale) scale = fabs(p1->x);
+    if (fabs(p1->y) > scale) scale = fabs(p1->y);
 
+    if (p1->y == p2->y)  /* horizontal edges do not change the winding */
+      continue;
 
-typedef struct _cdglFontCache
-{
-  char filename[10240];
-  int size;
-  FTGLfont *font;
-} cdglFontCache;
+    edge = edges + edge_count;
+    if (p1->y < p2->y)
+    {
+      edge->x0 = p1->x; edge->y0 = p1->y; edge->y1 = p2->y;
+      edge->dir = 1;
+    }
+    else
+    {
+      edge->x0 = p2->x; edge->y0 = p2->y; edge->y1 = p1->y;
+      edge->dir = -1;
+    }
+    edge->dxdy = (p2->x - p1->x) / (p2->y - p1->y);
+    edge->trap = -1;
 
+    ys[ys_count++] = p1->y;
+    ys[ys_count++] = p2->y;
+    edge_count++;
+  }
 
-struct _cdCtxImage
-{
-  unsigned int w, h;
-  GLubyte* img;     /* always RGBA 32bpp */
-  GLuint texture;
-};
+  eps = (scale + 1.0) * 1e-12;
 
-struct _cdCtxCanvas
-{
-  cdCanvas* canvas;
+  qsort(edges, edge_count, sizeof(cdglEdge), cdglCompareEdge);
+  qsort(ys, ys_count, sizeof(double), cdglCompareDouble);
+
+  e = 0;
+  for (k = 0; k < ys_count - 1 && ret; k++)
+  {
+    double ynext = ys[k + 1];
+    ybot = ys[k];
+    if (ynext == ybot)
+      continue;
 
-  FTGLfont *font;
+    /* update the active edge list */
+    for (i = 0; i < active_count; )
+    {
+      if (active[i]->y1 <= ybot)
+        active[i] = active[--active_count];
+      else
+        i++;
+    }
+    while (e < edge_count && edges[e].y0 <= ybot)
+    {
+      if (edges[e].y1 > ybot)
+        active[active_count++] = edges + e;
+      e++;
+    }
 
-  double rotate_angle;
-  int rotate_center_x;
-  int rotate_center_y;
+    /* the slab is divided at the edge intersections */
+    while (ybot < ynext && ret)
+    {
+      double ytop = ynext;
 
-  char* utf8_buffer;
-  int utf8mode, utf8_buffer_len;
+      cdglSortActive(active, active_count, ybot, eps);
 
-  cdglFontCache* gl_fonts;
-  int gl_fonts_count;
-  int gl_fonts_max;
+      /* the first intersection above ybot is between adjacent edges */
+      for (i = 0; i < active_count - 1; i++)
+      {
+        cdglEdge* e1 = active[i];
+        cdglEdge* e2 = active[i + 1];
+
+        if (e1->dxdy > e2->dxdy && cdglEdgeX(e1, ytop) > cdglEdgeX(e2, ytop) + eps)
+        {
+          double yc = ybot + (cdglEdgeX(e2, ybot) - cdglEdgeX(e1, ybot)) / (e1->dxdy - e2->dxdy);
+          if (yc < ytop)
+            ytop = yc;
+        }
+      }
 
-  int texture_filter;
-};
+      if (ytop <= ybot)  /* numerical noise, do not stop */
+        ytop = ybot + eps;
+      if (ytop > ynext)
+        ytop = ynext;
 
-/******************************************************/
+      ret = cdglTessSlab(tri, active, active_count, ybot, fill_mode, traps, &trap_count, new_traps);
+      ybot = ytop;
+    }
+  }
+
+  /* output the last trapezoids */
+  for (i = 0; i < trap_count && ret; i++)
+    ret = cdglAddTrapezoid(tri, traps + i, ybot);
+
+tess_end:
+  if (edges) free(edges);
+  if (active) free(active);
+  if (traps) free(traps);
+  if (new_traps) free(new_traps);
+  if (ys) free(ys);
+  return ret;
+}
+
+static void cdglFreeTessCache(cdglTessCache* cache)
+{
+  if (cache->poly) free(cache->poly);
+  if (cache->tri.v) free(cache->tri.v);
+  memset(cache, 0, sizeof(cdglTessCache));
+}
 
-static FTGLfont* cdglGetFont(cdCtxCanvas *ctxcanvas, const char* filename, int size, int res)
+static unsigned long long cdglHashPoly(const cdfPoint* poly, int n)
 {
+  /* FNV-1a over the coordinates bits */
+  unsigned long long hash = 14695981039346656037ULL;
   int i;
-  FTGLfont* font;
+  for (i = 0; i < n; i++)
+  {
+    unsigned long long x, y;
+    memcpy(&x, &poly[i].x, sizeof(double));
+    memcpy(&y, &poly[i].y, sizeof(double));
+    hash = (hash ^ x) * 1099511628211ULL;
+    hash = (hash ^ y) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+static void cdglFillTriangles(cdCtxCanvas *ctxcanvas, const GLfloat* tri, int count)
+{
+  cdCanvas* canvas = ctxcanvas->canvas;
+  int smooth;
+
+  if (count == 0)
+    return;
 
-  if (!ctxcanvas->gl_fonts)
+  /* opaque hatch is drawn in two passes with different states */
+  if (canvas->interior_style != CD_HATCH || canvas->back_opacity != CD_OPAQUE)
   {
-    ctxcanvas->gl_fonts_max = 10;
-    ctxcanvas->gl_fonts_count = 0;
-    ctxcanvas->gl_fonts = malloc(sizeof(cdglFontCache)*ctxcanvas->gl_fonts_max);
+    GLfloat* v = cdglBatchAdd(ctxcanvas, GL_TRIANGLES, count, canvas->foreground);
+    if (v)
+    {
+      memcpy(v, tri, count * 2 * sizeof(GLfloat));
+      return;
+    }
   }
+  else
+    cdglFlushBatch(ctxcanvas);
 
-  /* search for an existent font */
-  for (i = 0; i < ctxcanvas->gl_fonts_count; i++)
+  /* must disable polygon smooth or fill may get diagonal lines */
+  smooth = glIsEnabled(GL_POLYGON_SMOOTH);
+  if (smooth) glDisable(GL_POLYGON_SMOOTH);
+
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glVertexPointer(2, GL_FLOAT, 0, tri);
+
+  if (canvas->back_opacity == CD_OPAQUE && glIsEnabled(GL_POLYGON_STIPPLE))
   {
-    if (cdStrEqualNoCase(ctxcanvas->gl_fonts[i].filename, filename) &&
-        ctxcanvas->gl_fonts[i].size == size)
-      return ctxcanvas->gl_fonts[i].font;
+    /* draw twice, one with background color only, and one with foreground color */
+    glDisable(GL_POLYGON_STIPPLE);
+    glColor4ub(cdRed(canvas->background),
+               cdGreen(canvas->background),
+               cdBlue(canvas->background),
+               cdAlpha(canvas->background));
+
+    glDrawArrays(GL_TRIANGLES, 0, count);
+
+    /* restore the foreground color */
+    glColor4ub(cdRed(canvas->foreground),
+               cdGreen(canvas->foreground),
+               cdBlue(canvas->foreground),
+               cdAlpha(canvas->foreground));
+    glEnable(GL_POLYGON_STIPPLE);
   }
 
-  /* not found, create a new font and add it to the cache */
+  glDrawArrays(GL_TRIANGLES, 0, count);
 
-  font = ftglCreateTextureFont(filename);
-  if (!font)
-    return NULL;
+  glDisableClientState(GL_VERTEX_ARRAY);
+
+  if (smooth) glEnable(GL_POLYGON_SMOOTH);
+}
 
-  ftglSetFontFaceSize(font, size, res);
+/* Fills a non convex polygon, using either poly or fpoly.
+   The triangles of the last polygons are cached, so the same polygon drawn again is not tessellated again. 
+   Returns 0 if failed. */
+static int cdglFillTess(cdCtxCanvas *ctxcanvas, const cdPoint* poly, const cdfPoint* fpoly, int n)
+{
+  int i, fill_mode = ctxcanvas->canvas->fill_mode;
+  unsigned long long hash;
+  cdglTessCache* cache;
 
-  if (ctxcanvas->gl_fonts_count == ctxcanvas->gl_fonts_max)
+  if (poly)
   {
-    ctxcanvas->gl_fonts_max += 10;
-    ctxcanvas->gl_fonts = realloc(ctxcanvas->gl_fonts, sizeof(cdglFontCache)*ctxcanvas->gl_fonts_max);
+    if (n > ctxcanvas->tess_poly_max)
+    {
+      cdfPoint* new_poly = (cdfPoint*)realloc(ctxcanvas->tess_poly, n * sizeof(cdfPoint));
+      if (!new_poly)
+        return 0;
+      ctxcanvas->tess_poly = new_poly;
+      ctxcanvas->tess_poly_max = n;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+      ctxcanvas->tess_poly[i].x = poly[i].x;
+      ctxcanvas->tess_poly[i].y = poly[i].y;
+    }
+
+    fpoly = ctxcanvas->tess_poly;
   }
 
-  ctxcanvas->gl_fonts[ctxcanvas->gl_fonts_count].font = font;
-  strcpy(ctxcanvas->gl_fonts[ctxcanvas->gl_fonts_count].filename, filename);
-  ctxcanvas->gl_fonts[ctxcanvas->gl_fonts_count].size = size;
+  hash = cdglHashPoly(fpoly, n);
 
-  ctxcanvas->gl_fonts_count++;
-  return font;
+  for (i = 0; i < CDGL_TESS_CACHE_SIZE; i++)
+  {
+    cache = ctxcanvas->tess_cache + i;
+    if (cache->poly && cache->hash == hash && cache->n == n && cache->fill_mode == fill_mode &&
+        memcmp(cache->poly, fpoly, n * sizeof(cdfPoint)) == 0)
+    {
+      cdglFillTriangles(ctxcanvas, cache->tri.v, cache->tri.count);
+      return 1;
+    }
+  }
+
+  /* not found, replace the oldest entry */
+  cache = ctxcanvas->tess_cache + ctxcanvas->tess_cache_next;
+  ctxcanvas->tess_cache_next = (ctxcanvas->tess_cache_next + 1) % CDGL_TESS_CACHE_SIZE;
+  cdglFreeTessCache(cache);
+
+  if (!cdglTessPolygon(&cache->tri, fpoly, n, fill_mode))
+  {
+    cdglFreeTessCache(cache);
+    return 0;
+  }
+
+  cdglFillTriangles(ctxcanvas, cache->tri.v, cache->tri.count);
+
+  cache->poly = (cdfPoint*)malloc(n * sizeof(cdfPoint));
+  if (!cache->poly)
+  {
+    cdglFreeTessCache(cache);
+    return 1;
+  }
+
+  memcpy(cache->poly, fpoly, n * sizeof(cdfPoint));
+  cache->hash = hash;
+  cache->n = n;
+  cache->fill_mode = fill_mode;
+  return 1;
 }
 
-static void cdglStrConvertToUTF8(cdCtxCanvas *ctxcanvas, const char* str, int len)
+
+/* Adds a polygon or a polyline to the batch, using either poly or fpoly.
+   Convex filled polygons are converted to a triangle fan, others are tessellated, 
+   and polylines are converted to independent segments.
+   Returns 0 if it must be drawn immediately, in this case the batch is already flushed. */
+static int cdglBatchPoly(cdCtxCanvas *ctxcanvas, int mode, const cdPoint* poly, const cdfPoint* fpoly, int n)
 {
-  /* FTGL multibyte strings are always UTF-8 */
-  ctxcanvas->utf8_buffer = cdStrConvertToUTF8(str, len, ctxcanvas->utf8_buffer, &(ctxcanvas->utf8_buffer_len), ctxcanvas->utf8mode);
+  cdCanvas* canvas = ctxcanvas->canvas;
+  GLfloat* v;
+  int i, count;
+
+  if (mode == CD_FILL)
+  {
+    if (n >= 3 && !cdglIsConvex(poly, fpoly, n) && cdglFillTess(ctxcanvas, poly, fpoly, n))
+      return 1;
+
+    /* opaque hatch is drawn in two passes with different states */
+    if (n < 3 || (canvas->interior_style == CD_HATCH && canvas->back_opacity == CD_OPAQUE))
+    {
+      cdglFlushBatch(ctxcanvas);
+      return 0;
+    }
+
+    v = cdglBatchAdd(ctxcanvas, GL_TRIANGLES, 3 * (n - 2), canvas->foreground);
+    if (!v)
+      return 0;
+
+    for (i = 1; i < n - 1; i++)
+    {
+      *v++ = (GLfloat)CDGL_POLY_X(0);     *v++ = (GLfloat)CDGL_POLY_Y(0);
+      *v++ = (GLfloat)CDGL_POLY_X(i);     *v++ = (GLfloat)CDGL_POLY_Y(i);
+      *v++ = (GLfloat)CDGL_POLY_X(i + 1); *v++ = (GLfloat)CDGL_POLY_Y(i + 1);
+    }
+    return 1;
+  }
+
+  /* the line style pattern must continue along the polyline */
+  if (n < 2 || canvas->line_style != CD_CONTINUOUS)
+  {
+    cdglFlushBatch(ctxcanvas);
+    return 0;
+  }
+
+  count = (mode == CD_CLOSED_LINES) ? n : n - 1;
+
+  v = cdglBatchAdd(ctxcanvas, GL_LINES, 2 * count, canvas->foreground);
+  if (!v)
+    return 0;
+
+  for (i = 0; i < count; i++)
+  {
+    int i2 = (i + 1) % n;
+    *v++ = (GLfloat)CDGL_POLY_X(i);  *v++ = (GLfloat)CDGL_POLY_Y(i);
+    *v++ = (GLfloat)CDGL_POLY_X(i2); *v++ = (GLfloat)CDGL_POLY_Y(i2);
+  }
+  return 1;
 }
 
 static void cdglGetImageData(GLubyte* glImage, unsigned char *r, unsigned char *g, unsigned char *b, int w, int h)
@@ -338,56 +1548,289 @@ static int iGLIsOpenGL2orMore(void)
     return 0;
 }
 
-static GLuint cdglCreateTexture(void)
-{
-  GLuint texture;
-  glGenTextures(1, &texture);
-  glBindTexture(GL_TEXTURE_2D, texture);
-  return texture;
+static GLuint cdglCreateTexture(void)
+{
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  return texture;
+}
+
+static int cdglBeginTexture(cdCtxCanvas *ctxcanvas, GLuint texture)
+{
+  int smooth = glIsEnabled(GL_POLYGON_SMOOTH);
+  if (smooth) glDisable(GL_POLYGON_SMOOTH);
+  glEnable(GL_TEXTURE_2D);
+
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, ctxcanvas->texture_filter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, ctxcanvas->texture_filter);
+
+  return smooth;
+}
+
+static void cdglEndTexture(int smooth)
+{
+  glDisable(GL_TEXTURE_2D);
+  if (smooth) glEnable(GL_POLYGON_SMOOTH);
+}
+
+static void cdglDrawTextureImage(cdCtxCanvas *ctxcanvas, GLuint texture, double x, double y, double w, double h)
+{
+  double x2 = x + w - 1;
+  double y2 = y + h - 1;
+
+  int smooth = cdglBeginTexture(ctxcanvas, texture);
+
+  glBegin(GL_QUADS);
+  glTexCoord2d(0.0, 0.0); glVertex2d(x, y);
+  glTexCoord2d(1.0, 0.0); glVertex2d(x2 + 0.375, y);
+  glTexCoord2d(1.0, 1.0); glVertex2d(x2 + 0.375, y2 + 0.375);
+  glTexCoord2d(0.0, 1.0); glVertex2d(x, y2 + 0.375);
+  glEnd();
+
+  cdglEndTexture(smooth);
+}
+
+/******************************************************/
+
+/* Computes the key of the image region, its hash is 0 if the texture cache is not used. */
+static void cdglImageKeyRGBA(cdCtxCanvas *ctxcanvas, cdImageKey* key, int iw, const unsigned char *r, const unsigned char *g, const unsigned char *b, const unsigned char *a, 
+                             int xmin, int ymin, int rw, int rh)
+{
+  if (ctxcanvas->tex_cache_size == 0 || !iGLIsOpenGL2orMore())
+    key->hash = 0;
+  else
+    cdImageKeyRGBA(key, ctxcanvas->img_id, 0, iw, r, g, b, a, xmin, ymin, rw, rh);
+}
+
+static void cdglImageKeyMap(cdCtxCanvas *ctxcanvas, cdImageKey* key, int iw, const unsigned char *index, const long int *colors, 
+                            int xmin, int ymin, int rw, int rh)
+{
+  if (ctxcanvas->tex_cache_size == 0 || !iGLIsOpenGL2orMore())
+    key->hash = 0;
+  else
+    cdImageKeyMap(key, ctxcanvas->img_id, 0, iw, index, colors, xmin, ymin, rw, rh);
+}
+
+/* The hash is confirmed comparing the image contents, unless IMGID is used. */
+static int cdglFindTexture(cdCtxCanvas *ctxcanvas, const cdImageKey* key, int w, int h, GLenum format)
+{
+  int i;
+  for (i = 0; i < ctxcanvas->tex_count; i++)
+  {
+    cdglTexture* tex = ctxcanvas->tex_cache + i;
+    if (tex->key == key->hash && tex->w == w && tex->h == h && tex->format == format &&
+        cdImageKeyMatch(key, tex->key_data))
+      return i;
+  }
+  return -1;
+}
+
+static unsigned long cdglTextureBytes(int w, int h, GLenum format, int key_size)
+{
+  return (unsigned long)w * h * (format == GL_RGBA ? 4 : 3) + key_size;
+}
+
+/* Removes the least recently used textures until size bytes are available.
+   If a removed texture has the given dimensions, it is not deleted and returned, so it can be reused. */
+static GLuint cdglFreeTextures(cdCtxCanvas *ctxcanvas, unsigned long size, int w, int h, GLenum format)
+{
+  GLuint reuse = 0;
+
+  while (ctxcanvas->tex_count > 0 && ctxcanvas->tex_bytes + size > ctxcanvas->tex_cache_size)
+  {
+    int i, lru = 0;
+    cdglTexture* tex;
+
+    for (i = 1; i < ctxcanvas->tex_count; i++)
+    {
+      if (ctxcanvas->tex_cache[i].tick < ctxcanvas->tex_cache[lru].tick)
+        lru = i;
+    }
+
+    tex = ctxcanvas->tex_cache + lru;
+    if (!reuse && tex->w == w && tex->h == h && tex->format == format)
+      reuse = tex->texture;
+    else
+      glDeleteTextures(1, &tex->texture);
+
+    ctxcanvas->tex_bytes -= cdglTextureBytes(tex->w, tex->h, tex->format, tex->key_size);
+    if (tex->key_data) free(tex->key_data);
+    ctxcanvas->tex_count--;
+    *tex = ctxcanvas->tex_cache[ctxcanvas->tex_count];
+  }
+
+  return reuse;
+}
+
+static void cdglFreeTextureCache(cdCtxCanvas *ctxcanvas)
+{
+  int i;
+  for (i = 0; i < ctxcanvas->tex_count; i++)
+  {
+    glDeleteTextures(1, &ctxcanvas->tex_cache[i].texture);
+    if (ctxcanvas->tex_cache[i].key_data) free(ctxcanvas->tex_cache[i].key_data);
+  }
+
+  ctxcanvas->tex_count = 0;
+  ctxcanvas->tex_bytes = 0;
+}
+
+/* IMGUPDATE, uploads only the dirty rectangle of the image region to the texture. 
+   Returns 0 if the whole image must be uploaded. */
+static int cdglUpdateTexture(cdCtxCanvas *ctxcanvas, cdglTexture* tex, const cdImageKey* key, GLenum format)
+{
+  int xmin = key->xmin, 
+      xmax = key->xmin + key->rw - 1, 
+      ymin = key->ymin, 
+      ymax = key->ymin + key->rh - 1;
+  GLubyte* glImage;
+
+  if (ctxcanvas->img_update_rect)
+  {
+    if (ctxcanvas->img_update_xmin > xmin) xmin = ctxcanvas->img_update_xmin;
+    if (ctxcanvas->img_update_xmax < xmax) xmax = ctxcanvas->img_update_xmax;
+    if (ctxcanvas->img_update_ymin > ymin) ymin = ctxcanvas->img_update_ymin;
+    if (ctxcanvas->img_update_ymax < ymax) ymax = ctxcanvas->img_update_ymax;
+  }
+
+  ctxcanvas->img_update = 0;
+
+  if (xmin > xmax || ymin > ymax)
+    return 1;  /* outside the region, nothing to update */
+
+  if (key->index)
+    glImage = cdglCreateImageMap(xmin, ymin, xmax - xmin + 1, ymax - ymin + 1, key->colors, key->index, key->iw);
+  else
+    glImage = cdglCreateImageRGBA(xmin, ymin, xmax - xmin + 1, ymax - ymin + 1, key->r, key->g, key->b, key->a, key->iw);
+  if (!glImage)
+  {
+    ctxcanvas->img_update = 1;
+    return 0;
+  }
+
+  glBindTexture(GL_TEXTURE_2D, tex->texture);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, xmin - key->xmin, ymin - key->ymin, xmax - xmin + 1, ymax - ymin + 1, format, GL_UNSIGNED_BYTE, glImage);
+
+  free(glImage);
+  return 1;
+}
+
+/* Draws the image from the texture cache, if found. */
+static int cdglPutCachedImage(cdCtxCanvas *ctxcanvas, const cdImageKey* key, int rw, int rh, GLenum format, double x, double y, double w, double h)
+{
+  int i;
+
+  if (!key->hash)
+    return 0;
+
+  i = cdglFindTexture(ctxcanvas, key, rw, rh, format);
+  if (i < 0)
+  {
+    ctxcanvas->tex_misses++;
+    return 0;
+  }
+
+  cdglFlushBatch(ctxcanvas);
+
+  if (ctxcanvas->img_update && ctxcanvas->img_id)
+  {
+    ctxcanvas->tex_misses++;
+    if (!cdglUpdateTexture(ctxcanvas, ctxcanvas->tex_cache + i, key, format))
+      return 0;
+  }
+  else
+    ctxcanvas->tex_hits++;
+
+  ctxcanvas->tex_cache[i].tick = ++ctxcanvas->tex_tick;
+  cdglDrawTextureImage(ctxcanvas, ctxcanvas->tex_cache[i].texture, x, y, w, h);
+  return 1;
 }
 
-static int cdglBeginTexture(cdCtxCanvas *ctxcanvas, GLuint texture)
+/* Uploads the image to a cached texture. Returns 0 if it can not be cached. */
+static GLuint cdglCacheTexture(cdCtxCanvas *ctxcanvas, const cdImageKey* key, int rw, int rh, GLenum format, const unsigned char* glImage)
 {
-  int smooth = glIsEnabled(GL_POLYGON_SMOOTH);
-  if (smooth) glDisable(GL_POLYGON_SMOOTH);
-  glEnable(GL_TEXTURE_2D);
+  unsigned long size;
+  unsigned char* key_data;
+  int key_size = 0;
+  cdglTexture* tex;
+  GLuint texture;
+  int i;
 
-  glBindTexture(GL_TEXTURE_2D, texture);
-  glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+  i = cdglFindTexture(ctxcanvas, key, rw, rh, format);
+  if (i >= 0)
+  {
+    /* IMGUPDATE without memory for the dirty rectangle, update all the contents */
+    tex = ctxcanvas->tex_cache + i;
+    tex->tick = ++ctxcanvas->tex_tick;
+    ctxcanvas->img_update = 0;
+
+    glBindTexture(GL_TEXTURE_2D, tex->texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, rw, rh, format, GL_UNSIGNED_BYTE, glImage);
+    return tex->texture;
+  }
 
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, ctxcanvas->texture_filter);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, ctxcanvas->texture_filter);
+  ctxcanvas->img_update = 0;
 
-  return smooth;
-}
+  if (ctxcanvas->tex_count == ctxcanvas->tex_max)
+  {
+    int new_max = ctxcanvas->tex_max + 32;
+    cdglTexture* new_cache = (cdglTexture*)realloc(ctxcanvas->tex_cache, new_max * sizeof(cdglTexture));
+    if (!new_cache)
+      return 0;
+    ctxcanvas->tex_cache = new_cache;
+    ctxcanvas->tex_max = new_max;
+  }
 
-static void cdglEndTexture(int smooth)
-{
-  glDisable(GL_TEXTURE_2D);
-  if (smooth) glEnable(GL_POLYGON_SMOOTH);
-}
+  /* a copy of the contents confirms the hash in the next searches */
+  key_data = cdImageKeyData(key, &key_size);
+  if (!key_data && !key->img_id)
+    return 0;
 
-static void cdglDrawTextureImage(cdCtxCanvas *ctxcanvas, GLuint texture, double x, double y, double w, double h)
-{
-  double x2 = x + w - 1;
-  double y2 = y + h - 1;
+  size = cdglTextureBytes(rw, rh, format, key_size);
+  if (size > ctxcanvas->tex_cache_size)
+  {
+    if (key_data) free(key_data);
+    return 0;
+  }
 
-  int smooth = cdglBeginTexture(ctxcanvas, texture);
+  texture = cdglFreeTextures(ctxcanvas, size, rw, rh, format);
+  if (texture)
+  {
+    /* same dimensions, reuse the texture storage */
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, rw, rh, format, GL_UNSIGNED_BYTE, glImage);
+  }
+  else
+  {
+    texture = cdglCreateTexture();
+    glTexImage2D(GL_TEXTURE_2D, 0, format, rw, rh, 0, format, GL_UNSIGNED_BYTE, glImage);
+  }
 
-  glBegin(GL_QUADS);
-  glTexCoord2d(0.0, 0.0); glVertex2d(x, y);
-  glTexCoord2d(1.0, 0.0); glVertex2d(x2 + 0.375, y);
-  glTexCoord2d(1.0, 1.0); glVertex2d(x2 + 0.375, y2 + 0.375);
-  glTexCoord2d(0.0, 1.0); glVertex2d(x, y2 + 0.375);
-  glEnd();
+  tex = ctxcanvas->tex_cache + ctxcanvas->tex_count;
+  tex->key = key->hash;
+  tex->key_data = key_data;
+  tex->key_size = key_size;
+  tex->w = rw;
+  tex->h = rh;
+  tex->format = format;
+  tex->texture = texture;
+  tex->tick = ++ctxcanvas->tex_tick;
+  ctxcanvas->tex_count++;
+  ctxcanvas->tex_bytes += size;
 
-  cdglEndTexture(smooth);
+  return texture;
 }
 
-static void cdglPutImage(cdCtxCanvas *ctxcanvas, int rw, int rh, const unsigned char* glImage, int format, int x, int y, int w, int h)
+static void cdglPutImage(cdCtxCanvas *ctxcanvas, const cdImageKey* key, int rw, int rh, const unsigned char* glImage, int format, int x, int y, int w, int h)
 {
+  cdglFlushBatch(ctxcanvas);
+
   if (iGLIsOpenGL2orMore())
   {
     /* Texture is faster(?), will follow the transformations, follow clipping,
@@ -395,7 +1838,14 @@ static void cdglPutImage(cdCtxCanvas *ctxcanvas, int rw, int rh, const unsigned
     Its maximum size is 3379 (GL_MAX_TEXTURE_SIZE).
     In OpenGL 1.x its size must be a power of two.
     */
-    GLuint texture = cdglCreateTexture();
+    GLuint texture = key->hash ? cdglCacheTexture(ctxcanvas, key, rw, rh, format, glImage) : 0;
+    if (texture)
+    {
+      cdglDrawTextureImage(ctxcanvas, texture, x, y, w, h);
+      return;
+    }
+
+    texture = cdglCreateTexture();
 
     glTexImage2D(GL_TEXTURE_2D, 0, format, rw, rh, 0, format, GL_UNSIGNED_BYTE, glImage);
 
@@ -421,8 +1871,10 @@ static void cdglPutImage(cdCtxCanvas *ctxcanvas, int rw, int rh, const unsigned
   }
 }
 
-static void cdglfPutImage(cdCtxCanvas *ctxcanvas, int rw, int rh, const unsigned char* glImage, int format, double x, double y, double w, double h)
+static void cdglfPutImage(cdCtxCanvas *ctxcanvas, const cdImageKey* key, int rw, int rh, const unsigned char* glImage, int format, double x, double y, double w, double h)
 {
+  cdglFlushBatch(ctxcanvas);
+
   if (iGLIsOpenGL2orMore())
   {
     /* Texture is faster(?), will follow the transformations, follow clipping,
@@ -430,7 +1882,14 @@ static void cdglfPutImage(cdCtxCanvas *ctxcanvas, int rw, int rh, const unsigned
     Its maximum size is 3379 (GL_MAX_TEXTURE_SIZE).
     In OpenGL 1.x its size must be a power of two.
     */
-    GLuint texture = cdglCreateTexture();
+    GLuint texture = key->hash ? cdglCacheTexture(ctxcanvas, key, rw, rh, format, glImage) : 0;
+    if (texture)
+    {
+      cdglDrawTextureImage(ctxcanvas, texture, x, y, w, h);
+      return;
+    }
+
+    texture = cdglCreateTexture();
 
     glTexImage2D(GL_TEXTURE_2D, 0, format, rw, rh, 0, format, GL_UNSIGNED_BYTE, glImage);
 
@@ -462,6 +1921,9 @@ static int cdactivate(cdCtxCanvas *ctxcanvas)
 {
   /* SIZE attribute MUST be updated when the canvas window is resized */
   cdCanvas* canvas = ctxcanvas->canvas;
+
+  cdglFlushBatch(ctxcanvas);
+
   glViewport(0, 0, canvas->w, canvas->h);
 
   glMatrixMode(GL_PROJECTION);
@@ -484,17 +1946,33 @@ static int cdactivate(cdCtxCanvas *ctxcanvas)
 
 static void cdkillcanvas(cdCtxCanvas *ctxcanvas)
 {
-  if (ctxcanvas->gl_fonts)
-  {
-    int i;
-    for (i = 0; i<ctxcanvas->gl_fonts_count; i++)
-      ftglDestroyFont(ctxcanvas->gl_fonts[i].font);
+  int i;
 
-    ctxcanvas->gl_fonts_max = 0;
-    ctxcanvas->gl_fonts_count = 0;
-    free(ctxcanvas->gl_fonts);
-    ctxcanvas->gl_fonts = NULL;
+  cdglFlushBatch(ctxcanvas);
+  if (ctxcanvas->batch_vertex) free(ctxcanvas->batch_vertex);
+  if (ctxcanvas->batch_color) free(ctxcanvas->batch_color);
+
+  for (i = 0; i < CDGL_TESS_CACHE_SIZE; i++)
+    cdglFreeTessCache(ctxcanvas->tess_cache + i);
+  if (ctxcanvas->tess_poly) free(ctxcanvas->tess_poly);
+
+  cdglFreeTextureCache(ctxcanvas);
+  if (ctxcanvas->tex_cache) free(ctxcanvas->tex_cache);
+  if (ctxcanvas->img_id) free(ctxcanvas->img_id);
+
+  for (i = 0; i < CDGL_FONT_HASH_SIZE; i++)
+  {
+    cdglFont* font = ctxcanvas->font_hash[i];
+    while (font)
+    {
+      cdglFont* next = font->next;
+      cdglFreeFont(font);
+      font = next;
+    }
   }
+  if (ctxcanvas->ft_library) FT_Done_FreeType(ctxcanvas->ft_library);
+  if (ctxcanvas->text_vertex) free(ctxcanvas->text_vertex);
+  if (ctxcanvas->text_color) free(ctxcanvas->text_color);
 
   if (ctxcanvas->utf8_buffer)
     free(ctxcanvas->utf8_buffer);
@@ -506,14 +1984,16 @@ static void cdkillcanvas(cdCtxCanvas *ctxcanvas)
 
 static void cdflush(cdCtxCanvas *ctxcanvas)
 {
+  cdglFlushBatch(ctxcanvas);
   glFlush();
-  (void)ctxcanvas;
 }
 
 /******************************************************/
 
 static int cdclip(cdCtxCanvas *ctxcanvas, int clip_mode)
 {
+  cdglFlushBatch(ctxcanvas);
+
   switch (clip_mode)
   {
   case CD_CLIPOFF:
@@ -556,6 +2036,8 @@ static void cdcliparea(cdCtxCanvas *ctxcanvas, int xmin, int xmax, int ymin, int
 
 static int cdwritemode(cdCtxCanvas *ctxcanvas, int write_mode)
 {
+  cdglFlushBatch(ctxcanvas);
+
   switch (write_mode)
   {
   case CD_REPLACE:
@@ -572,7 +2054,6 @@ static int cdwritemode(cdCtxCanvas *ctxcanvas, int write_mode)
     break;
   }
 
-  (void)ctxcanvas;
   return write_mode;
 }
 
@@ -580,6 +2061,8 @@ static int cdhatch(cdCtxCanvas *ctxcanvas, int hatch_style)
 {
   GLubyte pattern[128]; /* 32x32 / 8 (1 bit per pixel) */
   int x, y, pos = 0;
+
+  cdglFlushBatch(ctxcanvas);
  
   glEnable(GL_POLYGON_STIPPLE);
  
@@ -594,12 +2077,13 @@ static int cdhatch(cdCtxCanvas *ctxcanvas, int hatch_style)
   }
   glPolygonStipple(pattern);
 
-  (void)ctxcanvas;
   return hatch_style;
 }
 
 static int cdinteriorstyle(cdCtxCanvas *ctxcanvas, int style)
 {
+  cdglFlushBatch(ctxcanvas);
+
   switch (style)
   {
   case CD_HOLLOW:
@@ -648,6 +2132,8 @@ static void cdstipple(cdCtxCanvas *ctxcanvas, int n, int m, const unsigned char
 
 static int cdlinestyle(cdCtxCanvas *ctxcanvas, int style)
 {
+  cdglFlushBatch(ctxcanvas);
+
   switch (style)
   {
   case CD_CONTINUOUS:
@@ -692,16 +2178,17 @@ static int cdlinewidth(cdCtxCanvas *ctxcanvas, int width)
   if (width == 0) 
     width = 1;
 
+  cdglFlushBatch(ctxcanvas);
+
   glLineWidth((GLfloat)width);
 
-  (void)ctxcanvas;
   return width;
 }
 
 static int cdfont(cdCtxCanvas *ctxcanvas, const char *type_face, int style, int size)
 {
   char filename[10240];
-  FTGLfont* font;
+  cdglFont* font;
   int res;
 
   /* try the pre-defined names and pre-defined style suffix */
@@ -732,10 +2219,10 @@ static void cdgetfontdim(cdCtxCanvas *ctxcanvas, int *max_width, int *height, in
   if(!ctxcanvas->font)
     return;
 
-  if (max_width) *max_width = cdRound(ftglGetFontMaxWidth(ctxcanvas->font));
-  if (height)    *height = cdRound(ftglGetFontLineHeight(ctxcanvas->font));
-  if (ascent)    *ascent = cdRound(ftglGetFontAscender(ctxcanvas->font));
-  if (descent)   *descent = cdRound(-ftglGetFontDescender(ctxcanvas->font));
+  if (max_width) *max_width = cdRound(ctxcanvas->font->max_width);
+  if (height)    *height = cdRound(ctxcanvas->font->line_height);
+  if (ascent)    *ascent = cdRound(ctxcanvas->font->ascent);
+  if (descent)   *descent = cdRound(-ctxcanvas->font->descent);
 }
 
 static long int cdforeground(cdCtxCanvas *ctxcanvas, long int color)
@@ -757,6 +2244,8 @@ static void cdclear(cdCtxCanvas* ctxcanvas)
   GLclampf b = (GLclampf)cdBlue(ctxcanvas->canvas->background)/255.0f;
   GLclampf a = (GLclampf)cdAlpha(ctxcanvas->canvas->background)/255.0f;
 
+  cdglFlushBatch(ctxcanvas);
+
   if (ctxcanvas->canvas->clip_mode == CD_CLIPAREA)
     cdclip(ctxcanvas, CD_CLIPOFF);
 
@@ -776,52 +2265,85 @@ static void cdclear(cdCtxCanvas* ctxcanvas)
 
 static void cdfline(cdCtxCanvas *ctxcanvas, double x1, double y1, double x2, double y2)
 {
+  GLfloat* v = cdglBatchAdd(ctxcanvas, GL_LINES, 2, ctxcanvas->canvas->foreground);
+  if (v)
+  {
+    v[0] = (GLfloat)x1; v[1] = (GLfloat)y1;
+    v[2] = (GLfloat)x2; v[3] = (GLfloat)y2;
+    return;
+  }
+
   glBegin(GL_LINES);
     glVertex2d(x1, y1);
     glVertex2d(x2, y2);
   glEnd();
-
-  (void)ctxcanvas;
 }
 
 static void cdline(cdCtxCanvas *ctxcanvas, int x1, int y1, int x2, int y2)
 {
+  GLfloat* v = cdglBatchAdd(ctxcanvas, GL_LINES, 2, ctxcanvas->canvas->foreground);
+  if (v)
+  {
+    v[0] = (GLfloat)x1; v[1] = (GLfloat)y1;
+    v[2] = (GLfloat)x2; v[3] = (GLfloat)y2;
+    return;
+  }
+
   glBegin(GL_LINES);
   glVertex2i(x1, y1);
   glVertex2i(x2, y2);
   glEnd();
-
-  (void)ctxcanvas;
 }
 
 static void cdfrect(cdCtxCanvas *ctxcanvas, double xmin, double xmax, double ymin, double ymax)
 {
+  cdfPoint poly[4];
+  poly[0].x = xmin; poly[0].y = ymin;
+  poly[1].x = xmax; poly[1].y = ymin;
+  poly[2].x = xmax; poly[2].y = ymax;
+  poly[3].x = xmin; poly[3].y = ymax;
+  if (cdglBatchPoly(ctxcanvas, CD_CLOSED_LINES, NULL, poly, 4))
+    return;
+
   glBegin(GL_LINE_LOOP);
     glVertex2d(xmin, ymin);
     glVertex2d(xmax, ymin);
     glVertex2d(xmax, ymax);
     glVertex2d(xmin, ymax);
   glEnd();
-
-  (void)ctxcanvas;
 }
 
 static void cdrect(cdCtxCanvas *ctxcanvas, int xmin, int xmax, int ymin, int ymax)
 {
+  cdPoint poly[4];
+  poly[0].x = xmin; poly[0].y = ymin;
+  poly[1].x = xmax; poly[1].y = ymin;
+  poly[2].x = xmax; poly[2].y = ymax;
+  poly[3].x = xmin; poly[3].y = ymax;
+  if (cdglBatchPoly(ctxcanvas, CD_CLOSED_LINES, poly, NULL, 4))
+    return;
+
   glBegin(GL_LINE_LOOP);
   glVertex2i(xmin, ymin);
   glVertex2i(xmax, ymin);
   glVertex2i(xmax, ymax);
   glVertex2i(xmin, ymax);
   glEnd();
-
-  (void)ctxcanvas;
 }
 
 static void cdfbox(cdCtxCanvas *ctxcanvas, double xmin, double xmax, double ymin, double ymax)
 {
+  int smooth;
+  cdfPoint poly[4];
+  poly[0].x = xmin; poly[0].y = ymin;
+  poly[1].x = xmax; poly[1].y = ymin;
+  poly[2].x = xmax; poly[2].y = ymax;
+  poly[3].x = xmin; poly[3].y = ymax;
+  if (cdglBatchPoly(ctxcanvas, CD_FILL, NULL, poly, 4))
+    return;
+
   /* must disable polygon smooth or fill may get diagonal lines */
-  int smooth = glIsEnabled(GL_POLYGON_SMOOTH);
+  smooth = glIsEnabled(GL_POLYGON_SMOOTH);
   if (smooth) glDisable(GL_POLYGON_SMOOTH);
 
   if (ctxcanvas->canvas->back_opacity == CD_OPAQUE && glIsEnabled(GL_POLYGON_STIPPLE))
@@ -860,8 +2382,17 @@ static void cdfbox(cdCtxCanvas *ctxcanvas, double xmin, double xmax, double ymin
 
 static void cdbox(cdCtxCanvas *ctxcanvas, int xmin, int xmax, int ymin, int ymax)
 {
+  int smooth;
+  cdPoint poly[4];
+  poly[0].x = xmin; poly[0].y = ymin;
+  poly[1].x = xmax; poly[1].y = ymin;
+  poly[2].x = xmax; poly[2].y = ymax;
+  poly[3].x = xmin; poly[3].y = ymax;
+  if (cdglBatchPoly(ctxcanvas, CD_FILL, poly, NULL, 4))
+    return;
+
   /* must disable polygon smooth or fill may get diagonal lines */
-  int smooth = glIsEnabled(GL_POLYGON_SMOOTH);
+  smooth = glIsEnabled(GL_POLYGON_SMOOTH);
   if (smooth) glDisable(GL_POLYGON_SMOOTH);
 
   if (ctxcanvas->canvas->back_opacity == CD_OPAQUE && glIsEnabled(GL_POLYGON_STIPPLE))
@@ -900,7 +2431,6 @@ static void cdbox(cdCtxCanvas *ctxcanvas, int xmin, int xmax, int ymin, int ymax
 
 static void cdftext(cdCtxCanvas *ctxcanvas, double x, double y, const char *s, int len)
 {
-  int stipple = 0;
   int w, h, baseline;
   double x_origin = x;
   double y_origin = y;
@@ -908,10 +2438,12 @@ static void cdftext(cdCtxCanvas *ctxcanvas, double x, double y, const char *s, i
   if (!ctxcanvas->font)
     return;
 
+  cdglFlushVertices(ctxcanvas);
+
   cdglStrConvertToUTF8(ctxcanvas, s, len);
-  w = cdRound(ftglGetFontAdvance(ctxcanvas->font, ctxcanvas->utf8_buffer));
-  h = cdRound(ftglGetFontLineHeight(ctxcanvas->font));
-  baseline = h - cdRound(ftglGetFontAscender(ctxcanvas->font));
+  w = cdRound(cdglTextAdvance(ctxcanvas->font, ctxcanvas->utf8_buffer));
+  h = cdRound(ctxcanvas->font->line_height);
+  baseline = h - cdRound(ctxcanvas->font->ascent);
 
   switch (ctxcanvas->canvas->text_alignment)
   {
@@ -967,21 +2499,10 @@ static void cdftext(cdCtxCanvas *ctxcanvas, double x, double y, const char *s, i
     cdfRotatePoint(ctxcanvas->canvas, x, y, x_origin, y_origin, &x, &y, sin_angle, cos_angle);
   }
 
-  if(glIsEnabled(GL_POLYGON_STIPPLE))
-  {
-    stipple = 1;
-    glDisable(GL_POLYGON_STIPPLE);
-  }
-
-  glPushMatrix();
-    glTranslated(x, y, 0.0);
-    glRotated(ctxcanvas->canvas->text_orientation, 0, 0, 1);
-    if (ctxcanvas->canvas->text_orientation == 0) ftglSetNearestFilter(ctxcanvas->font, 1);
-    ftglRenderFont(ctxcanvas->font, ctxcanvas->utf8_buffer, FTGL_RENDER_ALL);
-    glPopMatrix();
+  cdglTextQuads(ctxcanvas, ctxcanvas->font, ctxcanvas->utf8_buffer, x, y, ctxcanvas->canvas->text_orientation);
 
-  if(stipple)
-    glEnable(GL_POLYGON_STIPPLE);
+  if (!ctxcanvas->batch)
+    cdglFlushText(ctxcanvas);
 }
 
 static void cdtext(cdCtxCanvas *ctxcanvas, int x, int y, const char *s, int len)
@@ -996,8 +2517,8 @@ static void cdgettextsize(cdCtxCanvas *ctxcanvas, const char *s, int len, int *w
 
   cdglStrConvertToUTF8(ctxcanvas, s, len);
 
-  if (width)  *width = cdRound(ftglGetFontAdvance(ctxcanvas->font, ctxcanvas->utf8_buffer));
-  if (height) *height = cdRound(ftglGetFontLineHeight(ctxcanvas->font));
+  if (width)  *width = cdRound(cdglTextAdvance(ctxcanvas->font, ctxcanvas->utf8_buffer));
+  if (height) *height = cdRound(ctxcanvas->font->line_height);
 }
 
 static void cdpoly(cdCtxCanvas *ctxcanvas, int mode, cdPoint* poly, int n)
@@ -1011,7 +2532,11 @@ static void cdpoly(cdCtxCanvas *ctxcanvas, int mode, cdPoint* poly, int n)
   if (mode == CD_BEZIER)
   {
     int i, prec = 100;
-    double* points = (double*)malloc(n * 3 * sizeof(double));
+    double* points;
+
+    cdglFlushBatch(ctxcanvas);
+
+    points = (double*)malloc(n * 3 * sizeof(double));
 
     for(i = 0; i < n; i++)
     {
@@ -1036,6 +2561,9 @@ static void cdpoly(cdCtxCanvas *ctxcanvas, int mode, cdPoint* poly, int n)
     return;
   }
 
+  if (cdglBatchPoly(ctxcanvas, mode, poly, NULL, n))
+    return;
+
   switch (mode)
   {
   case CD_CLOSED_LINES :
@@ -1095,7 +2623,11 @@ static void cdfpoly(cdCtxCanvas *ctxcanvas, int mode, cdfPoint* poly, int n)
   if (mode == CD_BEZIER)
   {
     int i, prec = 100;
-    double* points = (double*)malloc(n * 3 * sizeof(double));
+    double* points;
+
+    cdglFlushBatch(ctxcanvas);
+
+    points = (double*)malloc(n * 3 * sizeof(double));
 
     for(i = 0; i < n; i++)
     {
@@ -1120,6 +2652,9 @@ static void cdfpoly(cdCtxCanvas *ctxcanvas, int mode, cdfPoint* poly, int n)
     return;
   }
 
+  if (cdglBatchPoly(ctxcanvas, mode, NULL, poly, n))
+    return;
+
   switch (mode)
   {
   case CD_CLOSED_LINES :
@@ -1173,6 +2708,8 @@ static void cdgetimagergb(cdCtxCanvas *ctxcanvas, unsigned char *r, unsigned cha
 {
   GLubyte* glImage = (GLubyte*)malloc((w*3)*h);  /* each pixel uses 3 bytes (RGB) */
 
+  cdglFlushBatch(ctxcanvas);
+
   glPixelStorei (GL_UNPACK_ALIGNMENT, 1);
   glReadPixels(x, y, w, h, GL_RGB, GL_UNSIGNED_BYTE, glImage);
   if (!glImage)
@@ -1180,8 +2717,6 @@ static void cdgetimagergb(cdCtxCanvas *ctxcanvas, unsigned char *r, unsigned cha
 
   cdglGetImageData(glImage, r, g, b, w, h);
 
-  (void)ctxcanvas;
-
   free(glImage);
 }
 
@@ -1189,42 +2724,50 @@ static void cdputimagerectrgb(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsi
                               int x, int y, int w, int h, int xmin, int xmax, int ymin, int ymax)
 {
   GLubyte* glImage;
+  cdImageKey key;
   int rw = xmax-xmin+1;
   int rh = ymax-ymin+1;
 
   glPixelStorei (GL_UNPACK_ALIGNMENT, 1);
 
+  cdglImageKeyRGBA(ctxcanvas, &key, iw, r, g, b, NULL, xmin, ymin, rw, rh);
+  if (cdglPutCachedImage(ctxcanvas, &key, rw, rh, GL_RGB, x, y, w, h))
+    return;
+
   glImage = cdglCreateImageRGBA(xmin, ymin, rw, rh, r, g, b, NULL, iw);
   if (!glImage)
     return;
 
-  cdglPutImage(ctxcanvas, rw, rh, glImage, GL_RGB, x, y, w, h);
+  cdglPutImage(ctxcanvas, &key, rw, rh, glImage, GL_RGB, x, y, w, h);
 
   free(glImage);
 
   (void)ih;
-  (void)ctxcanvas;
 }
 
 static void cdfputimagerectrgb(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *r, const unsigned char *g, const unsigned char *b, 
                               double x, double y, double w, double h, int xmin, int xmax, int ymin, int ymax)
 {
   GLubyte* glImage;
+  cdImageKey key;
   int rw = xmax - xmin + 1;
   int rh = ymax - ymin + 1;
 
   glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
+  cdglImageKeyRGBA(ctxcanvas, &key, iw, r, g, b, NULL, xmin, ymin, rw, rh);
+  if (cdglPutCachedImage(ctxcanvas, &key, rw, rh, GL_RGB, x, y, w, h))
+    return;
+
   glImage = cdglCreateImageRGBA(xmin, ymin, rw, rh, r, g, b, NULL, iw);
   if (!glImage)
     return;
 
-  cdglfPutImage(ctxcanvas, rw, rh, glImage, GL_RGB, x, y, w, h);
+  cdglfPutImage(ctxcanvas, &key, rw, rh, glImage, GL_RGB, x, y, w, h);
 
   free(glImage);
 
   (void)ih;
-  (void)ctxcanvas;
 }
 
 static void cdputimagerectrgba(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *r, const unsigned char *g, const unsigned char *b, const unsigned char *a, 
@@ -1232,14 +2775,15 @@ static void cdputimagerectrgba(cdCtxCanvas *ctxcanvas, int iw, int ih, const uns
 {
   int blend = 1;
   GLubyte* glImage;
+  cdImageKey key;
   int rw = xmax-xmin+1;
   int rh = ymax-ymin+1;
 
   glPixelStorei (GL_UNPACK_ALIGNMENT, 1);
 
-  glImage = cdglCreateImageRGBA(xmin, ymin, rw, rh, r, g, b, a, iw);
-  if (!glImage)
-    return;
+  cdglImageKeyRGBA(ctxcanvas, &key, iw, r, g, b, a, xmin, ymin, rw, rh);
+
+  cdglFlushBatch(ctxcanvas);
 
   if (!glIsEnabled(GL_BLEND))
   {
@@ -1248,15 +2792,20 @@ static void cdputimagerectrgba(cdCtxCanvas *ctxcanvas, int iw, int ih, const uns
   }
   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-  cdglPutImage(ctxcanvas, rw, rh, glImage, GL_RGBA, x, y, w, h);
+  if (!cdglPutCachedImage(ctxcanvas, &key, rw, rh, GL_RGBA, x, y, w, h))
+  {
+    glImage = cdglCreateImageRGBA(xmin, ymin, rw, rh, r, g, b, a, iw);
+    if (glImage)
+    {
+      cdglPutImage(ctxcanvas, &key, rw, rh, glImage, GL_RGBA, x, y, w, h);
+      free(glImage);
+    }
+  }
 
   if (!blend)
     glDisable(GL_BLEND);
 
-  free(glImage);
-
   (void)ih;
-  (void)ctxcanvas;
 }
 
 static void cdfputimagerectrgba(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *r, const unsigned char *g, const unsigned char *b, const unsigned char *a, 
@@ -1264,14 +2813,15 @@ static void cdfputimagerectrgba(cdCtxCanvas *ctxcanvas, int iw, int ih, const un
 {
   int blend = 1;
   GLubyte* glImage;
+  cdImageKey key;
   int rw = xmax - xmin + 1;
   int rh = ymax - ymin + 1;
 
   glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
-  glImage = cdglCreateImageRGBA(xmin, ymin, rw, rh, r, g, b, a, iw);
-  if (!glImage)
-    return;
+  cdglImageKeyRGBA(ctxcanvas, &key, iw, r, g, b, a, xmin, ymin, rw, rh);
+
+  cdglFlushBatch(ctxcanvas);
 
   if (!glIsEnabled(GL_BLEND))
   {
@@ -1280,61 +2830,81 @@ static void cdfputimagerectrgba(cdCtxCanvas *ctxcanvas, int iw, int ih, const un
   }
   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-  cdglfPutImage(ctxcanvas, rw, rh, glImage, GL_RGBA, x, y, w, h);
+  if (!cdglPutCachedImage(ctxcanvas, &key, rw, rh, GL_RGBA, x, y, w, h))
+  {
+    glImage = cdglCreateImageRGBA(xmin, ymin, rw, rh, r, g, b, a, iw);
+    if (glImage)
+    {
+      cdglfPutImage(ctxcanvas, &key, rw, rh, glImage, GL_RGBA, x, y, w, h);
+      free(glImage);
+    }
+  }
 
   if (!blend)
     glDisable(GL_BLEND);
 
-  free(glImage);
-
   (void)ih;
-  (void)ctxcanvas;
 }
 
 static void cdputimagerectmap(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *index, const long int *colors, 
                               int x, int y, int w, int h, int xmin, int xmax, int ymin, int ymax)
 {
   GLubyte* glImage;
+  cdImageKey key;
   int rw = xmax-xmin+1;
   int rh = ymax-ymin+1;
 
   glPixelStorei (GL_UNPACK_ALIGNMENT, 1);
 
+  cdglImageKeyMap(ctxcanvas, &key, iw, index, colors, xmin, ymin, rw, rh);
+  if (cdglPutCachedImage(ctxcanvas, &key, rw, rh, GL_RGB, x, y, w, h))
+    return;
+
   glImage = cdglCreateImageMap(xmin, ymin, rw, rh, colors, index, iw);
   if (!glImage)
     return;
 
-  cdglPutImage(ctxcanvas, rw, rh, glImage, GL_RGB, x, y, w, h);
+  cdglPutImage(ctxcanvas, &key, rw, rh, glImage, GL_RGB, x, y, w, h);
 
   free(glImage);
 
   (void)ih;
-  (void)ctxcanvas;
 }
 
 static void cdfputimagerectmap(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *index, const long int *colors, 
                                double x, double y, double w, double h, int xmin, int xmax, int ymin, int ymax)
 {
   GLubyte* glImage;
+  cdImageKey key;
   int rw = xmax-xmin+1;
   int rh = ymax-ymin+1;
 
   glPixelStorei (GL_UNPACK_ALIGNMENT, 1);
 
+  cdglImageKeyMap(ctxcanvas, &key, iw, index, colors, xmin, ymin, rw, rh);
+  if (cdglPutCachedImage(ctxcanvas, &key, rw, rh, GL_RGB, x, y, w, h))
+    return;
+
   glImage = cdglCreateImageMap(xmin, ymin, rw, rh, colors, index, iw);
   if (!glImage)
     return;
 
-  cdglfPutImage(ctxcanvas, rw, rh, glImage, GL_RGB, x, y, w, h);
+  cdglfPutImage(ctxcanvas, &key, rw, rh, glImage, GL_RGB, x, y, w, h);
 
   free(glImage);
 
   (void)ih;
-  (void)ctxcanvas;
 }
 
 static void cdpixel(cdCtxCanvas *ctxcanvas, int x, int y, long int color)
 {
+  GLfloat* v = cdglBatchAdd(ctxcanvas, GL_POINTS, 1, color);
+  if (v)
+  {
+    v[0] = (GLfloat)x; v[1] = (GLfloat)y;
+    return;
+  }
+
   glColor4ub(cdRed(color), 
              cdGreen(color), 
              cdBlue(color), 
@@ -1351,12 +2921,17 @@ static void cdpixel(cdCtxCanvas *ctxcanvas, int x, int y, long int color)
              cdGreen(ctxcanvas->canvas->foreground), 
              cdBlue(ctxcanvas->canvas->foreground), 
              cdAlpha(ctxcanvas->canvas->foreground));
-
-  (void)ctxcanvas;
 }
 
 static void cdfpixel(cdCtxCanvas *ctxcanvas, double x, double y, long int color)
 {
+  GLfloat* v = cdglBatchAdd(ctxcanvas, GL_POINTS, 1, color);
+  if (v)
+  {
+    v[0] = (GLfloat)x; v[1] = (GLfloat)y;
+    return;
+  }
+
   glColor4ub(cdRed(color), 
              cdGreen(color), 
              cdBlue(color), 
@@ -1373,8 +2948,6 @@ static void cdfpixel(cdCtxCanvas *ctxcanvas, double x, double y, long int color)
              cdGreen(ctxcanvas->canvas->foreground), 
              cdBlue(ctxcanvas->canvas->foreground), 
              cdAlpha(ctxcanvas->canvas->foreground));
-
-  (void)ctxcanvas;
 }
 
 static cdCtxImage *cdcreateimage (cdCtxCanvas *ctxcanvas, int w, int h)
@@ -1402,6 +2975,8 @@ static cdCtxImage *cdcreateimage (cdCtxCanvas *ctxcanvas, int w, int h)
 
 static void cdgetimage (cdCtxCanvas *ctxcanvas, cdCtxImage *ctximage, int x, int y)
 {
+  cdglFlushBatch(ctxcanvas);
+
   glPixelStorei (GL_UNPACK_ALIGNMENT, 1);
   glReadPixels(x, y - ctximage->h + 1, ctximage->w, ctximage->h, GL_RGBA, GL_UNSIGNED_BYTE, ctximage->img);
 
@@ -1410,8 +2985,6 @@ static void cdgetimage (cdCtxCanvas *ctxcanvas, cdCtxImage *ctximage, int x, int
     glBindTexture(GL_TEXTURE_2D, ctximage->texture);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, ctximage->w, ctximage->h, 0, GL_RGBA, GL_UNSIGNED_BYTE, ctximage->img);
   }
-
-  (void)ctxcanvas;
 }
 
 static void cdputimagerect (cdCtxCanvas *ctxcanvas, cdCtxImage *ctximage, int x, int y, int xmin, int xmax, int ymin, int ymax)
@@ -1419,6 +2992,8 @@ static void cdputimagerect (cdCtxCanvas *ctxcanvas, cdCtxImage *ctximage, int x,
   int rw = xmax - xmin + 1;
   int rh = ymax - ymin + 1;
 
+  cdglFlushBatch(ctxcanvas);
+
   glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
   if (rw == (int)ctximage->w && rh == (int)ctximage->h)
@@ -1437,12 +3012,10 @@ static void cdputimagerect (cdCtxCanvas *ctxcanvas, cdCtxImage *ctximage, int x,
     if (!glImage)
       return;
 
-    cdglPutImage(ctxcanvas, rw, rh, glImage, GL_RGBA, x, y, rw, rh);
+    cdglPutImage(ctxcanvas, 0, rw, rh, glImage, GL_RGBA, x, y, rw, rh);
 
     free(glImage);
   }
-
-  (void)ctxcanvas;
 }
 
 static void cdkillimage (cdCtxImage *ctximage)
@@ -1456,14 +3029,16 @@ static void cdkillimage (cdCtxImage *ctximage)
 
 static void cdscrollarea (cdCtxCanvas *ctxcanvas, int xmin, int xmax, int ymin, int ymax, int dx, int dy)
 {
+  cdglFlushBatch(ctxcanvas);
+
   glRasterPos2i(xmin+dx, ymin+dy);
   glCopyPixels(xmin, ymin, xmax-xmin+1, ymax-ymin+1, GL_RGBA);
-
-  (void)ctxcanvas;
 }
 
 static void cdtransform(cdCtxCanvas *ctxcanvas, const double* matrix)
 {
+  cdglFlushBatch(ctxcanvas);
+
   if (matrix)
   {
     GLdouble transformMTX[4][4];
@@ -1478,14 +3053,14 @@ static void cdtransform(cdCtxCanvas *ctxcanvas, const double* matrix)
   }
   else
     glLoadIdentity();
-
-  (void)ctxcanvas;
 }
 
 /******************************************************************/
 
 static void set_alpha_attrib(cdCtxCanvas* ctxcanvas, char* data)
 {
+  cdglFlushBatch(ctxcanvas);
+
   if (!data || data[0] == '0')
   {
     glDisable(GL_BLEND);
@@ -1495,8 +3070,6 @@ static void set_alpha_attrib(cdCtxCanvas* ctxcanvas, char* data)
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
   }
-
-  (void)ctxcanvas;
 }
 
 static char* get_alpha_attrib(cdCtxCanvas* ctxcanvas)
@@ -1518,6 +3091,8 @@ static cdAttribute alpha_attrib =
 
 static void set_aa_attrib(cdCtxCanvas* ctxcanvas, char* data)
 {
+  cdglFlushBatch(ctxcanvas);
+
   if (!data || data[0] == '0')
   {
     glDisable(GL_POINT_SMOOTH);
@@ -1534,8 +3109,6 @@ static void set_aa_attrib(cdCtxCanvas* ctxcanvas, char* data)
     glHint(GL_LINE_SMOOTH_HINT, GL_NICEST);
     glHint(GL_POLYGON_SMOOTH_HINT, GL_NICEST);
   }
-
-  (void)ctxcanvas;
 }
 
 static char* get_aa_attrib(cdCtxCanvas* ctxcanvas)
@@ -1578,6 +3151,124 @@ static cdAttribute interp_attrib =
   get_interp_attrib
 };
 
+static void set_batch_attrib(cdCtxCanvas* ctxcanvas, char* data)
+{
+  cdglFlushBatch(ctxcanvas);
+
+  if (!data || data[0] == '0')
+    ctxcanvas->batch = 0;
+  else
+    ctxcanvas->batch = 1;
+}
+
+static char* get_batch_attrib(cdCtxCanvas* ctxcanvas)
+{
+  if (ctxcanvas->batch)
+    return "1";
+  else
+    return "0";
+}
+
+static cdAttribute batch_attrib =
+{
+  "BATCH",
+  set_batch_attrib,
+  get_batch_attrib
+};
+
+static void set_imgcachesize_attrib(cdCtxCanvas* ctxcanvas, char* data)
+{
+  unsigned long size = CDGL_IMAGE_CACHE_SIZE;
+
+  if (data)
+    sscanf(data, "%lu", &size);
+
+  ctxcanvas->tex_cache_size = size * 1024;
+
+  if (ctxcanvas->tex_cache_size == 0)
+    cdglFreeTextureCache(ctxcanvas);
+  else
+  {
+    GLuint texture = cdglFreeTextures(ctxcanvas, 0, 0, 0, 0);
+    if (texture) glDeleteTextures(1, &texture);
+  }
+}
+
+static char* get_imgcachesize_attrib(cdCtxCanvas* ctxcanvas)
+{
+  static char data[100];
+  sprintf(data, "%lu", ctxcanvas->tex_cache_size / 1024);
+  return data;
+}
+
+static cdAttribute imgcachesize_attrib =
+{
+  "IMGCACHESIZE",
+  set_imgcachesize_attrib,
+  get_imgcachesize_attrib
+};
+
+static char* get_imgcacheinfo_attrib(cdCtxCanvas* ctxcanvas)
+{
+  static char data[200];
+  sprintf(data, "%lu %lu %d %lu", ctxcanvas->tex_hits, ctxcanvas->tex_misses, ctxcanvas->tex_count, ctxcanvas->tex_bytes / 1024);
+  return data;
+}
+
+static cdAttribute imgcacheinfo_attrib =
+{
+  "IMGCACHEINFO",
+  NULL,
+  get_imgcacheinfo_attrib
+};
+
+static void set_imgid_attrib(cdCtxCanvas* ctxcanvas, char* data)
+{
+  if (ctxcanvas->img_id)
+  {
+    free(ctxcanvas->img_id);
+    ctxcanvas->img_id = NULL;
+  }
+
+  if (data)
+    ctxcanvas->img_id = cdStrDup(data);
+}
+
+static char* get_imgid_attrib(cdCtxCanvas* ctxcanvas)
+{
+  return ctxcanvas->img_id;
+}
+
+static cdAttribute imgid_attrib =
+{
+  "IMGID",
+  set_imgid_attrib,
+  get_imgid_attrib
+};
+
+static void set_imgupdate_attrib(cdCtxCanvas* ctxcanvas, char* data)
+{
+  ctxcanvas->img_update_rect = 0;
+
+  if (data && sscanf(data, "%d %d %d %d", &ctxcanvas->img_update_xmin, &ctxcanvas->img_update_xmax, 
+                                          &ctxcanvas->img_update_ymin, &ctxcanvas->img_update_ymax) == 4)
+  {
+    ctxcanvas->img_update = 1;
+    ctxcanvas->img_update_rect = 1;
+  }
+  else if (!data || data[0] == '0')
+    ctxcanvas->img_update = 0;
+  else
+    ctxcanvas->img_update = 1;
+}
+
+static cdAttribute imgupdate_attrib =
+{
+  "IMGUPDATE",
+  set_imgupdate_attrib,
+  NULL
+};
+
 static void set_utf8mode_attrib(cdCtxCanvas* ctxcanvas, char* data)
 {
   if (!data || data[0] == '0')
@@ -1704,6 +3395,8 @@ static void cdcreatecanvas(cdCanvas* canvas, void *data)
 
   ctxcanvas->utf8_buffer = NULL;
   ctxcanvas->texture_filter = GL_LINEAR;
+  ctxcanvas->batch = 1;
+  ctxcanvas->tex_cache_size = CDGL_IMAGE_CACHE_SIZE * 1024;
 
   cdRegisterAttribute(canvas, &rotate_attrib);
   cdRegisterAttribute(canvas, &version_attrib);
@@ -1712,6 +3405,11 @@ static void cdcreatecanvas(cdCanvas* canvas, void *data)
   cdRegisterAttribute(canvas, &aa_attrib);
   cdRegisterAttribute(canvas, &utf8mode_attrib);
   cdRegisterAttribute(canvas, &interp_attrib);
+  cdRegisterAttribute(canvas, &batch_attrib);
+  cdRegisterAttribute(canvas, &imgcachesize_attrib);
+  cdRegisterAttribute(canvas, &imgcacheinfo_attrib);
+  cdRegisterAttribute(canvas, &imgid_attrib);
+  cdRegisterAttribute(canvas, &imgupdate_attrib);
 
   cdCanvasSetAttribute(canvas, "ALPHA", "1");
   cdCanvasSetAttribute(canvas, "ANTIALIAS", "1");
@@ -129,8 +129,6 @@ static void setInteriorStyle(cdCtxCanvas *ctxcanvas, int interiorStyle, int hatc
     }
 
     pptxPattern(ctxcanvas->presentation, rgba, width, height);
-
-    free(rgba);
     break;
   }
   case CD_STIPPLE:
@@ -169,8 +167,6 @@ static void setInteriorStyle(cdCtxCanvas *ctxcanvas, int interiorStyle, int hatc
     }
 
     pptxStipple(ctxcanvas->presentation, rgba, width, height);
-
-    free(rgba);
     break;
   }
   default: /* CD_HOLLOW */
@@ -848,8 +844,6 @@ static void cdputimagerectmap(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsi
   }
 
   pptxImageRGB(ctxcanvas->presentation, rw, rh, rgb, x, y, w, h);
-
-  free(rgb);
 }
 
 static void cdputimagerectrgb(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *r, const unsigned char *g, const unsigned char *b, int x, int y, int w, int h, int xmin, int xmax, int ymin, int ymax)
@@ -879,8 +873,6 @@ static void cdputimagerectrgb(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsi
   }
 
   pptxImageRGB(ctxcanvas->presentation, rw, rh, rgb, x, y, w, h);
-
-  free(rgb);
 }
 
 static void cdputimagerectrgba(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *r, const unsigned char *g, const unsigned char *b, const unsigned char *a, int x, int y, int w, int h, int xmin, int xmax, int ymin, int ymax)
@@ -911,8 +903,6 @@ static void cdputimagerectrgba(cdCtxCanvas *ctxcanvas, int iw, int ih, const uns
   }
 
   pptxImageRGBA(ctxcanvas->presentation, rw, rh, rgba, x, y, w, h);
-
-  free(rgba);
 }
 
 static void cdpixel(cdCtxCanvas *ctxcanvas, int x, int y, long int color)
@@ -1001,6 +991,54 @@ static cdAttribute master_slide_file_attrib =
   get_master_slide_file_attrib,
 };
 
+static void set_pngthreads_attrib(cdCtxCanvas* ctxcanvas, char* data)
+{
+  int threads = 0;
+
+  if (data)
+    sscanf(data, "%d", &threads);
+
+  pptxSetPNGThreads(ctxcanvas->presentation, threads);
+}
+
+static char* get_pngthreads_attrib(cdCtxCanvas* ctxcanvas)
+{
+  static char data[50];
+  sprintf(data, "%d", pptxGetPNGThreads(ctxcanvas->presentation));
+  return data;
+}
+
+static cdAttribute pngthreads_attrib =
+{
+  "PNGTHREADS",
+  set_pngthreads_attrib,
+  get_pngthreads_attrib,
+};
+
+static void set_pngcompression_attrib(cdCtxCanvas* ctxcanvas, char* data)
+{
+  int level = -1;
+
+  if (data)
+    sscanf(data, "%d", &level);
+
+  pptxSetPNGCompression(ctxcanvas->presentation, level);
+}
+
+static char* get_pngcompression_attrib(cdCtxCanvas* ctxcanvas)
+{
+  static char data[50];
+  sprintf(data, "%d", pptxGetPNGCompression(ctxcanvas->presentation));
+  return data;
+}
+
+static cdAttribute pngcompression_attrib =
+{
+  "PNGCOMPRESSION",
+  set_pngcompression_attrib,
+  get_pngcompression_attrib,
+};
+
 static void cdcreatecanvas(cdCanvas *canvas, void *data)
 {
   char filename[10240] = "";
@@ -1046,6 +1084,8 @@ static void cdcreatecanvas(cdCanvas *canvas, void *data)
   cdRegisterAttribute(canvas, &utf8mode_attrib);
   cdRegisterAttribute(canvas, &master_slide_attrib);
   cdRegisterAttribute(canvas, &master_slide_file_attrib);
+  cdRegisterAttribute(canvas, &pngthreads_attrib);
+  cdRegisterAttribute(canvas, &pngcompression_attrib);
 }
 
 static void cdinittable(cdCanvas* canvas)
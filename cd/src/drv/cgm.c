@@ -13,8 +13,16 @@
 #include <float.h>    
 #include <limits.h>   
 
+#ifdef WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
 #include "cgm.h"
 
+#define CGM_BUFFER_SIZE  65536
+#define CGM_BUFFER_FLUSH 49152
+
 
 struct _cgmFunc 
 {
@@ -487,6 +495,72 @@ static const CGMFUNC *cgmf[] = { &cgmf_character, &cgmf_binary, &cgmf_clear_text
 
 static void cgmb_putw ( CGM *, unsigned );
 
+/* Binary elements are built in memory, so the length of long form partitions
+   can be updated without seeking in the file. The buffer is written only 
+   up to the first partition whose length is still unknown. */
+
+static void cgmb_flush ( CGM *cgm )
+{
+  long n = cgm->buf_n;
+  register int i;
+
+  /* check all levels, cgm->op can be temporarily lowered when a partition is split */
+  for ( i=0; i<5; i++ )
+  {
+    if ( cgm->po[i] >= 0 && cgm->po[i] < n )
+      n = cgm->po[i];
+  }
+
+  if ( n == 0 )
+    return;
+
+  fwrite ( cgm->buf, 1, n, cgm->file );
+
+  cgm->buf_n -= n;
+  if ( cgm->buf_n )
+    memmove ( cgm->buf, cgm->buf + n, cgm->buf_n );
+
+  for ( i=0; i<5; i++ )
+  {
+    if ( cgm->po[i] >= 0 )
+      cgm->po[i] -= n;
+  }
+}
+
+static void cgmb_grow ( CGM *cgm )
+{
+  cgmb_flush ( cgm );
+
+  if ( cgm->buf_n > cgm->buf_size / 2 )
+  {
+    long size = 2 * cgm->buf_size;
+    unsigned char *buf = (unsigned char *)realloc ( cgm->buf, size );
+    if ( buf )
+    {
+      cgm->buf = buf;
+      cgm->buf_size = size;
+    }
+    else if ( cgm->buf_n == cgm->buf_size )
+    {
+      register int i;
+
+      /* no memory, write it anyway, only a partition length will be wrong */
+      fwrite ( cgm->buf, 1, cgm->buf_n, cgm->file );
+      cgm->buf_n = 0;
+
+      /* the pending lengths were written, they can not be updated anymore */
+      for ( i=0; i<5; i++ )
+        cgm->po[i] = -1L;
+    }
+  }
+}
+
+static void cgmb_patchw ( CGM *cgm, long po, unsigned w )
+{
+  cgm->buf[po]   = (unsigned char)(w >> 8);
+  cgm->buf[po+1] = (unsigned char)(w);
+}
+
 static void cgmb_putc ( CGM *cgm, int b )
 {
   if ( cgm->op != -1 )
@@ -496,15 +570,18 @@ static void cgmb_putc ( CGM *cgm, int b )
     {
       if ( cgm->bc[i] == 32766 - 2*i )
       {
-        long po = ftell(cgm->file);
+        long po;
         int op  = cgm->op;
 
-        cgm->op = -1;
-        fseek(cgm->file, cgm->po[i] , SEEK_SET);
-        cgmb_putw ( cgm, (1 << 15) | (cgm->bc[i]) );
+        if ( cgm->po[i] >= 0 )
+          cgmb_patchw ( cgm, cgm->po[i], (1 << 15) | (cgm->bc[i]) );
+
+        /* make room first, so the new position will not move */
+        if ( cgm->buf_n + 2 > cgm->buf_size )
+          cgmb_grow ( cgm );
 
         cgm->op = i - 1;
-        fseek(cgm->file, po, SEEK_SET);
+        po = cgm->buf_n;
         cgmb_putw ( cgm, 0 );
 
         cgm->op    = op;
@@ -515,7 +592,10 @@ static void cgmb_putc ( CGM *cgm, int b )
     }
   }
 
-  fputc ( b, cgm->file );
+  if ( cgm->buf_n == cgm->buf_size )
+    cgmb_grow ( cgm );
+
+  cgm->buf[cgm->buf_n++] = (unsigned char)b;
 }
 
 
@@ -634,11 +714,11 @@ static void cgmb_wch ( CGM* cgm, int c, int id, int len )
 
   if ( len > 30 )
   {
-    cgm->po[cgm->op] = ftell(cgm->file);
+    cgm->po[cgm->op] = cgm->buf_n;
     cgmb_putw ( cgm, 0 );
   }
   else
-    cgm->po[cgm->op] = 0L;
+    cgm->po[cgm->op] = -1L;
 
   cgm->bc[cgm->op] = 0;
 
@@ -848,19 +928,17 @@ static int cgmb_term ( CGM *cgm )
       cgm->bc[cgm->op] --;
     }
 
-    if ( cgm->po[cgm->op] != 0L )
+    if ( cgm->po[cgm->op] >= 0 )
     {
-      long po = ftell(cgm->file);
-      int  op = cgm->op;
-
-      cgm->op = -1;
-      fseek ( cgm->file, cgm->po[op], SEEK_SET);
-      cgmb_putw ( cgm, cgm->bc[op] );
-
-      fseek ( cgm->file, po, SEEK_SET );
-      cgm->op = op;
+      cgmb_patchw ( cgm, cgm->po[cgm->op], cgm->bc[cgm->op] );
+      cgm->po[cgm->op] = -1L;
     }
+
     cgm->op --;
+
+    /* write complete elements in large blocks */
+    if ( cgm->op == -1 && cgm->buf_n >= CGM_BUFFER_FLUSH )
+      cgmb_flush ( cgm );
   }
 
   return 0;
@@ -1187,6 +1265,21 @@ CGM *cgm_begin_metafile ( char *file, int mode, char *header )
   if ( (cgm = (CGM *)malloc ( sizeof (CGM) ) ) == NULL )
     return NULL;
 
+  cgm->buf = NULL;
+  cgm->buf_n = 0;
+  cgm->buf_size = 0;
+  for ( len=0; len<5; len++ )
+    cgm->po[len] = -1L;
+
+  if ( strcmp ( file, "-" ) == 0 )
+  {
+    cgm->file = stdout;
+#ifdef WIN32
+    if ( mode != 2 )
+      _setmode ( _fileno ( stdout ), _O_BINARY );
+#endif
+  }
+  else
 #ifdef __VAXC__
   if ( mode == 2 )
     cgm->file = fopen ( file , "w"  , "rfm=var", "rat=cr" );
@@ -1205,6 +1298,19 @@ CGM *cgm_begin_metafile ( char *file, int mode, char *header )
     return NULL;
   }
 
+  if ( mode == 1 ) /* binario */
+  {
+    cgm->buf_size = CGM_BUFFER_SIZE;
+    cgm->buf = (unsigned char *)malloc ( cgm->buf_size );
+    if ( cgm->buf == NULL )
+    {
+      if ( cgm->file != stdout )
+        fclose ( cgm->file );
+      free ( cgm );
+      return NULL;
+    }
+  }
+
   cgm->mode = mode;
   cgm->func = cgmf[mode];
 
@@ -1256,12 +1362,29 @@ CGM *cgm_begin_metafile ( char *file, int mode, char *header )
   return cgm;
 }
 
+void cgm_flush ( CGM *cgm )
+{
+  if ( cgm->buf )
+    cgmb_flush ( cgm );
+
+  fflush ( cgm->file );
+}
+
 int cgm_end_metafile ( CGM *cgm )
 {
   cgm->func->wch  ( cgm, 0, 2, 0 );
   cgm->func->term ( cgm );
 
-  fclose ( cgm->file );
+  if ( cgm->buf )
+  {
+    cgmb_flush ( cgm );
+    free ( cgm->buf );
+  }
+
+  if ( cgm->file == stdout )
+    fflush ( cgm->file );
+  else
+    fclose ( cgm->file );
   cgm->file = NULL;
   free ( cgm );
 
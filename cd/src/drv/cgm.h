@@ -47,11 +47,16 @@ typedef struct {
 
   int         op;        /* commands opened */
   int         bc[5];     /* bytes count for command */
-  long        po[5];     /* position offset do arquivo */
+  long        po[5];     /* position offset in buf of the partition length, -1 if short form */
+
+  unsigned char *buf;    /* binary elements not written yet */
+  long        buf_n,     /* used bytes */
+              buf_size;  /* allocated bytes */
 } CGM;
 
 CGM *cgm_begin_metafile		( char *, int, char * );
 int cgm_end_metafile		( CGM * );
+void cgm_flush		( CGM * );
 int cgm_begin_picture		( CGM *, const char * );
 int cgm_begin_picture_body	( CGM * );
 int cgm_end_picture		( CGM * );
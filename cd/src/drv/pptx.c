@@ -12,6 +12,7 @@
 #include "cd_private.h"
 
 #include "lodepng.h"
+#include "pngqueue.h"
 #include "pptx.h"
 
 #define to_angle(_)   (int)((_)*60000)
@@ -40,6 +41,8 @@ struct _pptxPresentation
   int imageId;
 
   char* importMasterSlideFile;
+
+  pngQueue* png_queue;
 };
 
 #define PPTX_PPT_DIR          "ppt"
@@ -668,14 +671,14 @@ static void printCloseSlideRels(FILE* slideRelsFile)
   fprintf(slideRelsFile, "%s", rels);
 }
 
-static void printSlideRels(pptxPresentation *presentation)
+static void printSlideRels(pptxPresentation *presentation, int media)
 {
   const char *rels =
   {
     "   <Relationship Id=\"rId%d\" Type=\"http://schemas.openxmlformats.org/officeDocument/2006/relationships/image\" Target=\"../media/media/image%d.png\"/>\n"
   };
 
-  fprintf(presentation->slideRelsFile, rels, presentation->imageId, presentation->mediaNum);
+  fprintf(presentation->slideRelsFile, rels, presentation->imageId, media);
 }
 
 /**************************************  FILE OPEN/CLOSE   ******************************************************/
@@ -994,7 +997,22 @@ void pptxHatchLine(pptxPresentation *presentation, const char* style, unsigned c
   fprintf(presentation->slideFile, patt, style, red, green, blue, alphaPct, bRed, bGreen, bBlue, bAlpha);
 }
 
-void pptxPattern(pptxPresentation *presentation, const unsigned char* rgba_data, int width, int height)
+static int encodeImage(pptxPresentation *presentation, unsigned char* data, int width, int height, int colortype)
+{
+  char filename[10240];
+  int media;
+
+  sprintf(filename, "%s/"PPTX_IMAGE_FILE, presentation->baseDir, presentation->mediaNum);
+
+  /* identical images share the same media file */
+  media = pngQueueEncode(presentation->png_queue, data, width, height, colortype, filename);
+  if (media == presentation->mediaNum)
+    presentation->mediaNum++;
+
+  return media;
+}
+
+void pptxPattern(pptxPresentation *presentation, unsigned char* rgba_data, int width, int height)
 {
   const char *img =
   {/*012345678901234| - path style ident (15) */
@@ -1004,21 +1022,18 @@ void pptxPattern(pptxPresentation *presentation, const unsigned char* rgba_data,
     "                  <a:tile tx=\"0\" ty=\"0\" sx=\"100000\" sy=\"100000\" flip=\"none\" algn=\"tl\"/>\n"
     "               </a:blipFill>\n"
   };
-  char filename[10240];
-
-  sprintf(filename, "%s/"PPTX_IMAGE_FILE, presentation->baseDir, presentation->mediaNum);
-
-  lodepng_encode_file(filename, rgba_data, width, height, LCT_RGBA, 8);
+  int media = encodeImage(presentation, rgba_data, width, height, LCT_RGBA);
+  if (media < 0)
+    return;
 
   fprintf(presentation->slideFile, img, presentation->imageId);
 
-  printSlideRels(presentation);
+  printSlideRels(presentation, media);
 
-  presentation->mediaNum++;
   presentation->imageId++;
 }
 
-void pptxStipple(pptxPresentation *presentation, const unsigned char *rgba_data, int width, int height)
+void pptxStipple(pptxPresentation *presentation, unsigned char *rgba_data, int width, int height)
 {
   const char *img =
   {/*012345678901234| - path style ident (15) */
@@ -1028,17 +1043,14 @@ void pptxStipple(pptxPresentation *presentation, const unsigned char *rgba_data,
     "                  <a:tile tx=\"0\" ty=\"0\" sx=\"100000\" sy=\"100000\" flip=\"none\" algn=\"tl\"/>\n"
     "               </a:blipFill>\n"
   };
-  char filename[10240];
-
-  sprintf(filename, "%s/"PPTX_IMAGE_FILE, presentation->baseDir, presentation->mediaNum);
-
-  lodepng_encode_file(filename, rgba_data, width, height, LCT_RGBA, 8);
+  int media = encodeImage(presentation, rgba_data, width, height, LCT_RGBA);
+  if (media < 0)
+    return;
 
   fprintf(presentation->slideFile, img, presentation->imageId);
 
-  printSlideRels(presentation);
+  printSlideRels(presentation, media);
 
-  presentation->mediaNum++;
   presentation->imageId++;
 }
 
@@ -1254,7 +1266,7 @@ void pptxPixel(pptxPresentation *presentation, int x, int y, int width, unsigned
   presentation->objectNum++;
 }
 
-void pptxImageRGB(pptxPresentation *presentation, int iw, int ih, const unsigned char *rgb_data, int x, int y, int w, int h)
+void pptxImageRGB(pptxPresentation *presentation, int iw, int ih, unsigned char *rgb_data, int x, int y, int w, int h)
 {
   const char *image =
   {/*012345678| - primitives ident (9) */
@@ -1287,23 +1299,20 @@ void pptxImageRGB(pptxPresentation *presentation, int iw, int ih, const unsigned
     "            </p:spPr>\n"
     "         </p:pic>\n"
   };
-  char filename[10240];
-
-  sprintf(filename, "%s/"PPTX_IMAGE_FILE, presentation->baseDir, presentation->mediaNum);
-
-  lodepng_encode_file(filename, rgb_data, iw, ih, LCT_RGB, 8);
+  int media = encodeImage(presentation, rgb_data, iw, ih, LCT_RGB);
+  if (media < 0)
+    return;
 
   fprintf(presentation->slideFile, image, presentation->objectNum, presentation->objectNum, presentation->imageId, x*presentation->slide_xfactor, y*presentation->slide_yfactor,
           w*presentation->slide_xfactor, h*presentation->slide_yfactor);
 
-  printSlideRels(presentation);
+  printSlideRels(presentation, media);
 
   presentation->objectNum++;
-  presentation->mediaNum++;
   presentation->imageId++;
 }
 
-void pptxImageRGBA(pptxPresentation *presentation, int iw, int ih, const unsigned char *rgba_data, int x, int y, int w, int h)
+void pptxImageRGBA(pptxPresentation *presentation, int iw, int ih, unsigned char *rgba_data, int x, int y, int w, int h)
 {
   const char *image =
   {/*012345678| - primitives ident (9) */
@@ -1336,19 +1345,16 @@ void pptxImageRGBA(pptxPresentation *presentation, int iw, int ih, const unsigne
     "            </p:spPr>\n"
     "         </p:pic>\n"
   };
-  char filename[10240];
-
-  sprintf(filename, "%s/"PPTX_IMAGE_FILE, presentation->baseDir, presentation->mediaNum);
-
-  lodepng_encode_file(filename, rgba_data, iw, ih, LCT_RGBA, 8);
+  int media = encodeImage(presentation, rgba_data, iw, ih, LCT_RGBA);
+  if (media < 0)
+    return;
 
   fprintf(presentation->slideFile, image, presentation->objectNum, presentation->objectNum, presentation->imageId, x*presentation->slide_xfactor, y*presentation->slide_yfactor,
           w*presentation->slide_xfactor, h*presentation->slide_yfactor);
 
-  printSlideRels(presentation);
+  printSlideRels(presentation, media);
 
   presentation->objectNum++;
-  presentation->mediaNum++;
   presentation->imageId++;
 }
 
@@ -1412,6 +1418,13 @@ pptxPresentation* pptxCreatePresentation(double width_mm, double height_mm, int
   createSubDirectory(presentation->baseDir, PPTX_MEDIA_MEDIA_DIR);
   createSubDirectory(presentation->baseDir, PPTX_RELS_DIR);
 
+  presentation->png_queue = pngQueueCreate(0);
+  if (!presentation->png_queue)
+  {
+    free(presentation);
+    return NULL;
+  }
+
   presentation->slideNum = 0;
   presentation->objectNum = 51;
   presentation->mediaNum = 0;
@@ -1419,6 +1432,7 @@ pptxPresentation* pptxCreatePresentation(double width_mm, double height_mm, int
 
   if (!pptxOpenSlide(presentation))
   {
+    pngQueueKill(presentation->png_queue);
     free(presentation);
     return NULL;
   }
@@ -1576,6 +1590,26 @@ void pptsEndMasterFile(pptxPresentation *presentation)
 
 }
 
+void pptxSetPNGThreads(pptxPresentation* presentation, int num_threads)
+{
+  pngQueueSetThreads(presentation->png_queue, num_threads);
+}
+
+int pptxGetPNGThreads(pptxPresentation* presentation)
+{
+  return pngQueueGetThreads(presentation->png_queue);
+}
+
+void pptxSetPNGCompression(pptxPresentation* presentation, int level)
+{
+  pngQueueSetCompression(presentation->png_queue, level);
+}
+
+int pptxGetPNGCompression(pptxPresentation* presentation)
+{
+  return pngQueueGetCompression(presentation->png_queue);
+}
+
 void pptxSetImportedMasterSlideFile(pptxPresentation* presentation, char* importedMasterSlideFile)
 {
   presentation->importMasterSlideFile = cdStrDup(importedMasterSlideFile);
@@ -1686,6 +1720,9 @@ int pptxKillPresentation(pptxPresentation *presentation, const char* filename)
 
   closePresentation(presentation);
 
+  /* wait for all the pending encodes */
+  pngQueueKill(presentation->png_queue);
+
   if (presentation->importMasterSlideFile)
     pptxImportMasterSlide(presentation);
 
@@ -5,6 +5,7 @@
 #include <string.h>
 
 #include <cd.h>
+#include <cd_private.h>
 #include <cdcgm.h>
 
 #include "cgm_play.h"
@@ -758,7 +759,7 @@ static int cdcgm_Counter(double percent, cdCGM* cd_cgm)
   return CGM_OK; 
 }
 
-int cdplayCGM(cdCanvas* canvas, int xmin, int xmax, int ymin, int ymax, void *data)
+static int sPlayCGM(cdCanvas* canvas, int picture, int xmin, int xmax, int ymin, int ymax, const char *filename)
 {
   cgmPlayFuncs funcs;
   cdCGM cd_cgm;
@@ -800,7 +801,10 @@ int cdplayCGM(cdCanvas* canvas, int xmin, int xmax, int ymin, int ymax, void *da
   funcs.TextAttrib = cdcgm_TextAttrib; 
   funcs.Counter = cdcgm_Counter;
 
-  ret = cgmPlay((char*)data, (void*)&cd_cgm, &funcs);
+  if (picture)
+    ret = cgmPlayPicture(filename, picture, (void*)&cd_cgm, &funcs);
+  else
+    ret = cgmPlay(filename, (void*)&cd_cgm, &funcs);
   if (ret == CGM_OK)
     return CD_OK;
   else if (ret == CGM_ABORT_COUNTER)
@@ -808,3 +812,28 @@ int cdplayCGM(cdCanvas* canvas, int xmin, int xmax, int ymin, int ymax, void *da
   else
     return CD_ERROR;
 }
+
+int cdplayCGM(cdCanvas* canvas, int xmin, int xmax, int ymin, int ymax, void *data)
+{
+  return sPlayCGM(canvas, 0, xmin, xmax, ymin, ymax, (const char*)data);
+}
+
+int cdCanvasPlayCGMPicture(cdCanvas* canvas, int picture, int xmin, int xmax, int ymin, int ymax, const char* filename)
+{
+  if (!_cdCheckCanvas(canvas) || picture < 1)
+    return CD_ERROR;
+
+  /* the rectangle can be all 0 here, same as cdCanvasPlay, do not use cdCheckBoxSize */
+  if (xmin > xmax) _cdSwapInt(xmin, xmax);
+  if (ymin > ymax) _cdSwapInt(ymin, ymax);
+
+  return sPlayCGM(canvas, picture, xmin, xmax, ymin, ymax, filename);
+}
+
+int cdCGMGetPictureCount(const char* filename)
+{
+  int count = cgmPictureCount(filename);
+  if (count < 0)
+    return CD_ERROR;
+  return count;
+}
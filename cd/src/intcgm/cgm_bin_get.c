@@ -9,10 +9,7 @@ static int bin_get_bit(tCGM* cgm, unsigned char *b)
 {
   if(cgm->buff.pc==0 || cgm->buff.pc==8)
   {
-    *b = cgm->buff.data[cgm->buff.bc];
-    cgm->buff.bc++;
-
-    if(cgm->buff.bc > cgm->buff.len)
+    if(cgm_bin_get_c(cgm, b)) 
       return CGM_ERR_READ;
 
     cgm->buff.pc=0;
@@ -59,10 +56,7 @@ static int bin_get_2bit(tCGM* cgm, unsigned char *b)
 {
   if(cgm->buff.pc==0 || cgm->buff.pc==8)
   {
-    *b = cgm->buff.data[cgm->buff.bc];
-    cgm->buff.bc++;
-
-    if(cgm->buff.bc > cgm->buff.len) 
+    if(cgm_bin_get_c(cgm, b)) 
       return CGM_ERR_READ;
 
     cgm->buff.pc=0;
@@ -98,10 +92,7 @@ static int bin_get_4bit(tCGM* cgm, unsigned char *b)
 {
   if(cgm->buff.pc==0 || cgm->buff.pc==8)
   {
-    *b = cgm->buff.data[cgm->buff.bc];
-    cgm->buff.bc++;
-
-    if(cgm->buff.bc > cgm->buff.len) 
+    if(cgm_bin_get_c(cgm, b)) 
       return CGM_ERR_READ;
 
     cgm->buff.pc=0;
@@ -126,73 +117,115 @@ static int bin_get_4bit(tCGM* cgm, unsigned char *b)
   return CGM_OK;
 }
 
-int cgm_bin_get_c(tCGM* cgm, unsigned char *b)
+/* Returns the next n bytes of the record, or NULL if the record is too short.
+   On failure bc is still advanced, so the overrun is detected when the next record is read. */
+static const unsigned char* bin_get_bytes(tCGM* cgm, int n)
 {
-  *b = cgm->buff.data[cgm->buff.bc];
-  cgm->buff.bc++;
+  const unsigned char* p = (const unsigned char*)cgm->buff.data + cgm->buff.bc;
+
+  cgm->buff.bc += n;
 
   if(cgm->buff.bc > cgm->buff.len) 
+    return NULL;
+
+  return p;
+}
+
+/* big endian decoders, p must have the necessary bytes */
+#define bin_dec_u16(_p) ((unsigned short)(((_p)[0] << 8) | (_p)[1]))
+#define bin_dec_i16(_p) ((short)bin_dec_u16(_p))
+#define bin_dec_u24(_p) ((unsigned long)(((_p)[0] << 16) | ((_p)[1] << 8) | (_p)[2]))
+#define bin_dec_u32(_p) ((unsigned long)(((unsigned int)(_p)[0] << 24) | ((_p)[1] << 16) | ((_p)[2] << 8) | (_p)[3]))
+#define bin_dec_i32(_p) ((long)(int)bin_dec_u32(_p))
+
+static float bin_dec_fl32(const unsigned char* p)
+{
+  union {
+    float f;
+    unsigned int l;
+  } r;
+
+  r.l = (unsigned int)bin_dec_u32(p);
+  return r.f;
+}
+
+static double bin_dec_fl64(const unsigned char* p)
+{
+  union {
+    double d;
+    unsigned long long l;
+  } r;
+
+  r.l = ((unsigned long long)bin_dec_u32(p) << 32) | bin_dec_u32(p + 4);
+  return r.d;
+}
+
+static float bin_dec_fx32(const unsigned char* p)
+{
+  return (float)(bin_dec_i16(p) + (bin_dec_u16(p + 2) / 65536.0));
+}
+
+static double bin_dec_fx64(const unsigned char* p)
+{
+  return bin_dec_i32(p) + (bin_dec_u32(p + 4) / (65536.0 * 65536.0));
+}
+
+const unsigned char* cgm_bin_get_bytes(tCGM* cgm, int n)
+{
+  return bin_get_bytes(cgm, n);
+}
+
+int cgm_bin_get_c(tCGM* cgm, unsigned char *b)
+{
+  const unsigned char* p = bin_get_bytes(cgm, 1);
+  if(!p) 
     return CGM_ERR_READ;
 
+  *b = *p;
+
   return CGM_OK;   
 }
 
 static int cgm_bin_get_i8(tCGM* cgm, signed char *b)
 {
-  unsigned char b1;
-
-  if(cgm_bin_get_c(cgm, &b1)) 
+  const unsigned char* p = bin_get_bytes(cgm, 1);
+  if(!p) 
     return CGM_ERR_READ;
 
-  *b =(signed char) b1;
+  *b =(signed char) *p;
 
   return CGM_OK;
 }
 
 static int cgm_bin_get_i16(tCGM* cgm, short *b)
 {
-  unsigned char b1, b2;
-
-  if(cgm_bin_get_c(cgm, &b1)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b2)) 
+  const unsigned char* p = bin_get_bytes(cgm, 2);
+  if(!p) 
     return CGM_ERR_READ;
 
-  *b =(b1<<8) | b2;
+  *b = bin_dec_i16(p);
 
   return CGM_OK;
 }
 
 static int cgm_bin_get_i24(tCGM* cgm, long *b)
 {
-  unsigned char b1, b2, b3;
-
-  if(cgm_bin_get_c(cgm, &b1)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b2)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b3)) 
+  const unsigned char* p = bin_get_bytes(cgm, 3);
+  if(!p) 
     return CGM_ERR_READ;
 
-  *b =(b1<<16) |(b2<<8) | b3;
+  *b = (long)bin_dec_u24(p);
 
   return CGM_OK;
 }
 
 static int cgm_bin_get_i32(tCGM* cgm, long *b)
 {
-  unsigned char b1, b2, b3, b4;
-
-  if(cgm_bin_get_c(cgm, &b1)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b2)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b3)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b4)) 
+  const unsigned char* p = bin_get_bytes(cgm, 4);
+  if(!p) 
     return CGM_ERR_READ;
 
-  *b =(b1<<24) |(b2<<16) |(b3<<8) | b4;
+  *b = bin_dec_i32(p);
 
   return CGM_OK;
 }
@@ -207,132 +240,77 @@ static int cgm_bin_get_u8(tCGM* cgm, unsigned char *b)
 
 static int cgm_bin_get_u16(tCGM* cgm, unsigned short *b)
 {
-  unsigned char b1, b2;
-
-  if(cgm_bin_get_c(cgm, &b1)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b2)) 
+  const unsigned char* p = bin_get_bytes(cgm, 2);
+  if(!p) 
     return CGM_ERR_READ;
 
-  *b =(b1<<8) | b2;
+  *b = bin_dec_u16(p);
 
   return CGM_OK;
 }
 
 static int cgm_bin_get_u24(tCGM* cgm, unsigned long *b)
 {
-  unsigned char b1, b2, b3;
-
-  if(cgm_bin_get_c(cgm, &b1)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b2)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b3)) 
+  const unsigned char* p = bin_get_bytes(cgm, 3);
+  if(!p) 
     return CGM_ERR_READ;
 
-  *b =(b1<<16) |(b2<<8) | b3;
+  *b = bin_dec_u24(p);
 
   return CGM_OK;
 }
 
 static int cgm_bin_get_u32(tCGM* cgm, unsigned long *b)
 {
-  unsigned char b1, b2, b3, b4;
-
-  if(cgm_bin_get_c(cgm, &b1)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b2)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b3)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b4)) 
+  const unsigned char* p = bin_get_bytes(cgm, 4);
+  if(!p) 
     return CGM_ERR_READ;
 
-  *b =(b1<<24) |(b2<<16) |(b3<<8) | b4;
+  *b = bin_dec_u32(p);
 
   return CGM_OK;
 }
 
 static int cgm_bin_get_fl32(tCGM* cgm, float *b)
 {
-  unsigned char b1, b2, b3, b4;
-  union {
-    float f;
-    long  l;
-  } r;
-
-  if(cgm_bin_get_c(cgm, &b1)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b2)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b3)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b4)) 
+  const unsigned char* p = bin_get_bytes(cgm, 4);
+  if(!p) 
     return CGM_ERR_READ;
 
-  r.l =(b1<<24) |(b2<<16) |(b3<<8) | b4;
-  *b = r.f;
+  *b = bin_dec_fl32(p);
 
   return CGM_OK;
 }
 
 static int cgm_bin_get_fl64(tCGM* cgm, double *b)
 {
-  unsigned char b1, b2, b3, b4, b5, b6, b7, b8;
-  union {
-    double d;
-    long   l[2];
-  } r;
-
-  if(cgm_bin_get_c(cgm, &b1)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b2)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b3)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b4)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b5)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b6)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b7)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b8)) 
+  const unsigned char* p = bin_get_bytes(cgm, 8);
+  if(!p) 
     return CGM_ERR_READ;
 
-  r.l[1] =(b1<<24) |(b2<<16) |(b3<<8) | b4;
-  r.l[0] =(b5<<24) |(b6<<16) |(b7<<8) | b8;
-  *b = r.d;
+  *b = bin_dec_fl64(p);
 
   return CGM_OK;
 }
 
 static int cgm_bin_get_fx32(tCGM* cgm, float *b)
 {
-  short si;
-  unsigned short ui;
-
-  if(cgm_bin_get_i16(cgm, &si)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_u16(cgm, &ui)) 
+  const unsigned char* p = bin_get_bytes(cgm, 4);
+  if(!p) 
     return CGM_ERR_READ;
 
-  *b =(float)(si +(ui / 65536.0));
+  *b = bin_dec_fx32(p);
 
   return CGM_OK;
 }
 
 static int cgm_bin_get_fx64(tCGM* cgm, double *b)
 {
-  long si, ui;
-
-  if(cgm_bin_get_i32(cgm, &si)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_i32(cgm, &ui)) 
+  const unsigned char* p = bin_get_bytes(cgm, 8);
+  if(!p) 
     return CGM_ERR_READ;
 
-  *b = si +((unsigned short) ui /(65536.0 * 65536.0));
+  *b = bin_dec_fx64(p);
 
   return CGM_OK;
 }
@@ -719,6 +697,72 @@ int cgm_bin_get_p(tCGM* cgm, double *x, double *y)
   return CGM_OK;
 }
 
+int cgm_bin_get_vdc_size(tCGM* cgm)
+{
+  static const int int_size[4] = {1, 2, 3, 4};
+  static const int real_size[4] = {4, 8, 4, 8};
+
+  if(cgm->vdc_type == CGM_INTEGER)
+  {
+    if(cgm->vdc_int.b_prec < 0 || cgm->vdc_int.b_prec > 3)
+      return 0;
+    return int_size[cgm->vdc_int.b_prec];
+  }
+  else
+  {
+    if(cgm->vdc_real.b_prec < 0 || cgm->vdc_real.b_prec > 3)
+      return 0;
+    return real_size[cgm->vdc_real.b_prec];
+  }
+}
+
+/* decodes the whole run in a single loop for each format */
+#define bin_dec_points(_dec, _size)        \
+  for(i=0; i<n; i++, p+=2*(_size))         \
+  {                                        \
+    pt[i].x =(double)_dec(p);              \
+    pt[i].y =(double)_dec(p + (_size));    \
+  }
+
+#define bin_dec_i8(_p) ((signed char)*(_p))
+#define bin_dec_i24(_p) ((long)bin_dec_u24(_p))
+
+int cgm_bin_get_points(tCGM* cgm, cgmPoint *pt, int n)
+{
+  const unsigned char* p;
+  int i, size = cgm_bin_get_vdc_size(cgm);
+
+  if(size == 0)
+    return CGM_ERR_READ;
+
+  p = bin_get_bytes(cgm, 2*n*size);
+  if(!p)
+    return CGM_ERR_READ;
+
+  if(cgm->vdc_type == CGM_INTEGER)
+  {
+    switch(cgm->vdc_int.b_prec)
+    {
+    case 0: bin_dec_points(bin_dec_i8, 1);   break;
+    case 1: bin_dec_points(bin_dec_i16, 2);  break;
+    case 2: bin_dec_points(bin_dec_i24, 3);  break;
+    case 3: bin_dec_points(bin_dec_i32, 4);  break;
+    }
+  }
+  else
+  {
+    switch(cgm->vdc_real.b_prec)
+    {
+    case 0: bin_dec_points(bin_dec_fl32, 4); break;
+    case 1: bin_dec_points(bin_dec_fl64, 8); break;
+    case 2: bin_dec_points(bin_dec_fx32, 4); break;
+    case 3: bin_dec_points(bin_dec_fx64, 8); break;
+    }
+  }
+
+  return CGM_OK;
+}
+
 int cgm_bin_get_co(tCGM* cgm, tColor *co)
 {
   if(cgm->color_mode == CGM_INDEXED) /* indexed */
@@ -19,6 +19,10 @@ int cgm_bin_get_rf(tCGM* cgm, double *);  /* real as floating point always */
 int cgm_bin_get_ix(tCGM* cgm, long *);  /* index */
 int cgm_bin_get_pixel(tCGM* cgm, tColor *, int);  /* clist pixel, co using local precision */
 int cgm_bin_get_c(tCGM* cgm, unsigned char *);  /* single byte */
+const unsigned char* cgm_bin_get_bytes(tCGM* cgm, int n);  /* n bytes at once, NULL if not available */
+
+int cgm_bin_get_vdc_size(tCGM* cgm);  /* size in bytes of a vdc, 0 if invalid */
+int cgm_bin_get_points(tCGM* cgm, cgmPoint *, int n);  /* n points decoded at once */
 
 typedef int(*cgmGetData)(tCGM* cgm, void *);
 cgmGetData cgm_bin_get_samplefunc(long sample_type);
@@ -6,6 +6,24 @@
 
 static int cgm_bin_exec_command(tCGM* cgm, int, int);
 
+static int bin_buff_reserve(tCGM* cgm, int len)
+{
+  if(len > cgm->buff.size)
+  {
+    char* mem =(char *)realloc(cgm->buff.mem, len);
+    if(!mem)
+      return CGM_ERR_READ;
+
+    if(cgm->buff.data == cgm->buff.mem)
+      cgm->buff.data = mem;
+
+    cgm->buff.mem = mem;
+    cgm->buff.size = len;
+  }
+
+  return CGM_OK;
+}
+
 /*******************************
 *     Delimiter Elements       *
 *******************************/
@@ -228,9 +246,9 @@ static int cgm_bin_bmtfdf(tCGM* cgm)
 {
   /* default state is the state to which the interpreter is returned 
      at the start of each picture. */
-  int c, id, len, cont, totbc; 
+  int c, id, len, cont; 
   unsigned short b;
-  int count=0, ret;
+  int count=0, ret=CGM_OK;
   int old_cgmlen;
   char *buff;
 
@@ -240,9 +258,7 @@ static int cgm_bin_bmtfdf(tCGM* cgm)
 
   old_cgmlen = cgm->buff.len;
 
-  totbc = 0;
-
-  while(count<old_cgmlen)
+  while(count+2<=old_cgmlen)
   {
     cgm->buff.bc = 0;
 
@@ -257,6 +273,12 @@ static int cgm_bin_bmtfdf(tCGM* cgm)
 
     if(len > 30)
     {
+      if(count+2 > old_cgmlen)
+      {
+        ret = CGM_ERR_READ;
+        break;
+      }
+
       b =((unsigned char)buff[count] << 8) |(unsigned char)buff[count+1];
       count += 2;
 
@@ -264,26 +286,35 @@ static int cgm_bin_bmtfdf(tCGM* cgm)
       cont =(b & 0x8000);
     }
 
+    if(count + len > old_cgmlen)
+    {
+      ret = CGM_ERR_READ;
+      break;
+    }
+
+    /* the element is decoded directly from the copy */
+    cgm->buff.data = &buff[count];
     cgm->buff.len = len;
+    count += len;
+
+    if(len & 1)
+      count++;
 
-    if(cgm->buff.len)
+    if(cont)
     {
-      if (cgm->buff.len>cgm->buff.size)
+      if(bin_buff_reserve(cgm, cgm->buff.len))
       {
-        cgm->buff.data = (char *)realloc(cgm->buff.data, cgm->buff.len);
-        cgm->buff.size = cgm->buff.len;
+        ret = CGM_ERR_READ;
+        break;
       }
 
-      memcpy(cgm->buff.data, &buff[count], cgm->buff.len);
-      count += cgm->buff.len;
-
-      if(len & 1)
-        count++;
+      memcpy(cgm->buff.mem, cgm->buff.data, cgm->buff.len);
+      cgm->buff.data = cgm->buff.mem;
 
       while(cont)
       {
-        unsigned short b;
-        int old_len = cgm->buff.len;
+        if(count+2 > old_cgmlen)
+          break;
 
         b =((unsigned char)buff[count] << 8) |(unsigned char)buff[count+1];
         count += 2;
@@ -292,34 +323,36 @@ static int cgm_bin_bmtfdf(tCGM* cgm)
 
         len = b & 0x7fff;
 
-        cgm->buff.len += len;
+        if(count + len > old_cgmlen || bin_buff_reserve(cgm, cgm->buff.len + len))
+          break;
 
-        if (cgm->buff.len>cgm->buff.size)
-        {
-          cgm->buff.data = (char *)realloc(cgm->buff.data, cgm->buff.len);
-          cgm->buff.size = cgm->buff.len;
-        }
-
-        memcpy(&cgm->buff.data[old_len], &buff[count], len);
+        memcpy(cgm->buff.mem + cgm->buff.len, &buff[count], len);
+        cgm->buff.len += len;
         count += len;
 
         if(len & 1)
           count++;
       }
+
+      if(cont)
+      {
+        ret = CGM_ERR_READ;
+        break;
+      }
     }
 
     ret = cgm_bin_exec_command(cgm, c, id);
     if(ret != CGM_OK) 
-    {
-      free(buff);
-      return ret;
-    }
-
-    totbc += count;
+      break;
   }
 
+  /* buff is released, the record was fully consumed */
+  cgm->buff.data = cgm->buff.mem;
+  cgm->buff.len = 0;
+  cgm->buff.bc = 0;
+
   free(buff);
-  return CGM_OK;
+  return ret;
 }
 
 static int cgm_bin_fntlst(tCGM* cgm)
@@ -593,22 +626,31 @@ static int cgm_bin_transpcellcolor(tCGM* cgm)
 
 static cgmPoint *get_points(tCGM* cgm, int *np)
 {
+  int size = 2*cgm_bin_get_vdc_size(cgm), 
+      remain = cgm->buff.len - cgm->buff.bc;
+
   *np=0;
 
-  while(cgm->buff.bc < cgm->buff.len)
+  /* all the remaining parameters are points */
+  if(size == 0 || remain % size) 
+    return NULL;
+
+  *np = remain / size;
+
+  /* list capacity is known from the record length */
+  if(*np >= cgm->point_list_n)
   {
-    if(cgm_bin_get_p(cgm, &(cgm->point_list[*np].x), &(cgm->point_list[*np].y))) 
+    cgmPoint* point_list =(cgmPoint *) realloc(cgm->point_list, (*np+1)*sizeof(cgmPoint));
+    if(!point_list)
       return NULL;
 
-    ++(*np);
-
-    if(*np==cgm->point_list_n)
-    {
-      cgm->point_list_n *= 2;
-      cgm->point_list =(cgmPoint *) realloc(cgm->point_list, cgm->point_list_n*sizeof(cgmPoint));
-    }
+    cgm->point_list = point_list;
+    cgm->point_list_n = *np+1;
   }
 
+  if(cgm_bin_get_points(cgm, cgm->point_list, *np)) 
+    return NULL;
+
   return cgm->point_list;
 }
 
@@ -747,15 +789,21 @@ static int cgm_bin_polygn(tCGM* cgm)
 
 static int get_point_set(tCGM* cgm, cgmPoint **pt, short **flags, int *np)
 {
-  int block=500;
+  int i, block, size = 2*cgm_bin_get_vdc_size(cgm) + 2;  /* point + edge flag */
 
   *np=0;
+
+  /* list capacity is known from the record length */
+  block = (cgm->buff.len - cgm->buff.bc) / size;
+  if(block < 1) block = 1;
+
   *pt =(cgmPoint *) malloc(block*sizeof(cgmPoint));
   *flags =(short *) malloc(block*sizeof(short));
 
-  while(cgm->buff.bc < cgm->buff.len)
+  for(i=0; i<block && cgm->buff.bc < cgm->buff.len; i++)
   {
-    if(cgm_bin_get_p(cgm, &((*pt)[*np].x), &((*pt)[*np].y))) 
+    if(cgm_bin_get_points(cgm, (*pt) + i, 1) ||
+       cgm_bin_get_e(cgm, (*flags) + i)) 
     {
       free(*pt);
       free(*flags);
@@ -763,24 +811,10 @@ static int get_point_set(tCGM* cgm, cgmPoint **pt, short **flags, int *np)
       *flags = NULL;
       return CGM_ERR_READ;
     }
-    if(cgm_bin_get_e(cgm, &((*flags)[*np]))) 
-    {
-      free(*pt);
-      free(*flags);
-      *pt = NULL;
-      *flags = NULL;
-      return CGM_ERR_READ;
-    }
-
-    ++(*np);
-    if(*np==block)
-    {
-      block *= 2;
-      *pt =(cgmPoint *) realloc(*pt, block*sizeof(cgmPoint));
-      *flags =(short *) realloc(*flags, block*sizeof(short));
-    }
   }
 
+  *np = i;
+
   return CGM_OK;
 }
 
@@ -801,6 +835,18 @@ static int cgm_bin_plgset(tCGM* cgm)
   return CGM_OK;
 }
 
+static int cellar_bits(tCGM* cgm, long prec)
+{
+  /* local precision 0 means the default color precision */
+  if (prec != 0)
+    return (int)prec;
+
+  if (cgm->color_mode == CGM_INDEXED)
+    return (cgm->cix_prec == 0)? 8: 0;
+  else
+    return (cgm->cd_prec == 0)? 8: 0;
+}
+
 static int cgm_bin_cellar(tCGM* cgm)
 {
   register int i, j, k, offset;
@@ -834,7 +880,73 @@ static int cgm_bin_cellar(tCGM* cgm)
 
   rgb = malloc(nx*ny*3);
 
-  if (mode)
+  if (mode && cellar_bits(cgm, prec) == 8)
+  {
+    /* Packed mode with one byte per component, 
+       each row is converted at once using tables */
+    unsigned char lut[3*256];
+    int row_size = (cgm->color_mode == CGM_INDEXED)? nx: 3*nx;
+
+    for(i=0; i<256; i++)
+    {
+      if (cgm->color_mode == CGM_INDEXED)
+      {
+        cell.index = i;
+        cgm_getcolor_ar(cgm, cell, lut + 3*i+0, lut + 3*i+1, lut + 3*i+2);
+      }
+      else
+      {
+        cgmRGB c;
+        cell.rgb.red = cell.rgb.green = cell.rgb.blue = i;
+        c = cgm_getrgb(cgm, cell.rgb);
+        lut[i] = c.red;
+        lut[256+i] = c.green;
+        lut[512+i] = c.blue;
+      }
+    }
+
+    for(k=0; k<ny; k++)
+    {
+      const unsigned char* row = cgm_bin_get_bytes(cgm, row_size);
+      unsigned char* dst = rgb + 3*k*nx;
+      if (!row)
+      {
+        free(rgb);
+        return CGM_ERR_READ;
+      }
+
+      if (cgm->color_mode == CGM_INDEXED)
+      {
+        for(i=0; i<nx; i++, dst+=3)
+        {
+          const unsigned char* c = lut + 3*row[i];
+          dst[0] = c[0];
+          dst[1] = c[1];
+          dst[2] = c[2];
+        }
+      }
+      else
+      {
+        for(i=0; i<nx; i++, dst+=3, row+=3)
+        {
+          dst[0] = lut[row[0]];
+          dst[1] = lut[256+row[1]];
+          dst[2] = lut[512+row[2]];
+        }
+      }
+
+      /* row starts on a word boundary */
+      if(k<(ny-1) && row_size%2) 
+        cgm_bin_get_c(cgm, &dummy);
+
+      if (cgm_inccounter(cgm))
+      {
+        free(rgb);
+        return CGM_ABORT_COUNTER;
+      }
+    }
+  }
+  else if (mode)
   {
     /* Packed mode */
     for(k=0; k<ny; k++)
@@ -2378,10 +2490,23 @@ static int cgm_bin_exec_command(tCGM* cgm, int classe, int id)
   return (*_cgm_bin_commands[classe][id])(cgm);
 }
 
+static int bin_read_word(tCGM* cgm, unsigned short *b)
+{
+  const unsigned char* p;
+
+  if(cgm->map_pos + 2 > cgm->map_size)
+    return CGM_ERR_READ;
+
+  p = cgm->map + cgm->map_pos;
+  *b =(p[0] << 8) + p[1];
+  cgm->map_pos += 2;
+
+  return CGM_OK;
+}
+
 int cgm_bin_rch(tCGM* cgm)
 {
-  int c, id, len, cont, i; 
-  unsigned char ch[2], dummy;
+  int c, id, len, cont; 
   unsigned short b;
   int ret;
 
@@ -2390,16 +2515,9 @@ int cgm_bin_rch(tCGM* cgm)
 
   cgm->buff.bc = 0;
 
-  ret = fread(ch, 1, 2, cgm->fp);
-  if(ret<2) 
-  {
-    if (feof(cgm->fp))
-      return CGM_OK;
-    else
-      return CGM_ERR_READ;
-  }
+  if(bin_read_word(cgm, &b)) 
+    return CGM_OK;  /* end of file */
 
-  b =(ch[0] << 8) + ch[1];
   len = b & 0x001F;
   id =(b & 0x0FE0) >> 5;
   c =(b & 0xF000) >> 12;
@@ -2408,71 +2526,50 @@ int cgm_bin_rch(tCGM* cgm)
 
   if(len > 30)
   {
-    ret = fread(ch, 1, 2, cgm->fp);
-    if(ret<2) 
+    if(bin_read_word(cgm, &b)) 
       return CGM_ERR_READ;
 
-    b =(ch[0] << 8) + ch[1];
-
     len = b & 0x7FFF;
     cont =(b & 0x8000);
   }
 
+  /* partitions are padded to an even length */
+  if(cgm->map_pos + len + (len & 1) > cgm->map_size) 
+    return CGM_ERR_READ;
+
+  /* a record in a single partition is decoded directly from the file contents */
+  cgm->buff.data = (char*)(cgm->map + cgm->map_pos);
   cgm->buff.len = len;
+  cgm->map_pos += len + (len & 1);
 
-  if(cgm->buff.len)
+  if(cont)
   {
-    if (cgm->buff.len>cgm->buff.size)
-    {
-      cgm->buff.data = (char *)realloc(cgm->buff.data, cgm->buff.len);
-      cgm->buff.size = cgm->buff.len;
-    }
-
-    ret = fread(cgm->buff.data, 1, cgm->buff.len, cgm->fp);
-    if(ret<cgm->buff.len) 
+    /* partitions are joined in the record buffer */
+    if(bin_buff_reserve(cgm, cgm->buff.len))
       return CGM_ERR_READ;
 
-    if (len & 1)
-    {
-      ret = fread(&dummy, 1, 1, cgm->fp);
-      if(ret<1) 
-        return CGM_ERR_READ;
-    }
+    memcpy(cgm->buff.mem, cgm->buff.data, cgm->buff.len);
+    cgm->buff.data = cgm->buff.mem;
 
     while(cont)
     {
-      unsigned char ch[2];
-      unsigned short b;
-      int old_len = cgm->buff.len;
-
-      ret = fread(ch, 1, 2, cgm->fp);
-      if(ret<2) 
+      if(bin_read_word(cgm, &b)) 
         return CGM_ERR_READ;
 
-      b =(ch[0] << 8) + ch[1];
-
       cont =(b & 0x8000);
 
       len = b & 0x7fff;
 
-      cgm->buff.len += len;
-
-      if (cgm->buff.len>cgm->buff.size)
-      {
-        cgm->buff.data = (char *)realloc(cgm->buff.data, cgm->buff.len);
-        cgm->buff.size = cgm->buff.len;
-      }
+      if(cgm->map_pos + len + (len & 1) > cgm->map_size) 
+        return CGM_ERR_READ;
 
-      ret = fread(&cgm->buff.data[old_len], 1, len, cgm->fp);
-      if(ret<len) 
+      if(bin_buff_reserve(cgm, cgm->buff.len + len))
         return CGM_ERR_READ;
 
-      if(len & 1)
-      {
-        ret = fread(&dummy, 1, 1, cgm->fp);
-        if(ret<1) 
-          return CGM_ERR_READ;
-      }
+      memcpy(cgm->buff.mem + cgm->buff.len, cgm->map + cgm->map_pos, len);
+      cgm->buff.data = cgm->buff.mem;
+      cgm->buff.len += len;
+      cgm->map_pos += len + (len & 1);
     }
   }
 
@@ -2483,15 +2580,61 @@ int cgm_bin_rch(tCGM* cgm)
   if (ret != CGM_OK) 
     return ret;
 
-  for(i=0; i<cgm->buff.len-cgm->buff.bc; i++)
-  {
-    unsigned char dummy;
-    if(cgm_bin_get_c(cgm, &dummy)) 
-      return CGM_ERR_READ;
-  }
+  /* skip unused parameters */
+  if(cgm->buff.bc < cgm->buff.len)
+    cgm->buff.bc = cgm->buff.len;
 
-  if (feof(cgm->fp))
+  if (cgm->map_pos >= cgm->map_size)
     return CGM_OK;
   else
     return CGM_CONT;
 }
+
+int cgm_bin_index(tCGM* cgm, tIndex* index)
+{
+  /* only the element headers are read */
+  while(cgm->map_pos + 2 <= cgm->map_size)
+  {
+    long offset = cgm->map_pos;
+    int c, id, len, cont; 
+    unsigned short b;
+
+    bin_read_word(cgm, &b);
+
+    len = b & 0x001F;
+    id =(b & 0x0FE0) >> 5;
+    c =(b & 0xF000) >> 12;
+
+    cont = 0;
+
+    if(len > 30)
+    {
+      if(bin_read_word(cgm, &b)) 
+        return CGM_ERR_READ;
+
+      len = b & 0x7FFF;
+      cont =(b & 0x8000);
+    }
+
+    cgm->map_pos += len + (len & 1);
+
+    while(cont)
+    {
+      if(bin_read_word(cgm, &b)) 
+        return CGM_ERR_READ;
+
+      cont =(b & 0x8000);
+      len = b & 0x7fff;
+
+      cgm->map_pos += len + (len & 1);
+    }
+
+    if(cgm->map_pos > cgm->map_size) 
+      return CGM_ERR_READ;
+
+    if (c == 0 && id == 3)  /* BEGIN PICTURE */
+      cgm_index_add(index, offset);
+  }
+
+  return CGM_OK;
+}
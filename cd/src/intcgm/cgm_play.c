@@ -3,7 +3,18 @@
 #include <math.h>     
 #include <ctype.h>
 
+#ifdef WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#include <sys/types.h>
+#include <sys/stat.h>
+
 #include "cgm_types.h"
+#include "cgm_txt_get.h"
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
@@ -513,7 +524,86 @@ static void set_funcs(cgmPlayFuncs* dof, cgmPlayFuncs* funcs)
 
 int cgm_inccounter (tCGM* cgm)
 {
-  return cgm->dof.Counter((ftell(cgm->fp )*100.)/cgm->file_size, cgm->userdata);
+  return cgm->dof.Counter((cgm->map_pos*100.)/cgm->file_size, cgm->userdata);
+}
+
+static int map_cgm(tCGM* cgm)
+{
+  long size = cgm->file_size;
+  unsigned char* data;
+
+  if (size <= 0)
+    return 0;
+
+  /* the whole file is mapped in memory, so binary records 
+     and text tokens are decoded directly from the file contents */
+#ifdef WIN32
+  {
+    HANDLE hFile = (HANDLE)_get_osfhandle(_fileno(cgm->fp));
+    HANDLE hMap = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (hMap)
+    {
+      cgm->map = (const unsigned char*)MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+      if (cgm->map)
+      {
+        cgm->map_handle = hMap;
+        cgm->map_size = size;
+        return 1;
+      }
+      CloseHandle(hMap);
+    }
+  }
+#else
+  {
+    void* addr = mmap(NULL, (size_t)size, PROT_READ, MAP_PRIVATE, fileno(cgm->fp), 0);
+    if (addr != MAP_FAILED)
+    {
+#ifdef MADV_SEQUENTIAL
+      madvise(addr, (size_t)size, MADV_SEQUENTIAL);
+#endif
+      cgm->map = (const unsigned char*)addr;
+      cgm->map_size = size;
+      return 1;
+    }
+  }
+#endif
+
+  /* fallback to read the file in memory */
+  data = (unsigned char*)malloc(size);
+  if (!data)
+    return 0;
+
+  fseek(cgm->fp, 0, SEEK_SET);
+  if (fread(data, 1, size, cgm->fp) != (size_t)size)
+  {
+    free(data);
+    return 0;
+  }
+
+  cgm->map = data;
+  cgm->map_size = size;
+  cgm->map_alloc = 1;
+  return 1;
+}
+
+static void unmap_cgm(tCGM* cgm)
+{
+  if (!cgm->map)
+    return;
+
+  if (cgm->map_alloc)
+    free((void*)cgm->map);
+  else
+  {
+#ifdef WIN32
+    UnmapViewOfFile(cgm->map);
+    CloseHandle((HANDLE)cgm->map_handle);
+#else
+    munmap((void*)cgm->map, (size_t)cgm->map_size);
+#endif
+  }
+
+  cgm->map = NULL;
 }
 
 static FILE* open_cgm(const char *filename, int *mode, int *file_size)
@@ -543,25 +633,23 @@ static FILE* open_cgm(const char *filename, int *mode, int *file_size)
   if(c==0 && id==1)
     *mode = 1;   /* binary */
   else
-  {
     *mode = 2;   /* text */
 
-    fclose(fp);
-    fp = fopen(filename, "r");
-  }
-
   return fp;
 }
 
-int cgmPlay(const char* filename, void* userdata, cgmPlayFuncs* funcs)
+static tCGM* create_cgm(const char* filename, void* userdata, cgmPlayFuncs* funcs, int *ret)
 {
   tCGM* cgm;
   FILE* fp;
-  int mode, file_size, ret;
+  int mode, file_size;
 
   fp = open_cgm(filename, &mode, &file_size);
   if (!fp)
-    return CGM_ERR_OPEN;
+  {
+    *ret = CGM_ERR_OPEN;
+    return NULL;
+  }
 
   cgm = calloc(1, sizeof(tCGM));
 
@@ -570,6 +658,15 @@ int cgmPlay(const char* filename, void* userdata, cgmPlayFuncs* funcs)
 
   cgm->fp = fp;
   cgm->file_size = file_size;
+  cgm->mode = mode;
+
+  if (!map_cgm(cgm))
+  {
+    fclose(fp);
+    free(cgm);
+    *ret = CGM_ERR_READ;
+    return NULL;
+  }
 
   cgm->dof.Counter(0, cgm->userdata);
 
@@ -641,7 +738,8 @@ int cgmPlay(const char* filename, void* userdata, cgmPlayFuncs* funcs)
 
   cgm->buff.len = 0;
   cgm->buff.size = 1024;
-  cgm->buff.data =(char *) malloc(sizeof(char) * cgm->buff.size);
+  cgm->buff.mem =(char *) malloc(sizeof(char) * cgm->buff.size);
+  cgm->buff.data = cgm->buff.mem;
   cgm->buff.bc = 0;
   cgm->buff.pc = 0;
 
@@ -704,26 +802,49 @@ int cgmPlay(const char* filename, void* userdata, cgmPlayFuncs* funcs)
   cgm->color_table[1].green = 0;
   cgm->color_table[1].blue  = 0;
 
-  if(mode == 1)
+  *ret = CGM_OK;
+  return cgm;
+}
+
+static int play_cgm(tCGM* cgm, long end)
+{
+  int ret = CGM_CONT;
+
+  /* stops at the end of the file or at the given offset */
+  while(ret==CGM_CONT)
   {
-    do
+    if(cgm->mode == 1)
     {
+      if (cgm->map_pos >= end)
+        break;
+
       ret = cgm_bin_rch(cgm);  /* binary */
-    } while(ret==CGM_CONT);  
-  }
-  else
-  {
-    do
+    }
+    else
     {
+      /* the offset is at the start of the next element */
+      cgm_txt_skip_sep(cgm);
+      cgm_txt_skip_com(cgm);
+      if (cgm->map_pos >= end)
+        break;
+
       ret = cgm_txt_rch(cgm);  /* text */
-    } while(ret==CGM_CONT);  
+    }
   }
 
+  if (ret==CGM_CONT)
+    ret = CGM_OK;
+
+  return ret;
+}
+
+static void kill_cgm(tCGM* cgm)
+{
   if(cgm->point_list)
     free(cgm->point_list);
 
-  if(cgm->buff.data)
-    free(cgm->buff.data);
+  if(cgm->buff.mem)
+    free(cgm->buff.mem);
 
   if(cgm->color_table)
     free(cgm->color_table);
@@ -750,8 +871,279 @@ int cgmPlay(const char* filename, void* userdata, cgmPlayFuncs* funcs)
 
   cgm->dof.Counter(100., cgm->userdata);
 
+  unmap_cgm(cgm);
   fclose(cgm->fp);
   free(cgm);
+}
+
+int cgmPlay(const char* filename, void* userdata, cgmPlayFuncs* funcs)
+{
+  int ret;
+  tCGM* cgm = create_cgm(filename, userdata, funcs, &ret);
+  if (!cgm)
+    return ret;
+
+  ret = play_cgm(cgm, cgm->map_size);
+
+  kill_cgm(cgm);
+  return ret;
+}
+
+/*******************************
+*        Picture Index         *
+*******************************/
+
+#define CGM_INDEX_VERSION 1
+
+static char* index_filename(const char* filename)
+{
+  char* idxname = malloc(strlen(filename) + 5);
+  strcpy(idxname, filename);
+  strcat(idxname, ".idx");
+  return idxname;
+}
+
+static int index_stat(const char* filename, long *size, long *mtime)
+{
+  struct stat st;
+  if (stat(filename, &st) != 0)
+    return 0;
+
+  *size = (long)st.st_size;
+  *mtime = (long)st.st_mtime;
+  return 1;
+}
+
+static int index_load(tIndex* index, const char* filename)
+{
+  /* sidecar file is valid only for the same size and modification time */
+  long size, mtime, idx_size, idx_mtime;
+  int version, count, i;
+  char* idxname;
+  FILE* fp;
+
+  if (!index_stat(filename, &size, &mtime))
+    return 0;
+
+  idxname = index_filename(filename);
+  fp = fopen(idxname, "r");
+  free(idxname);
+  if (!fp)
+    return 0;
+
+  if (fscanf(fp, "CGMINDEX %d %ld %ld %d %ld", &version, &idx_size, &idx_mtime, &count, &index->descriptor) != 5 ||
+      version != CGM_INDEX_VERSION || idx_size != size || idx_mtime != mtime || count < 0)
+  {
+    fclose(fp);
+    return 0;
+  }
+
+  index->pictures = malloc((count+1)*sizeof(long));
+  index->size = count+1;
+
+  for (i = 0; i < count; i++)
+  {
+    if (fscanf(fp, "%ld", index->pictures + i) != 1)
+    {
+      fclose(fp);
+      free(index->pictures);
+      index->pictures = NULL;
+      index->size = 0;
+      return 0;
+    }
+  }
+
+  index->count = count;
+  fclose(fp);
+  return 1;
+}
+
+static void index_save(tIndex* index, const char* filename)
+{
+  long size, mtime;
+  char *idxname, *tmpname;
+  FILE* fp;
+  int i, ok;
+#ifndef WIN32
+  int fd;
+#endif
+
+  if (!index_stat(filename, &size, &mtime))
+    return;
+
+  /* written to a temporary file with an unique name first, 
+     so concurrent players never see a partial index */
+  idxname = index_filename(filename);
+  tmpname = malloc(strlen(idxname) + 30);
+#ifdef WIN32
+  sprintf(tmpname, "%s.%lu.%lu", idxname, (unsigned long)GetCurrentProcessId(), (unsigned long)GetCurrentThreadId());
+  fp = fopen(tmpname, "w");
+#else
+  sprintf(tmpname, "%s.XXXXXX", idxname);
+  fp = NULL;
+  fd = mkstemp(tmpname);
+  if (fd != -1)
+  {
+    fchmod(fd, 0644);  /* mkstemp creates it readable only by the owner */
+    fp = fdopen(fd, "w");
+    if (!fp)
+    {
+      close(fd);
+      remove(tmpname);
+    }
+  }
+#endif
+  if (!fp)
+  {
+    free(tmpname);
+    free(idxname);
+    return;
+  }
+
+  ok = fprintf(fp, "CGMINDEX %d %ld %ld %d %ld\n", CGM_INDEX_VERSION, size, mtime, index->count, index->descriptor) > 0;
+  for (i = 0; i < index->count && ok; i++)
+    ok = fprintf(fp, "%ld\n", index->pictures[i]) > 0;
+
+  if (fclose(fp) != 0)
+    ok = 0;
+
+  if (ok)
+  {
+    remove(idxname);
+    ok = (rename(tmpname, idxname) == 0);
+  }
+
+  if (!ok)
+    remove(tmpname);
+
+  free(tmpname);
+  free(idxname);
+}
+
+void cgm_index_add(tIndex* index, long offset)
+{
+  if (index->count == index->size)
+  {
+    index->size += 256;
+    index->pictures = realloc(index->pictures, index->size*sizeof(long));
+  }
+
+  index->pictures[index->count] = offset;
+  index->count++;
+}
+
+static int index_cgm(tCGM* cgm, tIndex* index, const char* filename)
+{
+  int ret;
+
+  if (index_load(index, filename))
+    return CGM_OK;
+
+  if (cgm->mode == 1)
+    ret = cgm_bin_index(cgm, index);
+  else
+    ret = cgm_txt_index(cgm, index);
+
+  cgm->map_pos = 0;
+
+  if (ret != CGM_OK)
+    return ret;
+
+  /* the metafile descriptor ends at the first picture */
+  index->descriptor = index->count? index->pictures[0]: cgm->map_size;
+
+  index_save(index, filename);
+  return CGM_OK;
+}
+
+int cgmPictureCount(const char* filename)
+{
+  cgmPlayFuncs funcs;
+  tIndex index;
+  int ret;
+  tCGM* cgm;
+
+  memset(&funcs, 0, sizeof(cgmPlayFuncs));
+  cgm = create_cgm(filename, NULL, &funcs, &ret);
+  if (!cgm)
+    return -1;
+
+  memset(&index, 0, sizeof(tIndex));
+  ret = index_cgm(cgm, &index, filename);
+
+  kill_cgm(cgm);
+
+  if (index.pictures)
+    free(index.pictures);
+
+  if (ret != CGM_OK)
+    return -1;
+
+  return index.count;
+}
+
+/* Plays the pictures before the given one calling only the descriptor and control methods, 
+   so the player and the application have the same state of a sequential play, 
+   but nothing is drawn. */
+static int play_cgm_state(tCGM* cgm, long end)
+{
+  cgmPlayFuncs dof = cgm->dof;
+  cgmPlayFuncs funcs;
+  int ret;
+
+  memset(&funcs, 0, sizeof(cgmPlayFuncs));
+  funcs.DeviceExtent = dof.DeviceExtent;
+  funcs.ScaleMode = dof.ScaleMode;
+  funcs.BackgroundColor = dof.BackgroundColor;
+  funcs.Transparency = dof.Transparency;
+  funcs.ClipRectangle = dof.ClipRectangle;
+  funcs.ClipIndicator = dof.ClipIndicator;
+  funcs.Counter = dof.Counter;
+  set_funcs(&cgm->dof, &funcs);
+
+  ret = play_cgm(cgm, end);
+
+  cgm->dof = dof;
+  return ret;
+}
+
+int cgmPlayPicture(const char* filename, int picture, void* userdata, cgmPlayFuncs* funcs)
+{
+  tIndex index;
+  long end;
+  int ret;
+  tCGM* cgm = create_cgm(filename, userdata, funcs, &ret);
+  if (!cgm)
+    return ret;
+
+  memset(&index, 0, sizeof(tIndex));
+  ret = index_cgm(cgm, &index, filename);
+  if (ret == CGM_OK && (picture < 1 || picture > index.count))
+    ret = CGM_ERR_READ;
+
+  if (ret == CGM_OK)
+  {
+    /* metafile descriptor, including the metafile defaults replacement */
+    ret = play_cgm(cgm, index.descriptor);
+
+    /* attributes, color table and descriptor elements of the previous pictures */
+    if (ret == CGM_OK && picture > 1)
+      ret = play_cgm_state(cgm, index.pictures[picture-1]);
+
+    if (ret == CGM_OK)
+    {
+      end = (picture < index.count)? index.pictures[picture]: cgm->map_size;
+      ret = play_cgm(cgm, end);
+
+      if (ret == CGM_OK && picture < index.count)
+        cgm->dof.EndMetafile(cgm->userdata);
+    }
+  }
+
+  kill_cgm(cgm);
+
+  if (index.pictures)
+    free(index.pictures);
 
   return ret;
 }
@@ -164,6 +164,17 @@ typedef struct {
 
 int cgmPlay(const char* filename, void* userdata, cgmPlayFuncs* funcs);
 
+/* Picture Index
+  The offsets of the pictures are found in a single pass that does not decode the elements.
+  The index is saved in a sidecar file "<filename>.idx" and reused 
+  while the metafile size and modification time do not change.
+  cgmPlayPicture plays the metafile descriptor and then only the given picture (1 is the first).
+  The previous pictures are decoded calling only the picture descriptor and control methods, 
+  so the attributes they change are the same of a sequential play, but nothing is drawn.
+  It can be called from several threads for different pictures using different userdata. */
+int cgmPictureCount(const char* filename);  /* returns -1 if failed */
+int cgmPlayPicture(const char* filename, int picture, void* userdata, cgmPlayFuncs* funcs);
+
 
 #ifdef __cplusplus
 }
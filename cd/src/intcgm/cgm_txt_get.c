@@ -1,56 +1,128 @@
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <locale.h>
 
 #include "cgm_types.h"
 #include "cgm_txt_get.h"
 
 
+/* The clear text file is mapped in memory (see cgm_play.c).
+   Tokens are scanned directly from the file contents,
+   numbers are converted without the C locale. */
+
+#define TXT_EOF (-1)
+
+#define txt_peek(_cgm) ((_cgm)->map_pos < (_cgm)->map_size? (int)(_cgm)->map[(_cgm)->map_pos]: TXT_EOF)
+
+#define txt_is_sep(_c) ((_c)==' ' || (_c)=='\r' || (_c)=='\n' || (_c)=='\t' || (_c)=='\v' || (_c)=='\f' || (_c)==',')
+#define txt_is_space(_c) ((_c)==' ' || (_c)=='\r' || (_c)=='\n' || (_c)=='\t' || (_c)=='\v' || (_c)=='\f')
+#define txt_is_digit(_c) ((_c)>='0' && (_c)<='9')
+
+static void txt_skip_space(tCGM* cgm)
+{
+  while(cgm->map_pos < cgm->map_size && txt_is_space(cgm->map[cgm->map_pos]))
+    cgm->map_pos++;
+}
+
 char* cgm_txt_get_sep(tCGM* cgm, char* chr)
 {
-  fscanf(cgm->fp, "%[ \r\n\t\v\f,]", chr);
+  int i = 0;
+
+  while(cgm->map_pos < cgm->map_size && txt_is_sep(cgm->map[cgm->map_pos]))
+  {
+    if (i < 1023)
+      chr[i++] = (char)cgm->map[cgm->map_pos];
+    cgm->map_pos++;
+  }
+
+  chr[i] = 0;
   return chr;
 }
 
 void cgm_txt_skip_sep(tCGM* cgm)
 {
-  char chr[1024];
-  cgm_txt_get_sep(cgm, chr);
+  while(cgm->map_pos < cgm->map_size && txt_is_sep(cgm->map[cgm->map_pos]))
+    cgm->map_pos++;
 }
 
 void cgm_txt_skip_com(tCGM* cgm)
 {
-  char chr[1024], c;
-
-  while((c =(char)fgetc(cgm->fp)) == '%')
+  while(txt_peek(cgm) == '%')
   {
-    fscanf(cgm->fp, "%[^%]%%", chr);
-    cgm_txt_get_sep(cgm, chr);
-  }
+    cgm->map_pos++;
+
+    /* an empty comment leaves the closing '%' to be read as a new comment */
+    if (txt_peek(cgm) != '%')
+    {
+      while(cgm->map_pos < cgm->map_size && cgm->map[cgm->map_pos] != '%')
+        cgm->map_pos++;
+
+      if (txt_peek(cgm) == '%')
+        cgm->map_pos++;
+    }
 
-  ungetc(c, cgm->fp);
+    cgm_txt_skip_sep(cgm);
+  }
 }
 
 void cgm_txt_skip_parentheses(tCGM* cgm)
 {
-  char chr[1024];
-  cgm_txt_get_sep(cgm, chr);
-  fscanf(cgm->fp, "%[()]", chr);
+  int c;
+
+  cgm_txt_skip_sep(cgm);
+
+  c = txt_peek(cgm);
+  while(c == '(' || c == ')')
+  {
+    cgm->map_pos++;
+    c = txt_peek(cgm);
+  }
+}
+
+int cgm_txt_get_word(tCGM* cgm, char* word, int size, const char* stop)
+{
+  int i = 0, n = 0;
+
+  if (cgm->map_pos >= cgm->map_size)
+    return -1;
+
+  while(cgm->map_pos < cgm->map_size)
+  {
+    char c = (char)cgm->map[cgm->map_pos];
+    if (c == 0 || strchr(stop, c))
+      break;
+
+    /* '_' and '$' are ignored in keywords */
+    if (c != '_' && c != '$' && i < size-1)
+      word[i++] = c;
+
+    cgm->map_pos++;
+    n++;
+  }
+
+  word[i] = 0;
+  return n;
 }
 
 int cgm_txt_get_ter_noerr(tCGM* cgm)
 {
-  char c = 0;
+  int c;
 
   cgm_txt_skip_com(cgm);
 
   cgm_txt_skip_sep(cgm);
 
-  fscanf(cgm->fp, "%c", &c);
+  c = txt_peek(cgm);
+  if (c == TXT_EOF)
+    return 1;
+
+  cgm->map_pos++;
 
-  if (c=='/' || c==';') 
+  if (c=='/' || c==';')
     return 0;  /* found, stop while */
 
-  ungetc(c, cgm->fp);
+  cgm->map_pos--;
 
   return 1; /* not found, continue */
 }
@@ -63,14 +135,52 @@ int cgm_txt_get_ter(tCGM* cgm)
 
 int cgm_txt_get_i(tCGM* cgm, long *i)
 {
+  const unsigned char *p, *end;
+  unsigned long value = 0, limit;
+  int neg = 0, overflow = 0;
+
   cgm_txt_skip_sep(cgm);
 
   cgm_txt_skip_com(cgm);
 
-  if(fscanf(cgm->fp, "%ld", i)) 
-    return CGM_OK;
+  txt_skip_space(cgm);
 
-  return CGM_ERR_READ;
+  p = cgm->map + cgm->map_pos;
+  end = cgm->map + cgm->map_size;
+
+  if (p < end && (*p == '-' || *p == '+'))
+  {
+    neg = (*p == '-');
+    p++;
+  }
+
+  if (p == end || !txt_is_digit(*p))
+    return CGM_ERR_READ;
+
+  /* same as strtol, saturates on overflow */
+  limit = neg? (unsigned long)LONG_MAX + 1: (unsigned long)LONG_MAX;
+
+  while(p < end && txt_is_digit(*p))
+  {
+    unsigned long d = *p - '0';
+    if (value > (limit - d) / 10)
+      overflow = 1;
+    else
+      value = value*10 + d;
+    p++;
+  }
+
+  if (overflow)
+    value = limit;
+
+  cgm->map_pos = (long)(p - cgm->map);
+
+  if (neg)
+    *i = (value == (unsigned long)LONG_MAX + 1)? LONG_MIN: -(long)value;
+  else
+    *i = (long)value;
+
+  return CGM_OK;
 }
 
 int cgm_txt_get_ci(tCGM* cgm, unsigned long *ci)
@@ -82,13 +192,13 @@ int cgm_txt_get_ci(tCGM* cgm, unsigned long *ci)
 
 int cgm_txt_get_cd(tCGM* cgm, unsigned long *r, unsigned long *g, unsigned long *b)
 {
-  if(txt_get_cd(cgm, r)) 
+  if(txt_get_cd(cgm, r))
     return CGM_ERR_READ;
 
-  if(txt_get_cd(cgm, g)) 
+  if(txt_get_cd(cgm, g))
     return CGM_ERR_READ;
 
-  if(txt_get_cd(cgm, b)) 
+  if(txt_get_cd(cgm, b))
     return CGM_ERR_READ;
 
   return CGM_OK;
@@ -98,24 +208,15 @@ int cgm_txt_get_e(tCGM* cgm, short *e, const char **el)
 {
   char chr[1024] = "";
   int i;
-  char *pt;
 
   cgm_txt_skip_sep(cgm);
 
   cgm_txt_skip_com(cgm);
 
-  fscanf(cgm->fp, "%[^ \r\n\t\v\f,/;%\"\']", chr);
+  cgm_txt_get_word(cgm, chr, 1024, " \r\n\t\v\f,/;%\"\'");
 
   cgm_strupper(chr);
 
-  pt = strtok(chr,"_$");
-  while(pt)
-  {
-    pt = strtok(NULL, "_$");
-    if (pt)
-      strcat(chr, pt);
-  }
-
   for(i=0; el[i]!=NULL; i++)
   {
     if(strcmp(chr, el[i]) == 0)
@@ -128,84 +229,237 @@ int cgm_txt_get_e(tCGM* cgm, short *e, const char **el)
   return CGM_ERR_READ;
 }
 
+static double txt_strtod(const unsigned char* start, const unsigned char* end)
+{
+  /* slow path, uses the decimal point of the current locale */
+  char buffer[128], *str = buffer;
+  char point = localeconv()->decimal_point[0];
+  int i, n = (int)(end - start);
+  double f;
+
+  if (n >= (int)sizeof(buffer))
+    str = (char*)malloc(n + 1);
+
+  for (i = 0; i < n; i++)
+    str[i] = (start[i] == '.')? point: (char)start[i];
+  str[n] = 0;
+
+  f = strtod(str, NULL);
+
+  if (str != buffer)
+    free(str);
+
+  return f;
+}
+
 int cgm_txt_get_r(tCGM* cgm, double *f)
 {
+  static const double pow10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+                                  1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+  const unsigned char *p, *end, *start;
+  unsigned long long mant = 0;
+  int ndigits = 0, exp10 = 0, exact = 1, any = 0, neg = 0;
+
   cgm_txt_skip_sep(cgm);
 
   cgm_txt_skip_com(cgm);
 
-  if(fscanf(cgm->fp, "%lg", f)) 
-    return CGM_OK;
+  txt_skip_space(cgm);
 
-  return CGM_ERR_READ;
+  start = p = cgm->map + cgm->map_pos;
+  end = cgm->map + cgm->map_size;
+
+  if (p < end && (*p == '-' || *p == '+'))
+  {
+    neg = (*p == '-');
+    p++;
+  }
+
+  while(p < end && txt_is_digit(*p))
+  {
+    if (ndigits < 19)
+    {
+      mant = mant*10 + (*p - '0');
+      if (mant) ndigits++;
+    }
+    else
+    {
+      exp10++;
+      exact = 0;
+    }
+    any = 1;
+    p++;
+  }
+
+  if (p < end && *p == '.')
+  {
+    p++;
+    while(p < end && txt_is_digit(*p))
+    {
+      if (ndigits < 19)
+      {
+        mant = mant*10 + (*p - '0');
+        if (mant) ndigits++;
+        exp10--;
+      }
+      else
+        exact = 0;
+      any = 1;
+      p++;
+    }
+  }
+
+  if (!any)
+    return CGM_ERR_READ;
+
+  if (p < end && (*p == 'e' || *p == 'E'))
+  {
+    const unsigned char *q = p+1;
+    int eneg = 0, e = 0;
+
+    if (q < end && (*q == '-' || *q == '+'))
+    {
+      eneg = (*q == '-');
+      q++;
+    }
+
+    /* an incomplete exponent is not part of the number */
+    if (q < end && txt_is_digit(*q))
+    {
+      while(q < end && txt_is_digit(*q))
+      {
+        if (e < 100000)
+          e = e*10 + (*q - '0');
+        q++;
+      }
+
+      exp10 += eneg? -e: e;
+      p = q;
+    }
+  }
+
+  cgm->map_pos = (long)(p - cgm->map);
+
+  /* exact when the mantissa and the power of 10 are exact doubles,
+     otherwise use strtod that is correctly rounded */
+  if (exact && ndigits <= 15 && exp10 >= -22 && exp10 <= 22)
+  {
+    double d = (double)mant;
+    if (exp10 < 0)
+      d /= pow10[-exp10];
+    else
+      d *= pow10[exp10];
+    *f = neg? -d: d;
+  }
+  else
+    *f = txt_strtod(start, p);
+
+  return CGM_OK;
 }
 
 int cgm_txt_get_s(tCGM* cgm, char **str)
 {
-  char c, delim;
+  int c, delim;
   int block = 80;
-  int i = 0, ok=1;
+  int i = 0;
 
   cgm_txt_skip_sep(cgm);
 
   cgm_txt_skip_com(cgm);
 
-  delim =(char)fgetc(cgm->fp);
+  delim = txt_peek(cgm);
 
-  if(delim != '"' && delim != '\'') 
+  if(delim != '"' && delim != '\'')
     return CGM_ERR_READ;
 
+  cgm->map_pos++;
+
   *str =(char *) malloc(block*sizeof(char));
-  strcpy(*str, "");
 
-  do
+  for(;;)
   {
-    c = (char)fgetc(cgm->fp);
-    if (c == (char)EOF)
-    {
-      ok = 0;
-      return feof(cgm->fp)? CGM_OK: CGM_ERR_READ;
-    }
+    c = txt_peek(cgm);
+    if (c == TXT_EOF)
+      break;
+
+    cgm->map_pos++;
 
     if(c==delim)
     {
-      c=(char)fgetc(cgm->fp);
-      if (c == (char)EOF)
-      {
-        ok = 0;
-        return feof(cgm->fp)? CGM_OK: CGM_ERR_READ;
-      }
-
-      if(c==delim)
-        (*str)[i++] = c;
-      else 
-      {
-        ungetc(c,cgm->fp);
+      /* a doubled delimiter is part of the string */
+      if(txt_peek(cgm) != delim)
         break;
-      }
+
+      cgm->map_pos++;
     }
-    else
-      (*str)[i++] = c;
+#ifdef WIN32
+    else if (c == '\r' && txt_peek(cgm) == '\n')
+      continue;  /* same as a file opened in text mode */
+#endif
+
+    (*str)[i++] = (char)c;
 
     if((i+1)==block)
     {
       block *= 2;
       *str =(char *) realloc(*str, block*sizeof(char));
     }
-  } while(ok);
+  }
 
   (*str)[i] = '\0';
 
   return CGM_OK;
 }
 
+void cgm_txt_skip_element(tCGM* cgm)
+{
+  /* parameters are skipped until the terminator, 
+     strings and comments may contain terminators */
+  for(;;)
+  {
+    int c = txt_peek(cgm);
+    if (c == TXT_EOF)
+      return;
+
+    if (c == '%')
+      cgm_txt_skip_com(cgm);
+    else if (c == '"' || c == '\'')
+    {
+      cgm->map_pos++;
+
+      for(;;)
+      {
+        int s = txt_peek(cgm);
+        if (s == TXT_EOF)
+          return;
+
+        cgm->map_pos++;
+
+        if (s == c)
+        {
+          if (txt_peek(cgm) != c)
+            break;
+          cgm->map_pos++;
+        }
+      }
+    }
+    else
+    {
+      cgm->map_pos++;
+
+      if (c == ';' || c == '/')
+        return;
+    }
+  }
+}
+
 int cgm_txt_get_vdc(tCGM* cgm, double *vdc)
 {
   long l;
 
   if(cgm->vdc_type==CGM_INTEGER)
   {
-    if(cgm_txt_get_i(cgm, &l)) 
+    if(cgm_txt_get_i(cgm, &l))
       return CGM_ERR_READ;
     *vdc =(double) l;
     return CGM_OK;
@@ -218,10 +472,10 @@ int cgm_txt_get_p(tCGM* cgm, double *x, double *y)
 {
   cgm_txt_skip_parentheses(cgm);
 
-  if(cgm_txt_get_vdc(cgm, x)) 
+  if(cgm_txt_get_vdc(cgm, x))
     return CGM_ERR_READ;
 
-  if(cgm_txt_get_vdc(cgm, y)) 
+  if(cgm_txt_get_vdc(cgm, y))
     return CGM_ERR_READ;
 
   cgm_txt_skip_parentheses(cgm);
@@ -233,14 +487,14 @@ int cgm_txt_get_co(tCGM* cgm, tColor *co)
 {
   if(cgm->color_mode == CGM_INDEXED)
   {
-    if(cgm_txt_get_ci(cgm, &(co->index))) 
+    if(cgm_txt_get_ci(cgm, &(co->index)))
       return CGM_ERR_READ;
   }
   else
   {
-    if(cgm_txt_get_cd(cgm, &(co->rgb.red), &(co->rgb.green), &(co->rgb.blue))) 
+    if(cgm_txt_get_cd(cgm, &(co->rgb.red), &(co->rgb.green), &(co->rgb.blue)))
       return CGM_ERR_READ;
   }
 
-  return CGM_OK; 
+  return CGM_OK;
 }
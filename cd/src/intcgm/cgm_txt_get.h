@@ -11,6 +11,8 @@ void cgm_txt_skip_com(tCGM* cgm);
 void cgm_txt_skip_parentheses(tCGM* cgm);
 int cgm_txt_get_ter_noerr(tCGM* cgm);
 int cgm_txt_get_ter(tCGM* cgm);
+void cgm_txt_skip_element(tCGM* cgm);  /* parameters and terminator */
+int cgm_txt_get_word(tCGM* cgm, char* word, int size, const char* stop);  /* until a char in stop, without '_' and '$' */
 
 int cgm_txt_get_i(tCGM* cgm, long *);  /* integer */
 int cgm_txt_get_ci(tCGM* cgm, unsigned long *);  /* color index */
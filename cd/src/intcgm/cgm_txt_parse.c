@@ -2118,23 +2118,17 @@ static tCommand **_cgm_txt_commands[] = {
 int cgm_txt_rch(tCGM* cgm)
 {
   char chr[1024] = "";
-  char *pt;
   int i, j;
 
   cgm_txt_skip_sep(cgm);
 
   cgm_txt_skip_com(cgm);
 
-  if (fscanf(cgm->fp, "%[^ \r\n\t\v\f,/;%\"()]", chr)==0)
-    return CGM_ERR_READ;
+  if (cgm->map_pos >= cgm->map_size)
+    return CGM_OK;  /* end of file */
 
-  pt = strtok(chr,"_$");
-  while(pt)
-  {
-    pt = strtok(NULL, "_$");
-    if (pt)
-      strcat(chr, pt);
-  }
+  if (cgm_txt_get_word(cgm, chr, 1024, " \r\n\t\v\f,/;%\"()")<=0)
+    return CGM_ERR_READ;
 
   if (chr[0]==0)
     return CGM_ERR_READ;
@@ -2154,7 +2148,7 @@ int cgm_txt_rch(tCGM* cgm)
         if (cgm_inccounter(cgm))
           return CGM_ABORT_COUNTER;
 
-        if (feof(cgm->fp))
+        if (cgm->map_pos >= cgm->map_size)
           return CGM_OK;
         else
           return CGM_CONT;
@@ -2162,8 +2156,38 @@ int cgm_txt_rch(tCGM* cgm)
     }
   }
 
-  if (feof(cgm->fp))
+  if (cgm->map_pos >= cgm->map_size)
     return CGM_OK;
   else
     return CGM_CONT;
 }
+
+int cgm_txt_index(tCGM* cgm, tIndex* index)
+{
+  char chr[1024];
+
+  for(;;)
+  {
+    long offset;
+
+    cgm_txt_skip_sep(cgm);
+
+    cgm_txt_skip_com(cgm);
+
+    if (cgm->map_pos >= cgm->map_size)
+      break;
+
+    offset = cgm->map_pos;
+
+    cgm_txt_get_word(cgm, chr, 1024, " \r\n\t\v\f,/;%\"()");
+
+    cgm_strupper(chr);
+
+    if (strcmp(chr, "BEGPIC")==0)
+      cgm_index_add(index, offset);
+
+    cgm_txt_skip_element(cgm);
+  }
+
+  return CGM_OK;
+}
@@ -31,8 +31,9 @@ typedef union {
 } tColor;
 
 typedef struct {
-  char *data;
-  int size;  /* allocated size */
+  char *data;  /* points to mem or directly to the mapped file */
+  char *mem;
+  int size;  /* allocated size of mem */
   int len;   /* used size */
   int bc;    /* byte count */
   int pc;    /* pixel count */
@@ -117,9 +118,25 @@ typedef struct {
   short value;
 } tASF;
 
+typedef struct {
+  long descriptor;  /* end of the metafile descriptor */
+  long* pictures;   /* offsets of the BEGIN PICTURE elements */
+  int count, size;
+} tIndex;
+
 struct _tCGM {
   FILE *fp;
   int file_size;
+  int mode;  /* 1=binary, 2=text */
+
+  /* files are read from memory */
+  const unsigned char* map;
+  long map_size;
+  long map_pos;
+  int map_alloc;  /* could not be mapped, was read with fread */
+#ifdef WIN32
+  void* map_handle;
+#endif
 
   tData buff;
 
@@ -227,6 +244,10 @@ enum { CGM_PATH_RIGHT, CGM_PATH_LEFT, CGM_PATH_UP, CGM_PATH_DOWN };
 int cgm_bin_rch(tCGM* cgm);
 int cgm_txt_rch(tCGM* cgm);
 
+int cgm_bin_index(tCGM* cgm, tIndex* index);
+int cgm_txt_index(tCGM* cgm, tIndex* index);
+void cgm_index_add(tIndex* index, long offset);
+
 void cgm_strupper(char *s);
 
 void cgm_calc_arc_3p(cgmPoint start, cgmPoint intermediate, cgmPoint end, 
@@ -509,6 +509,19 @@ static int cdlua5_rgb2map(lua_State *L)
   return 0;
 }
 
+static int cdlua5_rgb2mapex(lua_State *L)
+{
+  cdluaImageRGB* imagergb_p = cdlua_checkimagergb(L, 1);
+  cdluaImageMap* imagemap_p = cdlua_checkimagemap(L, 2);
+  cdluaPalette* pal = cdlua_checkpalette(L, 3);
+  int flags = (int)luaL_optinteger(L, 4, 0);
+  int num_threads = (int)luaL_optinteger(L, 5, 1);
+  cdRGB2MapEx(imagergb_p->width, imagergb_p->height, 
+              imagergb_p->red, imagergb_p->green, imagergb_p->blue, 
+              imagemap_p->index, pal->count, pal->color, flags, num_threads);
+  return 0;
+}
+
 static int cdlua5_createbitmap(lua_State *L)
 {
   cdBitmap *bitmap;
@@ -602,10 +615,46 @@ static int cdlua5_bitmaprgb2map(lua_State *L)
   return 0;
 }
 
+/* packed image data is a string with the planes one after the other (RRR...GGG...BBB...) */
+static const char* cdlua_optimagedata(lua_State *L, int param, int size)
+{
+  size_t len;
+  const char* data = luaL_optlstring(L, param, NULL, &len);
+  if (data && len != (size_t)size)
+    luaL_argerror(L, param, "invalid image data size");
+  return data;
+}
+
+static void cdlua_pushimagedata(lua_State *L, unsigned char** planes, int count, long int size)
+{
+  int i;
+  unsigned char* data;
+
+  for (i = 1; i < count; i++)
+  {
+    if (planes[i] != planes[0] + i*size)
+      break;
+  }
+
+  if (i == count)  /* single buffer, as created by CreateImage* */
+  {
+    lua_pushlstring(L, (char*)planes[0], count*size);
+    return;
+  }
+
+  data = (unsigned char*)lua_newuserdata(L, count*size);  /* temporary, collected by Lua */
+  for (i = 0; i < count; i++)
+    memcpy(data + i*size, planes[i], size);
+
+  lua_pushlstring(L, (char*)data, count*size);
+  lua_remove(L, -2);
+}
+
 static int cdlua5_createimagergb(lua_State * L)
 {  
   unsigned char *red, *green, *blue;
   int size;
+  const char* data;
   int width = luaL_checkinteger(L,1);
   int height = luaL_checkinteger(L,2);
 
@@ -613,11 +662,15 @@ static int cdlua5_createimagergb(lua_State * L)
     luaL_argerror(L, 1, "image dimensions should be positive integers");
  
   size = width*height;
+  data = cdlua_optimagedata(L, 3, 3*size);
   red = (unsigned char*)malloc(3*size);
   
   if (red)
   {
-    memset(red, 255, 3*size);  /* white */
+    if (data)
+      memcpy(red, data, 3*size);
+    else
+      memset(red, 255, 3*size);  /* white */
     green = red + size;
     blue = red + 2*size;
     cdlua_pushimagergb(L, red, green, blue, width, height);
@@ -642,10 +695,25 @@ static int cdlua5_killimagergb(lua_State *L)
   return 0;
 }
 
+/***************************************************************************\
+* cd.ImageRGBToString(imagergb: cdImageRGB) -> (data: string)               *
+\***************************************************************************/
+static int cdlua5_imagergbtostring(lua_State *L)
+{
+  cdluaImageRGB* imagergb_p = cdlua_checkimagergb(L, 1);
+  unsigned char* planes[3];
+  planes[0] = imagergb_p->red;
+  planes[1] = imagergb_p->green;
+  planes[2] = imagergb_p->blue;
+  cdlua_pushimagedata(L, planes, 3, imagergb_p->size);
+  return 1;
+}
+
 static int cdlua5_createimagergba(lua_State * L)
 {  
   unsigned char *red, *green, *blue, *alpha;
   int size;
+  const char* data;
   int width = luaL_checkinteger(L,1);
   int height = luaL_checkinteger(L,2);
 
@@ -653,15 +721,21 @@ static int cdlua5_createimagergba(lua_State * L)
     luaL_argerror(L, 1, "image dimensions should be positive integers");
  
   size = width*height;
+  data = cdlua_optimagedata(L, 3, 4*size);
   red = (unsigned char*)malloc(4*size);
   
   if (red)
   {
-    memset(red, 255, 3*size); /* white */
     green = red + size;
     blue = red + 2*size;
     alpha = red + 3*size;
-    memset(alpha, 0, size);  /* transparent */
+    if (data)
+      memcpy(red, data, 4*size);
+    else
+    {
+      memset(red, 255, 3*size); /* white */
+      memset(alpha, 0, size);  /* transparent */
+    }
     cdlua_pushimagergba(L, red, green, blue, alpha, width, height);
   }
   else
@@ -685,10 +759,26 @@ static int cdlua5_killimagergba(lua_State *L)
   return 0;
 }
 
+/***************************************************************************\
+* cd.ImageRGBAToString(imagergba: cdImageRGBA) -> (data: string)           *
+\***************************************************************************/
+static int cdlua5_imagergbatostring(lua_State *L)
+{
+  cdluaImageRGBA* imagergba_p = cdlua_checkimagergba(L, 1);
+  unsigned char* planes[4];
+  planes[0] = imagergba_p->red;
+  planes[1] = imagergba_p->green;
+  planes[2] = imagergba_p->blue;
+  planes[3] = imagergba_p->alpha;
+  cdlua_pushimagedata(L, planes, 4, imagergba_p->size);
+  return 1;
+}
+
 static int cdlua5_createimagemap(lua_State *L)
 {
   int size;
   unsigned char *index;
+  const char* data;
   int width = luaL_checkinteger(L,1);
   int height = luaL_checkinteger(L,2);
 
@@ -696,11 +786,15 @@ static int cdlua5_createimagemap(lua_State *L)
     luaL_argerror(L, 1, "imagemap dimensions should be positive integers");
 
   size = width * height;
+  data = cdlua_optimagedata(L, 3, size);
   index = (unsigned char *) malloc(size);
 
   if (index)
   {
-    memset(index, 0, size);
+    if (data)
+      memcpy(index, data, size);
+    else
+      memset(index, 0, size);
     cdlua_pushimagemap(L, index, width, height);
   }
   else
@@ -721,6 +815,16 @@ static int cdlua5_killimagemap(lua_State *L)
   return 0;
 }
 
+/***************************************************************************\
+* cd.ImageMapToString(imagemap: cdImageMap) -> (data: string)               *
+\***************************************************************************/
+static int cdlua5_imagemaptostring(lua_State *L)
+{
+  cdluaImageMap* imagemap_p = cdlua_checkimagemap(L, 1);
+  lua_pushlstring(L, (char*)imagemap_p->index, imagemap_p->size);
+  return 1;
+}
+
 /***************************************************************************\
 * number = imagemap[i]                                                      *
 \***************************************************************************/
@@ -1352,6 +1456,15 @@ static int cdlua5_getscreensize(lua_State *L)
   return 4;
 }
 
+/***************************************************************************\
+* cd.CompileVectorFont(font, filename: string) -> (status: number)          *
+\***************************************************************************/
+static int cdlua5_compilevectorfont(lua_State *L)
+{
+  lua_pushinteger(L, cdCompileVectorFont(luaL_optstring(L, 1, NULL), luaL_checkstring(L, 2)));
+  return 1;
+}
+
 /***************************************************************************\
 * cd.UseContextPlus                                                        *
 \***************************************************************************/
@@ -1386,6 +1499,7 @@ static const luaL_Reg cdlib[] = {
   
   /* Client Images */
   {"RGB2Map"          , cdlua5_rgb2map},
+  {"RGB2MapEx"        , cdlua5_rgb2mapex},
   {"CreateBitmap"     , cdlua5_createbitmap},
   {"KillBitmap"       , cdlua5_killbitmap},
   {"BitmapGetData"    , cdlua5_bitmapgetdata},
@@ -1394,10 +1508,13 @@ static const luaL_Reg cdlib[] = {
 
   {"CreateImageRGB"   , cdlua5_createimagergb},
   {"KillImageRGB"     , cdlua5_killimagergb},
+  {"ImageRGBToString" , cdlua5_imagergbtostring},
   {"CreateImageRGBA"  , cdlua5_createimagergba},
   {"KillImageRGBA"    , cdlua5_killimagergba},
+  {"ImageRGBAToString", cdlua5_imagergbatostring},
   {"CreateImageMap"   , cdlua5_createimagemap},
   {"KillImageMap"     , cdlua5_killimagemap},
+  {"ImageMapToString" , cdlua5_imagemaptostring},
   
   /* Server Images */
   {"KillImage"        , cdlua5_killimage},
@@ -1427,6 +1544,9 @@ static const luaL_Reg cdlib[] = {
   /* native window functions */
   {"GetScreenColorPlanes" , cdlua5_getscreencolorplanes},
   {"GetScreenSize" , cdlua5_getscreensize},
+
+  /* vector text */
+  {"CompileVectorFont" , cdlua5_compilevectorfont},
   
   /* gdi+ functions */
   {"UseContextPlus"       , cdlua5_usecontextplus},
@@ -1478,6 +1598,9 @@ static const struct cdlua5_constant cdlibconstant[] = {
   {"MAP" , CD_MAP},
   {"RGBA", CD_RGBA},
 
+  {"RGB2MAP_NODITHER", CD_RGB2MAP_NODITHER},
+  {"RGB2MAP_KMEANS"  , CD_RGB2MAP_KMEANS},
+
   {"IRED"  , CD_IRED},
   {"IGREEN", CD_IGREEN},
   {"IBLUE" , CD_IBLUE},
@@ -1714,6 +1714,15 @@ static int cdlua5_vectortexttransform(lua_State *L)
   return 1;
 }
 
+/***************************************************************************\
+* cd.VectorTextPath(path: number) -> (old_path: number)                     *
+\***************************************************************************/
+static int cdlua5_vectortextpath(lua_State *L)
+{
+  lua_pushnumber(L, cdCanvasVectorTextPath(cdlua_checkcanvas(L, 1), (int)luaL_checkinteger(L, 2)));
+  return 1;
+}
+
 /***************************************************************************\
 * cd.VectorFontSize(w, h: number, text: string)                             *
 \***************************************************************************/
@@ -2443,6 +2452,152 @@ static int cdlua5_end(lua_State *L)
 }
 
 
+/***************************************************************************\
+* Bulk functions                                                            *
+* Points are a table {x1, y1, x2, y2, ...} or a string with packed native   *
+* doubles in the same order, for instance from string.pack.                 *
+\***************************************************************************/
+
+#if LUA_VERSION_NUM < 502
+#define cdlua_rawlen lua_objlen
+#else
+#define cdlua_rawlen lua_rawlen
+#endif
+
+static const double* cdlua_checkpoints(lua_State *L, int param, int *count)
+{
+  double* points;
+  int i, n;
+
+  if (lua_type(L, param) == LUA_TSTRING)
+  {
+    size_t len;
+    const char* data = lua_tolstring(L, param, &len);
+    if (len % (2*sizeof(double)) != 0)
+      luaL_argerror(L, param, "invalid points string size, must be a multiple of 2 doubles");
+
+    *count = (int)(len / (2*sizeof(double)));
+
+    if (((size_t)data % sizeof(double)) == 0)  /* used directly, no copy */
+      return (const double*)data;
+
+    points = (double*)lua_newuserdata(L, len);  /* temporary, collected by Lua */
+    memcpy(points, data, len);
+    return points;
+  }
+
+  if (!lua_istable(L, param))
+    luaL_argerror(L, param, "invalid points, must be a table or a string");
+
+  n = (int)cdlua_rawlen(L, param);
+  if (n % 2 != 0)
+    luaL_argerror(L, param, "invalid points table size, must be even");
+
+  *count = n / 2;
+  points = (double*)lua_newuserdata(L, n * sizeof(double));  /* temporary, collected by Lua */
+  for (i = 0; i < n; i++)
+  {
+    lua_rawgeti(L, param, i+1);
+
+    if (!lua_isnumber(L, -1))
+      luaL_argerror(L, param, "invalid point value, must be a number");
+
+    points[i] = lua_tonumber(L, -1);
+    lua_pop(L, 1);
+  }
+
+  return points;
+}
+
+/***************************************************************************\
+* cd.Poly(mode: number, points: table or string)                            *
+\***************************************************************************/
+static int cdlua5_poly(lua_State *L)
+{
+  cdCanvas* canvas = cdlua_checkcanvas(L, 1);
+  int i, count, mode = (int)luaL_checkinteger(L, 2);
+  const double* points = cdlua_checkpoints(L, 3, &count);
+
+  cdCanvasBegin(canvas, mode);
+  for (i = 0; i < count; i++)
+    cdCanvasVertex(canvas, (int)points[2*i], (int)points[2*i+1]);
+  cdCanvasEnd(canvas);
+  return 0;
+}
+
+/***************************************************************************\
+* cd.fPoly(mode: number, points: table or string)                           *
+\***************************************************************************/
+static int cdlua5_fpoly(lua_State *L)
+{
+  cdCanvas* canvas = cdlua_checkcanvas(L, 1);
+  int count, mode = (int)luaL_checkinteger(L, 2);
+  const double* points = cdlua_checkpoints(L, 3, &count);
+
+  /* the x,y pairs have the same layout of cdfPoint */
+  cdfCanvasPoly(canvas, mode, (const cdfPoint*)points, count);
+  return 0;
+}
+
+/***************************************************************************\
+* cd.wPoly(mode: number, points: table or string)                           *
+\***************************************************************************/
+static int wdlua5_poly(lua_State *L)
+{
+  cdCanvas* canvas = cdlua_checkcanvas(L, 1);
+  int i, count, mode = (int)luaL_checkinteger(L, 2);
+  const double* points = cdlua_checkpoints(L, 3, &count);
+
+  cdCanvasBegin(canvas, mode);
+  for (i = 0; i < count; i++)
+    wdCanvasVertex(canvas, points[2*i], points[2*i+1]);
+  cdCanvasEnd(canvas);
+  return 0;
+}
+
+/***************************************************************************\
+* cd.Marks(points: table or string)                                         *
+\***************************************************************************/
+static int cdlua5_marks(lua_State *L)
+{
+  cdCanvas* canvas = cdlua_checkcanvas(L, 1);
+  int i, count;
+  const double* points = cdlua_checkpoints(L, 2, &count);
+
+  for (i = 0; i < count; i++)
+    cdCanvasMark(canvas, (int)points[2*i], (int)points[2*i+1]);
+  return 0;
+}
+
+/***************************************************************************\
+* cd.fMarks(points: table or string)                                        *
+\***************************************************************************/
+static int cdlua5_fmarks(lua_State *L)
+{
+  cdCanvas* canvas = cdlua_checkcanvas(L, 1);
+  int i, count;
+  const double* points = cdlua_checkpoints(L, 2, &count);
+
+  for (i = 0; i < count; i++)
+    cdfCanvasMark(canvas, points[2*i], points[2*i+1]);
+  return 0;
+}
+
+/***************************************************************************\
+* cd.wMarks(points: table or string)                                        *
+\***************************************************************************/
+static int wdlua5_marks(lua_State *L)
+{
+  cdCanvas* canvas = cdlua_checkcanvas(L, 1);
+  int i, count;
+  const double* points = cdlua_checkpoints(L, 2, &count);
+
+  for (i = 0; i < count; i++)
+    wdCanvasMark(canvas, points[2*i], points[2*i+1]);
+  return 0;
+}
+
+
 /********************************************************************************\
 * Lua Exported functions                                                       *
 \********************************************************************************/
@@ -2611,6 +2766,7 @@ static const luaL_Reg cdlib_canvas_meta[] = {
   {"wVectorTextDirection" , wdlua5_vectortextdirection},
   {"fVectorTextDirection"  , cdflua5_vectortextdirection},
   {"VectorTextTransform"  , cdlua5_vectortexttransform},
+  {"VectorTextPath"       , cdlua5_vectortextpath},
   {"VectorFontSize"       , cdlua5_vectorfontsize},
   {"GetVectorFontSize"    , cdlua5_getvectorfontsize},
   {"VectorTextSize"       , cdlua5_vectortextsize},
@@ -2671,6 +2827,12 @@ static const luaL_Reg cdlib_canvas_meta[] = {
   {"wVertex"       , wdlua5_vertex},
   {"fVertex"        , cdlua5_fvertex},
   {"End"           , cdlua5_end},
+  {"Poly"          , cdlua5_poly},
+  {"fPoly"         , cdlua5_fpoly},
+  {"wPoly"         , wdlua5_poly},
+  {"Marks"         , cdlua5_marks},
+  {"fMarks"        , cdlua5_fmarks},
+  {"wMarks"        , wdlua5_marks},
 
   {"__eq", cdluaCanvas_eq},
   {"__tostring", cdluaCanvas_tostring},
@@ -8,6 +8,12 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
 #include "cd.h"
 
 #define PARM(a) a
@@ -190,85 +196,123 @@ typedef struct {
 } box;
 typedef box * boxptr;
 
-/* Local state for the IJG quantizer */
-
-static hist2d * sl_histogram;	/* pointer to the 3D histogram array */
-static FSERRPTR sl_fserrors;	/* accumulated-errors array */
-static int * sl_error_limiter;	/* table for clamping the applied error */
-static int sl_on_odd_row;	/* flag to remember which row we are on */
-static JSAMPROW sl_colormap[3];	/* selected colormap */
-static int sl_num_colors;	/* number of selected colors */
-
-
-static void   slow_fill_histogram PARM((const byte*, const byte*, const byte*, int));
+/* Local state for the IJG quantizer, 
+   one for each call so it can be used by several threads */
+
+typedef struct _rgb2mapQuant {
+  hist2d * histogram;	/* pointer to the 3D histogram array */
+  hist2d * inverse;	/* inverse color map, same cells of the histogram, color index + 1 */
+  FSERRPTR fserrors;	/* accumulated-errors array */
+  int * error_limiter;	/* table for clamping the applied error */
+  int on_odd_row;	/* flag to remember which row we are on */
+  JSAMPROW colormap[3];	/* selected colormap */
+  int num_colors;	/* number of selected colors */
+
+  int num_threads;	/* number of threads for the parallel parts */
+  const byte *red, *green, *blue;	/* input image */
+  int width, height;
+  byte *map;		/* output image */
+  hist2d ** thread_hist;	/* per thread histograms */
+  long long (*thread_sums)[MAXNUMCOLORS][5];	/* per thread k-means sums and errors */
+  long long (*cells)[5];	/* k-means pixel count, sums and sum of squares of each histogram cell */
+} rgb2mapQuant;
+
+
+static void   slow_fill_histogram PARM((rgb2mapQuant*));
 static boxptr find_biggest_color_pop PARM((boxptr, int));
 static boxptr find_biggest_volume PARM((boxptr, int));
-static void   update_box PARM((boxptr));
-static int    median_cut PARM((boxptr, int, int));
-static void   compute_color PARM((boxptr, int));
-static void   slow_select_colors PARM((int*));
-static int    find_nearby_colors PARM((int, int, int, JSAMPLE []));
-static void   find_best_colors PARM((int,int,int,int, JSAMPLE [], JSAMPLE []));
-static void   fill_inverse_cmap PARM((int, int, int));
-static void   slow_map_pixels PARM((const byte*, const byte*, const byte*, int, int, byte*));
-static void   init_error_limit PARM((void));
-
+static void   update_box PARM((rgb2mapQuant*, boxptr));
+static int    median_cut PARM((rgb2mapQuant*, boxptr, int, int));
+static void   compute_color PARM((rgb2mapQuant*, boxptr, int));
+static void   slow_select_colors PARM((rgb2mapQuant*, int*));
+static int    find_nearby_colors PARM((rgb2mapQuant*, int, int, int, JSAMPLE []));
+static void   find_best_colors PARM((rgb2mapQuant*, int,int,int,int, JSAMPLE [], JSAMPLE []));
+static void   fill_inverse_cmap PARM((rgb2mapQuant*, int, int, int));
+static void   slow_map_pixels PARM((rgb2mapQuant*));
+static int    init_error_limit PARM((rgb2mapQuant*));
+
+
+/* Parallel parts: the task is called with index 0..num_threads-1, 
+   index 0 in the calling thread and the others in new threads.
+   Each index writes only to its own memory, and the partial results 
+   are combined in the calling thread, so the result is the same for any number of threads. */
+
+#define RGB2MAP_MAX_THREADS 64
+
+typedef void (*rgb2mapTask)(rgb2mapQuant* q, int index);
+
+typedef struct _rgb2mapThread {
+  rgb2mapQuant* q;
+  rgb2mapTask task;
+  int index;
+} rgb2mapThread;
+
+#ifdef WIN32
+static DWORD WINAPI rgb2mapThreadFunc(LPVOID param)
+#else
+static void* rgb2mapThreadFunc(void* param)
+#endif
+{
+  rgb2mapThread* thread = (rgb2mapThread*)param;
+  thread->task(thread->q, thread->index);
+  return 0;
+}
 
-/* Master control for slow quantizer. */
-static int slow_quant(const byte *red, const byte *green, const byte *blue, int w, int h, byte *map, byte *rm, byte *gm, byte *bm, int *descols)
+static void run_parallel(rgb2mapQuant* q, rgb2mapTask task)
 {
-  size_t fs_arraysize = (w + 2) * (3 * sizeof(FSERROR));
-  
-  /* Allocate all the temporary storage needed */
-  init_error_limit();
+  rgb2mapThread threads[RGB2MAP_MAX_THREADS];
+#ifdef WIN32
+  HANDLE handles[RGB2MAP_MAX_THREADS];
+#else
+  pthread_t handles[RGB2MAP_MAX_THREADS];
+#endif
+  int started[RGB2MAP_MAX_THREADS];
+  int i;
 
-  sl_histogram = (hist2d *) malloc(sizeof(hist3d));
-  sl_fserrors = (FSERRPTR) malloc(fs_arraysize);
-  
-  if (! sl_error_limiter || ! sl_histogram || ! sl_fserrors) 
+  for (i = 1; i < q->num_threads; i++)
   {
-    if (sl_error_limiter) free(sl_error_limiter-255);
-    if (sl_fserrors) free(sl_fserrors);
-    if (sl_histogram) free(sl_histogram);
-    return 1;
+    threads[i].q = q;
+    threads[i].task = task;
+    threads[i].index = i;
+#ifdef WIN32
+    handles[i] = CreateThread(NULL, 0, rgb2mapThreadFunc, &threads[i], 0, NULL);
+    started[i] = (handles[i] != NULL);
+#else
+    started[i] = (pthread_create(&handles[i], NULL, rgb2mapThreadFunc, &threads[i]) == 0);
+#endif
   }
-  
-  sl_colormap[0] = (JSAMPROW) rm;
-  sl_colormap[1] = (JSAMPROW) gm;
-  sl_colormap[2] = (JSAMPROW) bm;
-  
-  /* Compute the color histogram */
-  slow_fill_histogram(red, green, blue, w*h);
-  
-  /* Select the colormap */
-  slow_select_colors(descols);
-  
-  /* Zero the histogram: now to be used as inverse color map */
-  xvbzero((char *) sl_histogram, sizeof(hist3d));
-  
-  /* Initialize the propagated errors to zero. */
-  xvbzero((char *) sl_fserrors, fs_arraysize);
-  sl_on_odd_row = FALSE;
-  
-  /* Map the image. */
-  slow_map_pixels(red, green, blue, w, h, map);
-  
-  /* Release working memory. */
-  free(sl_histogram);
-  free(sl_error_limiter-255);
-  free(sl_fserrors);
 
-  return 0;
+  task(q, 0);
+
+  for (i = 1; i < q->num_threads; i++)
+  {
+    if (started[i])
+    {
+#ifdef WIN32
+      WaitForSingleObject(handles[i], INFINITE);
+      CloseHandle(handles[i]);
+#else
+      pthread_join(handles[i], NULL);
+#endif
+    }
+    else
+      task(q, i);   /* could not create the thread */
+  }
 }
 
 
-static void slow_fill_histogram(register const byte *red, register const byte *green, register const byte *blue, int numpixels)
+static void fill_histogram_task(rgb2mapQuant* q, int index)
 {
   register histptr histp;
-  register hist2d * histogram = sl_histogram;
+  register hist2d * histogram = q->thread_hist[index];
+  int numpixels = q->width * q->height;
+  int start = (int)(((double)numpixels * index) / q->num_threads);
+  int end = (int)(((double)numpixels * (index + 1)) / q->num_threads);
+  register const byte *red = q->red + start, *green = q->green + start, *blue = q->blue + start;
   
   xvbzero((char *) histogram, sizeof(hist3d));
-  
+
+  numpixels = end - start;
   while (numpixels-- > 0) 
   {
     /* get pixel value and index into the histogram */
@@ -285,6 +329,55 @@ static void slow_fill_histogram(register const byte *red, register const byte *g
 }
 
 
+static void slow_fill_histogram(rgb2mapQuant* q)
+{
+  hist2d * thread_hist[RGB2MAP_MAX_THREADS];
+  int i, t, num_threads = q->num_threads;
+
+  thread_hist[0] = q->histogram;
+  for (t = 1; t < num_threads; t++)
+  {
+    thread_hist[t] = (hist2d *) malloc(sizeof(hist3d));
+    if (!thread_hist[t])
+    {
+      for (i = 1; i < t; i++)
+        free(thread_hist[i]);
+      num_threads = 1;
+      break;
+    }
+  }
+
+  if (num_threads == 1)
+  {
+    int save_num_threads = q->num_threads;
+    q->thread_hist = thread_hist;
+    q->num_threads = 1;
+    fill_histogram_task(q, 0);
+    q->num_threads = save_num_threads;
+    return;
+  }
+
+  q->thread_hist = thread_hist;
+  run_parallel(q, fill_histogram_task);
+
+  /* sum the partial histograms, saturating like the increment */
+  {
+    histptr histp = (histptr) q->histogram;
+    for (i = 0; i < HIST_C0_ELEMS*HIST_C1_ELEMS*HIST_C2_ELEMS; i++)
+    {
+      unsigned long count = histp[i];
+      for (t = 1; t < num_threads; t++)
+        count += ((histptr) thread_hist[t])[i];
+      histp[i] = (histcell) ((count > 65535) ? 65535 : count);
+    }
+  }
+
+  for (t = 1; t < num_threads; t++)
+    free(thread_hist[t]);
+  q->thread_hist = NULL;
+}
+
+
 static boxptr find_biggest_color_pop (boxptr boxlist, int numboxes)
 {
   register boxptr boxp;
@@ -319,9 +412,9 @@ static boxptr find_biggest_volume (boxptr boxlist, int numboxes)
 }
 
 
-static void update_box (boxptr boxp)
+static void update_box (rgb2mapQuant* q, boxptr boxp)
 {
-  hist2d * histogram = sl_histogram;
+  hist2d * histogram = q->histogram;
   histptr histp;
   int c0,c1,c2;
   int c0min,c0max,c1min,c1max,c2min,c2max;
@@ -421,7 +514,7 @@ have_c2max:
 }
 
 
-static int median_cut (boxptr boxlist, int numboxes, int desired_colors)
+static int median_cut (rgb2mapQuant* q, boxptr boxlist, int numboxes, int desired_colors)
 {
   int n,lb;
   int c0,c1,c2,cmax;
@@ -468,19 +561,19 @@ static int median_cut (boxptr boxlist, int numboxes, int desired_colors)
       break;
     }
     /* Update stats for boxes */
-    update_box(b1);
-    update_box(b2);
+    update_box(q, b1);
+    update_box(q, b2);
     numboxes++;
   }
   return numboxes;
 }
 
 
-static void compute_color (boxptr boxp, int icolor)
+static void compute_color (rgb2mapQuant* q, boxptr boxp, int icolor)
 {
   /* Current algorithm: mean weighted by pixels (not colors) */
   /* Note it is important to get the rounding correct! */
-  hist2d * histogram = sl_histogram;
+  hist2d * histogram = q->histogram;
   histptr histp;
   int c0,c1,c2;
   int c0min,c0max,c1min,c1max,c2min,c2max;
@@ -512,13 +605,13 @@ static void compute_color (boxptr boxp, int icolor)
     }
   }
     
-  sl_colormap[0][icolor] = (JSAMPLE) ((c0total + (total>>1)) / total);
-  sl_colormap[1][icolor] = (JSAMPLE) ((c1total + (total>>1)) / total);
-  sl_colormap[2][icolor] = (JSAMPLE) ((c2total + (total>>1)) / total);
+  q->colormap[0][icolor] = (JSAMPLE) ((c0total + (total>>1)) / total);
+  q->colormap[1][icolor] = (JSAMPLE) ((c1total + (total>>1)) / total);
+  q->colormap[2][icolor] = (JSAMPLE) ((c2total + (total>>1)) / total);
 }
 
 
-static void slow_select_colors (int *descolors)
+static void slow_select_colors (rgb2mapQuant* q, int *descolors)
 /* Master routine for color selection */
 {
   box boxlist[MAXNUMCOLORS];
@@ -534,15 +627,15 @@ static void slow_select_colors (int *descolors)
   boxlist[0].c2min = 0;
   boxlist[0].c2max = 255 >> C2_SHIFT;
   /* Shrink it to actually-used volume and set its statistics */
-  update_box(& boxlist[0]);
+  update_box(q, & boxlist[0]);
   /* Perform median-cut to produce final box list */
-  numboxes = median_cut(boxlist, numboxes, *descolors);
+  numboxes = median_cut(q, boxlist, numboxes, *descolors);
   /* Compute the representative color for each box, fill colormap */
   for (i = 0; i < numboxes; i++)
-    compute_color(& boxlist[i], i);
-  sl_num_colors = numboxes;
+    compute_color(q, & boxlist[i], i);
+  q->num_colors = numboxes;
 
-  *descolors = sl_num_colors;
+  *descolors = q->num_colors;
 }
 
 
@@ -560,9 +653,9 @@ static void slow_select_colors (int *descolors)
 #define BOX_C2_SHIFT  (C2_SHIFT + BOX_C2_LOG)
 
 
-static int find_nearby_colors (int minc0, int minc1, int minc2, JSAMPLE colorlist[])
+static int find_nearby_colors (rgb2mapQuant* q, int minc0, int minc1, int minc2, JSAMPLE colorlist[])
 {
-  int numcolors = sl_num_colors;
+  int numcolors = q->num_colors;
   int maxc0, maxc1, maxc2;
   int centerc0, centerc1, centerc2;
   int i, x, ncolors;
@@ -580,7 +673,7 @@ static int find_nearby_colors (int minc0, int minc1, int minc2, JSAMPLE colorlis
   
   for (i = 0; i < numcolors; i++) {
     /* We compute the squared-c0-distance term, then add in the other two. */
-    x = sl_colormap[0][i];
+    x = q->colormap[0][i];
     if (x < minc0) {
       tdist = (x - minc0) * C0_SCALE;
       min_dist = tdist*tdist;
@@ -603,7 +696,7 @@ static int find_nearby_colors (int minc0, int minc1, int minc2, JSAMPLE colorlis
       }
     }
     
-    x = sl_colormap[1][i];
+    x = q->colormap[1][i];
     if (x < minc1) {
       tdist = (x - minc1) * C1_SCALE;
       min_dist += tdist*tdist;
@@ -625,7 +718,7 @@ static int find_nearby_colors (int minc0, int minc1, int minc2, JSAMPLE colorlis
       }
     }
     
-    x = sl_colormap[2][i];
+    x = q->colormap[2][i];
     if (x < minc2) {
       tdist = (x - minc2) * C2_SCALE;
       min_dist += tdist*tdist;
@@ -661,7 +754,7 @@ static int find_nearby_colors (int minc0, int minc1, int minc2, JSAMPLE colorlis
 }
 
 
-static void find_best_colors (int minc0, int minc1, int minc2, int numcolors,
+static void find_best_colors (rgb2mapQuant* q, int minc0, int minc1, int minc2, int numcolors,
                               JSAMPLE colorlist[], JSAMPLE bestcolor[])
 {
   int ic0, ic1, ic2;
@@ -689,11 +782,11 @@ static void find_best_colors (int minc0, int minc1, int minc2, int numcolors,
   for (i = 0; i < numcolors; i++) {
     icolor = colorlist[i];
     /* Compute (square of) distance from minc0/c1/c2 to this color */
-    inc0 = (minc0 - (int) sl_colormap[0][icolor]) * C0_SCALE;
+    inc0 = (minc0 - (int) q->colormap[0][icolor]) * C0_SCALE;
     dist0 = inc0*inc0;
-    inc1 = (minc1 - (int) sl_colormap[1][icolor]) * C1_SCALE;
+    inc1 = (minc1 - (int) q->colormap[1][icolor]) * C1_SCALE;
     dist0 += inc1*inc1;
-    inc2 = (minc2 - (int) sl_colormap[2][icolor]) * C2_SCALE;
+    inc2 = (minc2 - (int) q->colormap[2][icolor]) * C2_SCALE;
     dist0 += inc2*inc2;
     /* Form the initial difference increments */
     inc0 = inc0 * (2 * STEP_C0) + STEP_C0 * STEP_C0;
@@ -729,9 +822,9 @@ static void find_best_colors (int minc0, int minc1, int minc2, int numcolors,
 }
 
 
-static void fill_inverse_cmap (int c0, int c1, int c2)
+static void fill_inverse_cmap (rgb2mapQuant* q, int c0, int c1, int c2)
 {
-  hist2d * histogram = sl_histogram;
+  hist2d * histogram = q->inverse;
   int minc0, minc1, minc2;	/* lower left corner of update box */
   int ic0, ic1, ic2;
   register JSAMPLE * cptr;	/* pointer into bestcolor[] array */
@@ -751,10 +844,10 @@ static void fill_inverse_cmap (int c0, int c1, int c2)
   minc1 = (c1 << BOX_C1_SHIFT) + ((1 << C1_SHIFT) >> 1);
   minc2 = (c2 << BOX_C2_SHIFT) + ((1 << C2_SHIFT) >> 1);
   
-  numcolors = find_nearby_colors(minc0, minc1, minc2, colorlist);
+  numcolors = find_nearby_colors(q, minc0, minc1, minc2, colorlist);
   
   /* Determine the actually nearest colors. */
-  find_best_colors(minc0, minc1, minc2, numcolors, colorlist, bestcolor);
+  find_best_colors(q, minc0, minc1, minc2, numcolors, colorlist, bestcolor);
   
   /* Save the best color numbers (plus 1) in the main cache array */
   c0 <<= BOX_C0_LOG;		/* convert ID back to base cell indexes */
@@ -772,8 +865,11 @@ static void fill_inverse_cmap (int c0, int c1, int c2)
 }
 
 
-static void slow_map_pixels(const byte *red, const byte *green, const byte *blue, int width, int height, byte *map)
+static void slow_map_pixels(rgb2mapQuant* q)
 {
+  const byte *red = q->red, *green = q->green, *blue = q->blue;
+  int width = q->width, height = q->height;
+  byte *map = q->map;
   register LOCFSERROR cur0, cur1, cur2;	/* current error or pixel value */
   LOCFSERROR belowerr0, belowerr1, belowerr2; /* error for pixel below cur */
   LOCFSERROR bpreverr0, bpreverr1, bpreverr2; /* error for below/prev col */
@@ -784,11 +880,11 @@ static void slow_map_pixels(const byte *red, const byte *green, const byte *blue
   int dir;			/* +1 or -1 depending on direction */
   int dir3;			/* 3*dir, for advancing errorptr */
   int row, col, offset;
-  int *error_limit = sl_error_limiter;
-  JSAMPROW colormap0 = sl_colormap[0];
-  JSAMPROW colormap1 = sl_colormap[1];
-  JSAMPROW colormap2 = sl_colormap[2];
-  hist2d * histogram = sl_histogram;
+  int *error_limit = q->error_limiter;
+  JSAMPROW colormap0 = q->colormap[0];
+  JSAMPROW colormap1 = q->colormap[1];
+  JSAMPROW colormap2 = q->colormap[2];
+  hist2d * histogram = q->inverse;
   
   for (row = 0; row < height; row++) 
   {
@@ -799,7 +895,7 @@ static void slow_map_pixels(const byte *red, const byte *green, const byte *blue
     inBptr = (JSAMPROW)&blue[offset];
     outptr = &map[offset];
 
-    if (sl_on_odd_row) 
+    if (q->on_odd_row) 
     {
       /* work right to left in this row */
       offset = width-1;
@@ -812,16 +908,16 @@ static void slow_map_pixels(const byte *red, const byte *green, const byte *blue
 
       dir = -1;
       dir3 = -3;
-      errorptr = sl_fserrors + (width+1)*3; /* => entry after last column */
-      sl_on_odd_row = FALSE;	/* flip for next time */
+      errorptr = q->fserrors + (width+1)*3; /* => entry after last column */
+      q->on_odd_row = FALSE;	/* flip for next time */
     } 
     else 
     {
       /* work left to right in this row */
       dir = 1;
       dir3 = 3;
-      errorptr = sl_fserrors;	/* => entry before first real column */
-      sl_on_odd_row = TRUE;	/* flip for next time */
+      errorptr = q->fserrors;	/* => entry before first real column */
+      q->on_odd_row = TRUE;	/* flip for next time */
     }
 
     /* Preset error values: no error propagated to first pixel from left */
@@ -854,7 +950,7 @@ static void slow_map_pixels(const byte *red, const byte *green, const byte *blue
       /* If we have not seen this color before, find nearest colormap */
       /* entry and update the cache */
       if (*cachep == 0)
-        fill_inverse_cmap(cur0>>C0_SHIFT, cur1>>C1_SHIFT, cur2>>C2_SHIFT);
+        fill_inverse_cmap(q, cur0>>C0_SHIFT, cur1>>C1_SHIFT, cur2>>C2_SHIFT);
 
       /* Now emit the colormap index for this cell */
       {
@@ -919,17 +1015,239 @@ static void slow_map_pixels(const byte *red, const byte *green, const byte *blue
 }
 
 
+/* Fill the whole inverse color map, 
+   the update boxes are distributed among the threads */
+#define BOX_C0_COUNT (HIST_C0_ELEMS/BOX_C0_ELEMS)
+#define BOX_C1_COUNT (HIST_C1_ELEMS/BOX_C1_ELEMS)
+
+static void fill_inverse_task(rgb2mapQuant* q, int index)
+{
+  int b, c2;
+  
+  for (b = index; b < BOX_C0_COUNT*BOX_C1_COUNT; b += q->num_threads)
+  {
+    int c0 = (b / BOX_C1_COUNT) * BOX_C0_ELEMS;
+    int c1 = (b % BOX_C1_COUNT) * BOX_C1_ELEMS;
+    for (c2 = 0; c2 < HIST_C2_ELEMS; c2 += BOX_C2_ELEMS)
+      fill_inverse_cmap(q, c0, c1, c2);
+  }
+}
+
+static void fill_inverse_all(rgb2mapQuant* q)
+{
+  xvbzero((char *) q->inverse, sizeof(hist3d));
+
+  if (q->num_threads > 1)
+    run_parallel(q, fill_inverse_task);
+  else
+    fill_inverse_task(q, 0);
+}
+
+
+/* Map pixels without dithering, using the precomputed inverse color map, 
+   the lines are distributed among the threads */
+static void map_pixels_task(rgb2mapQuant* q, int index)
+{
+  hist2d * inverse = q->inverse;
+  int start = (int)(((double)q->height * index) / q->num_threads);
+  int end = (int)(((double)q->height * (index + 1)) / q->num_threads);
+  int offset = start * q->width;
+  int count = (end - start) * q->width;
+  const byte *red = q->red + offset, *green = q->green + offset, *blue = q->blue + offset;
+  byte *map = q->map + offset;
+
+  while (count-- > 0)
+  {
+    *map++ = (byte) (inverse[*red++ >> C0_SHIFT][*green++ >> C1_SHIFT][*blue++ >> C2_SHIFT] - 1);
+  }
+}
+
+
+/* K-means refinement of the median cut colormap. 
+   The histogram cells are the k-means points, but the means use the actual 
+   pixel values of each cell, not the cell centers. A new colormap is kept 
+   only if it lowers the error of the pixels mapped by the inverse color map, 
+   so the refinement never makes the result worse than the median cut. 
+   Each thread sums the cells of some histogram planes. */
+#define KMEANS_ITERATIONS 8
+
+#define CELL_INDEX(c0, c1, c2) (((c0) * HIST_C1_ELEMS + (c1)) * HIST_C2_ELEMS + (c2))
+
+static void kmeans_cells_task(rgb2mapQuant* q, int index)
+{
+  long long (*cells)[5] = q->cells;
+  int numpixels = q->width * q->height;
+  const byte *red = q->red, *green = q->green, *blue = q->blue;
+  int c0;
+
+  for (c0 = index; c0 < HIST_C0_ELEMS; c0 += q->num_threads)
+    xvbzero((char *) cells[CELL_INDEX(c0, 0, 0)], HIST_C1_ELEMS * HIST_C2_ELEMS * sizeof(*cells));
+
+  /* all threads read all the pixels, but each one sums only its planes */
+  while (numpixels-- > 0)
+  {
+    int r = *red++, g = *green++, b = *blue++;
+    c0 = r >> C0_SHIFT;
+    if (c0 % q->num_threads == index)
+    {
+      long long *cell = cells[CELL_INDEX(c0, g >> C1_SHIFT, b >> C2_SHIFT)];
+      cell[0]++;
+      cell[1] += r;
+      cell[2] += g;
+      cell[3] += b;
+      cell[4] += r*r + g*g + b*b;
+    }
+  }
+}
+
+static void kmeans_sums_task(rgb2mapQuant* q, int index)
+{
+  long long (*cells)[5] = q->cells;
+  hist2d * inverse = q->inverse;
+  long long (*sums)[5] = q->thread_sums[index];
+  int c0, c1, c2;
+
+  xvbzero((char *) sums, MAXNUMCOLORS * sizeof(*sums));
+
+  for (c0 = index; c0 < HIST_C0_ELEMS; c0 += q->num_threads)
+  {
+    for (c1 = 0; c1 < HIST_C1_ELEMS; c1++)
+    {
+      for (c2 = 0; c2 < HIST_C2_ELEMS; c2++)
+      {
+        long long *cell = cells[CELL_INDEX(c0, c1, c2)];
+        if (cell[0] != 0)
+        {
+          int i = inverse[c0][c1][c2] - 1;
+          long long *s = sums[i];
+          int r = q->colormap[0][i], g = q->colormap[1][i], b = q->colormap[2][i];
+          s[0] += cell[0];
+          s[1] += cell[1];
+          s[2] += cell[2];
+          s[3] += cell[3];
+          /* sum of the squared distances of the cell pixels to the color */
+          s[4] += cell[4] - 2 * (r*cell[1] + g*cell[2] + b*cell[3]) + (r*r + g*g + b*b) * cell[0];
+        }
+      }
+    }
+  }
+}
+
+static void kmeans_refine(rgb2mapQuant* q)
+{
+  int iter, i, t, changed;
+  long long error, best_error = -1;
+  JSAMPLE best[3][MAXNUMCOLORS];
+
+  q->cells = (long long (*)[5]) malloc(HIST_C0_ELEMS*HIST_C1_ELEMS*HIST_C2_ELEMS * sizeof(*q->cells));
+  q->thread_sums = (long long (*)[MAXNUMCOLORS][5]) malloc(q->num_threads * sizeof(*q->thread_sums));
+  if (!q->cells || !q->thread_sums)
+  {
+    if (q->cells) free(q->cells);
+    if (q->thread_sums) free(q->thread_sums);
+    q->cells = NULL;
+    q->thread_sums = NULL;
+    return;
+  }
+
+  if (q->num_threads > 1)
+    run_parallel(q, kmeans_cells_task);
+  else
+    kmeans_cells_task(q, 0);
+
+  for (iter = 0; ; iter++)
+  {
+    /* assign each cell to the nearest color */
+    fill_inverse_all(q);
+
+    if (q->num_threads > 1)
+      run_parallel(q, kmeans_sums_task);
+    else
+      kmeans_sums_task(q, 0);
+
+    error = 0;
+    for (t = 0; t < q->num_threads; t++)
+    {
+      for (i = 0; i < q->num_colors; i++)
+        error += q->thread_sums[t][i][4];
+    }
+
+    /* the new colors did not improve, go back to the previous ones */
+    if (best_error >= 0 && error >= best_error)
+    {
+      for (i = 0; i < q->num_colors; i++)
+      {
+        q->colormap[0][i] = best[0][i];
+        q->colormap[1][i] = best[1][i];
+        q->colormap[2][i] = best[2][i];
+      }
+      break;
+    }
+
+    best_error = error;
+    for (i = 0; i < q->num_colors; i++)
+    {
+      best[0][i] = q->colormap[0][i];
+      best[1][i] = q->colormap[1][i];
+      best[2][i] = q->colormap[2][i];
+    }
+
+    if (iter == KMEANS_ITERATIONS)
+      break;
+
+    /* move each color to the mean of its pixels */
+    changed = 0;
+    for (i = 0; i < q->num_colors; i++)
+    {
+      long long total = 0, c0total = 0, c1total = 0, c2total = 0;
+      JSAMPLE c0, c1, c2;
+
+      for (t = 0; t < q->num_threads; t++)
+      {
+        total += q->thread_sums[t][i][0];
+        c0total += q->thread_sums[t][i][1];
+        c1total += q->thread_sums[t][i][2];
+        c2total += q->thread_sums[t][i][3];
+      }
+
+      if (total == 0)
+        continue;
+
+      c0 = (JSAMPLE) ((c0total + (total>>1)) / total);
+      c1 = (JSAMPLE) ((c1total + (total>>1)) / total);
+      c2 = (JSAMPLE) ((c2total + (total>>1)) / total);
+
+      if (c0 != q->colormap[0][i] || c1 != q->colormap[1][i] || c2 != q->colormap[2][i])
+      {
+        q->colormap[0][i] = c0;
+        q->colormap[1][i] = c1;
+        q->colormap[2][i] = c2;
+        changed = 1;
+      }
+    }
+
+    if (!changed)
+      break;
+  }
+
+  free(q->cells);
+  q->cells = NULL;
+  free(q->thread_sums);
+  q->thread_sums = NULL;
+}
+
+
 /* Allocate and fill in the error_limiter table */
-static void init_error_limit (void)
+static int init_error_limit (rgb2mapQuant* q)
 {
   int * table;
   int in, out, STEPSIZE;
   
   table = (int *) malloc((size_t) ((255*2+1) * sizeof(int)));
-  if (! table) return;
+  if (! table) return 0;
   
   table += 255;		/* so can index -255 .. +255 */
-  sl_error_limiter = table;
+  q->error_limiter = table;
   
   STEPSIZE = ((255+1)/16);
 
@@ -954,13 +1272,92 @@ static void init_error_limit (void)
     table[in]  =  out; 
     table[-in] = -out;
   }
+
+  return 1;
 }
 
-void cdRGB2Map(int width, int height, const unsigned char *red, const unsigned char *green, const unsigned char *blue, unsigned char *map, int pal_size, long *colors)
+/* Master control for slow quantizer. */
+static int slow_quant(rgb2mapQuant* q, byte *rm, byte *gm, byte *bm, int *descols, int flags)
+{
+  size_t fs_arraysize = (q->width + 2) * (3 * sizeof(FSERROR));
+  int dither = !(flags & CD_RGB2MAP_NODITHER);
+  int ok = 1;
+  
+  /* Allocate all the temporary storage needed */
+  q->histogram = (hist2d *) malloc(sizeof(hist3d));
+  q->inverse = (hist2d *) malloc(sizeof(hist3d));
+  if (dither)
+  {
+    ok = init_error_limit(q);
+    q->fserrors = (FSERRPTR) malloc(fs_arraysize);
+  }
+  
+  if (! ok || ! q->histogram || ! q->inverse || (dither && ! q->fserrors)) 
+  {
+    if (q->error_limiter) free(q->error_limiter-255);
+    if (q->fserrors) free(q->fserrors);
+    if (q->inverse) free(q->inverse);
+    if (q->histogram) free(q->histogram);
+    return 1;
+  }
+  
+  q->colormap[0] = (JSAMPROW) rm;
+  q->colormap[1] = (JSAMPROW) gm;
+  q->colormap[2] = (JSAMPROW) bm;
+  
+  /* Compute the color histogram */
+  slow_fill_histogram(q);
+  
+  /* Select the colormap */
+  slow_select_colors(q, descols);
+
+  if (flags & CD_RGB2MAP_KMEANS)
+    kmeans_refine(q);
+  
+  if (dither)
+  {
+    /* Zero the inverse color map, it is filled as the colors are used. 
+       With threads it is completely filled in parallel before. */
+    if (q->num_threads > 1)
+      fill_inverse_all(q);
+    else
+      xvbzero((char *) q->inverse, sizeof(hist3d));
+
+    /* Initialize the propagated errors to zero. */
+    xvbzero((char *) q->fserrors, fs_arraysize);
+    q->on_odd_row = FALSE;
+  
+    /* Map the image. */
+    slow_map_pixels(q);
+  }
+  else
+  {
+    fill_inverse_all(q);
+
+    if (q->num_threads > 1)
+      run_parallel(q, map_pixels_task);
+    else
+      map_pixels_task(q, 0);
+  }
+  
+  /* Release working memory. */
+  free(q->histogram);
+  free(q->inverse);
+  if (dither)
+  {
+    free(q->error_limiter-255);
+    free(q->fserrors);
+  }
+
+  return 0;
+}
+
+void cdRGB2MapEx(int width, int height, const unsigned char *red, const unsigned char *green, const unsigned char *blue, unsigned char *map, int pal_size, long *colors, int flags, int num_threads)
 {
   int i, err;
   byte rm[256], gm[256], bm[256];
   int num_colors;
+  rgb2mapQuant q;
 
   if (pal_size <= 0 || pal_size > 256)
     pal_size = 256;
@@ -969,7 +1366,19 @@ void cdRGB2Map(int width, int height, const unsigned char *red, const unsigned c
   
   if (!quick_map(red, green, blue, width, height, map, rm, gm, bm, &num_colors))  
   {
-    err = slow_quant(red, green, blue, width, height, map, rm, gm, bm, &num_colors);
+    xvbzero((char *) &q, sizeof(rgb2mapQuant));
+    q.red = red;
+    q.green = green;
+    q.blue = blue;
+    q.width = width;
+    q.height = height;
+    q.map = map;
+
+    if (num_threads < 1) num_threads = 1;
+    if (num_threads > RGB2MAP_MAX_THREADS) num_threads = RGB2MAP_MAX_THREADS;
+    q.num_threads = num_threads;
+
+    err = slow_quant(&q, rm, gm, bm, &num_colors, flags);
     if (err)
       return;
   }
@@ -983,3 +1392,8 @@ void cdRGB2Map(int width, int height, const unsigned char *red, const unsigned c
       *colors++ = 0;
   }
 }
+
+void cdRGB2Map(int width, int height, const unsigned char *red, const unsigned char *green, const unsigned char *blue, unsigned char *map, int pal_size, long *colors)
+{
+  cdRGB2MapEx(width, height, red, green, blue, map, pal_size, colors, 0, 1);
+}
@@ -17,6 +17,7 @@
 #include "cdsvg.h"
 
 #include "lodepng.h"
+#include "pngqueue.h"
 #include "base64.h"
 
 
@@ -51,10 +52,16 @@ struct _cdCtxCanvas
 
   int transform_control;
 
+  pngQueue* png_queue;
+  int defer_images;
+  unsigned char* image_used;  /* images referenced by <use>, written in <defs> */
+  int image_used_size;
+
   FILE* file;
 };
 
 static void cdtransform(cdCtxCanvas *ctxcanvas, const double* matrix);
+static void sWriteImageDefs(cdCtxCanvas *ctxcanvas);
 
 static void cdkillcanvas(cdCtxCanvas* ctxcanvas)
 {
@@ -65,10 +72,19 @@ static void cdkillcanvas(cdCtxCanvas* ctxcanvas)
     fprintf(ctxcanvas->file, "</g>\n");  /* close transform container */
 
   fprintf(ctxcanvas->file, "</g>\n");  /* close global container */
+
+  if (ctxcanvas->defer_images)
+    sWriteImageDefs(ctxcanvas);
+
   fprintf(ctxcanvas->file, "</svg>\n");
 
   fclose(ctxcanvas->file);
 
+  pngQueueKill(ctxcanvas->png_queue);
+
+  if (ctxcanvas->image_used)
+    free(ctxcanvas->image_used);
+
   if (ctxcanvas->old_locale)
   {
     setlocale(LC_NUMERIC, ctxcanvas->old_locale);
@@ -981,153 +997,206 @@ static long cdforeground(cdCtxCanvas *ctxcanvas, long int color)
   return color;
 }
 
-static void cdputimagerectrgb(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *r, const unsigned char *g, const unsigned char *b, int x, int y, int w, int h, int xmin, int xmax, int ymin, int ymax)
+static void sPutImage(cdCtxCanvas *ctxcanvas, unsigned char* rgb_data, int rw, int rh, int colortype, double x, double y, double w, double h)
 {
-  int i, j, d, rw, rh, rgb_size, target_size;
-  unsigned char* rgb_data, *rgb_buffer;
+  int index, sy;
   size_t buffer_size;
-  LodePNGState state;
-  char* rgb_target;
+  unsigned char* rgb_buffer;
 
-  if (xmin<0 || ymin<0 || xmax-xmin+1>iw || ymax-ymin+1>ih) return;
-
-  rw = xmax-xmin+1;
-  rh = ymax-ymin+1;
+  /* takes ownership of rgb_data */
+  index = pngQueueEncode(ctxcanvas->png_queue, rgb_data, rw, rh, colortype, NULL);
+  if (index < 0)
+    return;
 
-  rgb_size = 4*rw*rh;
-  rgb_data = (unsigned char*)malloc(rgb_size);
-  if (!rgb_data) return;
+  if (ctxcanvas->canvas->use_matrix)  /* Transformation active */
+  {
+    sy = -1;
+    y = y + h;
+  }
+  else
+  {
+    sy = 1;
+    y = y - h;
+  }
 
-  d = 0;
-  for (i=ymax; i>=ymin; i--)
+  if (ctxcanvas->defer_images)
   {
-    for (j=xmin; j<=xmax; j++)
+    if (index >= ctxcanvas->image_used_size)
     {
-      rgb_data[d] = r[i*iw+j]; d++;
-      rgb_data[d] = g[i*iw+j]; d++;
-      rgb_data[d] = b[i*iw+j]; d++;
-      rgb_data[d] = (unsigned char)0xFF; d++;
+      int new_size = index + 256;
+      unsigned char* new_used = (unsigned char*)realloc(ctxcanvas->image_used, new_size);
+      if (!new_used)
+        return;
+      memset(new_used + ctxcanvas->image_used_size, 0, new_size - ctxcanvas->image_used_size);
+      ctxcanvas->image_used = new_used;
+      ctxcanvas->image_used_size = new_size;
     }
+    ctxcanvas->image_used[index] = 1;
+
+    /* the image will be written in the <defs> section when the canvas is killed, 
+       after all the pending encodes are done */
+    fprintf(ctxcanvas->file, "<use transform=\"matrix(%.15g 0 0 %.15g %.15g %.15g)\" xlink:href=\"#cdimage%d\"/>\n",
+            w / rw, sy * h / rh, x, y, index);
   }
+  else
+  {
+    int target_size;
+    char* rgb_target;
 
-  lodepng_state_init(&state);
-  lodepng_encode(&rgb_buffer, &buffer_size, rgb_data, rw, rh, &state);
+    rgb_buffer = pngQueueGetBuffer(ctxcanvas->png_queue, index, &buffer_size);
+    if (!rgb_buffer)
+      return;
 
-  target_size = (int)(buffer_size+2)/3*4+1;
-  rgb_target = (char*)malloc(target_size);
-  base64_encode(rgb_buffer, (int)buffer_size, rgb_target, target_size);
- 
-  if (ctxcanvas->canvas->use_matrix)  /* Transformation active */
-    fprintf(ctxcanvas->file, "<image transform=\"matrix(%d %d %d %d %d %d)\" width=\"%d\" height=\"%d\" xlink:href=\"data:image/png;base64,%s\"/>\n", 
-            1, 0, 0, -1, x, y+h, w, h, rgb_target);
-  else
-    fprintf(ctxcanvas->file, "<image transform=\"matrix(%d %d %d %d %d %d)\" width=\"%d\" height=\"%d\" xlink:href=\"data:image/png;base64,%s\"/>\n", 
-            1, 0, 0, 1, x, y-h, w, h, rgb_target);
+    target_size = (int)(buffer_size + 2) / 3 * 4 + 1;
+    rgb_target = (char*)malloc(target_size);
+    base64_encode(rgb_buffer, (int)buffer_size, rgb_target, target_size);
+
+    fprintf(ctxcanvas->file, "<image transform=\"matrix(%d %d %d %d %.15g %.15g)\" width=\"%.15g\" height=\"%.15g\" xlink:href=\"data:image/png;base64,%s\"/>\n",
+            1, 0, 0, sy, x, y, w, h, rgb_target);
 
-  free(rgb_data);
-  free(rgb_buffer);
-  free(rgb_target);
-  lodepng_state_cleanup(&state);
+    free(rgb_target);
+
+    /* written inline, it is not needed anymore */
+    pngQueueReleaseBuffer(ctxcanvas->png_queue, index);
+  }
 }
 
-static void cdputimagerectrgba(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *r, const unsigned char *g, const unsigned char *b, const unsigned char *a, int x, int y, int w, int h, int xmin, int xmax, int ymin, int ymax)
+static void sWriteImageDefs(cdCtxCanvas *ctxcanvas)
 {
-  int i, j, d, rw, rh, rgb_size, target_size;
-  size_t buffer_size;
-  unsigned char* rgb_data, *rgb_buffer;
-  LodePNGState state;
-  char* rgb_target;
-
-  if (xmin<0 || ymin<0 || xmax-xmin+1>iw || ymax-ymin+1>ih) return;
+  int i, count = pngQueueCount(ctxcanvas->png_queue);
 
-  rw = xmax-xmin+1;
-  rh = ymax-ymin+1;
+  pngQueueWait(ctxcanvas->png_queue);
 
-  rgb_size = 4*rw*rh;
-  rgb_data = (unsigned char*)malloc(rgb_size);
-  if (!rgb_data) return;
+  fprintf(ctxcanvas->file, "<defs>\n");
 
-  d = 0;
-  for (i=ymax; i>=ymin; i--)
+  for (i = 0; i < count; i++)
   {
-    for (j=xmin; j<=xmax; j++)
+    size_t buffer_size;
+    unsigned char* rgb_buffer;
+
+    /* images written inline before PNGTHREADS was set are not referenced */
+    if (i >= ctxcanvas->image_used_size || !ctxcanvas->image_used[i])
+      continue;
+
+    rgb_buffer = pngQueueGetBuffer(ctxcanvas->png_queue, i, &buffer_size);
+    if (rgb_buffer)
     {
-      rgb_data[d] = r[i*iw+j]; d++;
-      rgb_data[d] = g[i*iw+j]; d++;
-      rgb_data[d] = b[i*iw+j]; d++;
-      rgb_data[d] = a[i*iw+j]; d++;
+      int w, h, target_size = (int)(buffer_size + 2) / 3 * 4 + 1;
+      char* rgb_target = (char*)malloc(target_size);
+      base64_encode(rgb_buffer, (int)buffer_size, rgb_target, target_size);
+
+      /* image size is stored in the PNG header, big endian */
+      w = (rgb_buffer[16] << 24) | (rgb_buffer[17] << 16) | (rgb_buffer[18] << 8) | rgb_buffer[19];
+      h = (rgb_buffer[20] << 24) | (rgb_buffer[21] << 16) | (rgb_buffer[22] << 8) | rgb_buffer[23];
+
+      fprintf(ctxcanvas->file, "<image id=\"cdimage%d\" width=\"%d\" height=\"%d\" xlink:href=\"data:image/png;base64,%s\"/>\n", 
+              i, w, h, rgb_target);
+
+      free(rgb_target);
+    }
+    else
+    {
+      /* the image could not be encoded, but it is already referenced by <use> */
+      fprintf(ctxcanvas->file, "<g id=\"cdimage%d\"/>\n", i);
     }
   }
 
-  lodepng_state_init(&state);
-  lodepng_encode(&rgb_buffer, &buffer_size, rgb_data, rw, rh, &state);
+  fprintf(ctxcanvas->file, "</defs>\n");
+}
 
-  target_size = (int)(buffer_size + 2) / 3 * 4 + 1;
-  rgb_target = (char*)malloc(target_size);
-  base64_encode(rgb_buffer, (int)buffer_size, rgb_target, target_size);
+static unsigned char* sGetImageRGB(int iw, const unsigned char *r, const unsigned char *g, const unsigned char *b, const unsigned char *a, int xmin, int xmax, int ymin, int ymax)
+{
+  int i, j, d, rw, rh, rgb_size;
+  unsigned char* rgb_data;
 
-  if (ctxcanvas->canvas->use_matrix)  /* Transformation active */
-    fprintf(ctxcanvas->file, "<image transform=\"matrix(%d %d %d %d %d %d)\" width=\"%d\" height=\"%d\" xlink:href=\"data:image/png;base64,%s\"/>\n", 
-            1, 0, 0, -1, x, y+h, w, h, rgb_target);
-  else
-    fprintf(ctxcanvas->file, "<image transform=\"matrix(%d %d %d %d %d %d)\" width=\"%d\" height=\"%d\" xlink:href=\"data:image/png;base64,%s\"/>\n", 
-            1, 0, 0, 1, x, y-h, w, h, rgb_target);
+  rw = xmax - xmin + 1;
+  rh = ymax - ymin + 1;
 
-  free(rgb_data);
-  free(rgb_buffer);
-  free(rgb_target);
-  lodepng_state_cleanup(&state);
+  rgb_size = (a ? 4 : 3) * rw*rh;
+  rgb_data = (unsigned char*)malloc(rgb_size);
+  if (!rgb_data) return NULL;
+
+  d = 0;
+  for (i = ymax; i >= ymin; i--)
+  {
+    int off = i*iw + xmin;
+    for (j = xmin; j <= xmax; j++, off++)
+    {
+      rgb_data[d] = r[off]; d++;
+      rgb_data[d] = g[off]; d++;
+      rgb_data[d] = b[off]; d++;
+      if (a)
+      {
+        rgb_data[d] = a[off]; d++;
+      }
+    }
+  }
+
+  return rgb_data;
 }
 
-static void cdputimagerectmap(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *index, const long int *colors, int x, int y, int w, int h, int xmin, int xmax, int ymin, int ymax)
+static unsigned char* sGetImageMap(int iw, const unsigned char *index, const long int *colors, int xmin, int xmax, int ymin, int ymax)
 {
-  int i, j, d, rw, rh, rgb_size, target_size;
-  unsigned char* rgb_data, *rgb_buffer;
-  size_t buffer_size;
-  LodePNGState state;
-  char* rgb_target;
-
-  if (xmin<0 || ymin<0 || xmax-xmin+1>iw || ymax-ymin+1>ih) return;
+  int i, j, d, rw, rh, rgb_size;
+  unsigned char* rgb_data;
 
-  rw = xmax-xmin+1;
-  rh = ymax-ymin+1;
+  rw = xmax - xmin + 1;
+  rh = ymax - ymin + 1;
 
-  rgb_size = 4*rw*rh;
+  rgb_size = 3 * rw*rh;
   rgb_data = (unsigned char*)malloc(rgb_size);
-  if (!rgb_data) return;
+  if (!rgb_data) return NULL;
 
   d = 0;
-  for (i=ymax; i>=ymin; i--)
+  for (i = ymax; i >= ymin; i--)
   {
-    for (j=xmin; j<=xmax; j++)
+    for (j = xmin; j <= xmax; j++)
     {
       unsigned char r, g, b;
-      cdDecodeColor(colors[index[i*iw+j]], &r, &g, &b);
+      cdDecodeColor(colors[index[i*iw + j]], &r, &g, &b);
       rgb_data[d] = r; d++;
       rgb_data[d] = g; d++;
       rgb_data[d] = b; d++;
-      rgb_data[d] = (unsigned char)0xFF; d++;
     }
   }
 
-  lodepng_state_init(&state);
-  lodepng_encode(&rgb_buffer, &buffer_size, rgb_data, rw, rh, &state);
+  return rgb_data;
+}
 
-  target_size = (int)(buffer_size + 2) / 3 * 4 + 1;
-  rgb_target = (char*)malloc(target_size);
-  base64_encode(rgb_buffer, (int)buffer_size, rgb_target, target_size);
+static void cdputimagerectrgb(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *r, const unsigned char *g, const unsigned char *b, int x, int y, int w, int h, int xmin, int xmax, int ymin, int ymax)
+{
+  unsigned char* rgb_data;
 
-  if (ctxcanvas->canvas->use_matrix)  /* Transformation active */
-    fprintf(ctxcanvas->file, "<image transform=\"matrix(%d %d %d %d %d %d)\" width=\"%d\" height=\"%d\" xlink:href=\"data:image/png;base64,%s\"/>\n", 
-            1, 0, 0, -1, x, y+h, w, h, rgb_target);
-  else
-    fprintf(ctxcanvas->file, "<image transform=\"matrix(%d %d %d %d %d %d)\" width=\"%d\" height=\"%d\" xlink:href=\"data:image/png;base64,%s\"/>\n", 
-            1, 0, 0, 1, x, y-h, w, h, rgb_target);
+  if (xmin<0 || ymin<0 || xmax-xmin+1>iw || ymax-ymin+1>ih) return;
+
+  rgb_data = sGetImageRGB(iw, r, g, b, NULL, xmin, xmax, ymin, ymax);
+  if (!rgb_data) return;
+
+  sPutImage(ctxcanvas, rgb_data, xmax - xmin + 1, ymax - ymin + 1, LCT_RGB, x, y, w, h);
+}
+
+static void cdputimagerectrgba(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *r, const unsigned char *g, const unsigned char *b, const unsigned char *a, int x, int y, int w, int h, int xmin, int xmax, int ymin, int ymax)
+{
+  unsigned char* rgb_data;
+
+  if (xmin<0 || ymin<0 || xmax-xmin+1>iw || ymax-ymin+1>ih) return;
+
+  rgb_data = sGetImageRGB(iw, r, g, b, a, xmin, xmax, ymin, ymax);
+  if (!rgb_data) return;
+
+  sPutImage(ctxcanvas, rgb_data, xmax - xmin + 1, ymax - ymin + 1, LCT_RGBA, x, y, w, h);
+}
+
+static void cdputimagerectmap(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *index, const long int *colors, int x, int y, int w, int h, int xmin, int xmax, int ymin, int ymax)
+{
+  unsigned char* rgb_data;
+
+  if (xmin<0 || ymin<0 || xmax-xmin+1>iw || ymax-ymin+1>ih) return;
+
+  rgb_data = sGetImageMap(iw, index, colors, xmin, xmax, ymin, ymax);
+  if (!rgb_data) return;
 
-  free(rgb_data);
-  free(rgb_buffer);
-  free(rgb_target);
-  lodepng_state_cleanup(&state);
+  sPutImage(ctxcanvas, rgb_data, xmax - xmin + 1, ymax - ymin + 1, LCT_RGB, x, y, w, h);
 }
 
 static void cdpixel(cdCtxCanvas *ctxcanvas, int x, int y, long int color)
@@ -1141,151 +1210,38 @@ static void cdpixel(cdCtxCanvas *ctxcanvas, int x, int y, long int color)
 
 static void cdfputimagerectrgb(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *r, const unsigned char *g, const unsigned char *b, double x, double y, double w, double h, int xmin, int xmax, int ymin, int ymax)
 {
-  int i, j, d, rw, rh, rgb_size, target_size;
-  unsigned char* rgb_data, *rgb_buffer;
-  size_t buffer_size;
-  LodePNGState state;
-  char* rgb_target;
+  unsigned char* rgb_data;
 
   if (xmin<0 || ymin<0 || xmax - xmin + 1>iw || ymax - ymin + 1>ih) return;
 
-  rw = xmax - xmin + 1;
-  rh = ymax - ymin + 1;
-
-  rgb_size = 4 * rw*rh;
-  rgb_data = (unsigned char*)malloc(rgb_size);
+  rgb_data = sGetImageRGB(iw, r, g, b, NULL, xmin, xmax, ymin, ymax);
   if (!rgb_data) return;
 
-  d = 0;
-  for (i = ymax; i >= ymin; i--)
-  {
-    for (j = xmin; j <= xmax; j++)
-    {
-      rgb_data[d] = r[i*iw + j]; d++;
-      rgb_data[d] = g[i*iw + j]; d++;
-      rgb_data[d] = b[i*iw + j]; d++;
-      rgb_data[d] = (unsigned char)0xFF; d++;
-    }
-  }
-
-  lodepng_state_init(&state);
-  lodepng_encode(&rgb_buffer, &buffer_size, rgb_data, rw, rh, &state);
-
-  target_size = (int)(buffer_size + 2) / 3 * 4 + 1;
-  rgb_target = (char*)malloc(target_size);
-  base64_encode(rgb_buffer, (int)buffer_size, rgb_target, target_size);
-
-  if (ctxcanvas->canvas->use_matrix)  /* Transformation active */
-    fprintf(ctxcanvas->file, "<image transform=\"matrix(%d %d %d %d %g %g)\" width=\"%g\" height=\"%g\" xlink:href=\"data:image/png;base64,%s\"/>\n",
-    1, 0, 0, -1, x, y + h, w, h, rgb_target);
-  else
-    fprintf(ctxcanvas->file, "<image transform=\"matrix(%d %d %d %d %g %g)\" width=\"%g\" height=\"%g\" xlink:href=\"data:image/png;base64,%s\"/>\n",
-    1, 0, 0, 1, x, y - h, w, h, rgb_target);
-
-  free(rgb_data);
-  free(rgb_buffer);
-  free(rgb_target);
-  lodepng_state_cleanup(&state);
+  sPutImage(ctxcanvas, rgb_data, xmax - xmin + 1, ymax - ymin + 1, LCT_RGB, x, y, w, h);
 }
 
 static void cdfputimagerectrgba(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *r, const unsigned char *g, const unsigned char *b, const unsigned char *a, double x, double y, double w, double h, int xmin, int xmax, int ymin, int ymax)
 {
-  int i, j, d, rw, rh, rgb_size, target_size;
-  size_t buffer_size;
-  unsigned char* rgb_data, *rgb_buffer;
-  LodePNGState state;
-  char* rgb_target;
+  unsigned char* rgb_data;
 
   if (xmin<0 || ymin<0 || xmax - xmin + 1>iw || ymax - ymin + 1>ih) return;
 
-  rw = xmax - xmin + 1;
-  rh = ymax - ymin + 1;
-
-  rgb_size = 4 * rw*rh;
-  rgb_data = (unsigned char*)malloc(rgb_size);
+  rgb_data = sGetImageRGB(iw, r, g, b, a, xmin, xmax, ymin, ymax);
   if (!rgb_data) return;
 
-  d = 0;
-  for (i = ymax; i >= ymin; i--)
-  {
-    for (j = xmin; j <= xmax; j++)
-    {
-      rgb_data[d] = r[i*iw + j]; d++;
-      rgb_data[d] = g[i*iw + j]; d++;
-      rgb_data[d] = b[i*iw + j]; d++;
-      rgb_data[d] = a[i*iw + j]; d++;
-    }
-  }
-
-  lodepng_state_init(&state);
-  lodepng_encode(&rgb_buffer, &buffer_size, rgb_data, rw, rh, &state);
-
-  target_size = (int)(buffer_size + 2) / 3 * 4 + 1;
-  rgb_target = (char*)malloc(target_size);
-  base64_encode(rgb_buffer, (int)buffer_size, rgb_target, target_size);
-
-  if (ctxcanvas->canvas->use_matrix)  /* Transformation active */
-    fprintf(ctxcanvas->file, "<image transform=\"matrix(%d %d %d %d %g %g)\" width=\"%g\" height=\"%g\" xlink:href=\"data:image/png;base64,%s\"/>\n",
-    1, 0, 0, -1, x, y + h, w, h, rgb_target);
-  else
-    fprintf(ctxcanvas->file, "<image transform=\"matrix(%d %d %d %d %g %g)\" width=\"%g\" height=\"%g\" xlink:href=\"data:image/png;base64,%s\"/>\n",
-    1, 0, 0, 1, x, y - h, w, h, rgb_target);
-
-  free(rgb_data);
-  free(rgb_buffer);
-  free(rgb_target);
-  lodepng_state_cleanup(&state);
+  sPutImage(ctxcanvas, rgb_data, xmax - xmin + 1, ymax - ymin + 1, LCT_RGBA, x, y, w, h);
 }
 
 static void cdfputimagerectmap(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *index, const long int *colors, double x, double y, double w, double h, int xmin, int xmax, int ymin, int ymax)
 {
-  int i, j, d, rw, rh, rgb_size, target_size;
-  unsigned char* rgb_data, *rgb_buffer;
-  size_t buffer_size;
-  LodePNGState state;
-  char* rgb_target;
+  unsigned char* rgb_data;
 
   if (xmin<0 || ymin<0 || xmax - xmin + 1>iw || ymax - ymin + 1>ih) return;
 
-  rw = xmax - xmin + 1;
-  rh = ymax - ymin + 1;
-
-  rgb_size = 4 * rw*rh;
-  rgb_data = (unsigned char*)malloc(rgb_size);
+  rgb_data = sGetImageMap(iw, index, colors, xmin, xmax, ymin, ymax);
   if (!rgb_data) return;
 
-  d = 0;
-  for (i = ymax; i >= ymin; i--)
-  {
-    for (j = xmin; j <= xmax; j++)
-    {
-      unsigned char r, g, b;
-      cdDecodeColor(colors[index[i*iw + j]], &r, &g, &b);
-      rgb_data[d] = r; d++;
-      rgb_data[d] = g; d++;
-      rgb_data[d] = b; d++;
-      rgb_data[d] = (unsigned char)0xFF; d++;
-    }
-  }
-
-  lodepng_state_init(&state);
-  lodepng_encode(&rgb_buffer, &buffer_size, rgb_data, rw, rh, &state);
-
-  target_size = (int)(buffer_size + 2) / 3 * 4 + 1;
-  rgb_target = (char*)malloc(target_size);
-  base64_encode(rgb_buffer, (int)buffer_size, rgb_target, target_size);
-
-  if (ctxcanvas->canvas->use_matrix)  /* Transformation active */
-    fprintf(ctxcanvas->file, "<image transform=\"matrix(%d %d %d %d %g %g)\" width=\"%g\" height=\"%g\" xlink:href=\"data:image/png;base64,%s\"/>\n",
-    1, 0, 0, -1, x, y + h, w, h, rgb_target);
-  else
-    fprintf(ctxcanvas->file, "<image transform=\"matrix(%d %d %d %d %g %g)\" width=\"%g\" height=\"%g\" xlink:href=\"data:image/png;base64,%s\"/>\n",
-    1, 0, 0, 1, x, y - h, w, h, rgb_target);
-
-  free(rgb_data);
-  free(rgb_buffer);
-  free(rgb_target);
-  lodepng_state_cleanup(&state);
+  sPutImage(ctxcanvas, rgb_data, xmax - xmin + 1, ymax - ymin + 1, LCT_RGB, x, y, w, h);
 }
 
 static void cdfpixel(cdCtxCanvas *ctxcanvas, double x, double y, long int color)
@@ -1363,6 +1319,59 @@ static cdAttribute opacity_attrib =
   get_opacity_attrib
 }; 
 
+static void set_pngthreads_attrib(cdCtxCanvas *ctxcanvas, char* data)
+{
+  int threads = 0;
+
+  if (data)
+    sscanf(data, "%d", &threads);
+
+  /* once images are encoded in parallel they must be 
+     written at the end of the file, so it can not be turned back */
+  if (threads > 0)
+    ctxcanvas->defer_images = 1;
+
+  pngQueueSetThreads(ctxcanvas->png_queue, threads);
+}
+
+static char* get_pngthreads_attrib(cdCtxCanvas *ctxcanvas)
+{
+  static char data[50];
+  sprintf(data, "%d", pngQueueGetThreads(ctxcanvas->png_queue));
+  return data;
+}
+
+static cdAttribute pngthreads_attrib =
+{
+  "PNGTHREADS",
+  set_pngthreads_attrib,
+  get_pngthreads_attrib
+}; 
+
+static void set_pngcompression_attrib(cdCtxCanvas *ctxcanvas, char* data)
+{
+  int level = -1;
+
+  if (data)
+    sscanf(data, "%d", &level);
+
+  pngQueueSetCompression(ctxcanvas->png_queue, level);
+}
+
+static char* get_pngcompression_attrib(cdCtxCanvas *ctxcanvas)
+{
+  static char data[50];
+  sprintf(data, "%d", pngQueueGetCompression(ctxcanvas->png_queue));
+  return data;
+}
+
+static cdAttribute pngcompression_attrib =
+{
+  "PNGCOMPRESSION",
+  set_pngcompression_attrib,
+  get_pngcompression_attrib
+}; 
+
 static void set_cmd_attrib(cdCtxCanvas *ctxcanvas, char* data)
 {
   fprintf(ctxcanvas->file, "%s", data);
@@ -1398,6 +1407,14 @@ static void cdcreatecanvas(cdCanvas *canvas, void *data)
     return;
   }
 
+  ctxcanvas->png_queue = pngQueueCreate(0);
+  if (!ctxcanvas->png_queue)
+  {
+    fclose(ctxcanvas->file);
+    free(ctxcanvas);
+    return;
+  }
+
   /* store the base canvas */
   ctxcanvas->canvas = canvas;
   canvas->ctxcanvas = ctxcanvas;
@@ -1436,6 +1453,8 @@ static void cdcreatecanvas(cdCanvas *canvas, void *data)
   cdRegisterAttribute(canvas, &cmd_attrib);
   cdRegisterAttribute(canvas, &hatchboxsize_attrib);
   cdRegisterAttribute(canvas, &opacity_attrib);
+  cdRegisterAttribute(canvas, &pngthreads_attrib);
+  cdRegisterAttribute(canvas, &pngcompression_attrib);
 
   /* header */
   fprintf(ctxcanvas->file, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
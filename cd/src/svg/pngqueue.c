@@ -0,0 +1,604 @@
+/** \file
+ * \brief PNG encoding queue, used by the SVG and PPTX drivers
+ *
+ * Images are encoded by a small pool of worker threads,
+ * the drawing thread only waits when the file is closed.
+ * Identical images are encoded only once, they are compared
+ * by a hash and then byte by byte. Only the most recently used raw images 
+ * are kept for that comparison, up to PNG_DEDUP_BYTES, 
+ * the others are released as soon as they are encoded.
+ *
+ * See Copyright Notice in cd.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#include "zlib.h"
+
+#include "lodepng.h"
+#include "pngqueue.h"
+
+
+#ifdef WIN32
+typedef HANDLE pngThread;
+typedef CRITICAL_SECTION pngMutex;
+typedef CONDITION_VARIABLE pngCond;
+#define pngMutexInit(_m)      InitializeCriticalSection(_m)
+#define pngMutexDestroy(_m)   DeleteCriticalSection(_m)
+#define pngMutexLock(_m)      EnterCriticalSection(_m)
+#define pngMutexUnlock(_m)    LeaveCriticalSection(_m)
+#define pngCondInit(_c)       InitializeConditionVariable(_c)
+#define pngCondDestroy(_c)
+#define pngCondWait(_c, _m)   SleepConditionVariableCS(_c, _m, INFINITE)
+#define pngCondSignal(_c)     WakeConditionVariable(_c)
+#define pngCondBroadcast(_c)  WakeAllConditionVariable(_c)
+#else
+typedef pthread_t pngThread;
+typedef pthread_mutex_t pngMutex;
+typedef pthread_cond_t pngCond;
+#define pngMutexInit(_m)      pthread_mutex_init(_m, NULL)
+#define pngMutexDestroy(_m)   pthread_mutex_destroy(_m)
+#define pngMutexLock(_m)      pthread_mutex_lock(_m)
+#define pngMutexUnlock(_m)    pthread_mutex_unlock(_m)
+#define pngCondInit(_c)       pthread_cond_init(_c, NULL)
+#define pngCondDestroy(_c)    pthread_cond_destroy(_c)
+#define pngCondWait(_c, _m)   pthread_cond_wait(_c, _m)
+#define pngCondSignal(_c)     pthread_cond_signal(_c)
+#define pngCondBroadcast(_c)  pthread_cond_broadcast(_c)
+#endif
+
+#define PNG_MAX_THREADS 64
+#define PNG_HASH_SIZE 1024
+#define PNG_DEDUP_BYTES (32*1024*1024)
+
+typedef struct _pngEntry
+{
+  unsigned long long hash;
+  int w, h, colortype;
+  unsigned char* data;    /* raw image, NULL after encoded if not in the dedup window */
+  size_t data_size;
+  int encoding;           /* data is being used by the encoder */
+
+  /* dedup window, entries that can be compared with new images */
+  int dedup;
+  int hash_next;          /* next entry in the same hash bucket */
+  int lru_prev, lru_next; /* most recently used first */
+
+  unsigned char* buffer;  /* encoded PNG, only for memory entries */
+  size_t size;
+} pngEntry;
+
+typedef struct _pngJob
+{
+  int index;
+  int w, h, colortype, level;
+  const unsigned char* data;  /* owned by the entry */
+  char* filename;
+
+  struct _pngJob* next;
+} pngJob;
+
+struct _pngQueue
+{
+  int num_threads;
+  int level;
+
+  pngEntry* entries;
+  int entry_count, entry_size;
+
+  int buckets[PNG_HASH_SIZE];
+  int lru_first, lru_last;
+  size_t dedup_bytes;
+
+  /* FIFO of jobs waiting for a thread */
+  pngJob *first, *last;
+  int queued,    /* jobs in the FIFO */
+      pending;   /* jobs in the FIFO plus jobs being encoded */
+  int quit;
+
+  pngMutex mutex;
+  pngCond has_job, job_done;
+  pngThread threads[PNG_MAX_THREADS];
+};
+
+static unsigned long long pngHash(const unsigned char* data, size_t size)
+{
+  /* FNV-1a */
+  unsigned long long hash = 14695981039346656037ULL;
+  size_t i;
+  for (i = 0; i < size; i++)
+  {
+    hash ^= data[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+/* Dedup window, changed only by the caller thread with the mutex locked.
+   The encoder threads only read the dedup flag of their entry. */
+
+static void pngLruRemove(pngQueue* queue, int index)
+{
+  pngEntry* entry = queue->entries + index;
+
+  if (entry->lru_prev >= 0)
+    queue->entries[entry->lru_prev].lru_next = entry->lru_next;
+  else
+    queue->lru_first = entry->lru_next;
+
+  if (entry->lru_next >= 0)
+    queue->entries[entry->lru_next].lru_prev = entry->lru_prev;
+  else
+    queue->lru_last = entry->lru_prev;
+}
+
+static void pngLruAddFirst(pngQueue* queue, int index)
+{
+  pngEntry* entry = queue->entries + index;
+
+  entry->lru_prev = -1;
+  entry->lru_next = queue->lru_first;
+  if (queue->lru_first >= 0)
+    queue->entries[queue->lru_first].lru_prev = index;
+  else
+    queue->lru_last = index;
+  queue->lru_first = index;
+}
+
+static void pngDedupRemove(pngQueue* queue, int index)
+{
+  pngEntry* entry = queue->entries + index;
+  int* next = queue->buckets + (entry->hash % PNG_HASH_SIZE);
+
+  while (*next != index)
+    next = &queue->entries[*next].hash_next;
+  *next = entry->hash_next;
+
+  pngLruRemove(queue, index);
+
+  queue->dedup_bytes -= entry->data_size;
+  entry->dedup = 0;
+
+  /* if still encoding, the encoder will release it */
+  if (!entry->encoding)
+  {
+    free(entry->data);
+    entry->data = NULL;
+  }
+}
+
+static void pngDedupAdd(pngQueue* queue, int index)
+{
+  pngEntry* entry = queue->entries + index;
+  int bucket = (int)(entry->hash % PNG_HASH_SIZE);
+
+  if (entry->data_size > PNG_DEDUP_BYTES)
+    return;
+
+  /* remove the least recently used images */
+  while (queue->lru_last >= 0 && queue->dedup_bytes + entry->data_size > PNG_DEDUP_BYTES)
+    pngDedupRemove(queue, queue->lru_last);
+
+  entry->hash_next = queue->buckets[bucket];
+  queue->buckets[bucket] = index;
+  pngLruAddFirst(queue, index);
+
+  queue->dedup_bytes += entry->data_size;
+  entry->dedup = 1;
+}
+
+static int pngDedupFind(pngQueue* queue, unsigned long long hash, const unsigned char* data, size_t data_size, int w, int h, int colortype)
+{
+  int index = queue->buckets[hash % PNG_HASH_SIZE];
+
+  while (index >= 0)
+  {
+    pngEntry* entry = queue->entries + index;
+    if (entry->hash == hash && entry->w == w && entry->h == h && entry->colortype == colortype &&
+        memcmp(entry->data, data, data_size) == 0)
+    {
+      pngLruRemove(queue, index);
+      pngLruAddFirst(queue, index);
+      return index;
+    }
+
+    index = entry->hash_next;
+  }
+
+  return -1;
+}
+
+static unsigned pngZlibCompress(unsigned char** out, size_t* outsize, const unsigned char* in, size_t insize, const LodePNGCompressSettings* settings)
+{
+  int level = *(const int*)settings->custom_context;
+  uLongf size = compressBound((uLong)insize);
+
+  *out = (unsigned char*)malloc(size);
+  if (!*out)
+    return 83; /* lodepng alloc error */
+
+  if (compress2(*out, &size, in, (uLong)insize, level) != Z_OK)
+  {
+    free(*out);
+    *out = NULL;
+    return 83;
+  }
+
+  *outsize = size;
+  return 0;
+}
+
+static void pngEncodeJob(pngQueue* queue, pngJob* job)
+{
+  LodePNGState state;
+  unsigned char* buffer = NULL;
+  size_t size = 0;
+
+  lodepng_state_init(&state);
+  state.info_raw.colortype = (LodePNGColorType)job->colortype;
+  state.info_raw.bitdepth = 8;
+
+  if (job->level >= 0)
+  {
+    /* use zlib deflate, it is much faster than the lodepng built-in encoder */
+    state.encoder.zlibsettings.custom_zlib = pngZlibCompress;
+    state.encoder.zlibsettings.custom_context = &job->level;
+
+    if (job->level <= 3)
+    {
+      /* favor speed, skip the color analysis and the filter heuristic */
+      state.encoder.auto_convert = 0;
+      state.encoder.filter_strategy = LFS_ZERO;
+      state.info_png.color.colortype = (LodePNGColorType)job->colortype;
+      state.info_png.color.bitdepth = 8;
+    }
+  }
+
+  if (lodepng_encode(&buffer, &size, job->data, job->w, job->h, &state) != 0 && job->level >= 0)
+  {
+    /* try again with the lodepng defaults */
+    lodepng_state_cleanup(&state);
+    lodepng_state_init(&state);
+    state.info_raw.colortype = (LodePNGColorType)job->colortype;
+    state.info_raw.bitdepth = 8;
+
+    free(buffer);
+    buffer = NULL;
+    size = 0;
+    lodepng_encode(&buffer, &size, job->data, job->w, job->h, &state);
+  }
+  lodepng_state_cleanup(&state);
+
+  if (job->filename)
+  {
+    if (buffer)
+      lodepng_save_file(buffer, size, job->filename);
+    free(buffer);
+    buffer = NULL;
+    size = 0;
+  }
+
+  pngMutexLock(&queue->mutex);
+  {
+    pngEntry* entry = queue->entries + job->index;
+    entry->buffer = buffer;
+    entry->size = size;
+
+    /* the raw image is kept only while it can be compared with new images */
+    entry->encoding = 0;
+    if (!entry->dedup)
+    {
+      free(entry->data);
+      entry->data = NULL;
+    }
+  }
+  pngMutexUnlock(&queue->mutex);
+
+  if (job->filename)
+    free(job->filename);
+  free(job);
+}
+
+#ifdef WIN32
+static DWORD WINAPI pngThreadFunc(LPVOID param)
+#else
+static void* pngThreadFunc(void* param)
+#endif
+{
+  pngQueue* queue = (pngQueue*)param;
+
+  pngMutexLock(&queue->mutex);
+  for (;;)
+  {
+    pngJob* job;
+
+    while (!queue->first && !queue->quit)
+      pngCondWait(&queue->has_job, &queue->mutex);
+
+    if (!queue->first)  /* quit and nothing left */
+      break;
+
+    job = queue->first;
+    queue->first = job->next;
+    if (!queue->first)
+      queue->last = NULL;
+    queue->queued--;
+    pngMutexUnlock(&queue->mutex);
+
+    pngEncodeJob(queue, job);
+
+    pngMutexLock(&queue->mutex);
+    queue->pending--;
+    pngCondBroadcast(&queue->job_done);
+  }
+  pngMutexUnlock(&queue->mutex);
+
+  return 0;
+}
+
+static void pngStartThreads(pngQueue* queue, int num_threads)
+{
+  int i;
+
+  if (num_threads < 0) num_threads = 0;
+  if (num_threads > PNG_MAX_THREADS) num_threads = PNG_MAX_THREADS;
+
+  queue->quit = 0;
+
+  for (i = 0; i < num_threads; i++)
+  {
+#ifdef WIN32
+    queue->threads[i] = CreateThread(NULL, 0, pngThreadFunc, queue, 0, NULL);
+    if (!queue->threads[i])
+      break;
+#else
+    if (pthread_create(&queue->threads[i], NULL, pngThreadFunc, queue) != 0)
+      break;
+#endif
+  }
+
+  queue->num_threads = i;
+}
+
+static void pngStopThreads(pngQueue* queue)
+{
+  int i;
+
+  pngMutexLock(&queue->mutex);
+  queue->quit = 1;
+  pngCondBroadcast(&queue->has_job);
+  pngMutexUnlock(&queue->mutex);
+
+  /* threads will finish the remaining jobs before leaving */
+  for (i = 0; i < queue->num_threads; i++)
+  {
+#ifdef WIN32
+    WaitForSingleObject(queue->threads[i], INFINITE);
+    CloseHandle(queue->threads[i]);
+#else
+    pthread_join(queue->threads[i], NULL);
+#endif
+  }
+
+  queue->num_threads = 0;
+}
+
+pngQueue* pngQueueCreate(int num_threads)
+{
+  int i;
+  pngQueue* queue = (pngQueue*)calloc(1, sizeof(pngQueue));
+  if (!queue)
+    return NULL;
+
+  queue->level = -1;
+  queue->lru_first = -1;
+  queue->lru_last = -1;
+  for (i = 0; i < PNG_HASH_SIZE; i++)
+    queue->buckets[i] = -1;
+
+  pngMutexInit(&queue->mutex);
+  pngCondInit(&queue->has_job);
+  pngCondInit(&queue->job_done);
+
+  pngStartThreads(queue, num_threads);
+
+  return queue;
+}
+
+void pngQueueKill(pngQueue* queue)
+{
+  int i;
+
+  pngStopThreads(queue);
+
+  pngMutexDestroy(&queue->mutex);
+  pngCondDestroy(&queue->has_job);
+  pngCondDestroy(&queue->job_done);
+
+  for (i = 0; i < queue->entry_count; i++)
+  {
+    if (queue->entries[i].buffer)
+      free(queue->entries[i].buffer);
+    if (queue->entries[i].data)
+      free(queue->entries[i].data);
+  }
+  if (queue->entries)
+    free(queue->entries);
+
+  free(queue);
+}
+
+void pngQueueSetThreads(pngQueue* queue, int num_threads)
+{
+  pngStopThreads(queue);
+  pngStartThreads(queue, num_threads);
+}
+
+int pngQueueGetThreads(pngQueue* queue)
+{
+  return queue->num_threads;
+}
+
+void pngQueueSetCompression(pngQueue* queue, int level)
+{
+  if (level < -1) level = -1;
+  if (level > 9) level = 9;
+  queue->level = level;
+}
+
+int pngQueueGetCompression(pngQueue* queue)
+{
+  return queue->level;
+}
+
+int pngQueueEncode(pngQueue* queue, unsigned char* data, int w, int h, int colortype, const char* filename)
+{
+  pngJob* job;
+  pngEntry* entry;
+  unsigned long long hash;
+  size_t data_size = (size_t)w * h * (colortype == LCT_RGBA ? 4 : 3);
+  int index;
+
+  hash = pngHash(data, data_size);
+
+  pngMutexLock(&queue->mutex);
+  index = pngDedupFind(queue, hash, data, data_size, w, h, colortype);
+  pngMutexUnlock(&queue->mutex);
+  if (index >= 0)
+  {
+    free(data);
+    return index;
+  }
+
+  job = (pngJob*)malloc(sizeof(pngJob));
+  if (!job)
+  {
+    free(data);
+    return -1;
+  }
+
+  pngMutexLock(&queue->mutex);
+
+  if (queue->entry_count == queue->entry_size)
+  {
+    int new_size = queue->entry_size + 32;
+    pngEntry* new_entries = (pngEntry*)realloc(queue->entries, new_size * sizeof(pngEntry));
+    if (!new_entries)
+    {
+      pngMutexUnlock(&queue->mutex);
+      free(job);
+      free(data);
+      return -1;
+    }
+    queue->entries = new_entries;
+    queue->entry_size = new_size;
+  }
+
+  index = queue->entry_count;
+  entry = queue->entries + index;
+  memset(entry, 0, sizeof(pngEntry));
+  entry->hash = hash;
+  entry->w = w;
+  entry->h = h;
+  entry->colortype = colortype;
+  entry->data = data;
+  entry->data_size = data_size;
+  entry->encoding = 1;
+  queue->entry_count++;
+
+  pngDedupAdd(queue, index);
+
+  pngMutexUnlock(&queue->mutex);
+
+  job->index = index;
+  job->w = w;
+  job->h = h;
+  job->colortype = colortype;
+  job->level = queue->level;
+  job->data = data;
+  job->filename = NULL;
+  if (filename)
+  {
+    job->filename = (char*)malloc(strlen(filename) + 1);
+    strcpy(job->filename, filename);
+  }
+  job->next = NULL;
+
+  if (queue->num_threads == 0)
+  {
+    pngEncodeJob(queue, job);
+    return index;
+  }
+
+  pngMutexLock(&queue->mutex);
+
+  /* bound the memory used by raw images waiting to be encoded */
+  while (queue->queued >= 2 * queue->num_threads)
+    pngCondWait(&queue->job_done, &queue->mutex);
+
+  if (queue->last)
+    queue->last->next = job;
+  else
+    queue->first = job;
+  queue->last = job;
+  queue->queued++;
+  queue->pending++;
+
+  pngCondSignal(&queue->has_job);
+  pngMutexUnlock(&queue->mutex);
+
+  return index;
+}
+
+int pngQueueCount(pngQueue* queue)
+{
+  return queue->entry_count;
+}
+
+void pngQueueWait(pngQueue* queue)
+{
+  pngMutexLock(&queue->mutex);
+  while (queue->pending > 0)
+    pngCondWait(&queue->job_done, &queue->mutex);
+  pngMutexUnlock(&queue->mutex);
+}
+
+unsigned char* pngQueueGetBuffer(pngQueue* queue, int index, size_t *size)
+{
+  if (index < 0 || index >= queue->entry_count)
+    return NULL;
+
+  *size = queue->entries[index].size;
+  return queue->entries[index].buffer;
+}
+
+void pngQueueReleaseBuffer(pngQueue* queue, int index)
+{
+  pngEntry* entry;
+
+  if (index < 0 || index >= queue->entry_count)
+    return;
+
+  pngMutexLock(&queue->mutex);
+  entry = queue->entries + index;
+
+  /* without the encoded PNG it can not be reused */
+  if (entry->dedup)
+    pngDedupRemove(queue, index);
+
+  if (entry->buffer)
+  {
+    free(entry->buffer);
+    entry->buffer = NULL;
+    entry->size = 0;
+  }
+  pngMutexUnlock(&queue->mutex);
+}
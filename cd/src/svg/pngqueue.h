@@ -0,0 +1,57 @@
+/** \file
+ * \brief PNG encoding queue, used by the SVG and PPTX drivers
+ *
+ * See Copyright Notice in cd.h
+ */
+
+#ifndef __PNGQUEUE_H
+#define __PNGQUEUE_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _pngQueue pngQueue;
+
+/* num_threads=0 encodes synchronously in the caller thread. */
+pngQueue* pngQueueCreate(int num_threads);
+void pngQueueKill(pngQueue* queue);
+
+/* Waits for pending encodes, then restarts the pool with the new number of threads. */
+void pngQueueSetThreads(pngQueue* queue, int num_threads);
+int pngQueueGetThreads(pngQueue* queue);
+
+/* -1=lodepng default, 0=no compression, 1=fastest ... 9=smallest */
+void pngQueueSetCompression(pngQueue* queue, int level);
+int pngQueueGetCompression(pngQueue* queue);
+
+/* Queues an image for encoding. Takes ownership of data, that must be allocated with malloc.
+   colortype is LCT_RGB or LCT_RGBA. If filename is NULL the PNG is kept in memory
+   and can be retrieved with pngQueueGetBuffer after pngQueueWait.
+   Returns the index of the image. When an identical image was already queued
+   its index is returned and nothing is encoded, so indices are always sequential for new images.
+   Only the most recently used images, up to 32Mb of raw data, are compared with the new images,
+   the data of the others is freed after encoded. */
+int pngQueueEncode(pngQueue* queue, unsigned char* data, int w, int h, int colortype, const char* filename);
+
+/* Number of different images queued so far. */
+int pngQueueCount(pngQueue* queue);
+
+/* Blocks until all queued images are encoded. */
+void pngQueueWait(pngQueue* queue);
+
+/* Returns the encoded PNG of an image queued without a filename. Valid until pngQueueKill.
+   Returns NULL if the image could not be encoded. */
+unsigned char* pngQueueGetBuffer(pngQueue* queue, int index, size_t *size);
+
+/* Frees the encoded PNG of an image queued without a filename, after it was written.
+   The image will not be reused for new identical images. */
+void pngQueueReleaseBuffer(pngQueue* queue, int index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -15,6 +15,13 @@
 
 #include <X11/Xproto.h>
 
+#ifdef USE_XSHM
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/extensions/XShm.h>
+#include <X11/extensions/shmproto.h>
+#endif
+
 unsigned long (*cdxGetPixel)(cdCtxCanvas *ctxcanvas, unsigned long rgb); /* acesso a tabela de cores */
 void (*cdxGetRGB)(cdCtxCanvas *ctxcanvas, unsigned long pixel, 
                                           unsigned char* red, 
@@ -24,6 +31,20 @@ static XGCValues gcval;
 
 static int cdxDirectColorTable[256];    /* used with directColor visuals */
 
+#ifdef USE_XSHM
+struct _cdxShm
+{
+  int enabled;
+  XShmSegmentInfo put_info;   /* pixels of the images being drawn */
+  XShmSegmentInfo get_info;   /* pixels read from the drawable */
+  int put_size, get_size;     /* 0 if not attached */
+  int put_pending;            /* the server may be still reading put_info */
+};
+
+static int cdxShmOpcode = 0;
+static int cdxShmError = 0;
+#endif
+
 #define NUM_HATCHES  6
 #define HATCH_WIDTH  8
 #define HATCH_HEIGHT 8
@@ -56,6 +77,12 @@ static int cdxErrorHandler(Display* dpy, XErrorEvent *err)
   if (err->request_code==X_FreeColors && err->error_code==BadAccess)
     return 0;
 
+#ifdef USE_XSHM
+  /* same as XGetImage */
+  if (cdxShmOpcode && err->request_code==cdxShmOpcode && err->minor_code==X_ShmGetImage && err->error_code==BadMatch)
+    return 0;
+#endif
+
   XGetErrorText(dpy, err->error_code, msg, 80);
   fprintf(stderr,"X Error of failed request %d: %s\n", err->request_code, msg);
 
@@ -65,34 +92,27 @@ static int cdxErrorHandler(Display* dpy, XErrorEvent *err)
 static void update_colors(cdCtxCanvas *ctxcanvas)
 {
   XQueryColors(ctxcanvas->dpy, ctxcanvas->colormap, ctxcanvas->color_table, ctxcanvas->num_colors);
+  ctxcanvas->imap_valid = 0;
 }
 
 static int find_color(cdCtxCanvas *ctxcanvas, XColor* xc1)
 {
-  int pos = 0, i;
-  unsigned long min_dist = ULONG_MAX, /* just a very big value */
-    this_dist;
-  int dr, dg, db;
-  XColor* xc2;
-
-  for (i=0; i<ctxcanvas->num_colors; i++)
+  if (!ctxcanvas->imap_valid)
   {
-    xc2 = &(ctxcanvas->color_table[i]);
-    
-    dr = (xc1->red   - xc2->red) / 850;       /* 0.30 / 255 */
-    dg = (xc1->green - xc2->green) / 432;     /* 0.59 / 255 */
-    db = (xc1->blue  - xc2->blue) /  2318;    /* 0.11 / 255 */
-    
-    this_dist = dr*dr + dg*dg + db*db;
-    
-    if (this_dist < min_dist)
+    long palette[256];
+    int i;
+
+    for (i=0; i<ctxcanvas->num_colors; i++)
     {
-      min_dist = this_dist;            
-      pos = i;                          
+      XColor* xc2 = &(ctxcanvas->color_table[i]);
+      palette[i] = cdEncodeColor(cdCOLOR16TO8(xc2->red), cdCOLOR16TO8(xc2->green), cdCOLOR16TO8(xc2->blue));
     }
+
+    cdInverseMapSetPalette(ctxcanvas->imap, ctxcanvas->num_colors, palette);
+    ctxcanvas->imap_valid = 1;
   }
 
-  return pos;
+  return cdInverseMapFind(ctxcanvas->imap, cdEncodeColor(cdCOLOR16TO8(xc1->red), cdCOLOR16TO8(xc1->green), cdCOLOR16TO8(xc1->blue)));
 }
 
 /* Busca o RGB mais proximo na tabela de cores */
@@ -154,6 +174,10 @@ static unsigned long not_truecolor_get_pixel(cdCtxCanvas *ctxcanvas, unsigned lo
   {
     /* ja' estava disponivel */
     /* atualizo a tabela de cores */
+    XColor* old_xc = &(ctxcanvas->color_table[xc.pixel]);
+    if (old_xc->red != xc.red || old_xc->green != xc.green || old_xc->blue != xc.blue)
+      ctxcanvas->imap_valid = 0;
+
     ctxcanvas->color_table[xc.pixel] = xc;
     pixel = xc.pixel;
   }
@@ -307,6 +331,184 @@ static void makeDirectCmap(cdCtxCanvas *ctxcanvas, Colormap cmap)
   }
 }
 
+/******************************************************/
+/* MIT-SHM, images are transfered using shared memory when the X server is local */
+
+#ifdef USE_XSHM
+static int cdxShmErrorHandler(Display* dpy, XErrorEvent *err)
+{
+  (void)dpy;
+  (void)err;
+  cdxShmError = 1;
+  return 0;
+}
+
+static void cdxShmFreeSegment(Display* dpy, XShmSegmentInfo* info, int *size)
+{
+  if (*size)
+  {
+    XShmDetach(dpy, info);
+    shmdt(info->shmaddr);
+    *size = 0;
+  }
+}
+
+static void cdxShmFree(cdCtxCanvas *ctxcanvas)
+{
+  cdxShm* shm = ctxcanvas->shm;
+
+  /* make sure the server is not using the segments */
+  XSync(ctxcanvas->dpy, False);
+  shm->put_pending = 0;
+
+  cdxShmFreeSegment(ctxcanvas->dpy, &shm->put_info, &shm->put_size);
+  cdxShmFreeSegment(ctxcanvas->dpy, &shm->get_info, &shm->get_size);
+}
+
+/* Makes sure the segment has at least size bytes. 
+   Returns 0 if failed, and disables MIT-SHM if the server can not attach it. */
+static int cdxShmAllocSegment(cdCtxCanvas *ctxcanvas, XShmSegmentInfo* info, int *size, int new_size)
+{
+  int (*old_handler)(Display*, XErrorEvent*);
+  cdxShm* shm = ctxcanvas->shm;
+
+  if (*size >= new_size)
+    return 1;
+
+  if (*size)
+  {
+    XSync(ctxcanvas->dpy, False);  /* the server may be using the old segment */
+    shm->put_pending = 0;
+    cdxShmFreeSegment(ctxcanvas->dpy, info, size);
+  }
+
+  new_size = (new_size + 0xFFFF) & ~0xFFFF;  /* avoid too many re-allocations */
+
+  info->shmid = shmget(IPC_PRIVATE, new_size, IPC_CREAT | 0600);
+  if (info->shmid < 0)
+    return 0;
+
+  info->shmaddr = (char*)shmat(info->shmid, NULL, 0);
+  if (info->shmaddr == (char*)-1)
+  {
+    shmctl(info->shmid, IPC_RMID, NULL);
+    return 0;
+  }
+  info->readOnly = False;
+
+  /* attach fails when the server is not in the same machine */
+  cdxShmError = 0;
+  old_handler = XSetErrorHandler(cdxShmErrorHandler);
+  XShmAttach(ctxcanvas->dpy, info);
+  XSync(ctxcanvas->dpy, False);
+  XSetErrorHandler(old_handler);
+
+  /* the segment will be destroyed when both client and server detach it */
+  shmctl(info->shmid, IPC_RMID, NULL);
+
+  if (cdxShmError)
+  {
+    shmdt(info->shmaddr);
+    shm->enabled = 0;
+    return 0;
+  }
+
+  *size = new_size;
+  return 1;
+}
+
+static char* cdxShmGetPutBuffer(cdCtxCanvas *ctxcanvas, int size)
+{
+  cdxShm* shm = ctxcanvas->shm;
+
+  if (!shm || !shm->enabled)
+    return NULL;
+
+  if (shm->put_pending)
+  {
+    /* wait until the server finishes reading the previous image */
+    XSync(ctxcanvas->dpy, False);
+    shm->put_pending = 0;
+  }
+
+  if (!cdxShmAllocSegment(ctxcanvas, &shm->put_info, &shm->put_size, size))
+    return NULL;
+
+  return shm->put_info.shmaddr;
+}
+
+static int cdxShmPutImage(cdCtxCanvas *ctxcanvas, XImage* xi, int x, int y, int w, int h)
+{
+  cdxShm* shm = ctxcanvas->shm;
+
+  if (!shm || !shm->put_size || xi->data != shm->put_info.shmaddr)
+    return 0;
+
+  /* the server will use its own scanline layout */
+  if (xi->byte_order != ImageByteOrder(ctxcanvas->dpy) ||
+      xi->bytes_per_line != ((xi->width * xi->bits_per_pixel + 31) / 32) * 4)
+    return 0;
+
+  xi->obdata = (char*)&shm->put_info;
+  XShmPutImage(ctxcanvas->dpy, ctxcanvas->wnd, ctxcanvas->gc, xi, 0, 0, x, y, w, h, False);
+  xi->obdata = NULL;
+
+  shm->put_pending = 1;
+  return 1;
+}
+
+static XImage* cdxShmGetImage(cdCtxCanvas *ctxcanvas, int x, int y, int w, int h)
+{
+  cdxShm* shm = ctxcanvas->shm;
+  XImage* xi;
+
+  if (!shm || !shm->enabled)
+    return NULL;
+
+  xi = XShmCreateImage(ctxcanvas->dpy, ctxcanvas->vis, ctxcanvas->depth, ZPixmap, NULL, &shm->get_info, w, h);
+  if (!xi)
+    return NULL;
+
+  if (!cdxShmAllocSegment(ctxcanvas, &shm->get_info, &shm->get_size, xi->bytes_per_line * h))
+  {
+    XDestroyImage(xi);
+    return NULL;
+  }
+
+  xi->data = shm->get_info.shmaddr;
+
+  if (!XShmGetImage(ctxcanvas->dpy, ctxcanvas->wnd, xi, x, y, AllPlanes))
+  {
+    XDestroyImage(xi);
+    return NULL;
+  }
+
+  /* XDestroyImage will not free the data */
+  return xi;
+}
+#endif
+
+static void cdxPutImage(cdCtxCanvas *ctxcanvas, XImage* xi, int x, int y, int w, int h)
+{
+#ifdef USE_XSHM
+  if (cdxShmPutImage(ctxcanvas, xi, x, y, w, h))
+    return;
+#endif
+
+  XPutImage(ctxcanvas->dpy, ctxcanvas->wnd, ctxcanvas->gc, xi, 0, 0, x, y, w, h);
+}
+
+static XImage* cdxGetImage(cdCtxCanvas *ctxcanvas, int x, int y, int w, int h)
+{
+#ifdef USE_XSHM
+  XImage* xi = cdxShmGetImage(ctxcanvas, x, y, w, h);
+  if (xi)
+    return xi;
+#endif
+
+  return XGetImage(ctxcanvas->dpy, ctxcanvas->wnd, x, y, w, h, ULONG_MAX, ZPixmap);
+}
+
 /******************************************************/
 
 void cdxKillCanvas(cdCtxCanvas *ctxcanvas)
@@ -322,9 +524,18 @@ void cdxKillCanvas(cdCtxCanvas *ctxcanvas)
 
     if (ctxcanvas->colormap != DefaultColormap(ctxcanvas->dpy, ctxcanvas->scr))
       XFreeColormap(ctxcanvas->dpy, ctxcanvas->colormap);
+
+    cdInverseMapKill(ctxcanvas->imap);
   }
  
   if (ctxcanvas->xidata) free(ctxcanvas->xidata);
+#ifdef USE_XSHM
+  if (ctxcanvas->shm)
+  {
+    cdxShmFree(ctxcanvas);
+    free(ctxcanvas->shm);
+  }
+#endif
   if (ctxcanvas->font) XFreeFont(ctxcanvas->dpy, ctxcanvas->font);
   if (ctxcanvas->last_hatch) XFreePixmap(ctxcanvas->dpy, ctxcanvas->last_hatch);
   if (ctxcanvas->clip_polygon) XFreePixmap(ctxcanvas->dpy, ctxcanvas->clip_polygon);
@@ -686,20 +897,19 @@ static void cdstipple(cdCtxCanvas *ctxcanvas, int w, int h, const unsigned char
   cdinteriorstyle(ctxcanvas, CD_STIPPLE);
 }
 
-static int find_match(unsigned long* palette, int pal_size, unsigned long color, unsigned char *match)
+#define CDX_MATCH_HASH 1024  /* must be a power of 2 greater than 256 */
+
+/* returns the hash position of the color, or the empty position where it must be inserted.
+   hash contains the palette index plus 1, 0 if empty. */
+static int find_match(unsigned long* palette, short* hash, unsigned long color)
 {
-  int i;
+  unsigned long h = color & 0xFFFFFF;
+  h = ((h * 2654435761UL) >> 12) & (CDX_MATCH_HASH - 1);
 
-  for (i=0;i<pal_size;i++)
-  {
-    if (palette[i] == color)
-    {
-      *match = (unsigned char)i;
-      return 1;
-    }
-  }
+  while (hash[h] && palette[hash[h] - 1] != color)
+    h = (h + 1) & (CDX_MATCH_HASH - 1);
 
-  return 0;
+  return (int)h;
 }
 
 static void cdpattern(cdCtxCanvas *ctxcanvas, int w, int h, const long int *colors)
@@ -729,24 +939,27 @@ static void cdpattern(cdCtxCanvas *ctxcanvas, int w, int h, const long int *colo
   {
     long int match_table[256];    /* X  colors */
     unsigned long palette[256];   /* CD colors */
-    unsigned char *index = (unsigned char*)malloc(size), match;
-    int pal_size = 1;
-    palette[0] = colors[0];
+    short hash[CDX_MATCH_HASH];
+    unsigned char *index = (unsigned char*)malloc(size);
+    int pal_size = 0, count, h;
+
+    memset(hash, 0, sizeof(hash));
 
     /* encontra as n primeiras cores diferentes da imagem (ate 256) */
-    for(i=0;i<size;i++)
+    for(count=0;count<size;count++)
     {
-      if (!find_match(palette, pal_size, colors[i], &match))
+      h = find_match(palette, hash, (unsigned long)colors[count]);
+      if (!hash[h])
       {
-         palette[pal_size] = colors[i];
-         index[i] = (unsigned char)pal_size;
-         pal_size++;
+        if (pal_size == 256)
+          break;
 
-         if (pal_size == 256)
-           break;
+        palette[pal_size] = (unsigned long)colors[count];
+        pal_size++;
+        hash[h] = (short)pal_size;
       }
-      else
-        index[i] = match;
+
+      index[count] = (unsigned char)(hash[h] - 1);
     }
 
     /* de cores do CD para cores do X */
@@ -754,9 +967,13 @@ static void cdpattern(cdCtxCanvas *ctxcanvas, int w, int h, const long int *colo
       match_table[i] = cdxGetPixel(ctxcanvas, palette[i]);
 
     /* de imagem do CD para imagem do X */
-    for(i=0;i<size;i++)
+    for(i=0;i<count;i++)
       pixels[i] = match_table[index[i]];
 
+    /* cores alem das 256 primeiras */
+    for(i=count;i<size;i++)
+      pixels[i] = cdxGetPixel(ctxcanvas, colors[i]);
+
     free(index);
   }
   else
@@ -1416,23 +1633,142 @@ static int byte_order(void)
   return (uc[0]==0xFF) ? MSBFirst : LSBFirst;
 }
 
+/* Channel values of TrueColor pixels, 
+   to convert whole lines without calling XGetPixel and cdxGetRGB for each pixel. */
+typedef struct _cdxPixelDecoder
+{
+  int valid;     /* 0 if the line must be converted by XGetPixel and cdxGetRGB */
+  int swap;      /* image byte order is not the same of the machine */
+  unsigned long rmask, gmask, bmask;
+  int rlow, glow, blow;
+  unsigned char red[256], green[256], blue[256];
+} cdxPixelDecoder;
+
+static int lowbit(unsigned long ul)
+{
+  int i;
+  if (!ul) return -1;
+  for (i = 0; (ul & 1) == 0; i++, ul >>= 1);
+  return i;
+}
+
+static void cdxInitPixelDecoder(cdCtxCanvas *ctxcanvas, XImage* xi, cdxPixelDecoder* dec)
+{
+  unsigned char dummy;
+  int v, rbits, gbits, bbits;
+
+  dec->valid = 0;
+
+  /* only the TrueColor conversion is known here */
+  if (cdxGetRGB != truecolor_get_rgb || xi->format != ZPixmap ||
+      (xi->bits_per_pixel != 16 && xi->bits_per_pixel != 24 && xi->bits_per_pixel != 32))
+    return;
+
+  dec->rmask = ctxcanvas->vis->red_mask;
+  dec->gmask = ctxcanvas->vis->green_mask;
+  dec->bmask = ctxcanvas->vis->blue_mask;
+  dec->rlow = lowbit(dec->rmask);
+  dec->glow = lowbit(dec->gmask);
+  dec->blow = lowbit(dec->bmask);
+  rbits = highbit(dec->rmask) - dec->rlow + 1;
+  gbits = highbit(dec->gmask) - dec->glow + 1;
+  bbits = highbit(dec->bmask) - dec->blow + 1;
+
+  if (dec->rlow < 0 || dec->glow < 0 || dec->blow < 0 || rbits > 8 || gbits > 8 || bbits > 8)
+    return;
+
+  /* use the same conversion of cdxGetRGB */
+  for (v = 0; v < (1 << rbits); v++)
+    truecolor_get_rgb(ctxcanvas, (unsigned long)v << dec->rlow, dec->red + v, &dummy, &dummy);
+  for (v = 0; v < (1 << gbits); v++)
+    truecolor_get_rgb(ctxcanvas, (unsigned long)v << dec->glow, &dummy, dec->green + v, &dummy);
+  for (v = 0; v < (1 << bbits); v++)
+    truecolor_get_rgb(ctxcanvas, (unsigned long)v << dec->blow, &dummy, &dummy, dec->blue + v);
+
+  dec->swap = (xi->byte_order != byte_order());
+  dec->valid = 1;
+}
+
+#define CDX_DECODE_PIXEL(_pixel)                           \
+{                                                          \
+  r[col] = dec->red[(_pixel & dec->rmask) >> dec->rlow];   \
+  g[col] = dec->green[(_pixel & dec->gmask) >> dec->glow]; \
+  b[col] = dec->blue[(_pixel & dec->bmask) >> dec->blow];  \
+}
+
+/* Converts line lin of the image to RGB. */
+static void cdxGetImageLineRGB(cdCtxCanvas *ctxcanvas, cdxPixelDecoder* dec, XImage* xi, int lin, int w, unsigned char *r, unsigned char *g, unsigned char *b)
+{
+  const unsigned char* line = (const unsigned char*)xi->data + lin * xi->bytes_per_line;
+  int col;
+
+  if (!dec->valid)
+  {
+    for (col = 0; col < w; col++)
+      cdxGetRGB(ctxcanvas, XGetPixel(xi, col, lin), r + col, g + col, b + col);
+    return;
+  }
+
+  switch (xi->bits_per_pixel)
+  {
+  case 32:
+    for (col = 0; col < w; col++, line += 4)
+    {
+      unsigned int pixel;
+      memcpy(&pixel, line, 4);
+      if (dec->swap)
+        pixel = (pixel >> 24) | ((pixel >> 8) & 0xFF00) | ((pixel << 8) & 0xFF0000) | (pixel << 24);
+      CDX_DECODE_PIXEL(pixel);
+    }
+    break;
+  case 24:
+    if (xi->byte_order == MSBFirst)
+    {
+      for (col = 0; col < w; col++, line += 3)
+      {
+        unsigned int pixel = ((unsigned int)line[0] << 16) | ((unsigned int)line[1] << 8) | line[2];
+        CDX_DECODE_PIXEL(pixel);
+      }
+    }
+    else
+    {
+      for (col = 0; col < w; col++, line += 3)
+      {
+        unsigned int pixel = ((unsigned int)line[2] << 16) | ((unsigned int)line[1] << 8) | line[0];
+        CDX_DECODE_PIXEL(pixel);
+      }
+    }
+    break;
+  case 16:
+    for (col = 0; col < w; col++, line += 2)
+    {
+      unsigned short pixel;
+      memcpy(&pixel, line, 2);
+      if (dec->swap)
+        pixel = (unsigned short)((pixel >> 8) | (pixel << 8));
+      CDX_DECODE_PIXEL(pixel);
+    }
+    break;
+  }
+}
+
 static void cdgetimagergb(cdCtxCanvas *ctxcanvas, unsigned char *r, unsigned char *g, unsigned char *b, int x, int y, int w, int h)
 {
-  int col, lin, pos;
-  XImage *xi = XGetImage(ctxcanvas->dpy, ctxcanvas->wnd, x, y-h+1, w, h, ULONG_MAX, ZPixmap);
+  int lin, pos;
+  cdxPixelDecoder dec;
+  XImage *xi = cdxGetImage(ctxcanvas, x, y-h+1, w, h);
   if (!xi)
   {
     fprintf(stderr, "CanvasDraw: error getting image\n");
     return;
   }
+
+  cdxInitPixelDecoder(ctxcanvas, xi, &dec);
   
   for (lin=0; lin<h; lin++)
   {
-    for (col=0; col<w; col++)
-    {
-      pos = (h-lin-1)*w+col;
-      cdxGetRGB(ctxcanvas, XGetPixel(xi, col, lin), r+pos, g+pos, b+pos);
-    }
+    pos = (h-lin-1)*w;
+    cdxGetImageLineRGB(ctxcanvas, &dec, xi, lin, w, r+pos, g+pos, b+pos);
   }
   
   XDestroyImage(xi);
@@ -1440,6 +1776,12 @@ static void cdgetimagergb(cdCtxCanvas *ctxcanvas, unsigned char *r, unsigned cha
 
 static long int* get_data_buffer(cdCtxCanvas *ctxcanvas, int size)
 {
+#ifdef USE_XSHM
+  char* shm_data = cdxShmGetPutBuffer(ctxcanvas, size);
+  if (shm_data)
+    return (long int*)shm_data;
+#endif
+
   if (!ctxcanvas->xidata)
   {
     ctxcanvas->xisize = size;
@@ -1457,11 +1799,79 @@ static long int* get_data_buffer(cdCtxCanvas *ctxcanvas, int size)
   return ctxcanvas->xidata;
 }
   
+/* Stores a line of pixels in the image format.
+   The loops are simple enough for the compiler to vectorize them. */
+static void cdxSetImageLine(XImage* xim, unsigned char* line_data, const unsigned long* pixels, int w)
+{
+  int j, swap = (xim->byte_order != byte_order());
+
+  switch (xim->bits_per_pixel)
+  {
+  case 32:
+    {
+      unsigned int* line32 = (unsigned int*)line_data;
+      if (swap)
+      {
+        for (j=0; j<w; j++)
+        {
+          unsigned int p = (unsigned int)pixels[j];
+          line32[j] = (p >> 24) | ((p >> 8) & 0xff00) | ((p << 8) & 0xff0000) | (p << 24);
+        }
+      }
+      else
+      {
+        for (j=0; j<w; j++)
+          line32[j] = (unsigned int)pixels[j];
+      }
+    }
+    break;
+  case 24:
+    if (xim->byte_order == MSBFirst)
+    {
+      for (j=0; j<w; j++, line_data += 3)
+      {
+        line_data[0] = (unsigned char)(pixels[j] >> 16);
+        line_data[1] = (unsigned char)(pixels[j] >> 8);
+        line_data[2] = (unsigned char)(pixels[j]);
+      }
+    }
+    else
+    {
+      for (j=0; j<w; j++, line_data += 3)
+      {
+        line_data[0] = (unsigned char)(pixels[j]);
+        line_data[1] = (unsigned char)(pixels[j] >> 8);
+        line_data[2] = (unsigned char)(pixels[j] >> 16);
+      }
+    }
+    break;
+  case 16:
+    {
+      unsigned short* line16 = (unsigned short*)line_data;
+      if (swap)
+      {
+        for (j=0; j<w; j++)
+          line16[j] = (unsigned short)(((pixels[j] >> 8) & 0xff) | ((pixels[j] & 0xff) << 8));
+      }
+      else
+      {
+        for (j=0; j<w; j++)
+          line16[j] = (unsigned short)pixels[j];
+      }
+    }
+    break;
+  case 8:
+    for (j=0; j<w; j++)
+      line_data[j] = (unsigned char)pixels[j];
+    break;
+  }
+}
+
 static XImage *cdxCreateXImageMap(cdCtxCanvas *ctxcanvas, int ew, int eh, const unsigned char *index, const long int * colors, int by, int bx, int bw, int bh, int iw)
 {
   long int match_table[256];
   int i, j, pal_size;
-  unsigned long xcol;
+  unsigned long *pixels;
   XImage *xim;
   int *fx, *fy, src, dst;
   unsigned char idx;
@@ -1534,7 +1944,6 @@ static XImage *cdxCreateXImageMap(cdCtxCanvas *ctxcanvas, int ew, int eh, const
   case 16: 
     {
       unsigned char *imagedata;
-      unsigned short *line_data;
     
       /* Now get the image data - pad each scanline as necessary */
       imagedata = (unsigned char*)get_data_buffer(ctxcanvas, 2*ew*eh);
@@ -1559,34 +1968,33 @@ static XImage *cdxCreateXImageMap(cdCtxCanvas *ctxcanvas, int ew, int eh, const
         return NULL;
       }
     
+      pixels = (unsigned long*)malloc(ew * sizeof(unsigned long));
+      if (!pixels)
+      {
+        xim->data = NULL;
+        XDestroyImage(xim);
+        fprintf(stderr, "CanvasDraw: not enough memory putting image\n");
+        return NULL;
+      }
+
       for (i=0; i<eh; i++) 
       {
-        line_data = (unsigned short*)(imagedata + (eh-1 - i) * xim->bytes_per_line);
+        const unsigned char *index_line = index + fy[i]*iw;
 
         for (j=0; j<ew; j++) 
-        {
-          src = (fy[i])*iw + fx[j];
-          xcol = match_table[index[src]];
-          
-          if (xim->byte_order == MSBFirst) 
-          {
-            *line_data++ = (unsigned short)(xcol & 0xffff);
-          }
-          else
-          {
-            /*  WAS *line_data++ = ((xcol>>8) & 0xff) | ((xcol&0xff) << 8);  */
-            *line_data++ = (unsigned short)(xcol);
-          }
-        }
+          pixels[j] = match_table[index_line[fx[j]]];
+
+        cdxSetImageLine(xim, imagedata + (eh-1 - i) * xim->bytes_per_line, pixels, ew);
       }
+
+      free(pixels);
     }
     break;
 
   case 24:
   case 32: 
     {
-      unsigned char *imagedata, *line_data;
-      int do32;
+      unsigned char *imagedata;
     
       /* Now get the image data - pad each scanline as necessary */
       imagedata = (unsigned char*)get_data_buffer(ctxcanvas, 4*ew*eh);
@@ -1603,33 +2011,26 @@ static XImage *cdxCreateXImageMap(cdCtxCanvas *ctxcanvas, int ew, int eh, const
         return NULL;
       }
     
-      do32 = (xim->bits_per_pixel == 32? 1: 0);
-    
+      pixels = (unsigned long*)malloc(ew * sizeof(unsigned long));
+      if (!pixels)
+      {
+        xim->data = NULL;
+        XDestroyImage(xim);
+        fprintf(stderr, "CanvasDraw: not enough memory putting image\n");
+        return NULL;
+      }
+
       for (i=0; i<eh; i++) 
       {
-        line_data = imagedata + (eh-1 - i) * xim->bytes_per_line;
+        const unsigned char *index_line = index + fy[i]*iw;
 
         for (j=0; j<ew; j++) 
-        {
-          src = (fy[i])*iw + fx[j];
-          xcol = match_table[index[src]];
-        
-          if (xim->byte_order == MSBFirst) 
-          {
-            if (do32) *line_data++ = 0;
-            *line_data++ = (unsigned char)((xcol>>16) & 0xff);
-            *line_data++ = (unsigned char)((xcol>>8)  & 0xff);
-            *line_data++ = (unsigned char)( xcol      & 0xff);
-          }
-          else 
-          {  /* LSBFirst */
-            *line_data++ = (unsigned char)( xcol      & 0xff);
-            *line_data++ = (unsigned char)((xcol>>8)  & 0xff);
-            *line_data++ = (unsigned char)((xcol>>16) & 0xff);
-            if (do32) *line_data++ = 0;
-          }
-        }
+          pixels[j] = match_table[index_line[fx[j]]];
+
+        cdxSetImageLine(xim, imagedata + (eh-1 - i) * xim->bytes_per_line, pixels, ew);
       }
+
+      free(pixels);
     }
     break;
   default: 
@@ -1685,12 +2086,15 @@ static XImage *cdxCreateXImageRGB(cdCtxCanvas *ctxcanvas, int ew, int eh,
 * variation of RGB the X device in question wants.  No color allocation
 * is involved.
 */
-  int     i,j;
+  int     i,j,v;
   XImage *xim;
-  unsigned long r, g, b, rmask, gmask, bmask, xcol;
-  int           rshift, gshift, bshift, bperpix, bperline, byte_order, cshift;
+  unsigned long r, g, b, rmask, gmask, bmask;
+  unsigned long rtable[256], gtable[256], btable[256], *pixels;
+  int           rshift, gshift, bshift, bperpix, bperline, cshift;
   int           maplen, src;
-  unsigned char *line_data, *imagedata, or, ob, og, al;
+  unsigned char *line_data, *imagedata, al;
+  unsigned char *or_line = NULL, *og_line = NULL, *ob_line = NULL;
+  cdxPixelDecoder dec;
   int *fx, *fy;
   
   /* compute various shifting constants that we'll need... */
@@ -1704,6 +2108,43 @@ static XImage *cdxCreateXImageRGB(cdCtxCanvas *ctxcanvas, int ew, int eh,
   maplen = ctxcanvas->vis->map_entries;
   if (maplen>256) maplen=256;
   cshift = 7 - highbit((unsigned long) (maplen-1));
+
+  /* pixel bits of each channel value */
+  for (v=0; v<256; v++)
+  {
+    r = g = b = v;
+
+    /* shift r,g,b so that high bit of 8-bit color specification is 
+    * aligned with high bit of r,g,b-mask in visual, 
+    * AND each component with its mask,
+    * and OR the three components together
+    */
+
+#ifdef __cplusplus
+    if (ctxcanvas->vis->c_class == DirectColor) 
+#else
+    if (ctxcanvas->vis->class == DirectColor) 
+#endif
+    {
+      r = (unsigned long) cdxDirectColorTable[(r>>cshift) & 0xff] << cshift;
+      g = (unsigned long) cdxDirectColorTable[(g>>cshift) & 0xff] << cshift;
+      b = (unsigned long) cdxDirectColorTable[(b>>cshift) & 0xff] << cshift;
+    }
+    
+    /* shift the bits around */
+    if (rshift<0) r = r << (-rshift);
+    else r = r >> rshift;
+    
+    if (gshift<0) g = g << (-gshift);
+    else g = g >> gshift;
+    
+    if (bshift<0) b = b << (-bshift);
+    else b = b >> bshift;
+    
+    rtable[v] = r & rmask;
+    gtable[v] = g & gmask;
+    btable[v] = b & bmask;
+  }
   
   xim = XCreateImage(ctxcanvas->dpy, ctxcanvas->vis, ctxcanvas->depth, ZPixmap, 0, NULL, ew,  eh, 32, 0);
   if (!xim) 
@@ -1714,7 +2155,6 @@ static XImage *cdxCreateXImageRGB(cdCtxCanvas *ctxcanvas, int ew, int eh,
   
   bperline = xim->bytes_per_line;
   bperpix  = xim->bits_per_pixel;
-  byte_order   = xim->byte_order;
   
   if (bperpix != 8 && bperpix != 16 && bperpix != 24 && bperpix != 32) 
   {
@@ -1731,6 +2171,24 @@ static XImage *cdxCreateXImageRGB(cdCtxCanvas *ctxcanvas, int ew, int eh,
     return NULL;
   }
 
+  /* one line of pixels, plus the old image line when there is alpha */
+  pixels = (unsigned long*)malloc(ew * sizeof(unsigned long) + (alpha? 3 * ew: 0));
+  if (!pixels)
+  {
+    XDestroyImage(xim);
+    fprintf(stderr, "CanvasDraw: not enough memory putting image\n");
+    return NULL;
+  }
+
+  if (alpha)
+  {
+    or_line = (unsigned char*)(pixels + ew);
+    og_line = or_line + ew;
+    ob_line = og_line + ew;
+
+    cdxInitPixelDecoder(ctxcanvas, oxi, &dec);
+  }
+
   fx = cdGetZoomTable(ew, bw, bx);
   fy = cdGetZoomTable(eh, bh, by);
 
@@ -1738,113 +2196,42 @@ static XImage *cdxCreateXImageRGB(cdCtxCanvas *ctxcanvas, int ew, int eh,
   
   for (i=0; i<eh; i++) 
   {
+    const unsigned char *red_line = red + fy[i]*iw, 
+                        *green_line = green + fy[i]*iw, 
+                        *blue_line = blue + fy[i]*iw;
+
     line_data = imagedata + (eh-1 - i) * bperline;
 
-    for (j=0; j<ew; j++) 
+    if (alpha)
     {
-      src = fy[i]*iw + fx[j];
+      const unsigned char *alpha_line = alpha + fy[i]*iw;
 
-      if (alpha)
-      {
-        unsigned long pixel = XGetPixel(oxi, j, eh-1 - i);
-        cdxGetRGB(ctxcanvas, pixel, &or, &og, &ob);
-        al = alpha[src];
-        r = CD_ALPHA_BLEND(red[src], or, al);
-        g = CD_ALPHA_BLEND(green[src], og, al);
-        b = CD_ALPHA_BLEND(blue[src], ob, al);
-      }
-      else
-      {
-        r = red[src];  
-        g = green[src];  
-        b = blue[src];
-      }
-      
-      /* shift r,g,b so that high bit of 8-bit color specification is 
-      * aligned with high bit of r,g,b-mask in visual, 
-      * AND each component with its mask,
-      * and OR the three components together
-      */
+      cdxGetImageLineRGB(ctxcanvas, &dec, oxi, eh-1 - i, ew, or_line, og_line, ob_line);
 
-#ifdef __cplusplus
-      if (ctxcanvas->vis->c_class == DirectColor) 
-#else
-      if (ctxcanvas->vis->class == DirectColor) 
-#endif
+      for (j=0; j<ew; j++) 
       {
-        r = (unsigned long) cdxDirectColorTable[(r>>cshift) & 0xff] << cshift;
-        g = (unsigned long) cdxDirectColorTable[(g>>cshift) & 0xff] << cshift;
-        b = (unsigned long) cdxDirectColorTable[(b>>cshift) & 0xff] << cshift;
+        src = fx[j];
+        al = alpha_line[src];
+        pixels[j] = rtable[CD_ALPHA_BLEND(red_line[src], or_line[j], al)] | 
+                    gtable[CD_ALPHA_BLEND(green_line[src], og_line[j], al)] | 
+                    btable[CD_ALPHA_BLEND(blue_line[src], ob_line[j], al)];
       }
-      
-      /* shift the bits around */
-      if (rshift<0) r = r << (-rshift);
-      else r = r >> rshift;
-      
-      if (gshift<0) g = g << (-gshift);
-      else g = g >> gshift;
-      
-      if (bshift<0) b = b << (-bshift);
-      else b = b >> bshift;
-      
-      r = r & rmask;
-      g = g & gmask;
-      b = b & bmask;
-      
-      xcol = r | g | b;
-      
-      if (bperpix == 32) 
-      {
-        if (byte_order == MSBFirst) {
-          *line_data++ = (unsigned char)((xcol>>24) & 0xff);
-          *line_data++ = (unsigned char)((xcol>>16) & 0xff);
-          *line_data++ = (unsigned char)((xcol>>8)  & 0xff);
-          *line_data++ = (unsigned char)( xcol      & 0xff);
-        }
-        else 
-        {  /* LSBFirst */
-          *line_data++ = (unsigned char)( xcol      & 0xff);
-          *line_data++ = (unsigned char)((xcol>>8)  & 0xff);
-          *line_data++ = (unsigned char)((xcol>>16) & 0xff);
-          *line_data++ = (unsigned char)((xcol>>24) & 0xff);
-        }
-      }
-      else if (bperpix == 24) 
-      {
-        if (byte_order == MSBFirst) 
-        {
-          *line_data++ = (unsigned char)((xcol>>16) & 0xff);
-          *line_data++ = (unsigned char)((xcol>>8)  & 0xff);
-          *line_data++ = (unsigned char)( xcol      & 0xff);
-        }
-        else 
-        {  /* LSBFirst */
-          *line_data++ = (unsigned char)( xcol      & 0xff);
-          *line_data++ = (unsigned char)((xcol>>8)  & 0xff);
-          *line_data++ = (unsigned char)((xcol>>16) & 0xff);
-        }
-      }
-      else if (bperpix == 16) 
-      {
-        if (byte_order == MSBFirst) 
-        {
-          *line_data++ = (unsigned char)((xcol>>8)  & 0xff);
-          *line_data++ = (unsigned char)( xcol      & 0xff);
-        }
-        else {  /* LSBFirst */
-          *line_data++ = (unsigned char)( xcol      & 0xff);
-          *line_data++ = (unsigned char)((xcol>>8)  & 0xff);
-        }
-      }
-      else if (bperpix == 8) 
+    }
+    else
+    {
+      for (j=0; j<ew; j++) 
       {
-        *line_data++ =  (unsigned char)(xcol      & 0xff);
+        src = fx[j];
+        pixels[j] = rtable[red_line[src]] | gtable[green_line[src]] | btable[blue_line[src]];
       }
     }
+
+    cdxSetImageLine(xim, line_data, pixels, ew);
   }
   
   free(fx);
   free(fy);
+  free(pixels);
 
   return xim;
 }
@@ -1932,7 +2319,7 @@ static void cdputimagerectrgba_matrix(cdCtxCanvas* ctxcanvas, int iw, int ih, co
 
     if (a)
     {
-      oxi = XGetImage(ctxcanvas->dpy, ctxcanvas->wnd, ex, ey, ew, eh, ULONG_MAX, ZPixmap);
+      oxi = cdxGetImage(ctxcanvas, ex, ey, ew, eh);
       if (!oxi)
       {
         fprintf(stderr, "CanvasDraw: error getting image\n");
@@ -1945,7 +2332,7 @@ static void cdputimagerectrgba_matrix(cdCtxCanvas* ctxcanvas, int iw, int ih, co
     if (!xi)
       return;
 
-    XPutImage(ctxcanvas->dpy, ctxcanvas->wnd, ctxcanvas->gc, xi, 0, 0, ex, ey, ew, eh);
+    cdxPutImage(ctxcanvas, xi, ex, ey, ew, eh);
 
     /* reset cliping */
     XFreePixmap(ctxcanvas->dpy, clip_polygon);
@@ -2036,7 +2423,7 @@ static void cdputimagerectmap_matrix(cdCtxCanvas* ctxcanvas, int iw, int ih, con
     if (!xi)
       return;
 
-    XPutImage(ctxcanvas->dpy, ctxcanvas->wnd, ctxcanvas->gc, xi, 0, 0, ex, ey, ew, eh);
+    cdxPutImage(ctxcanvas, xi, ex, ey, ew, eh);
 
     /* reset cliping */
     XFreePixmap(ctxcanvas->dpy, clip_polygon);
@@ -2083,7 +2470,7 @@ static void cdputimagerectrgb(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsi
   if (!xi)
     return;
 
-  XPutImage(ctxcanvas->dpy, ctxcanvas->wnd, ctxcanvas->gc, xi, 0, 0, ex, ey, ew, eh);
+  cdxPutImage(ctxcanvas, xi, ex, ey, ew, eh);
 
   xi->data = NULL;
   XDestroyImage(xi);
@@ -2112,7 +2499,7 @@ static void cdputimagerectrgba(cdCtxCanvas *ctxcanvas, int iw, int ih, const uns
   if (!cdCalcZoom(ctxcanvas->canvas->h, y, h, &ey, &eh, ymin, rh, &by, &bh, 0))
     return;
 
-  oxi = XGetImage(ctxcanvas->dpy, ctxcanvas->wnd, ex, ey, ew, eh, ULONG_MAX, ZPixmap);
+  oxi = cdxGetImage(ctxcanvas, ex, ey, ew, eh);
   if (!oxi)
   {
     fprintf(stderr, "CanvasDraw: error getting image\n");
@@ -2123,7 +2510,7 @@ static void cdputimagerectrgba(cdCtxCanvas *ctxcanvas, int iw, int ih, const uns
   if (!xi)
     return;
 
-  XPutImage(ctxcanvas->dpy, ctxcanvas->wnd, ctxcanvas->gc, xi, 0, 0, ex, ey, ew, eh);
+  cdxPutImage(ctxcanvas, xi, ex, ey, ew, eh);
 
   xi->data = NULL;
   XDestroyImage(xi);
@@ -2157,7 +2544,7 @@ static void cdputimagerectmap(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsi
   if (!xi)
     return;
 
-  XPutImage(ctxcanvas->dpy, ctxcanvas->wnd, ctxcanvas->gc, xi, 0, 0, ex, ey, ew, eh);
+  cdxPutImage(ctxcanvas, xi, ex, ey, ew, eh);
 
   xi->data = NULL;
   XDestroyImage(xi);
@@ -2316,6 +2703,37 @@ static cdAttribute gc_attrib =
   get_gc_attrib
 }; 
 
+#ifdef USE_XSHM
+static void set_xshm_attrib(cdCtxCanvas *ctxcanvas, char* data)
+{
+  if (!ctxcanvas->shm)
+    return;
+
+  if (data && data[0] == '0')
+  {
+    cdxShmFree(ctxcanvas);
+    ctxcanvas->shm->enabled = 0;
+  }
+  else
+    ctxcanvas->shm->enabled = 1;
+}
+
+static char* get_xshm_attrib(cdCtxCanvas *ctxcanvas)
+{
+  if (ctxcanvas->shm && ctxcanvas->shm->enabled)
+    return "1";
+  else
+    return "0";
+}
+
+static cdAttribute xshm_attrib =
+{
+  "XSHM",
+  set_xshm_attrib,
+  get_xshm_attrib
+}; 
+#endif
+
 static void get_geometry(Display *dpy, Drawable wnd, cdCtxCanvas *ctxcanvas)
 {
   Window root;
@@ -2396,6 +2814,7 @@ cdCtxCanvas *cdxCreateCanvas(cdCanvas* canvas, Display *dpy, int scr, Drawable w
 
     ctxcanvas->colormap = DefaultColormap(dpy, scr);
     ctxcanvas->num_colors = 1L << canvas->bpp;
+    ctxcanvas->imap = cdInverseMapCreate(30, 59, 11);  /* same weights of the luminance */
 
     for (i=0; i<ctxcanvas->num_colors; i++) 
       ctxcanvas->color_table[i].pixel = i;
@@ -2412,6 +2831,19 @@ cdCtxCanvas *cdxCreateCanvas(cdCanvas* canvas, Display *dpy, int scr, Drawable w
   cdRegisterAttribute(canvas, &gc_attrib);
   cdRegisterAttribute(canvas, &rotate_attrib);
 
+#ifdef USE_XSHM
+  if (XShmQueryExtension(dpy))
+  {
+    int event_base, error_base;
+    XQueryExtension(dpy, "MIT-SHM", &cdxShmOpcode, &event_base, &error_base);
+
+    ctxcanvas->shm = (cdxShm*)calloc(1, sizeof(cdxShm));
+    ctxcanvas->shm->enabled = 1;
+  }
+
+  cdRegisterAttribute(canvas, &xshm_attrib);
+#endif
+
   first = 0;
 
   return ctxcanvas;
@@ -17,6 +17,9 @@
 /* Hidden declaration for the Context Plus driver */
 typedef struct _cdxContextPlus cdxContextPlus;
 
+/* Hidden declaration of the MIT-SHM buffers */
+typedef struct _cdxShm cdxShm;
+
 struct _cdCtxImage {
   unsigned int w, h, depth;
   Pixmap img;
@@ -50,9 +53,12 @@ struct _cdCtxCanvas {
   void *data;            /* informacoes especificas do driver */
   long int *xidata;      /* ximage cache */
   int xisize;
+  cdxShm* shm;           /* shared memory for images, NULL if not available */
   Colormap colormap;          /* colormap para todos os canvas */
   XColor color_table[256];    /* tabela de cores do colormap */
   int num_colors;             /* tamanho maximo da tabela de cores  */
+  cdInverseMap* imap;         /* busca da cor mais proxima na tabela de cores */
+  int imap_valid;
   int rshift;                 /* constante red para calculo truecolor */
   int gshift;                 /* constante green para calculo truecolor */
   int bshift;                 /* constante blue para calculo truecolor */
@@ -31,12 +31,48 @@ static unsigned char hatches[NUM_HATCHES][8] = {
   {0x18,0x18,0x24,0x42,0x81,0x81,0x42,0x24}   /* DIAGCROSS */
 };
 
+#define XR_FONT_CACHE_SIZE 32
+
+typedef struct _xrFontEntry
+{
+  char* name;        /* Xft font name or XLFD, includes family, style, size and orientation */
+  int xlfd;
+  XftFont* font;
+  unsigned long tick;  /* last use, for LRU eviction */
+} xrFontEntry;
+
+#define XR_IMAGE_CACHE_SIZE 65536  /* KB */
+
+typedef struct _xrImage
+{
+  unsigned long long key;  /* image content hash or IMGID */
+  unsigned char* key_data; /* image contents to confirm the key, NULL for IMGID */
+  int key_size;
+  int w, h;
+  Pixmap pixmap;
+  Picture picture;
+  unsigned long tick;  /* last use, for LRU eviction */
+} xrImage;
+
 struct _cdxContextPlus
 {
   XftDraw* draw;
   Picture solid_pic, pattern_pic, fill_picture, dst_picture;
   XftFont *font,
           *flat_font;  /* used only for text size when orientation!=0 */
+
+  /* fonts already opened, font changes do not need to match and open the font again */
+  xrFontEntry* font_cache;
+  int font_count, font_max, font_cache_size;
+  unsigned long font_tick;
+
+  /* ARGB32 pictures of the images already drawn, kept in the server */
+  xrImage* img_cache;
+  int img_count, img_max;
+  unsigned long img_bytes, img_cache_size, img_tick, img_hits, img_misses;
+  char* img_id;
+  int img_update;
+
   XRenderPictFormat* maskFormat;
 
   int antialias;
@@ -546,6 +582,95 @@ static long int cdbackground(cdCtxCanvas *ctxcanvas, long int color)
   return color;
 }
 
+/* removes the least recently used fonts until count fonts are left,
+   the current fonts are never removed */
+static void xrTrimFontCache(cdCtxCanvas *ctxcanvas, int count)
+{
+  cdxContextPlus* ctxplus = ctxcanvas->ctxplus;
+
+  while (ctxplus->font_count > count)
+  {
+    int i, lru = -1;
+    for (i = 0; i < ctxplus->font_count; i++)
+    {
+      xrFontEntry* entry = ctxplus->font_cache + i;
+      if (entry->font == ctxplus->font || entry->font == ctxplus->flat_font)
+        continue;
+
+      if (lru == -1 || entry->tick < ctxplus->font_cache[lru].tick)
+        lru = i;
+    }
+
+    if (lru == -1)
+      return;
+
+    XftFontClose(ctxcanvas->dpy, ctxplus->font_cache[lru].font);
+    free(ctxplus->font_cache[lru].name);
+
+    ctxplus->font_count--;
+    if (lru < ctxplus->font_count)
+      ctxplus->font_cache[lru] = ctxplus->font_cache[ctxplus->font_count];
+  }
+}
+
+static void xrFreeFontCache(cdCtxCanvas *ctxcanvas)
+{
+  cdxContextPlus* ctxplus = ctxcanvas->ctxplus;
+
+  ctxplus->font = NULL;
+  ctxplus->flat_font = NULL;
+  xrTrimFontCache(ctxcanvas, 0);
+
+  if (ctxplus->font_cache)
+    free(ctxplus->font_cache);
+}
+
+/* returns a font from the cache, or opens it and adds it to the cache.
+   The cache owns all the fonts, including the current ones. */
+static XftFont* xrOpenFont(cdCtxCanvas *ctxcanvas, const char* name, int xlfd)
+{
+  cdxContextPlus* ctxplus = ctxcanvas->ctxplus;
+  xrFontEntry* entry;
+  XftFont* font;
+  int i;
+
+  for (i = 0; i < ctxplus->font_count; i++)
+  {
+    entry = ctxplus->font_cache + i;
+    if (entry->xlfd == xlfd && strcmp(entry->name, name) == 0)
+    {
+      entry->tick = ++ctxplus->font_tick;
+      return entry->font;
+    }
+  }
+
+  if (ctxplus->font_count == ctxplus->font_max)
+  {
+    int new_max = ctxplus->font_max + 8;
+    xrFontEntry* font_cache = (xrFontEntry*)realloc(ctxplus->font_cache, new_max * sizeof(xrFontEntry));
+    if (!font_cache)
+      return NULL;
+    ctxplus->font_cache = font_cache;
+    ctxplus->font_max = new_max;
+  }
+
+  if (xlfd)
+    font = XftFontOpenXlfd(ctxcanvas->dpy, ctxcanvas->scr, name);
+  else
+    font = XftFontOpenName(ctxcanvas->dpy, ctxcanvas->scr, name);
+  if (!font)
+    return NULL;
+
+  entry = ctxplus->font_cache + ctxplus->font_count;
+  entry->name = cdStrDup(name);
+  entry->xlfd = xlfd;
+  entry->font = font;
+  entry->tick = ++ctxplus->font_tick;
+  ctxplus->font_count++;
+
+  return font;
+}
+
 static int cdfont(cdCtxCanvas *ctxcanvas, const char *type_face, int style, int size)
 {
   char font_name[1024];
@@ -583,26 +708,22 @@ static int cdfont(cdCtxCanvas *ctxcanvas, const char *type_face, int style, int
   size = cdGetFontSizePoints(ctxcanvas->canvas, size);
 
   sprintf(font_name,"%s-%d%s%s", type_face, size, type_style[style&3], matrix);
-  font = XftFontOpenName(ctxcanvas->dpy, ctxcanvas->scr, font_name);
+  font = xrOpenFont(ctxcanvas, font_name, 0);
   if (!font)
     return 0;
 
-  if (ctxcanvas->ctxplus->font)
-    XftFontClose(ctxcanvas->dpy, ctxcanvas->ctxplus->font);
+  ctxcanvas->ctxplus->font = font;
 
   if (ctxcanvas->canvas->text_orientation)
   {
     /* XftTextExtents8 will return the size of the rotated text, but we want the size without orientation.
        So create a font without orientation just to return the correct text size. */
 
-    if (ctxcanvas->ctxplus->flat_font)
-      XftFontClose(ctxcanvas->dpy, ctxcanvas->ctxplus->flat_font);
-
     sprintf(font_name,"%s-%d%s", type_face, size, type_style[style&3]);
-    ctxcanvas->ctxplus->flat_font = XftFontOpenName(ctxcanvas->dpy, ctxcanvas->scr, font_name);
+    ctxcanvas->ctxplus->flat_font = xrOpenFont(ctxcanvas, font_name, 0);
   }
 
-  ctxcanvas->ctxplus->font = font;
+  xrTrimFontCache(ctxcanvas, ctxcanvas->ctxplus->font_cache_size);
 
   return 1;
 }
@@ -614,22 +735,20 @@ static int cdnativefont(cdCtxCanvas *ctxcanvas, const char* nativefont)
 
   if (nativefont[0] == '-')
   {
-    XftFont *font = XftFontOpenXlfd(ctxcanvas->dpy, ctxcanvas->scr, nativefont);
-    if (!font)
-      return 0;
+    XftFont *font;
 
     if (!cdParseXWinFont(nativefont, type_face, &style, &size))
-    {
-      XftFontClose(ctxcanvas->dpy, font);
       return 0;
-    }
 
-    if (ctxcanvas->ctxplus->font)
-      XftFontClose(ctxcanvas->dpy, ctxcanvas->ctxplus->font);
+    font = xrOpenFont(ctxcanvas, nativefont, 1);
+    if (!font)
+      return 0;
+
 
     ctxcanvas->canvas->text_orientation = 0; /* orientation not supported when using XLFD */
 
     ctxcanvas->ctxplus->font = font;
+    xrTrimFontCache(ctxcanvas, ctxcanvas->ctxplus->font_cache_size);
   }
   else
   {
@@ -656,6 +775,331 @@ static double cdtextorientation(cdCtxCanvas *ctxcanvas, double angle)
   return angle;
 }
 
+/******************************************************/
+
+/* Computes the key of the image region, its hash is 0 if the image cache is not used. */
+static void xrImageKey(cdCtxCanvas *ctxcanvas, cdImageKey* key, int iw, const unsigned char *r, const unsigned char *g, const unsigned char *b, const unsigned char *a, 
+                       int xmin, int ymin, int rw, int rh)
+{
+  if (ctxcanvas->ctxplus->img_cache_size == 0)
+    key->hash = 0;
+  else
+    cdImageKeyRGBA(key, ctxcanvas->ctxplus->img_id, 0, iw, r, g, b, a, xmin, ymin, rw, rh);
+}
+
+/* The hash is confirmed comparing the image contents, unless IMGID is used. */
+static int xrFindImage(cdxContextPlus* ctxplus, const cdImageKey* key, int w, int h)
+{
+  int i;
+  for (i = 0; i < ctxplus->img_count; i++)
+  {
+    xrImage* image = ctxplus->img_cache + i;
+    if (image->key == key->hash && image->w == w && image->h == h &&
+        cdImageKeyMatch(key, image->key_data))
+      return i;
+  }
+  return -1;
+}
+
+static void xrFreeImage(cdCtxCanvas *ctxcanvas, xrImage* image)
+{
+  XRenderFreePicture(ctxcanvas->dpy, image->picture);
+  XFreePixmap(ctxcanvas->dpy, image->pixmap);
+  if (image->key_data) free(image->key_data);
+}
+
+/* Removes the least recently used images until size bytes are available. */
+static void xrFreeImages(cdCtxCanvas *ctxcanvas, unsigned long size)
+{
+  cdxContextPlus* ctxplus = ctxcanvas->ctxplus;
+
+  while (ctxplus->img_count > 0 && ctxplus->img_bytes + size > ctxplus->img_cache_size)
+  {
+    int i, lru = 0;
+    xrImage* image;
+
+    for (i = 1; i < ctxplus->img_count; i++)
+    {
+      if (ctxplus->img_cache[i].tick < ctxplus->img_cache[lru].tick)
+        lru = i;
+    }
+
+    image = ctxplus->img_cache + lru;
+    xrFreeImage(ctxcanvas, image);
+
+    ctxplus->img_bytes -= (unsigned long)image->w * image->h * 4 + image->key_size;
+    ctxplus->img_count--;
+    *image = ctxplus->img_cache[ctxplus->img_count];
+  }
+}
+
+static void xrFreeImageCache(cdCtxCanvas *ctxcanvas)
+{
+  cdxContextPlus* ctxplus = ctxcanvas->ctxplus;
+  int i;
+
+  for (i = 0; i < ctxplus->img_count; i++)
+    xrFreeImage(ctxcanvas, ctxplus->img_cache + i);
+
+  ctxplus->img_count = 0;
+  ctxplus->img_bytes = 0;
+}
+
+/* Copies the image region to the ARGB32 picture, with premultiplied alpha and top-down lines. */
+static void xrUploadImage(cdCtxCanvas *ctxcanvas, Pixmap pixmap, int iw, const unsigned char *r, const unsigned char *g, const unsigned char *b, const unsigned char *a, 
+                          int xmin, int ymin, int rw, int rh)
+{
+  unsigned short us = 0xFF00;
+  unsigned int *data, *line;
+  XImage* xi;
+  GC gc;
+  int x, y;
+
+  data = (unsigned int*)malloc(rw * rh * sizeof(unsigned int));
+  if (!data)
+  {
+    fprintf(stderr, "CanvasDraw: not enough memory putting image\n");
+    return;
+  }
+
+  for (y = 0; y < rh; y++)
+  {
+    int offset = (ymin + rh-1 - y) * iw + xmin;
+    line = data + y * rw;
+
+    if (a)
+    {
+      for (x = 0; x < rw; x++)
+      {
+        unsigned int al = a[offset + x];
+        line[x] = (al << 24) | 
+                  (((r[offset + x] * al + 127) / 255) << 16) | 
+                  (((g[offset + x] * al + 127) / 255) << 8) | 
+                   ((b[offset + x] * al + 127) / 255);
+      }
+    }
+    else
+    {
+      for (x = 0; x < rw; x++)
+        line[x] = 0xFF000000 | (r[offset + x] << 16) | (g[offset + x] << 8) | b[offset + x];
+    }
+  }
+
+  xi = XCreateImage(ctxcanvas->dpy, NULL, 32, ZPixmap, 0, (char*)data, rw, rh, 32, rw * 4);
+  if (!xi)
+  {
+    free(data);
+    fprintf(stderr, "CanvasDraw: not enough memory putting image\n");
+    return;
+  }
+
+  /* the data is in the client byte order, Xlib will swap it if necessary */
+  xi->byte_order = (*(unsigned char*)&us == 0xFF) ? MSBFirst : LSBFirst;
+
+  gc = XCreateGC(ctxcanvas->dpy, pixmap, 0, NULL);
+  XPutImage(ctxcanvas->dpy, pixmap, gc, xi, 0, 0, 0, 0, rw, rh);
+  XFreeGC(ctxcanvas->dpy, gc);
+
+  xi->data = NULL;
+  XDestroyImage(xi);
+  free(data);
+}
+
+/* Returns the picture of a cached image, or creates a new one. 
+   When the picture is not cached (key is 0 or it is too large) *temp is set, and it must be released after use. */
+static xrImage* xrGetImage(cdCtxCanvas *ctxcanvas, const cdImageKey* key, xrImage* temp, int iw, const unsigned char *r, const unsigned char *g, const unsigned char *b, const unsigned char *a, 
+                           int xmin, int ymin, int rw, int rh)
+{
+  cdxContextPlus* ctxplus = ctxcanvas->ctxplus;
+  unsigned long long hash = key->hash;
+  unsigned long size = (unsigned long)rw * rh * 4;
+  unsigned char* key_data = NULL;
+  int key_size = 0;
+  xrImage* image;
+  int i;
+
+  if (hash)
+  {
+    i = xrFindImage(ctxplus, key, rw, rh);
+    if (i >= 0)
+    {
+      image = ctxplus->img_cache + i;
+      image->tick = ++ctxplus->img_tick;
+
+      if (ctxplus->img_update && ctxplus->img_id)
+      {
+        /* IMGUPDATE, update the contents only */
+        ctxplus->img_update = 0;
+        ctxplus->img_misses++;
+        xrUploadImage(ctxcanvas, image->pixmap, iw, r, g, b, a, xmin, ymin, rw, rh);
+      }
+      else
+        ctxplus->img_hits++;
+
+      return image;
+    }
+
+    ctxplus->img_misses++;
+  }
+
+  ctxplus->img_update = 0;
+
+  if (hash)
+  {
+    /* a copy of the contents confirms the hash in the next searches */
+    key_data = cdImageKeyData(key, &key_size);
+    if (!key_data && !key->img_id)
+      hash = 0;
+    size += key_size;
+  }
+
+  image = NULL;
+  if (hash && size <= ctxplus->img_cache_size)
+  {
+    if (ctxplus->img_count == ctxplus->img_max)
+    {
+      int new_max = ctxplus->img_max + 32;
+      xrImage* new_cache = (xrImage*)realloc(ctxplus->img_cache, new_max * sizeof(xrImage));
+      if (new_cache)
+      {
+        ctxplus->img_cache = new_cache;
+        ctxplus->img_max = new_max;
+      }
+    }
+
+    if (ctxplus->img_count < ctxplus->img_max)
+    {
+      xrFreeImages(ctxcanvas, size);
+      image = ctxplus->img_cache + ctxplus->img_count;
+    }
+  }
+
+  if (!image)
+  {
+    image = temp;
+    hash = 0;
+    if (key_data) free(key_data);
+    key_data = NULL;
+    key_size = 0;
+  }
+
+  image->key = hash;
+  image->key_data = key_data;
+  image->key_size = key_size;
+  image->w = rw;
+  image->h = rh;
+  image->tick = ++ctxplus->img_tick;
+  image->pixmap = XCreatePixmap(ctxcanvas->dpy, ctxcanvas->wnd, rw, rh, 32);
+  image->picture = XRenderCreatePicture(ctxcanvas->dpy, image->pixmap, XRenderFindStandardFormat(ctxcanvas->dpy, PictStandardARGB32), 0, NULL);
+
+  xrUploadImage(ctxcanvas, image->pixmap, iw, r, g, b, a, xmin, ymin, rw, rh);
+
+  if (hash)
+  {
+    ctxplus->img_count++;
+    ctxplus->img_bytes += size;
+  }
+
+  return image;
+}
+
+static void cdputimagerectrgba(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *r, const unsigned char *g, const unsigned char *b, const unsigned char *a, int x, int y, int w, int h, int xmin, int xmax, int ymin, int ymax)
+{
+  int rw = xmax-xmin+1;
+  int rh = ymax-ymin+1;
+  double matrix[6], inv_matrix[6], px[4], py[4];
+  double bxmin, bxmax, bymin, bymax;
+  int i, dx, dy, dw, dh;
+  cdImageKey key;
+  xrImage *image, temp;
+  XTransform transform;
+
+  if (w <= 0 || h <= 0)
+    return;
+
+  /* matrix from the image region (top-down, continuous coordinates) to the canvas */
+  if (ctxcanvas->canvas->use_matrix)
+  {
+    /* image region in continuous world coordinates */
+    double s[6];
+    s[0] = (double)w / rw;  s[1] = 0;
+    s[2] = 0;               s[3] = -(double)h / rh;
+    s[4] = x;               s[5] = y + h;
+
+    /* xmatrix uses pixel indices, so move to pixel centers before and back after */
+    memcpy(matrix, ctxcanvas->xmatrix, sizeof(matrix));
+    matrix[4] += 0.5 - 0.5 * (matrix[0] + matrix[2]);
+    matrix[5] += 0.5 - 0.5 * (matrix[1] + matrix[3]);
+    cdMatrixMultiply(s, matrix);
+  }
+  else
+  {
+    /* y is at the bottom-left of the image */
+    matrix[0] = (double)w / rw;  matrix[1] = 0;
+    matrix[2] = 0;               matrix[3] = (double)h / rh;
+    matrix[4] = x;               matrix[5] = y - (h - 1);
+  }
+
+  /* destination bounding box */
+  for (i = 0; i < 4; i++)
+  {
+    double u = (i == 1 || i == 2) ? rw : 0;
+    double v = (i >= 2) ? rh : 0;
+    px[i] = matrix[0] * u + matrix[2] * v + matrix[4];
+    py[i] = matrix[1] * u + matrix[3] * v + matrix[5];
+  }
+
+  bxmin = bxmax = px[0];
+  bymin = bymax = py[0];
+  for (i = 1; i < 4; i++)
+  {
+    if (px[i] < bxmin) bxmin = px[i];
+    if (px[i] > bxmax) bxmax = px[i];
+    if (py[i] < bymin) bymin = py[i];
+    if (py[i] > bymax) bymax = py[i];
+  }
+
+  dx = (int)floor(bxmin);
+  dy = (int)floor(bymin);
+  dw = (int)ceil(bxmax) - dx;
+  dh = (int)ceil(bymax) - dy;
+
+  if (dx < 0) { dw += dx; dx = 0; }
+  if (dy < 0) { dh += dy; dy = 0; }
+  if (dx + dw > ctxcanvas->canvas->w) dw = ctxcanvas->canvas->w - dx;
+  if (dy + dh > ctxcanvas->canvas->h) dh = ctxcanvas->canvas->h - dy;
+  if (dw <= 0 || dh <= 0)
+    return;
+
+  cdMatrixInverse(matrix, inv_matrix);
+
+  xrImageKey(ctxcanvas, &key, iw, r, g, b, a, xmin, ymin, rw, rh);
+  image = xrGetImage(ctxcanvas, &key, &temp, iw, r, g, b, a, xmin, ymin, rw, rh);
+
+  /* the picture transform maps canvas coordinates to image coordinates */
+  transform.matrix[0][0] = XDoubleToFixed(inv_matrix[0]);
+  transform.matrix[0][1] = XDoubleToFixed(inv_matrix[2]);
+  transform.matrix[0][2] = XDoubleToFixed(inv_matrix[4]);
+  transform.matrix[1][0] = XDoubleToFixed(inv_matrix[1]);
+  transform.matrix[1][1] = XDoubleToFixed(inv_matrix[3]);
+  transform.matrix[1][2] = XDoubleToFixed(inv_matrix[5]);
+  transform.matrix[2][0] = XDoubleToFixed(0);
+  transform.matrix[2][1] = XDoubleToFixed(0);
+  transform.matrix[2][2] = XDoubleToFixed(1);
+  XRenderSetPictureTransform(ctxcanvas->dpy, image->picture, &transform);
+
+  /* same as the X11 driver, nearest for zoom, bilinear for transformations */
+  XRenderSetPictureFilter(ctxcanvas->dpy, image->picture, ctxcanvas->canvas->use_matrix? FilterBilinear: FilterNearest, NULL, 0);
+
+  XRenderComposite(ctxcanvas->dpy, PictOpOver, image->picture, None, ctxcanvas->ctxplus->dst_picture, 
+                   dx, dy, 0, 0, dx, dy, dw, dh);
+
+  if (image == &temp)
+    xrFreeImage(ctxcanvas, &temp);
+
+  (void)ih;
+}
+
 static void cdgetfontdim(cdCtxCanvas *ctxcanvas, int *max_width, int *height, int *ascent, int *descent)
 {
   if (!ctxcanvas->ctxplus->font)
@@ -872,6 +1316,111 @@ static cdAttribute aa_attrib =
   get_aa_attrib
 }; 
 
+static void set_fontcachesize_attrib(cdCtxCanvas* ctxcanvas, char* data)
+{
+  int size = XR_FONT_CACHE_SIZE;
+
+  if (data)
+    sscanf(data, "%d", &size);
+  if (size < 0)
+    size = 0;
+
+  ctxcanvas->ctxplus->font_cache_size = size;
+  xrTrimFontCache(ctxcanvas, size);
+}
+
+static char* get_fontcachesize_attrib(cdCtxCanvas* ctxcanvas)
+{
+  static char data[50];
+  sprintf(data, "%d", ctxcanvas->ctxplus->font_cache_size);
+  return data;
+}
+
+static cdAttribute fontcachesize_attrib =
+{
+  "FONTCACHESIZE",
+  set_fontcachesize_attrib,
+  get_fontcachesize_attrib
+}; 
+
+static void set_imgcachesize_attrib(cdCtxCanvas* ctxcanvas, char* data)
+{
+  unsigned long size = XR_IMAGE_CACHE_SIZE;
+
+  if (data)
+    sscanf(data, "%lu", &size);
+
+  ctxcanvas->ctxplus->img_cache_size = size * 1024;
+  xrFreeImages(ctxcanvas, 0);
+}
+
+static char* get_imgcachesize_attrib(cdCtxCanvas* ctxcanvas)
+{
+  static char data[100];
+  sprintf(data, "%lu", ctxcanvas->ctxplus->img_cache_size / 1024);
+  return data;
+}
+
+static cdAttribute imgcachesize_attrib =
+{
+  "IMGCACHESIZE",
+  set_imgcachesize_attrib,
+  get_imgcachesize_attrib
+};
+
+static char* get_imgcacheinfo_attrib(cdCtxCanvas* ctxcanvas)
+{
+  static char data[200];
+  sprintf(data, "%lu %lu %d %lu", ctxcanvas->ctxplus->img_hits, ctxcanvas->ctxplus->img_misses, ctxcanvas->ctxplus->img_count, ctxcanvas->ctxplus->img_bytes / 1024);
+  return data;
+}
+
+static cdAttribute imgcacheinfo_attrib =
+{
+  "IMGCACHEINFO",
+  NULL,
+  get_imgcacheinfo_attrib
+};
+
+static void set_imgid_attrib(cdCtxCanvas* ctxcanvas, char* data)
+{
+  if (ctxcanvas->ctxplus->img_id)
+  {
+    free(ctxcanvas->ctxplus->img_id);
+    ctxcanvas->ctxplus->img_id = NULL;
+  }
+
+  if (data)
+    ctxcanvas->ctxplus->img_id = cdStrDup(data);
+}
+
+static char* get_imgid_attrib(cdCtxCanvas* ctxcanvas)
+{
+  return ctxcanvas->ctxplus->img_id;
+}
+
+static cdAttribute imgid_attrib =
+{
+  "IMGID",
+  set_imgid_attrib,
+  get_imgid_attrib
+};
+
+static void set_imgupdate_attrib(cdCtxCanvas* ctxcanvas, char* data)
+{
+  if (!data || data[0] == '0')
+    ctxcanvas->ctxplus->img_update = 0;
+  else
+    ctxcanvas->ctxplus->img_update = 1;
+}
+
+static cdAttribute imgupdate_attrib =
+{
+  "IMGUPDATE",
+  set_imgupdate_attrib,
+  NULL
+};
+
 static char cdxXRenderVersion[50] = "";
 
 static char* get_version_attrib(cdCtxCanvas* ctxcanvas)
@@ -903,11 +1452,11 @@ static void cdkillcanvas(cdCtxCanvas *ctxcanvas)
     XRenderFreePicture(ctxcanvas->dpy, ctxcanvas->ctxplus->lineargradient_pic);
 #endif
 
-  if (ctxcanvas->ctxplus->flat_font)
-    XftFontClose(ctxcanvas->dpy, ctxcanvas->ctxplus->flat_font);
+  xrFreeFontCache(ctxcanvas);
 
-  if (ctxcanvas->ctxplus->font)
-    XftFontClose(ctxcanvas->dpy, ctxcanvas->ctxplus->font);
+  xrFreeImageCache(ctxcanvas);
+  if (ctxcanvas->ctxplus->img_cache) free(ctxcanvas->ctxplus->img_cache);
+  if (ctxcanvas->ctxplus->img_id) free(ctxcanvas->ctxplus->img_id);
 
   /* call original method */
   ctxcanvas->ctxplus->cxKillCanvas(ctxcanvas);
@@ -951,7 +1500,7 @@ static void xrInitTable(cdCanvas* canvas)
   canvas->cxFChord = cdfSimChord;
   canvas->cxFPoly = cdfpoly;
 
-  /* TODO: canvas->cxPutImageRectRGBA = cdputimagerectrgba; */
+  canvas->cxPutImageRectRGBA = cdputimagerectrgba;
 
   canvas->cxFont = cdfont;
   canvas->cxNativeFont = cdnativefont;
@@ -970,6 +1519,11 @@ static void xrCreateContextPlus(cdCtxCanvas *ctxcanvas)
 
   cdRegisterAttribute(ctxcanvas->canvas, &aa_attrib);
   cdRegisterAttribute(ctxcanvas->canvas, &version_attrib);
+  cdRegisterAttribute(ctxcanvas->canvas, &fontcachesize_attrib);
+  cdRegisterAttribute(ctxcanvas->canvas, &imgcachesize_attrib);
+  cdRegisterAttribute(ctxcanvas->canvas, &imgcacheinfo_attrib);
+  cdRegisterAttribute(ctxcanvas->canvas, &imgid_attrib);
+  cdRegisterAttribute(ctxcanvas->canvas, &imgupdate_attrib);
 #if (RENDER_MAJOR>0 || RENDER_MINOR>=10)
   cdRegisterAttribute(ctxcanvas->canvas, &lineargradient_attrib);
   cdRegisterAttribute(ctxcanvas->canvas, &old_lineargradient_attrib);
@@ -980,6 +1534,8 @@ static void xrCreateContextPlus(cdCtxCanvas *ctxcanvas)
   ctxcanvas->ctxplus->maskFormat = XRenderFindStandardFormat(ctxcanvas->dpy, PictStandardA8);
 
   ctxcanvas->ctxplus->antialias = 1;
+  ctxcanvas->ctxplus->font_cache_size = XR_FONT_CACHE_SIZE;
+  ctxcanvas->ctxplus->img_cache_size = XR_IMAGE_CACHE_SIZE * 1024;
 }
 
 /*******************************************************************************************************/
@@ -0,0 +1,206 @@
+/* Tests for the C++17 wrappers in cd_raii.hpp, using the IMAGERGB driver. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <array>
+#include <vector>
+
+#include <cd.h>
+#include <cdirgb.h>
+#include <cd_raii.hpp>
+
+using namespace cd::raii;
+
+static int failed = 0;
+
+#define CHECK(_cond) do { if (!(_cond)) { printf("FAILED: %s (line %d)\n", #_cond, __LINE__); failed++; } } while(0)
+
+static const int W = 200, H = 150;
+
+static ImageRGB getContents(Canvas& canvas)
+{
+  ImageRGB image(W, H);
+  canvas.GetImage(image, 0, 0);
+  return image;
+}
+
+static bool sameContents(Canvas& canvas1, Canvas& canvas2)
+{
+  ImageRGB image1 = getContents(canvas1);
+  ImageRGB image2 = getContents(canvas2);
+  return image1.red == image2.red && image1.green == image2.green && image1.blue == image2.blue;
+}
+
+static void testMove()
+{
+  Canvas canvas(CD_IMAGERGB, "200x150");
+  CHECK(canvas && !canvas.Failed());
+
+  cdCanvas* handle = canvas.GetHandle();
+  Canvas other(std::move(canvas));
+  CHECK(!canvas);
+  CHECK(other.GetHandle() == handle);
+
+  canvas = std::move(other);
+  CHECK(canvas.GetHandle() == handle);
+  CHECK(!other);
+
+  cdCanvas* released = canvas.Release();
+  CHECK(!canvas);
+  cdKillCanvas(released);
+
+  Canvas empty;
+  CHECK(empty.Failed());
+}
+
+static void testStateGuard()
+{
+  Canvas canvas(CD_IMAGERGB, "200x150");
+  canvas.Foreground(CD_RED);
+  canvas.LineWidth(3);
+  {
+    StateGuard state = canvas.SaveState();
+    canvas.Foreground(CD_BLUE);
+    canvas.LineWidth(1);
+    CHECK(canvas.Foreground(CD_QUERY) == CD_BLUE);
+  }
+  CHECK(canvas.Foreground(CD_QUERY) == CD_RED);
+  CHECK(canvas.LineWidth(CD_QUERY) == 3);
+}
+
+static void testBatch()
+{
+  Canvas canvas1(CD_IMAGERGB, "200x150");
+  Canvas canvas2(CD_IMAGERGB, "200x150");
+  std::vector<cdfPoint> line;
+  std::array<cdPoint, 4> box = {{ {20, 20}, {80, 25}, {70, 90}, {15, 70} }};
+  const cdfPoint marks[] = { {100.5, 100.5}, {120, 110}, {140.25, 60} };
+  int i;
+
+  for (i = 0; i < 100; i++)
+    line.push_back(cdfPoint{ 2.0 * i, 75 + 50 * ((i % 7) - 3) / 3.0 });
+
+  canvas1.Clear();
+  canvas2.Clear();
+
+  canvas1.Foreground(CD_DARK_GREEN);
+  canvas1.Polyline(line);
+  canvas1.Polygon(box);
+  canvas1.MarkType(CD_STAR);
+  canvas1.Marks(marks);
+
+  canvas2.Foreground(CD_DARK_GREEN);
+  cdCanvasBegin(canvas2.GetHandle(), CD_OPEN_LINES);
+  for (i = 0; i < (int)line.size(); i++)
+    cdfCanvasVertex(canvas2.GetHandle(), line[i].x, line[i].y);
+  cdCanvasEnd(canvas2.GetHandle());
+  cdCanvasBegin(canvas2.GetHandle(), CD_FILL);
+  for (i = 0; i < (int)box.size(); i++)
+    cdCanvasVertex(canvas2.GetHandle(), box[i].x, box[i].y);
+  cdCanvasEnd(canvas2.GetHandle());
+  canvas2.MarkType(CD_STAR);
+  for (i = 0; i < 3; i++)
+    cdfCanvasMark(canvas2.GetHandle(), marks[i].x, marks[i].y);
+
+  CHECK(sameContents(canvas1, canvas2));
+
+  /* something was drawn */
+  ImageRGB image = getContents(canvas1);
+  CHECK(image.green[40 * W + 40] != 255);
+
+  /* several polylines from a single array */
+  const int counts[] = { 40, 0, 60 };
+  canvas1.Clear();
+  canvas2.Clear();
+  canvas1.MultiPoly(CD_OPEN_LINES, line, counts);
+  canvas2.Polyline(Span<cdfPoint>(line.data(), 40));
+  canvas2.Polyline(Span<cdfPoint>(line.data() + 40, 60));
+  CHECK(sameContents(canvas1, canvas2));
+
+  /* counts larger than the points are not drawn */
+  const int large_counts[] = { 40, 61 };
+  canvas1.MultiPoly(CD_FILL, line, large_counts);
+  CHECK(sameContents(canvas1, canvas2));
+
+  /* empty ranges are allowed */
+  canvas1.Polyline(Span<cdfPoint>());
+  canvas1.Marks(Span<cdPoint>());
+  CHECK(sameContents(canvas1, canvas2));
+}
+
+static void testImages()
+{
+  Canvas canvas(CD_IMAGERGB, "200x150");
+  ImageRGB image(50, 40, 0);
+  int i;
+
+  for (i = 0; i < (int)image.Size(); i++)
+  {
+    image.red[i] = (unsigned char)i;
+    image.green[i] = (unsigned char)(i / 50);
+    image.blue[i] = (unsigned char)(255 - i);
+  }
+
+  canvas.Clear();
+  canvas.PutImage(image, 10, 20);
+
+  ImageRGB result(50, 40, 0);
+  canvas.GetImage(result, 10, 20);
+  CHECK(result.red == image.red && result.green == image.green && result.blue == image.blue);
+
+  /* buffers smaller than the image are not drawn */
+  std::vector<unsigned char> small(10, 0);
+  canvas.Clear();
+  canvas.PutImageRectRGB(50, 40, small, small, small, 0, 0);
+  ImageRGB contents = getContents(canvas);
+  CHECK(contents.red[0] == 255);
+
+  /* map image */
+  std::vector<unsigned char> index(50 * 40, 1);
+  std::vector<long> colors = { CD_BLACK, CD_BLUE };
+  canvas.PutImageRectMap(50, 40, index, colors, 0, 0);
+  contents = getContents(canvas);
+  CHECK(contents.blue[0] == 255 && contents.red[0] == 0);
+
+  index[5] = 2;  /* color out of the table */
+  canvas.Clear();
+  canvas.PutImageRectMap(50, 40, index, colors, 0, 0);
+  contents = getContents(canvas);
+  CHECK(contents.red[0] == 255 && contents.blue[0] == 255);
+
+  /* server image */
+  canvas.Clear();
+  canvas.PutImage(image, 0, 0);
+  Image server = canvas.CreateImage(50, 40);
+  CHECK(server);
+  canvas.GetImage(server, 0, 0);
+  Image moved = std::move(server);
+  CHECK(!server && moved);
+  canvas.PutImageRect(moved, 100, 100);
+  canvas.GetImage(result, 100, 100);
+  CHECK(result.red == image.red && result.green == image.green && result.blue == image.blue);
+
+  /* bitmap */
+  Bitmap bitmap(50, 40, CD_RGB);
+  CHECK(bitmap && bitmap.Width() == 50 && bitmap.Height() == 40);
+  canvas.GetBitmap(bitmap, 0, 0);
+  CHECK(memcmp(bitmap.GetData(CD_IRED), image.red.data(), image.Size()) == 0);
+}
+
+int main(void)
+{
+  testMove();
+  testStateGuard();
+  testBatch();
+  testImages();
+
+  if (failed)
+  {
+    printf("cdraii: %d checks failed\n", failed);
+    return 1;
+  }
+
+  printf("cdraii: all checks passed\n");
+  return 0;
+}
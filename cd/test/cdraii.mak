@@ -0,0 +1,7 @@
+APPNAME = cdraii
+APPTYPE = console
+
+USE_CD = Yes
+CPPFLAGS = -std=c++17
+
+SRC = cdraii.cpp
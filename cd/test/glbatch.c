@@ -0,0 +1,129 @@
+/* Compares the drawing time of the OpenGL driver with and without the BATCH attribute.
+   Run with: glbatch [number_of_frames]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <iup.h>
+#include <iupgl.h>
+#include <cd.h>
+#include <cdgl.h>
+
+#define WIDTH  800
+#define HEIGHT 600
+
+static void draw_primitive(cdCanvas* canvas, int i, int type)
+{
+  int x = (i * 37) % WIDTH;
+  int y = (i * 91) % HEIGHT;
+  long color = cdEncodeColor((unsigned char)(i * 3), (unsigned char)(i * 5), (unsigned char)(i * 7));
+
+  cdCanvasForeground(canvas, color);
+
+  switch (type)
+  {
+  case 0:
+    cdCanvasLine(canvas, x, y, x + 10, y + 5);
+    break;
+  case 1:
+    cdCanvasBox(canvas, x, x + 6, y, y + 6);
+    break;
+  case 2:
+    cdCanvasRect(canvas, x, x + 8, y, y + 8);
+    break;
+  case 3:
+    cdCanvasPixel(canvas, x, y, color);
+    break;
+  }
+}
+
+/* The same primitives grouped by type, or interleaved. 
+   A different type of primitive flushes the batch, so interleaved primitives are not accumulated. */
+static void draw_scene(cdCanvas* canvas, int interleaved)
+{
+  int i, type;
+
+  cdCanvasBackground(canvas, CD_WHITE);
+  cdCanvasClear(canvas);
+
+  if (interleaved)
+  {
+    for (i = 0; i < 20000; i++)
+      draw_primitive(canvas, i, i % 4);
+  }
+  else
+  {
+    for (type = 0; type < 4; type++)
+    {
+      for (i = type; i < 20000; i += 4)
+        draw_primitive(canvas, i, type);
+    }
+  }
+}
+
+static double draw_frames(cdCanvas* canvas, const char* batch, int interleaved, int frames)
+{
+  unsigned char r, g, b;
+  clock_t start;
+  int i;
+
+  cdCanvasSetAttribute(canvas, "BATCH", (char*)batch);
+
+  start = clock();
+  for (i = 0; i < frames; i++)
+    draw_scene(canvas, interleaved);
+
+  /* reading a pixel waits for OpenGL to finish the drawing */
+  cdCanvasGetImageRGB(canvas, &r, &g, &b, 0, 0, 1, 1);
+
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char** argv)
+{
+  Ihandle *dialog, *glcanvas;
+  cdCanvas* canvas;
+  char data[100];
+  int frames = 20;
+
+  if (argc > 1)
+    frames = atoi(argv[1]);
+
+  IupOpen(&argc, &argv);
+  IupGLCanvasOpen();
+
+  glcanvas = IupGLCanvas(NULL);
+  IupSetfAttribute(glcanvas, "RASTERSIZE", "%dx%d", WIDTH, HEIGHT);
+  IupSetAttribute(glcanvas, "BUFFER", "DOUBLE");
+  dialog = IupDialog(glcanvas);
+  IupSetAttribute(dialog, "TITLE", "CD_GL BATCH");
+  IupShow(dialog);
+
+  IupGLMakeCurrent(glcanvas);
+
+  sprintf(data, "%dx%d", WIDTH, HEIGHT);
+  canvas = cdCreateCanvas(CD_GL, data);
+  if (!canvas)
+  {
+    printf("Error creating canvas.\n");
+    IupClose();
+    return 1;
+  }
+
+  /* a few frames only to initialize the driver in both modes */
+  draw_frames(canvas, "1", 0, 3);
+  draw_frames(canvas, "0", 0, 3);
+
+  printf("%d frames\n", frames);
+  printf("grouped      BATCH=1  %.3fs\n", draw_frames(canvas, "1", 0, frames));
+  printf("grouped      BATCH=0  %.3fs\n", draw_frames(canvas, "0", 0, frames));
+  printf("interleaved  BATCH=1  %.3fs\n", draw_frames(canvas, "1", 1, frames));
+  printf("interleaved  BATCH=0  %.3fs\n", draw_frames(canvas, "0", 1, frames));
+
+  cdKillCanvas(canvas);
+  IupDestroy(dialog);
+  IupClose();
+  return 0;
+}
@@ -0,0 +1,10 @@
+APPNAME = glbatch
+APPTYPE = console
+
+USE_CD = Yes
+USE_IUP = Yes
+USE_OPENGL = Yes
+
+LIBS = cdgl
+
+SRC = glbatch.c
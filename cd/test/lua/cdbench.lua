@@ -0,0 +1,92 @@
+-- Compares drawing one vertex or one pixel per call with the bulk functions.
+-- Run with: lua cdbench.lua [number_of_points]
+
+require("cdlua")
+
+n = tonumber(arg and arg[1]) or 1000000
+w = 1000
+h = 1000
+
+canvas = cd.CreateCanvas(cd.IMAGERGB, w .. "x" .. h)
+
+local xy = {}
+for i = 1, n do
+  xy[2*i-1] = (i * 7) % w
+  xy[2*i]   = (i * 13) % h
+end
+
+local function bench(name, func)
+  local t = os.clock()
+  func()
+  print(string.format("%-30s %.3fs", name, os.clock() - t))
+end
+
+print(n .. " points")
+
+bench("Vertex per call", function()
+  canvas:Begin(cd.OPEN_LINES)
+  for i = 1, n do
+    canvas:fVertex(xy[2*i-1], xy[2*i])
+  end
+  canvas:End()
+end)
+
+bench("fPoly with a table", function()
+  canvas:fPoly(cd.OPEN_LINES, xy)
+end)
+
+if string.pack then
+  local packed
+  bench("string.pack of the points", function()
+    local parts = {}
+    for i = 1, n, 1000 do
+      parts[#parts+1] = string.pack(string.rep("d", 2*math.min(1000, n-i+1)), table.unpack(xy, 2*i-1, 2*math.min(i+999, n)))
+    end
+    packed = table.concat(parts)
+  end)
+
+  bench("fPoly with a packed string", function()
+    canvas:fPoly(cd.OPEN_LINES, packed)
+  end)
+end
+
+canvas:MarkType(cd.PLUS)
+canvas:MarkSize(3)
+
+bench("Mark per call", function()
+  for i = 1, n do
+    canvas:fMark(xy[2*i-1], xy[2*i])
+  end
+end)
+
+bench("fMarks with a table", function()
+  canvas:fMarks(xy)
+end)
+
+local size = w * h
+
+bench("Image per pixel", function()
+  local image = cd.CreateImageRGB(w, h)
+  for i = 0, size-1 do
+    image.r[i] = i % 256
+    image.g[i] = 0
+    image.b[i] = 255
+  end
+  cd.KillImageRGB(image)
+end)
+
+bench("Image from a string", function()
+  local data = string.rep(string.char(128), size) .. string.rep("\0", size) .. string.rep("\255", size)
+  local image = cd.CreateImageRGB(w, h, data)
+  cd.KillImageRGB(image)
+end)
+
+bench("Canvas image to a string", function()
+  local image = cd.CreateImageRGB(w, h)
+  canvas:GetImageRGB(image, 0, 0)
+  local data = cd.ImageRGBToString(image)
+  assert(#data == 3 * size)
+  cd.KillImageRGB(image)
+end)
+
+canvas:Kill()
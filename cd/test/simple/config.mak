@@ -48,7 +48,7 @@ ifneq ($(findstring Win, $(TEC_SYSNAME)), )
     LIBS += gdiplus
   endif
   ifdef USE_OPENGL
-    LIBS += ftgl cdgl
+    LIBS += cdgl
   endif
 else
   ifdef DBG_DIR
@@ -63,7 +63,6 @@ else
 #    USE_CAIRO=Yes
   endif
   ifdef USE_OPENGL
-    SLIB += $(CDLIB)/libcdgl.a $(CDLIB)/libftgl.a
-    #LIBS = ftgl
+    SLIB += $(CDLIB)/libcdgl.a
   endif
 endif